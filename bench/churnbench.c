@@ -0,0 +1,191 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <yarilib.h>
+
+/*
+ * Connection churn test. Every client thread (-n) keeps connecting to the
+ * server, doing one GET and closing, -N times, as a fleet of short lived
+ * clients or one restarting does. Reported are connections per second,
+ * the latency percentiles of connect + GET + close, and the connections
+ * that failed or timed out. Closes are aborts (RST) by default, so that
+ * client ports don't pile up in TIME_WAIT over long runs; -F closes them
+ * orderly. Run it against servers with few and many acceptors (-a) and
+ * short backlogs (-L) to see where a burst gets refused.
+ */
+
+#define NOPN_DEFAULT   (10000)
+#define NTHREAD_MAX    (256)
+
+int   nopn   = NOPN_DEFAULT;                      /* connections per thread */
+int   nthr   = 8;
+int   orderly;                           /* FIN instead of RST on close */
+int   port   = YNET_SER_PORT;
+char *host   = NULL;
+
+size_t *lats[NTHREAD_MAX];              /* connection latencies, per thread */
+int     fails[NTHREAD_MAX * 16];          /* failed ones, a cache line each */
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+  size_t x = *(size_t *)a;
+  size_t y = *(size_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+void * churn_thread(void *arg)
+{
+  int           ind;
+  int           thr = (long)arg;
+  int           olen;
+  char          out[64];
+  size_t        beg;
+  yari_ctx_t    ctx;
+  struct linger lin = { 1, 0 };
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    beg = get_cur_nsec();
+
+    if (yari_connect(&ctx, host, port) != 0)
+    {
+      fails[thr * 16]++;
+      lats[thr][ind] = get_cur_nsec() - beg;
+      continue;
+    }
+
+    olen = sizeof(out);
+
+    if (yari_get(&ctx, "churn", 5, out, &olen) != 0)
+      fails[thr * 16]++;
+
+    if (!orderly)
+      setsockopt(ctx.ictx.sfd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+
+    yari_close(&ctx);
+
+    lats[thr][ind] = get_cur_nsec() - beg;
+  }
+
+  return NULL;
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "Fh:n:N:p:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'F':
+        orderly = 1;
+        break;
+      case 'h':
+        host = strdup(optarg);
+        break;
+      case 'n':
+        nthr = atol(optarg);
+        break;
+      case 'N':
+        nopn = atol(optarg);
+        break;
+      case 'p':
+        port = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-n threads] [-N connections per thread] "
+               "[-F orderly close] [-h host] [-p port]\n", argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nthr <= 0 || nthr > NTHREAD_MAX || nopn <= 0)
+  {
+    printf("threads 1..%d, connections positive\n", NTHREAD_MAX);
+    exit(1);
+  }
+
+  printf("# threads        = %d\n", nthr);
+  printf("# conns each     = %d\n", nopn);
+  printf("# close          = %s\n", (orderly) ? "orderly" : "abort");
+}
+
+int main(int argc, char *argv[])
+{
+  int        ind;
+  int        tot;
+  int        bad = 0;
+  size_t     beg;
+  size_t     dur;
+  size_t    *all;
+  yari_ctx_t ctx;
+  pthread_t  hdl[NTHREAD_MAX];
+
+  parse_cmd_line(argc, argv);
+
+  if ((yari_connect(&ctx, host, port) != 0) ||
+      (yari_set(&ctx, "churn", 5, "churn", 5) != 0))
+  {
+    printf("setup failed : errno = %d\n", errno);
+    exit(1);
+  }
+
+  yari_close(&ctx);
+
+  for (ind = 0; ind < nthr; ind++)
+  {
+    if ((lats[ind] = malloc(nopn * sizeof(size_t))) == NULL)
+      exit(1);
+  }
+
+  beg = get_cur_nsec();
+
+  for (ind = 0; ind < nthr; ind++)
+    pthread_create(&hdl[ind], NULL, churn_thread, (void *)(long)ind);
+
+  for (ind = 0; ind < nthr; ind++)
+  {
+    pthread_join(hdl[ind], NULL);
+    bad += fails[ind * 16];
+  }
+
+  dur = get_cur_nsec() - beg;
+  tot = nthr * nopn;
+  all = malloc(tot * sizeof(size_t));
+
+  for (ind = 0; ind < nthr; ind++)
+    memcpy(all + ind * nopn, lats[ind], nopn * sizeof(size_t));
+
+  qsort(all, tot, sizeof(size_t), cmp_size);
+
+  printf("churn : %.0f conn/sec : failed = %d\n",
+         (double)(tot - bad) * 1000000000 / dur, bad);
+
+  printf("churn : connect+GET+close us : p50 = %.1f : p99 = %.1f : "
+         "p99.9 = %.1f : max = %.1f\n", (double)all[tot / 2] / 1000,
+         (double)all[(size_t)tot * 99 / 100] / 1000,
+         (double)all[(size_t)tot * 999 / 1000] / 1000,
+         (double)all[tot - 1] / 1000);
+
+  free(all);
+
+  return bad ? 1 : 0;
+}
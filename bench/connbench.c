@@ -0,0 +1,224 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <yarilib.h>
+
+/*
+ * Idle connection test. Opens many connections to the server and keeps
+ * them open, spreading them over loopback source addresses so that the
+ * ephemeral ports of one don't run out. Every -S'th connection then does
+ * a SET and a GET, to check the server serves connections at any
+ * descriptor. With the server pid (-s), its resident memory before and
+ * after is reported, as memory per idle connection. Needs a descriptor
+ * limit (ulimit -n) above the connection count, on both sides.
+ */
+
+#define NCONN_DEFAULT   (100000)
+#define CONN_PER_ADDR   (20000)           /* connections per source address */
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+int   nconn  = NCONN_DEFAULT;
+int   stride = 1000;                     /* every stride'th one does I/O */
+int   port   = YNET_SER_PORT;
+int   spid;                                 /* server pid, for its memory */
+char *host   = "127.0.0.1";
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+/*
+ * Resident memory of a process in KB, 0 if not known.
+ */
+long rss_get(int pid)
+{
+  long  kb = 0;
+  char  path[64];
+  char  line[256];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return 0;
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+      break;
+  }
+
+  fclose(fp);
+
+  return kb;
+}
+
+int conn_open(int ind)
+{
+  int                sfd;
+  int                one = 1;
+  struct sockaddr_in src;
+  struct sockaddr_in dst;
+
+  if ((sfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+
+  memset(&src, 0, sizeof(src));
+  memset(&dst, 0, sizeof(dst));
+
+  /* 127.0.0.1, 127.0.0.2, ... port picked at connect, per address */
+  src.sin_family      = AF_INET;
+  src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + ind / CONN_PER_ADDR);
+
+  dst.sin_family      = AF_INET;
+  dst.sin_addr.s_addr = inet_addr(host);
+  dst.sin_port        = htons(port);
+
+  setsockopt(sfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+
+  if ((bind(sfd, (struct sockaddr *)&src, sizeof(src)) < 0) ||
+      (connect(sfd, (struct sockaddr *)&dst, sizeof(dst)) < 0))
+  {
+    close(sfd);
+    return -1;
+  }
+
+  return sfd;
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "c:h:p:s:S:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'c':
+        nconn = atol(optarg);
+        break;
+      case 'h':
+        host = strdup(optarg);
+        break;
+      case 'p':
+        port = atol(optarg);
+        break;
+      case 's':
+        spid = atol(optarg);
+        break;
+      case 'S':
+        stride = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-c connections] [-h host] [-p port] "
+               "[-s server pid] [-S io stride]\n", argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nconn <= 0 || stride <= 0)
+  {
+    printf("connections and stride should be positive\n");
+    exit(1);
+  }
+
+  printf("# connections    = %d\n", nconn);
+  printf("# io stride      = %d\n", stride);
+}
+
+int main(int argc, char *argv[])
+{
+  int           ind;
+  int           len;
+  int           olen;
+  int           bad = 0;
+  int          *fds;
+  long          rss0;
+  long          rss1;
+  size_t        beg;
+  size_t        tot;
+  char          val[64];
+  char          out[64];
+  yari_ctx_t    ctx;
+  struct rlimit rl;
+
+  parse_cmd_line(argc, argv);
+
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  if (rl.rlim_cur <= nconn)
+  {
+    printf("descriptor limit %lu, raise ulimit -n above %d\n",
+           (unsigned long)rl.rlim_cur, nconn);
+    exit(1);
+  }
+
+  if ((fds = (int *)malloc(nconn * sizeof(int))) == NULL)
+    exit(1);
+
+  rss0 = rss_get(spid);
+  beg  = get_cur_nsec();
+
+  for (ind = 0; ind < nconn; ind++)
+  {
+    if ((fds[ind] = conn_open(ind)) < 0)
+    {
+      printf("connection %d failed : errno = %d\n", ind, errno);
+      exit(1);
+    }
+  }
+
+  tot = get_cur_nsec() - beg;
+
+  printf("connected      : %d in %.2f s : %.0f conn/sec\n", nconn,
+         (double)tot / 1000000000, (double)nconn * 1000000000 / tot);
+
+  for (ind = 0; ind < nconn; ind += stride)
+  {
+    ynet_ctx_init(&ctx.ictx, YNET_CLASS_MSG, fds[ind]);
+
+    len = sprintf(val, "conn-%d", ind);
+
+    olen = sizeof(out);
+
+    if ((yari_set(&ctx, val, len, val, len) != 0) ||
+        (yari_get(&ctx, val, len, out, &olen) != 0) ||
+        (olen != len) || memcmp(out, val, len))
+      bad++;
+  }
+
+  printf("io             : %d connections, %d failed\n",
+         (nconn + stride - 1) / stride, bad);
+
+  sleep(1);                     /* let the server settle on the last ones */
+
+  if (spid && rss0 && (rss1 = rss_get(spid)))
+  {
+    printf("server rss     : %ld KB -> %ld KB : %.0f bytes/connection\n",
+           rss0, rss1, (double)(rss1 - rss0) * 1024 / nconn);
+  }
+
+  for (ind = 0; ind < nconn; ind++)
+    close(fds[ind]);
+
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include <ycommon.h>
+#include <ylock.h>
+#include <yqueue.h>
+
+/*
+ * Event dispatch micro benchmark. Threads hand events to each other
+ * through the shared event queue of the server, as the epoll waiter and
+ * the worker threads do in shared waiter mode, and the aggregate rate is
+ * reported for 1 upto -n threads. Both the locked ring it used to be and
+ * the lock-free queue (yqueue.h) are measured. Every thread queues a
+ * batch of events and takes a batch off, in a loop.
+ */
+
+#define NOPN_DEFAULT   (1000000)
+#define NTHREAD_MAX    (64)
+#define BATCH          (16)
+#define QUEUE_MAX      (4096)
+
+int nopn    = NOPN_DEFAULT;                            /* per thread */
+int nthread = NTHREAD_MAX;
+
+/*
+ * Locked ring, events copied in and out under an exclusive lock.
+ */
+struct ring_t
+{
+  ylock_t             lock;
+  int                 max;
+  int                 head;
+  int                 tail;
+  struct epoll_event *events;
+};
+typedef struct ring_t ring_t;
+
+ring_t   ring;
+yqueue_t queue;
+
+volatile int start;
+uint64_t     sums[NTHREAD_MAX * 8];        /* popped, a cache line each */
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+int ring_push(uint64_t val)
+{
+  int ret = FALSE;
+
+  ylock_acq(&ring.lock, YLOCK_EXCL);
+
+  if ((ring.tail + 1) % ring.max != ring.head)
+  {
+    ring.events[ring.tail].events  = val >> 32;
+    ring.events[ring.tail].data.fd = (uint32_t)val;
+    ring.tail = (ring.tail + 1) % ring.max;
+    ret = TRUE;
+  }
+
+  ylock_rel(&ring.lock, YLOCK_EXCL);
+
+  return ret;
+}
+
+int ring_pop(uint64_t *val)
+{
+  int ret = FALSE;
+
+  ylock_acq(&ring.lock, YLOCK_EXCL);
+
+  if (ring.head != ring.tail)
+  {
+    *val = ((uint64_t)ring.events[ring.head].events << 32) |
+           (uint32_t)ring.events[ring.head].data.fd;
+    ring.head = (ring.head + 1) % ring.max;
+    ret = TRUE;
+  }
+
+  ylock_rel(&ring.lock, YLOCK_EXCL);
+
+  return ret;
+}
+
+int queue_push(uint64_t val)
+{
+  return yqueue_push(&queue, val);
+}
+
+int queue_pop(uint64_t *val)
+{
+  return yqueue_pop(&queue, val);
+}
+
+int (*test_push)(uint64_t val);
+int (*test_pop)(uint64_t *val);
+
+void * test_thread(void *arg)
+{
+  int      ind;
+  int      cnt;
+  int      thr = (long)arg;
+  uint64_t val;
+  uint64_t tmp;
+  uint64_t sum = 0;
+
+  while (!start);
+
+  for (ind = 0; ind < nopn; )
+  {
+    for (cnt = 0; cnt < BATCH && ind < nopn; cnt++, ind++)
+    {
+      val = ((uint64_t)EPOLLIN << 32) | (thr * nopn + ind);
+
+      while (!test_push(val))
+      {
+        if (test_pop(&tmp))                 /* full, drain one and retry */
+          sum += tmp;
+        else
+          sched_yield();       /* a peer holds the cell, let it finish */
+      }
+    }
+
+    for (cnt = 0; cnt < BATCH && test_pop(&val); cnt++)
+      sum += val;
+  }
+
+  sums[thr * 8] = sum;
+
+  return NULL;
+}
+
+void test_run(char *str, int n)
+{
+  int       ind;
+  uint64_t  val;
+  uint64_t  sum = 0;
+  uint64_t  exp = 0;
+  size_t    beg;
+  size_t    tot;
+  pthread_t hdl[NTHREAD_MAX];
+
+  start = 0;
+
+  for (ind = 0; ind < n; ind++)
+    pthread_create(&hdl[ind], NULL, test_thread, (void *)(long)ind);
+
+  beg   = get_cur_nsec();
+  start = 1;
+
+  for (ind = 0; ind < n; ind++)
+    pthread_join(hdl[ind], NULL);
+
+  tot = get_cur_nsec() - beg;
+
+  while (test_pop(&val))                       /* left over by the last */
+    sum += val;
+
+  for (ind = 0; ind < n; ind++)
+    sum += sums[ind * 8];
+
+  for (ind = 0; ind < n * nopn; ind++)
+    exp += ((uint64_t)EPOLLIN << 32) | ind;
+
+  printf("%-8s : threads = %2d : events/sec = %10.0f : ns/event = %6.1f%s\n",
+         str, n, (double)n * nopn * 1000000000 / tot,
+         (double)tot / ((double)n * nopn), (sum == exp) ? "" : " : LOST");
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "n:N:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'N':
+        nopn = atol(optarg);
+        break;
+      case 'n':
+        nthread = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-N events per thread] [-n max threads]\n",
+               argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nthread <= 0 || nthread > NTHREAD_MAX || nopn <= 0)
+  {
+    printf("threads 1..%d\n", NTHREAD_MAX);
+    exit(1);
+  }
+
+  printf("# events/thread  = %d\n", nopn);
+  printf("# max threads    = %d\n", nthread);
+}
+
+int main(int argc, char *argv[])
+{
+  int n;
+
+  parse_cmd_line(argc, argv);
+
+  ylock_init(&ring.lock);
+
+  ring.max    = QUEUE_MAX;
+  ring.head   = ring.tail = 0;
+  ring.events = malloc(QUEUE_MAX * sizeof(struct epoll_event));
+
+  if (!ring.events || yqueue_create(&queue, QUEUE_MAX) != 0)
+  {
+    printf("allocation failed\n");
+    exit(1);
+  }
+
+  for (n = 1; n <= nthread; n *= 2)
+  {
+    test_push = ring_push;
+    test_pop  = ring_pop;
+    test_run("locked", n);
+
+    test_push = queue_push;
+    test_pop  = queue_pop;
+    test_run("lockfree", n);
+  }
+
+  return 0;
+}
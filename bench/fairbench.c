@@ -0,0 +1,258 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <yarilib.h>
+
+/*
+ * Mixed client test. Interactive clients (-i) each do GETs one at a time,
+ * while bulk clients (-b) keep streaming pipelines of -P SETs of -v byte
+ * values. Reported are the round trip latency percentiles of the GETs,
+ * and the SET rate of the bulk clients next to them. Run it against a
+ * server with and without its read quota (-q 0), on few server threads
+ * (-t 1, -R), to see interactive clients wait behind bulk ones.
+ */
+
+#define NOPN_DEFAULT   (5000)
+#define NTHREAD_MAX    (64)
+#define KEY_LEN_MAX    (32)
+
+int   nopn  = NOPN_DEFAULT;                    /* GETs per interactive */
+int   nint  = 4;                                /* interactive clients */
+int   nbulk = 1;                                       /* bulk clients */
+int   depth = 512;                        /* SETs per bulk round trip */
+int   vlen  = 1024;                              /* bulk value length */
+int   port  = YNET_SER_PORT;
+char *host  = NULL;
+
+volatile int done;
+
+size_t *lats[NTHREAD_MAX];              /* GET latencies, per interactive */
+size_t  sets[NTHREAD_MAX * 8];             /* SETs done, a cache line each */
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+  size_t x = *(size_t *)a;
+  size_t y = *(size_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+void * int_thread(void *arg)
+{
+  int        ind;
+  int        thr = (long)arg;
+  int        len;
+  int        olen;
+  char       key[KEY_LEN_MAX];
+  char       out[64];
+  size_t     beg;
+  yari_ctx_t ctx;
+
+  if (yari_connect(&ctx, host, port) != 0)
+  {
+    printf("connect failed : errno = %d\n", errno);
+    exit(1);
+  }
+
+  len = sprintf(key, "int-%d", thr);
+
+  if (yari_set(&ctx, key, len, key, len) != 0)
+  {
+    printf("set failed : errno = %d\n", errno);
+    exit(1);
+  }
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    olen = sizeof(out);
+    beg  = get_cur_nsec();
+
+    if (yari_get(&ctx, key, len, out, &olen) != 0)
+    {
+      printf("get failed : errno = %d\n", errno);
+      exit(1);
+    }
+
+    lats[thr][ind] = get_cur_nsec() - beg;
+  }
+
+  yari_close(&ctx);
+
+  return NULL;
+}
+
+void * bulk_thread(void *arg)
+{
+  int         ind;
+  int         thr = (long)arg;
+  int         len;
+  char        key[KEY_LEN_MAX];
+  char       *val;
+  size_t      cnt = 0;
+  yari_ctx_t  ctx;
+  yari_pipe_t pipe;
+
+  if ((yari_connect(&ctx, host, port) != 0) ||
+      (yari_pipe_init(&pipe, depth) != 0) ||
+      ((val = malloc(vlen)) == NULL))
+  {
+    printf("bulk setup failed : errno = %d\n", errno);
+    exit(1);
+  }
+
+  memset(val, 'v', vlen);
+
+  while (!done)
+  {
+    for (ind = 0; ind < depth; ind++)
+    {
+      len = sprintf(key, "bulk-%d-%d", thr, ind);
+
+      if (yari_pipe_set(&ctx, &pipe, key, len, val, vlen) != 0)
+        break;
+    }
+
+    if (yari_pipe_exec(&ctx, &pipe, NULL, NULL) < 0)
+    {
+      printf("bulk pipeline failed : errno = %d\n", errno);
+      exit(1);
+    }
+
+    cnt += depth;
+  }
+
+  sets[thr * 8] = cnt;
+
+  yari_pipe_free(&pipe);
+  yari_close(&ctx);
+  free(val);
+
+  return NULL;
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "b:h:i:N:p:P:v:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'b':
+        nbulk = atol(optarg);
+        break;
+      case 'h':
+        host = strdup(optarg);
+        break;
+      case 'i':
+        nint = atol(optarg);
+        break;
+      case 'N':
+        nopn = atol(optarg);
+        break;
+      case 'p':
+        port = atol(optarg);
+        break;
+      case 'P':
+        depth = atol(optarg);
+        break;
+      case 'v':
+        vlen = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-i interactive clients] [-b bulk clients] "
+               "[-N gets per interactive] [-P bulk pipeline depth] "
+               "[-v bulk value bytes] [-h host] [-p port]\n", argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nint <= 0 || nint > NTHREAD_MAX || nbulk < 0 || nbulk > NTHREAD_MAX ||
+      nopn <= 0 || depth <= 0 || vlen <= 0)
+  {
+    printf("clients 1..%d, counts positive\n", NTHREAD_MAX);
+    exit(1);
+  }
+
+  printf("# interactive    = %d\n", nint);
+  printf("# gets each      = %d\n", nopn);
+  printf("# bulk           = %d\n", nbulk);
+  printf("# bulk pipeline  = %d x %d bytes\n", depth, vlen);
+}
+
+int main(int argc, char *argv[])
+{
+  int       ind;
+  int       tot;
+  size_t    beg;
+  size_t    dur;
+  size_t    nset = 0;
+  size_t   *all;
+  pthread_t ihdl[NTHREAD_MAX];
+  pthread_t bhdl[NTHREAD_MAX];
+
+  parse_cmd_line(argc, argv);
+
+  for (ind = 0; ind < nint; ind++)
+  {
+    if ((lats[ind] = malloc(nopn * sizeof(size_t))) == NULL)
+      exit(1);
+  }
+
+  for (ind = 0; ind < nbulk; ind++)
+    pthread_create(&bhdl[ind], NULL, bulk_thread, (void *)(long)ind);
+
+  usleep(100000);                       /* bulk clients get going first */
+
+  beg = get_cur_nsec();
+
+  for (ind = 0; ind < nint; ind++)
+    pthread_create(&ihdl[ind], NULL, int_thread, (void *)(long)ind);
+
+  for (ind = 0; ind < nint; ind++)
+    pthread_join(ihdl[ind], NULL);
+
+  dur  = get_cur_nsec() - beg;
+  done = 1;
+
+  for (ind = 0; ind < nbulk; ind++)
+  {
+    pthread_join(bhdl[ind], NULL);
+    nset += sets[ind * 8];
+  }
+
+  tot = nint * nopn;
+  all = malloc(tot * sizeof(size_t));
+
+  for (ind = 0; ind < nint; ind++)
+    memcpy(all + ind * nopn, lats[ind], nopn * sizeof(size_t));
+
+  qsort(all, tot, sizeof(size_t), cmp_size);
+
+  printf("interactive : GET latency us : p50 = %.1f : p99 = %.1f : "
+         "p99.9 = %.1f\n", (double)all[tot / 2] / 1000,
+         (double)all[(size_t)tot * 99 / 100] / 1000,
+         (double)all[(size_t)tot * 999 / 1000] / 1000);
+
+  printf("bulk        : SET ops/sec = %.0f\n",
+         (double)nset * 1000000000 / dur);
+
+  free(all);
+
+  return 0;
+}
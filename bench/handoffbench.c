@@ -0,0 +1,291 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <ycommon.h>
+#include <ylock.h>
+#include <yqueue.h>
+
+/*
+ * Handoff latency micro benchmark. A producer queues bursts of events, as
+ * the epoll waiter of the server does, and wakes idle worker threads to
+ * take them. Between bursts it pauses (-g), so workers go idle. Reported
+ * is the latency from queueing an event to a worker taking it, the
+ * wakeups made, and the cpu time and context switches of the process per
+ * event, for:
+ *   eventfd : workers block reading an eventfd, a write per thread woken,
+ *             whether it sleeps or not, as the server used to do
+ *   park    : workers spin on a park word and then sleep on it (futex),
+ *             only parked ones are woken, no more than there are events
+ *             not taken by threads woken already
+ */
+
+#define NBURST_DEFAULT (2000)
+#define NTHREAD_MAX    (64)
+#define QUEUE_MAX      (4096)
+
+int nburst  = NBURST_DEFAULT;
+int nthread = 4;
+int burst   = 8;                                    /* events per burst */
+int gap     = 100;                          /* usecs between the bursts */
+int spin    = -1;                       /* park spin rounds, -1 for auto */
+
+yqueue_t     queue;
+volatile int done;
+int          woken;                       /* park : woken, not running */
+int          parks[NTHREAD_MAX * 16];      /* park words, own cache line */
+int          efds[NTHREAD_MAX];
+
+size_t      *lats[NTHREAD_MAX];                  /* latencies per thread */
+int          nlat[NTHREAD_MAX];
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+static void take_all(int thr)
+{
+  uint64_t val;
+
+  while (yqueue_pop(&queue, &val))
+    lats[thr][nlat[thr]++] = get_cur_nsec() - val;
+}
+
+static int ready(void *arg)
+{
+  return done || !yqueue_is_empty(&queue);
+}
+
+void * efd_thread(void *arg)
+{
+  int      thr = (long)arg;
+  uint64_t val;
+
+  while (TRUE)
+  {
+    take_all(thr);
+
+    if (done)
+      break;
+
+    read(efds[thr], &val, sizeof(val));
+  }
+
+  return NULL;
+}
+
+void * park_thread(void *arg)
+{
+  int thr = (long)arg;
+
+  while (TRUE)
+  {
+    take_all(thr);
+
+    if (done)
+      break;
+
+    if (ylock_park(&parks[thr * 16], spin, ready, NULL))
+      __atomic_fetch_sub(&woken, 1, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+int efd_wake(int n)
+{
+  int      ind;
+  uint64_t val = 1;
+
+  for (ind = 0; ind < n && ind < nthread; ind++)
+    write(efds[ind], &val, sizeof(val));
+
+  return ind;
+}
+
+int park_wake(int n)
+{
+  int ind;
+  int cnt = 0;
+  int max = (int)yqueue_count(&queue) -
+            __atomic_load_n(&woken, __ATOMIC_RELAXED);
+
+  if (n > max)
+    n = max;
+
+  for (ind = 0; ind < nthread && cnt < n; ind++)
+  {
+    if (ylock_unpark(&parks[ind * 16]))
+    {
+      __atomic_fetch_add(&woken, 1, __ATOMIC_RELAXED);
+      cnt++;
+    }
+  }
+
+  return cnt;
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+  size_t x = *(size_t *)a;
+  size_t y = *(size_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+void test_run(char *str, void * (*thread)(void *), int (*wake)(int))
+{
+  int       ind;
+  int       cnt;
+  int       tot = 0;
+  size_t    wakes = 0;
+  size_t   *all;
+  double    cpu;
+  long      csw;
+  pthread_t hdl[NTHREAD_MAX];
+  struct rusage ru0;
+  struct rusage ru1;
+
+  done  = 0;
+  woken = 0;
+
+  for (ind = 0; ind < nthread; ind++)
+  {
+    nlat[ind] = 0;
+    pthread_create(&hdl[ind], NULL, thread, (void *)(long)ind);
+  }
+
+  usleep(10000);
+
+  getrusage(RUSAGE_SELF, &ru0);
+
+  for (ind = 0; ind < nburst; ind++)
+  {
+    for (cnt = 0; cnt < burst; cnt++)
+      yqueue_push(&queue, get_cur_nsec());
+
+    wakes += wake(burst);
+
+    usleep(gap);                                      /* idle till next */
+  }
+
+  done = 1;
+
+  for (ind = 0; ind < nthread; ind++)
+  {
+    ylock_unpark(&parks[ind * 16]);
+    efd_wake(nthread);
+    pthread_join(hdl[ind], NULL);
+  }
+
+  getrusage(RUSAGE_SELF, &ru1);
+
+  cpu = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec +
+         ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1000000.0 +
+        (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec +
+         ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec);
+  csw = (ru1.ru_nvcsw - ru0.ru_nvcsw) + (ru1.ru_nivcsw - ru0.ru_nivcsw);
+
+  all = malloc(nburst * burst * sizeof(size_t));
+
+  for (ind = 0; ind < nthread; ind++)
+  {
+    memcpy(all + tot, lats[ind], nlat[ind] * sizeof(size_t));
+    tot += nlat[ind];
+  }
+
+  qsort(all, tot, sizeof(size_t), cmp_size);
+
+  printf("%-8s : p50 = %6.1fus : p99 = %7.1fus : wakes/burst = %5.2f : "
+         "cpu/event = %5.2fus : switches/event = %4.2f\n", str,
+         (double)all[tot / 2] / 1000,
+         (double)all[(size_t)tot * 99 / 100] / 1000,
+         (double)wakes / nburst, cpu / tot, (double)csw / tot);
+
+  free(all);
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "b:g:n:N:s:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'b':
+        burst = atol(optarg);
+        break;
+      case 'g':
+        gap = atol(optarg);
+        break;
+      case 'n':
+        nthread = atol(optarg);
+        break;
+      case 'N':
+        nburst = atol(optarg);
+        break;
+      case 's':
+        spin = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-N bursts] [-b events per burst] "
+               "[-g usecs between bursts] [-n threads] [-s park spins]\n",
+               argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nthread <= 0 || nthread > NTHREAD_MAX || nburst <= 0 || burst <= 0 ||
+      burst >= QUEUE_MAX || gap < 0)
+  {
+    printf("threads 1..%d, burst below %d\n", NTHREAD_MAX, QUEUE_MAX);
+    exit(1);
+  }
+
+  printf("# bursts         = %d\n", nburst);
+  printf("# events/burst   = %d\n", burst);
+  printf("# gap usecs      = %d\n", gap);
+  printf("# threads        = %d\n", nthread);
+}
+
+int main(int argc, char *argv[])
+{
+  int ind;
+
+  parse_cmd_line(argc, argv);
+
+  if (yqueue_create(&queue, QUEUE_MAX) != 0)
+  {
+    printf("allocation failed\n");
+    exit(1);
+  }
+
+  for (ind = 0; ind < nthread; ind++)
+  {
+    efds[ind] = eventfd(0, 0);
+    lats[ind] = malloc(nburst * burst * sizeof(size_t));
+
+    if (efds[ind] < 0 || lats[ind] == NULL)
+    {
+      printf("setup failed : errno = %d\n", errno);
+      exit(1);
+    }
+  }
+
+  test_run("eventfd", efd_thread, efd_wake);
+  test_run("park", park_thread, park_wake);
+
+  return 0;
+}
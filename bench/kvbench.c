@@ -8,6 +8,7 @@
 #include <getopt.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <time.h>
 
 #include <redislib.h>
 #include <yarilib.h>
@@ -25,11 +26,13 @@
 char *test_str[]=
 { 
   "redis",
-  "yari"
+  "yari",
+  "yarib"
 };
 
 #define TEST_REDIS (0)
 #define TEST_YARI  (1)
+#define TEST_YARIB (2)                          /* yari, binary protocol */
 
 struct thread_t
 {
@@ -40,6 +43,8 @@ struct thread_t
   volatile int done;
   volatile int end;
   size_t       time_diff;
+  size_t      *lat;             /* round trip latencies of a test, nanosecs */
+  int          nlat;
 };
 typedef struct thread_t thread_t;
 
@@ -49,6 +54,10 @@ thread_t  thr_ctx_arr[NTHREAD];
 
 int nopn = NOPN_DEFAULT;
 
+int bulk = 0;                               /* bulk load batch, 0 for none */
+int pipe_depth = 1;                        /* requests per round trip, yari */
+int pipe_mux   = 0;                  /* pipelines answered out of order, yarib */
+
 int klen = KEY_LEN_MAX;
 int vlen = VAL_LEN_MAX;
 int kcnt = KEY_CNT_MAX;
@@ -70,6 +79,22 @@ __thread yari_ctx_t  yari_ctx;
 
 char server_host[128];
 int  server_port;
+char *unix_path;                   /* yari over Unix domain socket, if set */
+char *shm_path;                  /* yari over shared memory rings, if set */
+
+/*
+ * Connect to yari over the selected transport.
+ */
+int bench_connect(yari_ctx_t *ctx)
+{
+  if (shm_path)
+    return yari_connect_shm(ctx, shm_path);
+
+  if (unix_path)
+    return yari_connect_unix(ctx, unix_path);
+
+  return yari_connect(ctx, server_host[0] ? server_host : NULL, server_port);
+}
 
 __thread void *test_ctx;
 int (*test_get)(void *ctx, char *key, int klen, char *val, int *vlen);
@@ -82,6 +107,62 @@ static size_t get_cur_time()                    /* current time in microsecs */
   return (s.tv_sec * 1000000 + s.tv_usec);
 }
 
+static size_t get_cur_nsec()                   /* monotonic time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+/*
+ * Record latency of a round trip started at 'beg'.
+ */
+static inline void lat_add(thread_t *tctx, size_t beg)
+{
+  if (tctx->lat && tctx->nlat < nopn)
+    tctx->lat[tctx->nlat++] = get_cur_nsec() - beg;
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+  size_t x = *(const size_t *)a;
+  size_t y = *(const size_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * Latency percentiles across all threads of the last test.
+ */
+void lat_print(char *str)
+{
+  int     ind;
+  int     cnt = 0;
+  size_t *all;
+
+  for (ind = 0; ind < nthread; ind++)
+    cnt += thr_ctx_arr[ind].nlat;
+
+  if (cnt == 0 || (all = (size_t *)malloc(cnt * sizeof(size_t))) == NULL)
+    return;
+
+  for (ind = 0, cnt = 0; ind < nthread; ind++)
+  {
+    memcpy(all + cnt, thr_ctx_arr[ind].lat, 
+           thr_ctx_arr[ind].nlat * sizeof(size_t));
+    cnt += thr_ctx_arr[ind].nlat;
+  }
+
+  qsort(all, cnt, sizeof(size_t), lat_cmp);
+
+  printf("%s : %s : latency us   : p50 = %.1f : p99 = %.1f : p99.9 = %.1f : "
+         "max = %.1f\n", test_str[test_type], str, 
+         all[cnt / 2] / 1000.0, all[(size_t)cnt * 99 / 100] / 1000.0,
+         all[(size_t)cnt * 999 / 1000] / 1000.0, all[cnt - 1] / 1000.0);
+
+  free(all);
+}
+
 int process_init(void)
 {
   int ind;
@@ -101,7 +182,7 @@ int process_init(void)
     test_get = (int (*)(void *, char *, int, char *, int *))redis_get;
     test_set = (int (*)(void *, char *, int, char *, int))redis_set;
   }
-  else if (test_type == TEST_YARI)
+  else if (test_type == TEST_YARI || test_type == TEST_YARIB)
   {
     test_get = (int (*)(void *, char *, int, char *, int *))yari_get;
     test_set = (int (*)(void *, char *, int, char *, int))yari_set;
@@ -137,7 +218,8 @@ void thread_init(int thr)
 
   if (test_type == TEST_REDIS)
   {
-    if (redis_connect(&redis_ctx, server_host[0] ? server_host : NULL, 0) < 0)
+    if (redis_connect(&redis_ctx, server_host[0] ? server_host : NULL,
+                      server_port) < 0)
     {
       printf("thread [%d] : redis connect failed\n", thr);
       exit(0);
@@ -145,20 +227,72 @@ void thread_init(int thr)
 
     test_ctx = (void *)&redis_ctx;
   }
-  else if (test_type == TEST_YARI)
+  else if (test_type == TEST_YARI || test_type == TEST_YARIB)
   {
-    if (yari_connect(&yari_ctx, server_host[0] ? server_host : NULL, 0) < 0)
+    if (bench_connect(&yari_ctx) < 0)
     {
       printf("thread [%d] : yari connect failed\n", thr);
       exit(0);
     }
 
+    if (test_type == TEST_YARIB)
+      yari_proto(&yari_ctx, YARI_PROTO_BIN);
+
     test_ctx = (void *)&yari_ctx;
   }
 
   //printf("thread_init : %d : done\n", thr);
 }
 
+/*
+ * Pipelined SET or GET, 'pipe_depth' requests per round trip.
+ */
+void test_pipe_driver(thread_t *tctx, int get)
+{
+  int         ind;
+  int         kind;
+  int         ret;
+  int         cnt;
+  size_t      beg = 0;
+  yari_pipe_t pipe;
+
+  if ((yari_pipe_init(&pipe, pipe_depth) < 0) ||
+      (yari_pipe_mux(&yari_ctx, &pipe, pipe_mux) < 0))
+  {
+    tctx->err++;
+    return;
+  }
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    kind = (ind + key_off) % KEY_CNT_MAX;
+
+    if (pipe.cnt == 0)
+      beg = get_cur_nsec();
+
+    if (get)
+      ret = yari_pipe_get(&yari_ctx, &pipe, key[kind], keyl[kind]);
+    else
+      ret = yari_pipe_set(&yari_ctx, &pipe, key[kind], keyl[kind],
+                          val[kind], vall[kind]);
+
+    if (ret < 0)
+      tctx->err++;
+
+    if (pipe.cnt == pipe_depth || ind == nopn - 1)
+    {
+      cnt = pipe.cnt;
+      ret = yari_pipe_exec(&yari_ctx, &pipe, NULL, NULL);
+
+      lat_add(tctx, beg);
+
+      tctx->err += (ret < 0) ? cnt : cnt - ret;
+    }
+  }
+
+  yari_pipe_free(&pipe);
+}
+
 void test_get_driver(thread_t *tctx)
 {
   int ind;
@@ -167,6 +301,13 @@ void test_get_driver(thread_t *tctx)
   int vind;
   int ret;
   int vlen;
+  size_t beg;
+
+  if (pipe_depth > 1 && test_type != TEST_REDIS)
+  {
+    test_pipe_driver(tctx, TRUE);
+    return;
+  }
 
   for (ind = 0; ind < nopn; ind++)
   {
@@ -176,8 +317,12 @@ void test_get_driver(thread_t *tctx)
 
    //   printf("[%d] test_get_driver : %d : kind = %d [%.*s] %d\n", tctx->ind, ind, kind, keyl[kind], key[kind], keyl[kind]);
 
+    beg = get_cur_nsec();
+
     ret = (*test_get)(test_ctx, key[kind], keyl[kind], val_out, &vlen);
 
+    lat_add(tctx, beg);
+
     if (ret < 0)
       tctx->err++;
   }
@@ -191,6 +336,13 @@ void test_set_driver(thread_t *tctx)
   int vind;
   int ret;
   int vlen;
+  size_t beg;
+
+  if (pipe_depth > 1 && test_type != TEST_REDIS)
+  {
+    test_pipe_driver(tctx, FALSE);
+    return;
+  }
 
   for (ind = 0; ind < nopn; ind++)
   {
@@ -198,13 +350,69 @@ void test_set_driver(thread_t *tctx)
 
    //   printf("[%d] test_get_driver : %d : kind = %d [%.*s] %d\n", tctx->ind, ind, kind, keyl[kind], key[kind], keyl[kind]);
 
+    beg = get_cur_nsec();
+
     ret = (*test_set)(test_ctx, key[kind], keyl[kind], val[kind], vall[kind]);
 
+    lat_add(tctx, beg);
+
     if (ret < 0)
       tctx->err++;
   }
 }
 
+/*
+ * Ingest of unique keys, one SET per key. Baseline for bulk load.
+ */
+void test_load_driver(thread_t *tctx)
+{
+  int  ind;
+  int  kind;
+  int  len;
+  char kbuf[KEY_LEN_MAX];
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    kind = (ind + key_off) % KEY_CNT_MAX;
+    len  = snprintf(kbuf, sizeof(kbuf), "ld_%d_%d", tctx->ind, ind);
+
+    if ((*test_set)(test_ctx, kbuf, len, val[kind], vall[kind]) < 0)
+      tctx->err++;
+  }
+}
+
+/*
+ * Ingest of unique keys through bulk load batches.
+ */
+void test_bulk_driver(thread_t *tctx)
+{
+  int         ind;
+  int         kind;
+  int         len;
+  char        kbuf[KEY_LEN_MAX];
+  yari_bulk_t batch;
+
+  if (yari_bulk_init(&batch, bulk * (KEY_LEN_MAX + VAL_LEN_MAX)) < 0)
+  {
+    tctx->err++;
+    return;
+  }
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    kind = (ind + key_off) % KEY_CNT_MAX;
+    len  = snprintf(kbuf, sizeof(kbuf), "bk_%d_%d", tctx->ind, ind);
+
+    if (yari_bulk_add(&yari_ctx, &batch, kbuf, len, val[kind], vall[kind]) < 0)
+      tctx->err++;
+  }
+
+  if (yari_bulk_flush(&yari_ctx, &batch) < 0)
+    tctx->err++;
+
+  yari_bulk_free(&batch);
+}
+
 void (*test_driver)(thread_t *tctx);
 
 volatile int test_ready;
@@ -233,6 +441,7 @@ void * thread_driver(void *ctx)
       }
     }
     tctx->done  = 0;
+    tctx->nlat  = 0;
     tctx->ready = 1;
     while(!test_start);
 
@@ -296,7 +505,10 @@ void test_function(char *str, void (*func)(thread_t *))
     time_tot += tctx->time_diff;
   }
 
-  printf("%s : %s : time taken = %-16llu : avg/opn = %3.2f\n", test_str[test_type], str, time_tot, (double)time_tot/(nthread * nopn));
+  printf("%s : %s : time taken = %-16llu : avg/opn = %3.2f : ops/sec = %.0f\n", test_str[test_type], str, time_tot, (double)time_tot/(nthread * nopn),
+         (time_tot) ? (double)nthread * nthread * nopn * 1000000 / time_tot : 0);
+
+  lat_print(str);
 }
 
 void parse_cmd_line(int argc, char *argv[])
@@ -304,10 +516,16 @@ void parse_cmd_line(int argc, char *argv[])
   int opt;
 
   while ((opt = getopt_long(argc, argv,
-            "a:b:c:d:D:f:i:ln:N:o:h:Op:s:S:t:wV?", NULL, NULL)) != -1)
+            "a:b:B:c:d:D:f:i:lm:Mn:N:o:h:Op:P:s:S:t:u:wV?", NULL, NULL)) != -1)
   {
     switch (opt)
     {
+      case 'B':
+        bulk = atol(optarg);
+        break;
+      case 'P':
+        pipe_depth = atol(optarg);
+        break;
       case 'N':
         nopn = atol(optarg);
         break;
@@ -317,9 +535,23 @@ void parse_cmd_line(int argc, char *argv[])
       case 'h':
         strcpy(server_host, optarg);
         break;
+      case 'p':
+        server_port = atol(optarg);
+        break;
+      case 'u':
+        unix_path = strdup(optarg);
+        break;
+      case 'm':
+        shm_path = strdup(optarg);
+        break;
+      case 'M':
+        pipe_mux = 1;
+        break;
       case 't':
         if (strcmp(optarg, "yari") == 0)
 	  test_type = TEST_YARI;
+        else if (strcmp(optarg, "yarib") == 0)
+	  test_type = TEST_YARIB;
         break;
     }
   }
@@ -328,7 +560,36 @@ void parse_cmd_line(int argc, char *argv[])
   printf("# client threads = %d\n", nthread);
   if (server_host[0])
     printf("# server host    = %s\n", server_host);
+  if (server_port)
+    printf("# server port    = %d\n", server_port);
+  if (unix_path)
+    printf("# unix socket    = %s\n", unix_path);
+  if (shm_path)
+    printf("# shm socket     = %s\n", shm_path);
   printf("test type = %s\n", test_str[test_type]);
+  if (bulk)
+    printf("# bulk batch     = %d\n", bulk);
+  if (pipe_depth > 1)
+    printf("# pipeline depth = %d\n", pipe_depth);
+  if (pipe_mux)
+    printf("# multiplexed    = on\n");
+}
+
+void print_server_stats()
+{
+  int        len;
+  char       buf[4096];
+  yari_ctx_t sctx;
+
+  if (bench_connect(&sctx) < 0)
+    return;
+
+  len = sizeof(buf);
+
+  if (yari_stats(&sctx, buf, &len) == 0)
+    printf("server : %.*s\n", len, buf);
+
+  ynet_close(&sctx.ictx);
 }
 
 int main(int argc, char *argv[])
@@ -344,6 +605,7 @@ int main(int argc, char *argv[])
   {
     tctx = &thr_ctx_arr[ind1];
     tctx->ind = ind1;
+    tctx->lat = (size_t *)malloc(nopn * sizeof(size_t));
     pthread_create(&tctx->hdl, NULL, thread_driver, (void *)tctx);
   }
 
@@ -351,6 +613,12 @@ int main(int argc, char *argv[])
   test_function("SET", test_set_driver);
   test_function("GET", test_get_driver);
 
+  if (bulk && test_type != TEST_REDIS)
+  {
+    test_function("LOAD", test_load_driver);
+    test_function("BULK", test_bulk_driver);
+  }
+
   for (ind1 = 0 ; ind1 < nthread; ind1++)       /* join and accumulate stats */
   {
     tctx = &thr_ctx_arr[ind1];
@@ -363,5 +631,8 @@ int main(int argc, char *argv[])
     pthread_join(tctx->hdl, NULL);
   }
 
+  if (test_type != TEST_REDIS && server_port == 0) /* server counters */
+    print_server_stats();
+
   return 0;
 }
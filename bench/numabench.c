@@ -0,0 +1,222 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <yhash.h>
+#include <ynuma.h>
+
+/*
+ * Local vs remote memory test, on the table alone, no network. Readers
+ * (-n) pinned to the cpus of node 0 look up random keys of a table of -k
+ * keys, -N lookups each. The table, its slot array and objects, is loaded
+ * by a thread allocating on :
+ *   - local      : node 0, next to the readers
+ *   - remote     : the last node, every lookup crosses (more than 1 node)
+ *   - interleave : every node, page by page
+ * Every layout runs in a process of its own, so that none reuses memory
+ * placed for another.
+ */
+
+#define NKEY_DEFAULT   (1000000)
+#define NOPS_DEFAULT   (2000000)
+#define NTHREAD_MAX    (256)
+#define KEY_LEN_MAX    (32)
+
+int nkey = NKEY_DEFAULT;
+int nops = NOPS_DEFAULT;
+int nthr = 4;
+int vlen = 64;
+
+yhtab_t      *ht;
+int           cpus[YNUMA_CPU_MAX];
+int           ncpu;
+volatile int  start;
+size_t        nsecs[NTHREAD_MAX * 8];
+size_t        miss[NTHREAD_MAX * 8];
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+void * get_thread(void *arg)
+{
+  int          thr  = (long)arg;
+  int          ind;
+  int          len;
+  char         key[KEY_LEN_MAX];
+  size_t       beg;
+  unsigned int seed = thr + 1;
+  yhobj_t     *obj;
+
+  if (ncpu > 0)
+    ynuma_pin(cpus[thr % ncpu]);
+
+  while (!start)
+    ;
+
+  beg = get_cur_nsec();
+
+  for (ind = 0; ind < nops; ind++)
+  {
+    len = sprintf(key, "numa-%d", rand_r(&seed) % nkey);
+
+    if (yhtab_get(&obj, ht, key, len) != 0)
+    {
+      miss[thr * 8]++;
+      continue;
+    }
+
+    yhobj_release(obj);
+  }
+
+  nsecs[thr * 8] = get_cur_nsec() - beg;
+
+  return NULL;
+}
+
+/*
+ * Load the table with memory on a node, YNUMA_ALL for every node, then
+ * run the readers over it.
+ */
+void layout_run(char *name, int node)
+{
+  int       ind;
+  int       len;
+  char      key[KEY_LEN_MAX];
+  char     *val;
+  size_t    total = 0;
+  size_t    bad   = 0;
+  pthread_t hdl[NTHREAD_MAX];
+
+  if (ynuma_policy(node) != 0)
+  {
+    printf("%-10s : placement failed : errno = %d\n", name, errno);
+    return;
+  }
+
+  val = malloc(vlen);
+  memset(val, 'v', vlen);
+
+  if ((ht = yhtab_create(YHTAB_NCNT_DEFAULT, 0)) == NULL)
+  {
+    printf("%-10s : table failed : errno = %d\n", name, errno);
+    return;
+  }
+
+  for (ind = 0; ind < nkey; ind++)
+  {
+    len = sprintf(key, "numa-%d", ind);
+    yhtab_set(NULL, ht, key, len, val, vlen);
+  }
+
+  ynuma_policy(-1);
+
+  for (ind = 0; ind < nthr; ind++)
+    pthread_create(&hdl[ind], NULL, get_thread, (void *)(long)ind);
+
+  start = 1;
+
+  for (ind = 0; ind < nthr; ind++)
+  {
+    pthread_join(hdl[ind], NULL);
+
+    total += nsecs[ind * 8];
+    bad   += miss[ind * 8];
+  }
+
+  printf("%-10s : %.1f ns/get : %.2f Mgets/sec : missed = %zu\n", name,
+         (double)total / nthr / nops,
+         (double)nops * nthr / ((double)total / nthr) * 1000, bad);
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "k:n:N:v:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'k':
+        nkey = atol(optarg);
+        break;
+      case 'n':
+        nthr = atol(optarg);
+        break;
+      case 'N':
+        nops = atol(optarg);
+        break;
+      case 'v':
+        vlen = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-n threads] [-N gets per thread] [-k keys] "
+               "[-v value length]\n", argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nthr <= 0 || nthr > NTHREAD_MAX || nkey <= 0 || nops <= 0 ||
+      vlen <= 0)
+  {
+    printf("threads 1..%d, keys, gets and value length positive\n",
+           NTHREAD_MAX);
+    exit(1);
+  }
+
+  ynuma_init(NULL, NULL);
+
+  ncpu = ynuma_node_cpus(0, cpus, YNUMA_CPU_MAX);
+
+  printf("# nodes          = %d\n", ynuma_nnode);
+  printf("# readers        = %d, on %d cpu(s) of node 0\n", nthr, ncpu);
+  printf("# keys           = %d, %d byte values\n", nkey, vlen);
+  printf("# gets           = %d per reader\n", nops);
+}
+
+int main(int argc, char *argv[])
+{
+  int    ind;
+  int    nodes[3];
+  char  *names[3] = {"local", "remote", "interleave"};
+  pid_t  pid;
+
+  parse_cmd_line(argc, argv);
+
+  nodes[0] = 0;
+  nodes[1] = ynuma_nnode - 1;
+  nodes[2] = YNUMA_ALL;
+
+  fflush(stdout);
+
+  for (ind = 0; ind < 3; ind++)
+  {
+    if ((ind == 1) && (ynuma_nnode == 1))
+    {
+      printf("%-10s : skipped, a single node\n", names[ind]);
+      fflush(stdout);
+      continue;
+    }
+
+    if ((pid = fork()) == 0)
+    {
+      layout_run(names[ind], nodes[ind]);
+      exit(0);
+    }
+
+    waitpid(pid, NULL, 0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <ycommand.h>
+
+/*
+ * Wire protocol micro benchmark. Encodes and decodes SET and GET requests
+ * with both the text and the binary protocol, in memory, and reports the
+ * cost per operation along with bytes on wire per request and response.
+ */
+
+#define NOPN_DEFAULT (1000000)
+
+char *proto_str[]=
+{
+  "text",
+  "binary"
+};
+
+int nopn = NOPN_DEFAULT;
+int klen = 16;
+int vlen = 64;
+
+char kbuf[YBIN_KEY_MAX];
+char vbuf[MSG_MAX];
+
+volatile int sink;                        /* keeps decoded results alive */
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+/*
+ * Length of response to given request with a value of 'len' bytes,
+ * -1 for result only.
+ */
+int res_len(ycmd_req_t *req, int len)
+{
+  ybuf_t out;
+
+  ybuf_init(&out);
+
+  ycmd_encode_res(&out, req, 0, len);
+
+  return ybuf_rem(&out) + ((len < 0) ? 0 : len) +
+         ((len >= 0 && req->proto == YPROTO_TEXT) ? 1 : 0);
+}
+
+void test_proto(int proto, int cmd)
+{
+  int        ind;
+  int        rlen;
+  size_t     beg;
+  size_t     enc;
+  size_t     dec;
+  ybuf_t     buf;
+  ycmd_req_t req = { .proto = proto, .cmd = cmd, .key = { klen, kbuf } };
+  ycmd_req_t dreq;
+
+  if (cmd == CMD_SET)
+  {
+    req.val.str = vbuf;
+    req.val.len = vlen;
+  }
+
+  beg = get_cur_nsec();
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    ybuf_init(&buf);
+
+    if (ycmd_encode_req(&buf, &req) != 0)
+    {
+      printf("encode failed : %d\n", errno);
+      exit(1);
+    }
+
+    sink += buf.ep[-1];
+  }
+
+  enc = get_cur_nsec() - beg;
+  rlen = ybuf_rem(&buf);
+
+  beg = get_cur_nsec();
+
+  for (ind = 0; ind < nopn; ind++)
+  {
+    buf.sp = buf.bp;
+
+    if (ycmd_decode_req(&buf, &dreq) != 0)
+    {
+      printf("decode failed : %d\n", errno);
+      exit(1);
+    }
+
+    sink += dreq.key.len + dreq.val.len;
+  }
+
+  dec = get_cur_nsec() - beg;
+
+  if (dreq.cmd != cmd || dreq.key.len != klen ||
+      memcmp(dreq.key.str, kbuf, klen) != 0 ||
+      (cmd == CMD_SET && (dreq.val.len != vlen ||
+                          memcmp(dreq.val.str, vbuf, vlen) != 0)))
+  {
+    printf("%s : round trip mismatch\n", proto_str[proto]);
+    exit(1);
+  }
+
+  printf("%-6s : %-3s : encode/opn = %6.1f ns : decode/opn = %6.1f ns : "
+         "request = %4d bytes : response = %4d bytes\n",
+         proto_str[proto], (cmd == CMD_SET) ? "SET" : "GET",
+         (double)enc / nopn, (double)dec / nopn, rlen,
+         res_len(&req, (cmd == CMD_GET) ? vlen : -1));
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "k:N:v:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'N':
+        nopn = atol(optarg);
+        break;
+      case 'k':
+        klen = atol(optarg);
+        break;
+      case 'v':
+        vlen = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-N operations] [-k key len] [-v value len]\n",
+               argv[0]);
+        exit(0);
+    }
+  }
+
+  if (klen <= 0 || klen > 1024 || vlen < 0 || vlen > MSG_MAX - 1024)
+  {
+    printf("key length 1..1024, value length 0..%d\n", MSG_MAX - 1024);
+    exit(1);
+  }
+
+  printf("# operations     = %d\n", nopn);
+  printf("# key/val length = %d/%d\n", klen, vlen);
+}
+
+int main(int argc, char *argv[])
+{
+  int ind;
+
+  parse_cmd_line(argc, argv);
+
+  for (ind = 0; ind < klen; ind++)
+    kbuf[ind] = 'a' + ind % 26;
+
+  for (ind = 0; ind < vlen; ind++)
+    vbuf[ind] = 'A' + ind % 26;
+
+  test_proto(YPROTO_TEXT, CMD_SET);
+  test_proto(YPROTO_BIN,  CMD_SET);
+  test_proto(YPROTO_TEXT, CMD_GET);
+  test_proto(YPROTO_BIN,  CMD_GET);
+
+  return 0;
+}
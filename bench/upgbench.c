@@ -0,0 +1,255 @@
+#include <stdio.h>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <yarilib.h>
+
+/*
+ * Upgrade service gap test. Loads -k keys, then client threads (-n) keep
+ * doing GETs of them for -d seconds, over connections kept open (or a
+ * connection per GET, -C), reconnecting as soon as one fails. Take the
+ * server over with a new one (yari_server -T) meanwhile. Reported are
+ * the longest stretch in which no client got an answer, the longest one
+ * a single client went without, the GETs that failed or came back wrong,
+ * and, after the run, how many of the keys the server still has.
+ */
+
+#define NKEY_DEFAULT   (100000)
+#define NTHREAD_MAX    (256)
+#define KEY_LEN_MAX    (32)
+#define LOAD_DEPTH     (1000)                      /* SETs per round trip */
+
+int   nkey  = NKEY_DEFAULT;
+int   nthr  = 8;
+int   secs  = 10;
+int   churn;                                   /* connection per GET */
+int   port  = YNET_SER_PORT;
+char *host  = NULL;
+
+volatile int done;
+size_t       last_ok;                     /* latest answer, any client */
+size_t       gaps[NTHREAD_MAX * 8];      /* longest, any client, by thread */
+size_t       waits[NTHREAD_MAX * 8];  /* longest of the thread on its own */
+size_t       nops[NTHREAD_MAX * 8];
+size_t       fails[NTHREAD_MAX * 8];
+size_t       wrong[NTHREAD_MAX * 8];
+
+static size_t get_cur_nsec()                  /* current time in nanosecs */
+{
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  return (s.tv_sec * 1000000000ULL + s.tv_nsec);
+}
+
+void * get_thread(void *arg)
+{
+  int          thr  = (long)arg;
+  int          conn = FALSE;
+  int          len;
+  int          olen;
+  char         key[KEY_LEN_MAX];
+  char         out[KEY_LEN_MAX];
+  size_t       now;
+  size_t       prev;
+  size_t       mine = get_cur_nsec();
+  unsigned int seed = thr;
+  yari_ctx_t   ctx;
+
+  while (!done)
+  {
+    if (!conn && (yari_connect(&ctx, host, port) != 0))
+    {
+      fails[thr * 8]++;
+      continue;
+    }
+
+    conn = TRUE;
+    len  = sprintf(key, "upg-%d", rand_r(&seed) % nkey);
+    olen = sizeof(out);
+
+    if (yari_get(&ctx, key, len, out, &olen) != 0)
+    {
+      fails[thr * 8]++;
+      yari_close(&ctx);
+      conn = FALSE;
+      continue;
+    }
+
+    if ((olen != len) || (memcmp(out, key, len) != 0))
+      wrong[thr * 8]++;
+
+    now  = get_cur_nsec();
+    prev = __atomic_exchange_n(&last_ok, now, __ATOMIC_RELAXED);
+
+    if ((now > prev) && (now - prev > gaps[thr * 8]))
+      gaps[thr * 8] = now - prev;
+
+    if (now - mine > waits[thr * 8])
+      waits[thr * 8] = now - mine;
+
+    mine = now;
+    nops[thr * 8]++;
+
+    if (churn)
+    {
+      yari_close(&ctx);
+      conn = FALSE;
+    }
+  }
+
+  if (conn)
+    yari_close(&ctx);
+
+  return NULL;
+}
+
+/*
+ * Keys upg-<n>, valued as named, in pipelines. With 'check' GETs them
+ * instead, returning how many are there.
+ */
+int keys_run(int check)
+{
+  int          ind;
+  int          len;
+  int          cnt = 0;
+  int          olen;
+  char         key[KEY_LEN_MAX];
+  char         out[KEY_LEN_MAX];
+  yari_ctx_t   ctx;
+  yari_pipe_t  pipe;
+
+  if ((yari_connect(&ctx, host, port) != 0) ||
+      (yari_pipe_init(&pipe, LOAD_DEPTH) != 0))
+  {
+    printf("connect failed : errno = %d\n", errno);
+    exit(1);
+  }
+
+  for (ind = 0; ind < nkey; ind++)
+  {
+    len = sprintf(key, "upg-%d", ind);
+
+    if (check)
+    {
+      olen = sizeof(out);
+      cnt += (yari_get(&ctx, key, len, out, &olen) == 0) && (olen == len) &&
+             (memcmp(out, key, len) == 0);
+      continue;
+    }
+
+    yari_pipe_set(&ctx, &pipe, key, len, key, len);
+
+    if (((ind + 1) % LOAD_DEPTH == 0) || (ind + 1 == nkey))
+    {
+      if (yari_pipe_exec(&ctx, &pipe, NULL, NULL) < 0)
+      {
+        printf("load failed : errno = %d\n", errno);
+        exit(1);
+      }
+    }
+  }
+
+  yari_pipe_free(&pipe);
+  yari_close(&ctx);
+
+  return cnt;
+}
+
+void parse_cmd_line(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "Cd:h:k:n:p:?", NULL, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'C':
+        churn = 1;
+        break;
+      case 'd':
+        secs = atol(optarg);
+        break;
+      case 'h':
+        host = strdup(optarg);
+        break;
+      case 'k':
+        nkey = atol(optarg);
+        break;
+      case 'n':
+        nthr = atol(optarg);
+        break;
+      case 'p':
+        port = atol(optarg);
+        break;
+      default:
+        printf("usage : %s [-n threads] [-d seconds] [-k keys] "
+               "[-C connection per GET] [-h host] [-p port]\n", argv[0]);
+        exit(0);
+    }
+  }
+
+  if (nthr <= 0 || nthr > NTHREAD_MAX || nkey <= 0 || secs <= 0)
+  {
+    printf("threads 1..%d, keys and seconds positive\n", NTHREAD_MAX);
+    exit(1);
+  }
+
+  printf("# threads        = %d\n", nthr);
+  printf("# seconds        = %d\n", secs);
+  printf("# keys           = %d\n", nkey);
+  printf("# connections    = %s\n", (churn) ? "one per GET" : "kept open");
+}
+
+int main(int argc, char *argv[])
+{
+  int       ind;
+  size_t    gap  = 0;
+  size_t    wait = 0;
+  size_t    ops  = 0;
+  size_t    bad  = 0;
+  size_t    badv = 0;
+  pthread_t hdl[NTHREAD_MAX];
+
+  parse_cmd_line(argc, argv);
+
+  keys_run(FALSE);
+
+  printf("loaded, take the server over now\n");
+  fflush(stdout);
+
+  last_ok = get_cur_nsec();
+
+  for (ind = 0; ind < nthr; ind++)
+    pthread_create(&hdl[ind], NULL, get_thread, (void *)(long)ind);
+
+  sleep(secs);
+  done = 1;
+
+  for (ind = 0; ind < nthr; ind++)
+  {
+    pthread_join(hdl[ind], NULL);
+
+    gap   = (gaps[ind * 8] > gap) ? gaps[ind * 8] : gap;
+    wait  = (waits[ind * 8] > wait) ? waits[ind * 8] : wait;
+    ops  += nops[ind * 8];
+    bad  += fails[ind * 8];
+    badv += wrong[ind * 8];
+  }
+
+  printf("gets  : %.0f ops/sec : failed = %zu : wrong = %zu\n",
+         (double)ops / secs, bad, badv);
+
+  printf("gap   : no answer at all = %.2f ms : a client waited = %.2f ms\n",
+         (double)gap / 1000000, (double)wait / 1000000);
+
+  printf("keys  : %d of %d kept\n", keys_run(TRUE), nkey);
+
+  return 0;
+}
@@ -17,6 +17,7 @@
  */
 #include <yarilib.h>
 #include <ycommand.h>
+#include <yshm.h>
 
 int yari_connect(yari_ctx_t *ctx, char *ip, int port)
 {
@@ -35,9 +36,35 @@ int yari_connect(yari_ctx_t *ctx, char *ip, int port)
     srv = &serv_addr;
   }
 
+  ynet_ctx_init(&ctx->ictx, YNET_CLASS_MSG, -1);
+
   return ynet_connect(&ctx->ictx, srv);
 }
 
+int yari_connect_unix(yari_ctx_t *ctx, char *path)
+{
+  ynet_ctx_init(&ctx->ictx, YNET_CLASS_MSG, -1);
+
+  return ynet_connect_unix(&ctx->ictx, path);
+}
+
+int yari_connect_shm(yari_ctx_t *ctx, char *path)
+{
+  ynet_ctx_init(&ctx->ictx, YNET_CLASS_MSG, -1);
+
+  return yshm_connect(&ctx->ictx, path);
+}
+
+int yari_proto(yari_ctx_t *ctx, int proto)
+{
+  if (proto != YARI_PROTO_TEXT && proto != YARI_PROTO_BIN)
+    return y_error(EINVAL);
+
+  ctx->ictx.proto = proto;
+
+  return 0;
+}
+
 int yari_set(yari_ctx_t *ctx, char *key, int klen, char *val, int vlen)
 {
   return ycmd_client_process_set(&ctx->ictx, key, klen, val, vlen, 0);
@@ -48,12 +75,279 @@ int yari_get(yari_ctx_t *ctx, char *key, int klen, char *val, int *vlen)
   return ycmd_client_process_get(&ctx->ictx, key, klen, val, vlen);
 }
 
+int yari_select(yari_ctx_t *ctx, char *ns, int len)
+{
+  return ycmd_client_process_select(&ctx->ictx, ns, len);
+}
+
+int yari_flush(yari_ctx_t *ctx)
+{
+  return ycmd_client_process_flush(&ctx->ictx);
+}
+
+int yari_stats(yari_ctx_t *ctx, char *buf, int *len)
+{
+  return ycmd_client_process_stats(&ctx->ictx, buf, len);
+}
+
+int yari_bulk_init(yari_bulk_t *bulk, int max)
+{
+  if (max <= 0)
+    max = YARI_BULK_DEFAULT;
+
+  if ((bulk->buf = (char *)malloc(max)) == NULL)
+    return y_error(ENOMEM);
+
+  bulk->max = max;
+  bulk->len = 0;
+  bulk->cnt = 0;
+
+  return 0;
+}
+
+int yari_bulk_add(yari_ctx_t *ctx, yari_bulk_t *bulk,
+                  char *key, int klen, char *val, int vlen)
+{
+  int      ret;
+  uint32_t rlen[2];
+  int      len = YCMD_BULK_HDR + klen + vlen;
+
+  if (len > bulk->max)
+    return y_error(E2BIG);
+
+  if ((bulk->len + len > bulk->max) &&
+      ((ret = yari_bulk_flush(ctx, bulk)) < 0))
+    return ret;
+
+  rlen[0] = klen;
+  rlen[1] = vlen;
+
+  memcpy(bulk->buf + bulk->len, rlen, YCMD_BULK_HDR);
+  memcpy(bulk->buf + bulk->len + YCMD_BULK_HDR, key, klen);
+  memcpy(bulk->buf + bulk->len + YCMD_BULK_HDR + klen, val, vlen);
+
+  bulk->len += len;
+  bulk->cnt++;
+
+  return 0;
+}
+
+int yari_bulk_flush(yari_ctx_t *ctx, yari_bulk_t *bulk)
+{
+  int ret;
+
+  if (bulk->cnt == 0)
+    return 0;
+
+  ret = ycmd_client_process_bulk(&ctx->ictx, bulk->buf, bulk->len, bulk->cnt);
+
+  bulk->len = 0;
+  bulk->cnt = 0;
+
+  return ret;
+}
+
+int yari_bulk_free(yari_bulk_t *bulk)
+{
+  free(bulk->buf);
+  bulk->buf = NULL;
+
+  return 0;
+}
+
+int yari_pipe_init(yari_pipe_t *pipe, int max)
+{
+  if (max <= 0)
+    return y_error(EINVAL);
+
+  pipe->cmd  = (int *)malloc(max * sizeof(int));
+  pipe->buf  = (char *)malloc(MSG_MAX);
+
+  if (pipe->cmd == NULL || pipe->buf == NULL)
+  {
+    yari_pipe_free(pipe);
+    return y_error(ENOMEM);
+  }
+
+  pipe->max  = max;
+  pipe->mux  = FALSE;
+  pipe->cnt  = 0;
+  pipe->len  = 0;
+  pipe->size = MSG_MAX;
+
+  return 0;
+}
+
+/**
+ * Queue an encoded request to the pipeline.
+ */
+static int yari_pipe_add(yari_ctx_t *ctx, yari_pipe_t *pipe, ycmd_req_t *req)
+{
+  int     len = req->key.len + req->val.len + 64;        /* framing incl */
+  int     size;
+  char   *buf;
+  ybuf_t  out;
+
+  if (pipe->cnt == pipe->max)
+    return y_error(ENOSPC);
+
+  if (pipe->len + len > pipe->size)
+  {
+    for (size = pipe->size * 2; size < pipe->len + len; size *= 2);
+
+    if ((buf = (char *)realloc(pipe->buf, size)) == NULL)
+      return y_error(ENOMEM);
+
+    pipe->buf  = buf;
+    pipe->size = size;
+  }
+
+  req->proto = ctx->ictx.proto;
+  req->rid   = pipe->cnt;                     /* matches binary responses */
+
+  if (pipe->mux)
+    req->flags |= YBIN_FLAG_MUX;
+
+  ybuf_view(&out, pipe->buf + pipe->len, 0, pipe->size - pipe->len);
+
+  if (ycmd_encode_req(&out, req) != 0)
+    return -1;
+
+  pipe->len += ybuf_rem(&out);
+  pipe->cmd[pipe->cnt++] = req->cmd;
+
+  return 0;
+}
+
+int yari_pipe_set(yari_ctx_t *ctx, yari_pipe_t *pipe,
+                  char *key, int klen, char *val, int vlen)
+{
+  ycmd_req_t req = { .cmd = CMD_SET, .key = { klen, key }, 
+                     .val = { vlen, val } };
+
+  return yari_pipe_add(ctx, pipe, &req);
+}
+
+int yari_pipe_get(yari_ctx_t *ctx, yari_pipe_t *pipe, char *key, int klen)
+{
+  ycmd_req_t req = { .cmd = CMD_GET, .key = { klen, key } };
+
+  return yari_pipe_add(ctx, pipe, &req);
+}
+
+/**
+ * Let the server answer requests of the pipeline out of order, binary
+ * protocol only, set before they are queued.
+ */
+int yari_pipe_mux(yari_ctx_t *ctx, yari_pipe_t *pipe, int on)
+{
+  if (on && (ctx->ictx.proto != YPROTO_BIN))
+    return y_error(EPROTONOSUPPORT);
+
+  pipe->mux = on;
+
+  return 0;
+}
+
+int yari_pipe_exec(yari_ctx_t *ctx, yari_pipe_t *pipe, 
+                   yari_pipe_cb_t cb, void *arg)
+{
+  int ret;
+
+  if (pipe->cnt == 0)
+    return 0;
+
+  ret = ycmd_client_process_pipe(&ctx->ictx, pipe->buf, pipe->len, 
+                                 pipe->cmd, pipe->cnt, cb, arg);
+
+  pipe->cnt = 0;
+  pipe->len = 0;
+
+  return ret;
+}
+
+int yari_pipe_free(yari_pipe_t *pipe)
+{
+  free(pipe->cmd);
+  free(pipe->buf);
+
+  pipe->cmd = NULL;
+  pipe->buf = NULL;
+
+  return 0;
+}
+
 int yari_close(yari_ctx_t *ctx)
 {
+  if (ctx->ictx.sfd < 0)
+    return 0;
+
+  ynet_close(&ctx->ictx);                        /* and its rings, if shm */
+
+  ctx->ictx.sfd = -1;
+
   return 0;
 }
 
 #ifdef TEST
+
+/*
+ * Build and run with a server on the default port
+ *   gcc -DTEST -I. yarilib.c -L../lib -lyari -lpthread
+ */
+
+#define TEST_PIPE_BYTES (4 * 64 * 1024)   /* several read quotas of server */
+
+/*
+ * Pipeline SETs past the read quota of the server, then half close : every
+ * one of them should still be answered before the server closes.
+ */
+static int test_half_close(void)
+{
+  int         cnt  = 0;
+  int         nres = 0;
+  int         len  = 0;
+  int         ret;
+  char        val[100];
+  char       *req;
+  char        res[4096];
+  yari_ctx_t  ctx;
+
+  if (yari_connect(&ctx, NULL, 0) < 0)
+    return -1;
+
+  req = malloc(TEST_PIPE_BYTES + 256);
+  memset(val, 'v', sizeof(val));
+
+  while (len < TEST_PIPE_BYTES)
+  {
+    len += sprintf(req + len, "#:%d~#:%d~#:hc%d~#:%d~#:%.*s~", CMD_SET,
+                   (int)snprintf(NULL, 0, "hc%d", cnt), cnt, 
+                   (int)sizeof(val), (int)sizeof(val), val);
+    cnt++;
+  }
+
+  if (send(ctx.ictx.sfd, req, len, 0) != len)
+    return -1;
+
+  shutdown(ctx.ictx.sfd, SHUT_WR);
+
+  /* a result only response, "#:0~", per request */
+  while ((ret = recv(ctx.ictx.sfd, res, sizeof(res), 0)) > 0)
+  {
+    while (ret--)
+      nres += (res[ret] == '~');
+  }
+
+  printf("%s : half close : %d bytes, %d requests, %d answered\n",
+         (nres == cnt) ? "PASS" : "FAIL", len, cnt, nres);
+
+  free(req);
+  yari_close(&ctx);
+
+  return (nres == cnt) ? 0 : -1;
+}
+
 int main()
 {
   char         out[4096];
@@ -103,6 +397,8 @@ int main()
   printf("main : get [%.*s] = [%.*s] %d\n", klen1, key1, len, out, len);
 
   yari_close(&ctx);
+
+  return test_half_close();
 }
 #endif
 
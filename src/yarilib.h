@@ -27,9 +27,72 @@ struct yari_ctx_t
 };
 typedef struct yari_ctx_t yari_ctx_t;
 
+/**
+ * Bulk load batch. Records are accumulated and sent once the batch is 
+ * full or flushed.
+ */
+struct yari_bulk_t
+{
+  int   cnt;                                       /* records in batch */
+  int   len;                                          /* bytes in batch */
+  int   max;                                      /* capacity of batch */
+  char *buf;
+};
+typedef struct yari_bulk_t yari_bulk_t;
+
+/**
+ * Pipeline. Requests are queued and sent in a single write by 
+ * yari_pipe_exec, which then reads all the responses. In binary protocol
+ * each carries its index as request id, and with yari_pipe_mux the server
+ * may run them in parallel and answer them as they complete, the 
+ * callback still gets the index of the request answered.
+ */
+struct yari_pipe_t
+{
+  int   cnt;                                          /* queued requests */
+  int   max;                                    /* max queued requests */
+  int  *cmd;                               /* command of each request */
+  int   len;                                            /* bytes queued */
+  int   size;                                       /* capacity of buf */
+  char *buf;
+  int   mux;                      /* answered out of order, binary only */
+};
+typedef struct yari_pipe_t yari_pipe_t;
+
+/**
+ * Response callback of a pipeline, value valid only during the call.
+ */
+typedef int (*yari_pipe_cb_t)(void *arg, int ind, int err, char *val, int vlen);
+
+#define YARI_PROTO_TEXT   YPROTO_TEXT        /**< text wire protocol */
+#define YARI_PROTO_BIN    YPROTO_BIN        /**< binary wire protocol */
+
+#define YARI_BULK_DEFAULT (4 * 1024 * 1024)   /**< default batch capacity */
+
 int yari_connect(yari_ctx_t *ctx, char *ip, int port);
+int yari_connect_unix(yari_ctx_t *ctx, char *path);
+int yari_connect_shm(yari_ctx_t *ctx, char *path);
+int yari_proto(yari_ctx_t *ctx, int proto);
 int yari_set(yari_ctx_t *ctx, char *key, int klen, char *val, int vlen);
 int yari_get(yari_ctx_t *ctx, char *key, int klen, char *val, int *vlen);
+int yari_select(yari_ctx_t *ctx, char *ns, int len);
+int yari_flush(yari_ctx_t *ctx);
+int yari_stats(yari_ctx_t *ctx, char *buf, int *len);
+
+int yari_bulk_init(yari_bulk_t *bulk, int max);
+int yari_bulk_add(yari_ctx_t *ctx, yari_bulk_t *bulk,
+                  char *key, int klen, char *val, int vlen);
+int yari_bulk_flush(yari_ctx_t *ctx, yari_bulk_t *bulk);
+int yari_bulk_free(yari_bulk_t *bulk);
+
+int yari_pipe_init(yari_pipe_t *pipe, int max);
+int yari_pipe_set(yari_ctx_t *ctx, yari_pipe_t *pipe,
+                  char *key, int klen, char *val, int vlen);
+int yari_pipe_get(yari_ctx_t *ctx, yari_pipe_t *pipe, char *key, int klen);
+int yari_pipe_mux(yari_ctx_t *ctx, yari_pipe_t *pipe, int on);
+int yari_pipe_exec(yari_ctx_t *ctx, yari_pipe_t *pipe, 
+                   yari_pipe_cb_t cb, void *arg);
+int yari_pipe_free(yari_pipe_t *pipe);
 int yari_close(yari_ctx_t *ctx);
 
 #endif
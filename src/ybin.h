@@ -0,0 +1,106 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YBIN_H
+
+#define _YBIN_H
+
+#include <endian.h>
+#include <ycommon.h>
+
+/**
+ * @file ybin.h - Binary Wire Protocol
+ *
+ * Every message is a fixed 16 byte header followed by raw key and value
+ * bytes. Header fields are little endian. First byte of a request is
+ * YBIN_MAGIC_REQ, which never starts a text protocol message ('#').
+ *
+ *   0      1       2      4          8          12         16
+ *   +------+-------+------+----------+----------+----------+
+ *   |magic |opcode |flags | req id   | key len  | val len  |
+ *   +------+-------+------+----------+----------+----------+
+ *
+ * In a response flags carry the status (errno value, 0 on success) and
+ * the request id of the request is echoed back. A request flagged
+ * YBIN_FLAG_MUX may be answered out of order, as it completes, so the
+ * client has to match responses by request id (ymux.h).
+ */
+
+#define YBIN_MAGIC_REQ  (0xB7)                          /**< request magic */
+#define YBIN_MAGIC_RES  (0xB8)                         /**< response magic */
+#define YBIN_HDR_LEN    (16)                             /**< header length */
+#define YBIN_KEY_MAX    (64 * 1024)                 /**< maximum key length */
+
+#define YBIN_FLAG_MUX   (0x1)           /**< request, answer out of order */
+
+/**
+ * @struct ybin_hdr_t
+ *
+ * @brief  Header in host byte order.
+ */
+struct ybin_hdr_t
+{
+  uint8_t   magic;
+  uint8_t   opcode;                                         /**< CMD_* */
+  uint16_t  flags;                          /**< request flags or status */
+  uint32_t  rid;                                          /**< request id */
+  uint32_t  klen;                                         /**< key length */
+  uint32_t  vlen;                                       /**< value length */
+};
+typedef struct ybin_hdr_t ybin_hdr_t;
+
+/**
+ * @brief Encode header in wire format.
+ *
+ * @param dp  - destination, YBIN_HDR_LEN bytes
+ * @param hdr - header
+ *
+ * @return None.
+ */
+static inline void ybin_hdr_encode(char *dp, ybin_hdr_t *hdr)
+{
+  ybin_hdr_t tmp;
+
+  tmp.magic  = hdr->magic;
+  tmp.opcode = hdr->opcode;
+  tmp.flags  = htole16(hdr->flags);
+  tmp.rid    = htole32(hdr->rid);
+  tmp.klen   = htole32(hdr->klen);
+  tmp.vlen   = htole32(hdr->vlen);
+
+  memcpy(dp, &tmp, YBIN_HDR_LEN);
+}
+
+/**
+ * @brief Decode header from wire format.
+ *
+ * @param sp  - source, YBIN_HDR_LEN bytes
+ * @param hdr - header
+ *
+ * @return None.
+ */
+static inline void ybin_hdr_decode(char *sp, ybin_hdr_t *hdr)
+{
+  memcpy(hdr, sp, YBIN_HDR_LEN);
+
+  hdr->flags = le16toh(hdr->flags);
+  hdr->rid   = le32toh(hdr->rid);
+  hdr->klen  = le32toh(hdr->klen);
+  hdr->vlen  = le32toh(hdr->vlen);
+}
+
+#endif /* ybin.h */
@@ -19,41 +19,18 @@
 #include <ycommand.h>
 #include <ytrace.h>
 #include <yhash.h>
+#include <yns.h>
+#include <yresp.h>
+#include <ymc.h>
 
-/**
- * Internal token object. 
- */
-struct ytoken_t
-{
-  int   len;
-  char *str;
-};
-typedef struct ytoken_t ytoken_t;
-
-/**
- * send result in given network context.
- */
-#define ycmd_send_res(ctx, val) \
-        do \
-	{ \
-	  char c = val; \
-	   write(ctx->sfd, &c, 1); \
-	} \
-	while (FALSE)
-
-/**
- * send success
- */
-#define ycmd_send_ok(ctx)  ycmd_send_res(ctx, 0)
+int ycmd_bulk_workers = 4;             /**< parallel workers for bulk load */
 
-/* 
- * send failure 
- */
-#define ycmd_send_err(ctx) ycmd_send_res(ctx, -1)
+int (*ycmd_mux_submit)(ynet_ctx_t *ctx, ycmd_req_t *req);  /**< lanes, if any */
 
 #define CMD_PREFIX_1   '#'
 #define CMD_PREFIX_2   ':'
 #define CMD_SUFFIX_1   '~'
+#define CMD_DIGITS_MAX (9)                /* integers fit an int, unsigned */
 
 /**
  * Dump given token.
@@ -175,37 +152,35 @@ static inline int ycmd_encode_str(ybuf_t *buf, char *str, int len)
 }
 
 /**
- * Decode integer
+ * Decode integer. Fails with EAGAIN if buffer ends before the integer.
  */
 static inline int ycmd_decode_int(ybuf_t *buf, int *val)
 {
   int    ind;
-  char  *cp;
+  char  *cp  = buf->sp;
   int    nval = 0;
   int    rem = ybuf_rem(buf);
 
   *val = 0;
 
-  if (rem <= 3)
-    return y_error(EINVAL);
-  
-  cp = buf->sp;
-
-  if (cp[0] != CMD_PREFIX_1 || cp[1] != CMD_PREFIX_2)
+  if ((rem > 0 && cp[0] != CMD_PREFIX_1) || (rem > 1 && cp[1] != CMD_PREFIX_2))
     return y_error(EINVAL);
 
-  for (ind = 2; ind < rem - 1; ind++)
+  for (ind = 2; ind < rem; ind++)
   {
     if (cp[ind] == CMD_SUFFIX_1)
       break;
 
-    if (!(cp[ind] >= '0' && cp[ind] <= '9'))
+    if (!(cp[ind] >= '0' && cp[ind] <= '9') || (ind >= CMD_DIGITS_MAX + 2))
       return y_error(EINVAL);
     
     nval = nval * 10 + (cp[ind] - '0');
   }
 
-  if ((ind == 2) || (cp[ind] != CMD_SUFFIX_1))
+  if (ind >= rem)
+    return y_error(EAGAIN);
+
+  if (ind == 2)
     return y_error(EINVAL);
 
   ind++;
@@ -218,23 +193,28 @@ static inline int ycmd_decode_int(ybuf_t *buf, int *val)
 }
 
 /**
- * Decode string
+ * Decode string. Fails with EAGAIN if buffer ends before the string, 
+ * 'val->len' is then the string length if known, -1 otherwise.
  */
 static inline int ycmd_decode_str(ybuf_t *buf, ytoken_t *val)
 {
   char  *cp;
-  int    nval = 0;
   int    len;
   int    ret;
-  int    rem;
+
+  val->str = NULL;
+  val->len = -1;
 
   if ((ret = ycmd_decode_int(buf, &len)) != 0)
     return ret;
 
-  rem = ybuf_rem(buf);
+  if (len < 0)
+    return y_error(EINVAL);
+
+  val->len = len;
 
-  if (rem <= 3)
-    return y_error(EINVAL);   /* TODO : Need to retrieve the second buffer */
+  if (ybuf_rem(buf) < len + 3)
+    return y_error(EAGAIN);
   
   cp = buf->sp;
 
@@ -245,7 +225,6 @@ static inline int ycmd_decode_str(ybuf_t *buf, ytoken_t *val)
     return y_error(EINVAL);
 
   val->str = buf->sp + 2;
-  val->len = len;
 
   buf->sp  += (len + 3);
 
@@ -271,6 +250,16 @@ ycmd_t ycmd_get_ycmd_id(ytoken_t *tok)
     case 's':
       if (YCMD_CMD_CMP(tok->str, tok->len, CMD_SET_STR))
         return CMD_SET;
+      if (YCMD_CMD_CMP(tok->str, tok->len, CMD_SELECT_STR))
+        return CMD_SELECT;
+      if (YCMD_CMD_CMP(tok->str, tok->len, CMD_STATS_STR))
+        return CMD_STATS;
+      break;
+
+    case 'F':
+    case 'f':
+      if (YCMD_CMD_CMP(tok->str, tok->len, CMD_FLUSH_STR))
+        return CMD_FLUSH;
       break;
 
     case 'Q':
@@ -281,273 +270,1583 @@ ycmd_t ycmd_get_ycmd_id(ytoken_t *tok)
   return CMD_UNKNOWN;
 }
 
-int ycmd_server_process_set(ynet_ctx_t *ctx, ybuf_t *buf)
+/**
+ * Decode a text protocol request. If a string is incomplete, 'need' is 
+ * set to the length of the whole request.
+ */
+static int ycmd_text_decode_req(ybuf_t *buf, ycmd_req_t *req)
 {
-  int     ret;
-  ytoken_t key;
-  ytoken_t val;
-  yhobj_t *obj;
-  ybuf_t   out;
+  int       ret = 0;
+  int       len;
+  char     *start = buf->sp;
+  ytoken_t *tok   = NULL;
 
-  if ((ret = ycmd_decode_str(buf, &key)) != 0)
+  if ((ret = ycmd_decode_int(buf, &req->cmd)) != 0)
     return ret;
 
-  if ((ret = ycmd_decode_str(buf, &val)) != 0)
-    return ret;
+  switch (req->cmd)
+  {
+    case CMD_GET:
+    case CMD_SELECT:
+      ret = ycmd_decode_str(buf, tok = &req->key);
+      break;
 
-  /* TODO handle big values */
+    case CMD_SET:
+      if ((ret = ycmd_decode_str(buf, tok = &req->key)) == 0)
+        ret = ycmd_decode_str(buf, tok = &req->val);
+      break;
 
-  ret = yhtab_set(&obj, yhtab_global, key.str, key.len, val.str, val.len, YLOCK_EXCL);
+    case CMD_FLUSH:
+    case CMD_STATS:
+    case CMD_PING:
+      break;
 
-  if (ret != 0)
-    return ret;
+    case CMD_BULK:
+    {
+      if ((ret = ycmd_decode_int(buf, &req->cnt)) != 0)
+        break;
 
-  yhobj_unlock(obj, YLOCK_EXCL);
+      if ((ret = ycmd_decode_int(buf, &len)) != 0)
+        break;
 
-  /* TODO handle big values */
+      if (len > YCMD_BULK_MAX)
+      {
+        ret = y_error(E2BIG);
+        break;
+      }
 
-  ybuf_init(&out);
+      if (ybuf_rem(buf) < len)
+      {
+        req->need = (buf->sp - start) + len;
+        ret       = y_error(EAGAIN);
+        break;
+      }
+
+      req->val.str = buf->sp;
+      req->val.len = len;
+
+      buf->sp += len;
+      break;
+    }
+    default:
+      ret = y_error(EINVAL);          /* can't tell where it ends, left */
+  }
 
-  ycmd_encode_int(&out, ret);
+  if ((ret != 0) && (errno == EAGAIN) && tok && (tok->len >= 0))
+  {
+    if (tok->len > YCMD_BULK_MAX)
+      return y_error(E2BIG);
 
-  ynet_send(ctx, &out);
+    req->need = (buf->sp - start) + tok->len + 3;
+    errno     = EAGAIN;
+  }
 
   return ret;
 }
 
-int ycmd_server_process_get(ynet_ctx_t *ctx, ybuf_t *buf)
+/**
+ * Decode a binary protocol request.
+ */
+static int ycmd_bin_decode_req(ybuf_t *buf, ycmd_req_t *req)
 {
-  int     ret;
-  ytoken_t key;
-  yhobj_t *obj;
-  yhdata_t *val;
-  ybuf_t   out;
+  ybin_hdr_t  hdr;
+  char       *cp  = buf->sp;
+  int         rem = ybuf_rem(buf);
+  size_t      len;
 
-  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process_get : enter \n");
+  if (rem < YBIN_HDR_LEN)
+  {
+    req->need = YBIN_HDR_LEN;
+    return y_error(EAGAIN);
+  }
 
-  if ((ret = ycmd_decode_str(buf, &key)) != 0)
-    return ret;
+  ybin_hdr_decode(cp, &hdr);
 
-  obj = NULL;
+  req->cmd   = hdr.opcode;
+  req->flags = hdr.flags;
+  req->rid   = hdr.rid;
 
-  ret = yhtab_get(&obj, yhtab_global, key.str, key.len, YLOCK_SHARED);
+  if (hdr.klen > YBIN_KEY_MAX)
+    return y_error(EINVAL);
 
-  ybuf_init(&out);
+  if (hdr.vlen > YCMD_BULK_MAX)
+    return y_error(E2BIG);
 
-  ycmd_encode_int(&out, ret);
+  len = YBIN_HDR_LEN + (size_t)hdr.klen + hdr.vlen;
 
-  if (ret == 0)
+  if (rem < len)
   {
-    /* TODO handle big values */
-    val = yhobj_val(obj);
+    req->need = len;
+    return y_error(EAGAIN);
+  }
 
-    ycmd_encode_str(&out, val->data, val->len);
+  req->key.str = cp + YBIN_HDR_LEN;
+  req->key.len = hdr.klen;
+  req->val.str = cp + YBIN_HDR_LEN + hdr.klen;
+  req->val.len = hdr.vlen;
 
-    yhobj_unlock(obj, YLOCK_SHARED);
+  if (req->cmd == CMD_BULK)                 /* key is the record count */
+  {
+    if (hdr.klen != sizeof(uint32_t))
+      return y_error(EINVAL);
+
+    req->cnt = le32toh(*(uint32_t *)req->key.str);
   }
-  else if (obj)
-    ytrace_msg(YTRACE_LEVEL1, "Something wrong in ycmd_server_process_get : %p\n", obj);
 
-  ycmd_ybuf_dump(YTRACE_LEVEL1, "ycmd_server_process_get_send_buf", &out, FALSE);
+  buf->sp += len;
+
+  return 0;
+}
+
+/**
+ * Decode request. Refer ycommand.h for details.
+ */
+int ycmd_decode_req(ybuf_t *buf, ycmd_req_t *req)
+{
+  int   ret;
+  char *start = buf->sp;
+
+  memset(req, 0, sizeof(*req));
+
+  if (ybuf_rem(buf) == 0)
+    return y_error(EAGAIN);
+
+  if ((uint8_t)buf->sp[0] == YBIN_MAGIC_REQ)
+  {
+    req->proto = YPROTO_BIN;
+    ret        = ycmd_bin_decode_req(buf, req);
+  }
+  else 
+  {
+    req->proto = YPROTO_TEXT;
+    ret        = ycmd_text_decode_req(buf, req);
+  }
 
-  ynet_send(ctx, &out);
+  if (ret != 0 && errno == EAGAIN)
+    buf->sp = start;                      /* nothing consumed till complete */
 
   return ret;
 }
 
-
-int ycmd_server_process(ynet_ctx_t *ctx)
+/**
+ * Encode request header. Refer ycommand.h for details.
+ */
+int ycmd_encode_hdr(ybuf_t *buf, ycmd_req_t *req)
 {
-  ybuf_t   buf;
-  int     cmn;
-  int     ret = y_error(EINVAL);
-  ytoken_t cmd;
+  int        ret = 0;
+  uint32_t   cnt;
+  ybin_hdr_t hdr;
 
-  ybuf_init(&buf);
-
-  if ((ret = ynet_recv(ctx, &buf)) != 0)
-    return ret;
+  if (req->proto == YPROTO_BIN)
+  {
+    hdr.magic  = YBIN_MAGIC_REQ;
+    hdr.opcode = req->cmd;
+    hdr.flags  = req->flags;
+    hdr.rid    = req->rid;
+    hdr.klen   = (req->cmd == CMD_BULK) ? sizeof(cnt) : req->key.len;
+    hdr.vlen   = req->val.len;
+
+    if (buf->fre < YBIN_HDR_LEN + hdr.klen)
+      return y_error(EINVAL);
 
-  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process : enter\n");
+    ybin_hdr_encode(buf->ep, &hdr);
+    buf->ep += YBIN_HDR_LEN;
 
-  /* ycmd_ybuf_dump("ycmd_server_process_1", &buf, TRUE); */
+    if (req->cmd == CMD_BULK)
+    {
+      cnt = htole32(req->cnt);
+      memcpy(buf->ep, &cnt, sizeof(cnt));
+    }
+    else 
+      memcpy(buf->ep, req->key.str, hdr.klen);
 
-  if ((ret = ycmd_decode_int(&buf, &cmn)) != 0)
-    return ret;
+    buf->ep  += hdr.klen;
+    buf->fre -= YBIN_HDR_LEN + hdr.klen;
 
-  /* ycmd_token_dump("ycmd_server_process_ycmd_token", &cmd); */
+    return 0;
+  }
 
-  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process : cmd = %d \n", cmn);
+  if ((ret = ycmd_encode_int(buf, req->cmd)) != 0)
+    return ret;
 
-  switch (cmn)
+  switch (req->cmd)
   {
     case CMD_GET:
-    {
-      ret = ycmd_server_process_get(ctx, &buf);
+    case CMD_SELECT:
+      ret = ycmd_encode_str(buf, req->key.str, req->key.len);
       break;
-    }
+
     case CMD_SET:
     {
-      ret = ycmd_server_process_set(ctx, &buf);
+      if ((ret = ycmd_encode_str(buf, req->key.str, req->key.len)) != 0)
+        break;
+
+      if ((ret = ycmd_encode_int(buf, req->val.len)) != 0)
+        break;
+
+      if (buf->fre < 2)
+        return y_error(EINVAL);
+
+      *buf->ep++ = CMD_PREFIX_1;
+      *buf->ep++ = CMD_PREFIX_2;
+      buf->fre  -= 2;
       break;
     }
-    default:
+    case CMD_BULK:
     {
-      ycmd_send_err(ctx);
+      if ((ret = ycmd_encode_int(buf, req->cnt)) != 0)
+        break;
+
+      ret = ycmd_encode_int(buf, req->val.len);
+      break;
     }
   }
-}
-
-#define ycmd_is_ws(c) ((c) == ' ' || (c) == '\n')
-
-static inline void ycmd_token_skip_ws(ybuf_t *buf)
-{
-  int   ind;
-  int   rem = ybuf_rem(buf);
-  char *cp  = buf->sp;
-
-  for (ind = 0; (ind < rem) && ycmd_is_ws(cp[ind]); ind++);
 
-  buf->sp  += ind;
+  return ret;
 }
 
-static inline int ycmd_token_get(ybuf_t *buf, ytoken_t *tok, int consume)
+/**
+ * Encode request. Refer ycommand.h for details.
+ */
+int ycmd_encode_req(ybuf_t *buf, ycmd_req_t *req)
 {
-  int   ind;
-  int   rem;
-  char *cp;
-
-  ycmd_token_skip_ws(buf);
-
-  rem = ybuf_rem(buf);
+  int ret;
+  int sfx = (req->proto == YPROTO_TEXT && req->cmd == CMD_SET);
 
-  if (!rem)
-    return -1;
+  if ((ret = ycmd_encode_hdr(buf, req)) != 0)
+    return ret;
 
-  cp  = buf->sp;
+  if (buf->fre < req->val.len + sfx)
+    return y_error(EINVAL);
 
-  for (ind = 0; (ind < rem) && !ycmd_is_ws(cp[ind]); ind++);
+  memcpy(buf->ep, req->val.str, req->val.len);
 
-  tok->len = ind;
-  tok->str = buf->sp;
+  buf->ep  += req->val.len;
+  buf->fre -= req->val.len;
 
-  if (consume)
-    buf->sp  += ind;
+  if (sfx)
+  {
+    *buf->ep++ = CMD_SUFFIX_1;
+    buf->fre--;
+  }
 
   return 0;
 }
 
-int ycmd_client_process_set(ynet_ctx_t *sctx, char *key, int klen, char *val, int vlen, int expiry)
+/**
+ * Encode response header. Refer ycommand.h for details.
+ */
+int ycmd_encode_res(ybuf_t *buf, ycmd_req_t *req, int err, int vlen)
 {
-  ybuf_t sbuf;
-  ybuf_t rbuf;
-  int   ret;
+  int        ret;
+  ybin_hdr_t hdr;
 
-  ybuf_init(&sbuf);
-  ybuf_init(&rbuf);
+  if (req->proto == YPROTO_RESP)
+    return yresp_encode_res(buf, req, err, vlen);
 
-  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_set : key = [%.*s] val = [%.*s]\n", klen, key, vlen, val);
+  if (req->proto == YPROTO_BIN)
+  {
+    if (buf->fre < YBIN_HDR_LEN)
+      return y_error(EINVAL);
 
-  if ((ret = ycmd_encode_int(&sbuf, CMD_SET)) != 0)
-    return ret;
+    hdr.magic  = YBIN_MAGIC_RES;
+    hdr.opcode = req->cmd;
+    hdr.flags  = err;
+    hdr.rid    = req->rid;
+    hdr.klen   = 0;
+    hdr.vlen   = (vlen > 0) ? vlen : 0;
 
-  if ((ret = ycmd_encode_str(&sbuf, key, klen)) != 0)
-    return ret;
+    ybin_hdr_encode(buf->ep, &hdr);
 
-  if ((ret = ycmd_encode_str(&sbuf, val, vlen)) != 0)
-    return ret;
+    buf->ep  += YBIN_HDR_LEN;
+    buf->fre -= YBIN_HDR_LEN;
 
-  ycmd_ybuf_dump(YTRACE_LEVEL1, "ycmd_client_process_set", &sbuf, TRUE); 
+    return 0;
+  }
 
-  if ((ret = ynet_send(sctx, &sbuf)) != 0)
+  if ((ret = ycmd_encode_int(buf, err)) != 0)
     return ret;
 
-  if ((ret = ynet_recv(sctx, &rbuf)) != 0)
+  if (vlen < 0)
+    return 0;
+
+  if ((ret = ycmd_encode_int(buf, vlen)) != 0)
     return ret;
 
+  if (buf->fre < 2)
+    return y_error(EINVAL);
+
+  *buf->ep++ = CMD_PREFIX_1;
+  *buf->ep++ = CMD_PREFIX_2;
+  buf->fre  -= 2;
+
   return 0;
 }
 
-int ycmd_client_process_get(ynet_ctx_t *sctx, char *key, int klen, char *val, int *vlen)
+/**
+ * Responses are queued in the connection output queue (ynet_out_t) and
+ * written once per ynet_conn_process pass, or earlier when the queue 
+ * reaches YCMD_OUT_MAX bytes or runs out of entries. Response headers and
+ * small values are copied into the queue buffer, larger values are queued
+ * by reference and their objects held till written. If the socket can't
+ * take the output, decoding stops till it has drained.
+ */
+#define YCMD_OUT_MAX       (256 * 1024)    /**< flush threshold, in bytes */
+#define YCMD_OUT_IOV_MIN   (4)           /**< entries kept free per request */
+#define YCMD_OUT_RES_MAX   (64)            /**< room for a response header */
+
+#define YCMD_READ_MIN      (1024)           /**< min room for a socket read */
+
+/**
+ * Release an object queued for output.
+ */
+static void ycmd_out_rel(void *ref)
 {
-  ybuf_t sbuf;
-  ybuf_t rbuf;
-  ybuf_t out;
-  int   ret;
-  int   cret;
-  ytoken_t tval;
+  yhobj_release((yhobj_t *)ref);
+}
 
-  ybuf_init(&sbuf);
-  ybuf_init(&rbuf);
+/**
+ * Make room for one more request. Refer ycommand.h for details.
+ */
+int ycmd_out_room(ynet_ctx_t *ctx)
+{
+  int         ret;
+  ynet_out_t *out = ctx->out;
 
-  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_get : key = [%.*s]\n", klen, key);
+  if ((ynet_out_nfree(out) >= YCMD_OUT_IOV_MIN) && 
+      (ynet_out_used(out) < YCMD_OUT_MAX))
+    return 0;
 
-  if ((ret = ycmd_encode_int(&sbuf, CMD_GET)) != 0)
-    return ret;
+  if ((ret = ynet_out_flush(ctx)) != EAGAIN)
+    return 0;                        /* hard errors are seen by next read */
 
-  if ((ret = ycmd_encode_str(&sbuf, key, klen)) != 0)
-    return ret;
+  return ret;
+}
 
-  /* ycmd_ybuf_dump("ycmd_client_process_get", &buf, TRUE); */
+/**
+ * Make room in output buffer. Refer ycommand.h for details.
+ */
+int ycmd_out_reserve(ynet_ctx_t *ctx, int len)
+{
+  return ybuf_reserve(ctx->out->buf, len + YCMD_OUT_RES_MAX);
+}
 
-  if ((ret = ynet_send(sctx, &sbuf)) != 0)
-    return ret;
+/**
+ * Bytes of a value copied. Refer ycommand.h for details.
+ */
+int ycmd_out_copy_len(ynet_ctx_t *ctx, int len)
+{
+  /* copy when small, or when entries run short. One entry is always left
+   * for the bytes that follow, a multi key response adds many values */
+  if ((len > YCMD_OUT_COPY_MAX) && (ynet_out_nfree(ctx->out) >= 3))
+    return 0;
 
-  ycmd_ybuf_dump(YTRACE_LEVEL1, "ycmd_client_process_get_send_buf", &sbuf, TRUE);  
+  return len;
+}
 
-  if ((ret = ynet_recv(sctx, &rbuf)) != 0)
-    return ret;
+/**
+ * Add a value to the response. Refer ycommand.h for details.
+ */
+int ycmd_out_data(ynet_ctx_t *ctx, char *ptr, int len, yhobj_t *obj)
+{
+  int     ret;
+  ybuf_t *buf = ctx->out->buf;
 
-  ycmd_ybuf_dump(YTRACE_LEVEL1, "ycmd_client_process_get_recv_buf", &rbuf, TRUE);  
+  if (ycmd_out_copy_len(ctx, len) == 0)
+  {
+    ynet_out_ref(ctx->out, ptr, len, obj);
+    return 0;
+  }
 
-  if ((ret = ycmd_decode_int(&rbuf, &cret)) != 0)
-    return ret;
+  /* reserved by the caller along with the header, so this doesn't fail */
+  if ((ret = ybuf_reserve(buf, len)) == 0)
+  {
+    memcpy(buf->ep, ptr, len);
 
-  if ((ret = ycmd_decode_str(&rbuf, &tval)) != 0)
-    return ret;
- 
-  if (cret != 0)
-    return cret;
+    buf->ep  += len;
+    buf->fre -= len;
+  }
 
-  *vlen = tval.len;
-  memcpy(val, tval.str, tval.len);
+  yhobj_release(obj);
 
-  return 0;
+  return ret;
 }
 
-int ycmd_client_process(ynet_ctx_t *sctx, ybuf_t *buf)
+/**
+ * Terminate a value in the response, text and RESP protocols only.
+ */
+static inline void ycmd_out_sfx(ynet_ctx_t *ctx, ycmd_req_t *req)
 {
-  ycmd_t    cmn;
-  ybuf_t    out;
-  ytoken_t  cmd;
-  ytoken_t  key;
-  ytoken_t  val;
-  int      len = 0;
-  int      ret = y_error(EINVAL);
+  ybuf_t *buf = ctx->out->buf;
 
-  if (ycmd_token_get(buf, &cmd, TRUE) < 0)
+  if (req->proto == YPROTO_TEXT)
   {
-    printf("ERROR : unknown command [%.*s]\n", (int)ybuf_rem(buf), buf->sp);
-    return 0;
+    *buf->ep++ = CMD_SUFFIX_1;
+    buf->fre--;
+  }
+  else if (req->proto == YPROTO_RESP)
+  {
+    *buf->ep++ = '\r';
+    *buf->ep++ = '\n';
+    buf->fre  -= 2;
   }
+}
 
-  /* ycmd_ybuf_dump("ycmd_client_process_2", buf); */
-  /* ycmd_token_dump("cmd", &cmd); */
+/**
+ * Add a result only response for given request.
+ */
+static int ycmd_out_ret(ynet_ctx_t *ctx, ycmd_req_t *req, int ret)
+{
+  int err = (ret) ? errno : 0;
 
-  cmn = ycmd_get_ycmd_id(&cmd);
+  if (ycmd_out_reserve(ctx, 0) == 0)
+    ycmd_encode_res(ctx->out->buf, req, err, -1);
 
-  if (cmn == CMD_QUIT)
-    return y_error(EINVAL);
+  return (err) ? y_error(err) : 0;
+}
 
-  ybuf_init(&out);
+/**
+ * Add a value response for given request, taking over the hold on 'obj'.
+ */
+static int ycmd_out_val(ynet_ctx_t *ctx, ycmd_req_t *req, yhobj_t *obj)
+{
+  int       ret;
+  int       err;
+  yhdata_t *val = yhobj_val(obj);
 
-  switch (cmn)
+  /* room for the whole response first, a header is never left alone */
+  if ((ret = ycmd_out_reserve(ctx, 
+                              ycmd_out_copy_len(ctx, val->len) + 2)) != 0)
   {
-    case CMD_GET:
-    {
-      if (ycmd_token_get(buf, &key, TRUE) < 0)
-        break;
-      
+    err = errno;
+    yhobj_release(obj);
+    errno = err;
+
+    return ycmd_out_ret(ctx, req, ret);
+  }
+
+  ycmd_encode_res(ctx->out->buf, req, 0, val->len);
+
+  if (ycmd_out_data(ctx, val->data, val->len, obj) != 0)  /* obj released */
+    return -1;
+
+  ycmd_out_sfx(ctx, req);
+
+  return 0;
+}
+
+int ycmd_server_process_set(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  int      ret;
+  yhtab_t *ht;
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    ret = y_error(EINVAL);
+  else
+  {
+    ret = yhtab_set(NULL, ht, req->key.str, req->key.len, 
+                    req->val.str, req->val.len);
+
+    yns_rel(ctx->ns);
+  }
+
+  return ycmd_out_ret(ctx, req, ret);
+}
+
+int ycmd_server_process_get(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  int       ret;
+  yhobj_t  *obj;
+  yhtab_t  *ht;
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process_get : enter \n");
+
+  obj = NULL;
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    ret = y_error(EINVAL);
+  else
+    ret = yhtab_get(&obj, ht, req->key.str, req->key.len); /* returned held */
+
+  if ((ret != 0) && obj)
+    ytrace_msg(YTRACE_LEVEL1, "Something wrong in ycmd_server_process_get : %p\n", obj);
+
+  if (ht)
+    yns_rel(ctx->ns);
+
+  if (ret != 0)
+    return ycmd_out_ret(ctx, req, ret);
+
+  return ycmd_out_val(ctx, req, obj);
+}
+
+int ycmd_server_process_select(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  int ret;
+  int id;
+
+  if ((id = yns_lookup(req->key.str, req->key.len)) >= 0)
+  {
+    ctx->ns = id;
+    ret     = 0;
+  }
+  else 
+    ret = id;
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process_select : [%.*s] = %d\n",
+             req->key.len, req->key.str, id);
+
+  return ycmd_out_ret(ctx, req, ret);
+}
+
+int ycmd_server_process_flush(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  return ycmd_out_ret(ctx, req, yns_flush(ctx->ns));
+}
+
+int ycmd_server_process_bulk(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  int       ret;
+  int       err;
+  int       cnt  = req->cnt;
+  int       len  = req->val.len;
+  int       ind;
+  int       done = 0;
+  char     *data = req->val.str;
+  char     *cp;
+  uint32_t  rlen[2];
+  uint32_t  rdone;
+  yhload_t *recs = NULL;
+  yhtab_t  *ht;
+  ybuf_t   *buf;
+
+  do 
+  {
+    if (cnt < 0 || cnt > len / YCMD_BULK_HDR)
+    {
+      ret = y_error(E2BIG);
+      break;
+    }
+
+    if ((recs = (yhload_t *)malloc(cnt * sizeof(yhload_t))) == NULL)
+    {
+      ret = y_error(ENOMEM);
+      break;
+    }
+
+    for (ind = 0, cp = data; ind < cnt; ind++)
+    {
+      if (cp + YCMD_BULK_HDR > data + len)
+        break;
+
+      memcpy(rlen, cp, YCMD_BULK_HDR);
+      cp += YCMD_BULK_HDR;
+
+      if (cp + rlen[0] + rlen[1] > data + len)
+        break;
+
+      recs[ind].key  = cp;
+      recs[ind].klen = rlen[0];
+      recs[ind].val  = cp + rlen[0];
+      recs[ind].vlen = rlen[1];
+
+      cp += rlen[0] + rlen[1];
+    }
+
+    if (ind != cnt)
+    {
+      ret = y_error(EINVAL);
+      break;
+    }
+
+    if ((ht = yns_acq(ctx->ns)) == NULL)
+    {
+      ret = y_error(EINVAL);
+      break;
+    }
+
+    ret = yhtab_load(ht, recs, cnt, ycmd_bulk_workers);
+
+    yns_rel(ctx->ns);
+
+    if (ret >= 0)
+    {
+      done = ret;
+      ret  = 0;
+    }
+  }
+  while (FALSE);
+
+  err = (ret) ? errno : 0;
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process_bulk : %d of %d : ret = %d\n",
+             done, cnt, ret);
+
+  free(recs);
+
+  if (ycmd_out_reserve(ctx, 0) != 0)
+    return -1;
+
+  buf = ctx->out->buf;
+
+  if (req->proto == YPROTO_BIN)                /* loaded count as value */
+  {
+    ycmd_encode_res(buf, req, err, sizeof(rdone));
+
+    rdone = htole32(done);
+    memcpy(buf->ep, &rdone, sizeof(rdone));
+
+    buf->ep  += sizeof(rdone);
+    buf->fre -= sizeof(rdone);
+  }
+  else 
+  {
+    ycmd_encode_int(buf, err);
+    ycmd_encode_int(buf, done);
+  }
+
+  return (err) ? y_error(err) : 0;
+}
+
+int ycmd_server_process_stats(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  int           len;
+  char          val[2048];
+  ybuf_t       *buf;
+  ynet_stats_t  st;
+
+  ynet_stats_fold();
+  ynet_stats_get(&st);
+
+  len = snprintf(val, sizeof(val), 
+                 "requests %zu reads %zu writes %zu polls %zu parks %zu "
+                 "yields %zu syscalls/request %.3f",
+                 st.requests, st.reads, st.writes, st.polls, st.parks,
+                 st.yields,
+                 (st.requests) ? 
+                   (double)(st.reads + st.writes + st.polls) / st.requests :
+                   0.0);
+
+  if (ynet_sched_nthread)                       /* server threads, if any */
+  {
+    val[len++] = ' ';
+    len += ynet_sched_stats_str(val + len, sizeof(val) - len);
+  }
+
+  if (ycmd_out_reserve(ctx, len + 2) != 0)
+    return -1;
+
+  buf = ctx->out->buf;
+
+  ycmd_encode_res(buf, req, 0, len);
+
+  memcpy(buf->ep, val, len);
+
+  buf->ep  += len;
+  buf->fre -= len;
+
+  ycmd_out_sfx(ctx, req);
+
+  return 0;
+}
+
+/**
+ * PING, with a message it is echoed back.
+ */
+int ycmd_server_process_ping(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  ybuf_t *buf;
+
+  if (req->key.len == 0)
+    return ycmd_out_ret(ctx, req, 0);
+
+  if (ycmd_out_reserve(ctx, req->key.len + 2) != 0)
+    return -1;
+
+  buf = ctx->out->buf;
+
+  ycmd_encode_res(buf, req, 0, req->key.len);
+
+  memcpy(buf->ep, req->key.str, req->key.len);
+
+  buf->ep  += req->key.len;
+  buf->fre -= req->key.len;
+
+  ycmd_out_sfx(ctx, req);
+
+  return 0;
+}
+
+/**
+ * Execute a decoded request.
+ */
+static int ycmd_server_exec(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_exec : cmd = %d : proto = %d\n", 
+             req->cmd, req->proto);
+
+  ynet_tstats.requests++;
+
+  switch (req->cmd)
+  {
+    case CMD_GET:
+      return ycmd_server_process_get(ctx, req);
+
+    case CMD_SET:
+      return ycmd_server_process_set(ctx, req);
+
+    case CMD_SELECT:
+      return ycmd_server_process_select(ctx, req);
+
+    case CMD_FLUSH:
+      return ycmd_server_process_flush(ctx, req);
+
+    case CMD_BULK:
+      return ycmd_server_process_bulk(ctx, req);
+
+    case CMD_STATS:
+      return ycmd_server_process_stats(ctx, req);
+
+    case CMD_PING:
+      return ycmd_server_process_ping(ctx, req);
+
+    case CMD_QUIT:                            /* peer closes after reply */
+      return ycmd_out_ret(ctx, req, 0);
+  }
+
+  return ycmd_out_ret(ctx, req, y_error(EINVAL));
+}
+
+/**
+ * Execute a request on a lane. Refer ycommand.h for details.
+ */
+int ycmd_server_lane_exec(ycmd_req_t *req, int ns, yhobj_t **obj)
+{
+  int      ret;
+  yhtab_t *ht;
+
+  ynet_tstats.requests++;
+
+  *obj = NULL;
+
+  if ((ht = yns_acq(ns)) == NULL)
+    return EINVAL;
+
+  if (req->cmd == CMD_GET)
+    ret = yhtab_get(obj, ht, req->key.str, req->key.len); /* returned held */
+  else
+    ret = yhtab_set(NULL, ht, req->key.str, req->key.len, 
+                    req->val.str, req->val.len);
+
+  yns_rel(ns);
+
+  return (ret) ? errno : 0;
+}
+
+/**
+ * Respond to a request executed on a lane. Refer ycommand.h for details.
+ */
+int ycmd_server_lane_done(ynet_ctx_t *ctx, ycmd_req_t *req, int err,
+                          yhobj_t *obj)
+{
+  if (ynet_out_get(ctx, ycmd_out_rel) == NULL)
+  {
+    if (obj)
+      yhobj_release(obj);
+
+    return -1;
+  }
+
+  ycmd_out_room(ctx);                        /* write out a full queue */
+
+  if (obj)
+    return ycmd_out_val(ctx, req, obj);
+
+  return ycmd_out_ret(ctx, req, (err) ? y_error(err) : 0);
+}
+
+/**
+ * Whether a request goes to the lanes, binary GET or SET flagged to be
+ * answered out of order, on a connection processed by ynet_conn_process.
+ */
+#define ycmd_mux_route(ctx, req)                                         \
+          (ycmd_mux_submit && ((ctx)->class == YNET_CLASS_MSG) &&        \
+           !(ctx)->async && ((req)->proto == YPROTO_BIN) &&              \
+           ((req)->flags & YBIN_FLAG_MUX) &&                             \
+           (((req)->cmd == CMD_GET) || ((req)->cmd == CMD_SET)))
+
+/**
+ * Execute every complete request in the input buffer. A partial request
+ * at the end is left in the buffer, with the bytes it needs recorded so
+ * that it is not decoded again till they have arrived. If the socket 
+ * doesn't take more output, rest of the requests are held back. So are 
+ * they from the first one that has to wait for requests in flight on 
+ * lanes. A request that can't be decoded ends the input, rest of it is
+ * dropped after an error answer and the connection marked lost.
+ */
+static int ycmd_server_process_buf(ynet_ctx_t *ctx, ybuf_t *in)
+{
+  int         ret;
+  char       *sp;
+  ycmd_req_t  req;
+
+  if (ctx->proto == YPROTO_MC)
+    return ymc_server_process_buf(ctx, in);
+
+  ctx->need = 0;
+  ctx->held = FALSE;
+
+  while (ybuf_rem(in))
+  {
+    if (ycmd_out_room(ctx) != 0)
+    {
+      ctx->held = TRUE;
+      break;
+    }
+
+    sp = in->sp;
+
+    if (ctx->proto == YPROTO_RESP)
+      ret = yresp_decode_req(in, &req);
+    else 
+      ret = ycmd_decode_req(in, &req);
+
+    if (ret == 0)
+    {
+      if (req.cmd == CMD_NONE)            /* empty inline RESP command */
+        continue;
+
+      if (ycmd_mux_route(ctx, &req) && ((*ycmd_mux_submit)(ctx, &req) == 0))
+        continue;
+
+      /* others wait for those in flight, as do flagged ones finding no
+       * room, till some are answered. None in flight, none to order */
+      if (ctx->mux > 0)
+      {
+        in->sp    = sp;
+        ctx->held = TRUE;
+        break;
+      }
+
+      ycmd_server_exec(ctx, &req);
+      continue;
+    }
+
+    if (errno == EAGAIN)
+    {
+      ctx->need = req.need;
+      break;
+    }
+
+    ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process_buf : decode failed : "
+               "%d\n", errno);
+
+    ycmd_out_ret(ctx, &req, ret);
+
+    /* no telling where the next request starts, the error is the last
+     * answer, the connection is closed once it is written */
+    in->sp    = in->ep;
+    ctx->lost = TRUE;
+    break;
+  }
+
+  if (ybuf_rem(in) == 0)
+    ybuf_reset(in);
+
+  return (ctx->lost) ? y_error(EPROTO) : 0;
+}
+
+/**
+ * Process incoming requests of a connection. Refer ycommand.h for details.
+ */
+int ycmd_server_process(ynet_ctx_t *ctx)
+{
+  int         ret = 0;
+  int         rem;
+  ybuf_t     *in;
+
+  if (ctx->ibuf == NULL && (ctx->ibuf = ybuf_get()) == NULL)
+    return y_error(ENOMEM);
+
+  if (ynet_out_get(ctx, ycmd_out_rel) == NULL)
+    return -1;
+
+  in = ctx->ibuf;
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_server_process : enter\n");
+
+  if (ctx->held)                        /* requests held back on output */
+    ycmd_server_process_buf(ctx, in);
+
+  while (!ctx->held && !ctx->lost) /* edge triggered, read till nothing */
+  {
+    if (ctx->quota == 0)            /* used up this pass, caller requeues */
+      break;
+
+    rem = ybuf_rem(in);
+
+    /* room for rest of a known partial request, or at least a chunk */
+    if ((ret = ybuf_reserve(in, max(ctx->need - rem, YCMD_READ_MIN))) != 0)
+      break;
+
+    if ((ret = ynet_recv(ctx, in)) != 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        ret = 0;
+
+      break;
+    }
+
+    if (ybuf_rem(in) == rem)                           /* peer closed */
+      break;
+
+    if (ctx->quota > 0)
+      ctx->quota = max(ctx->quota - (ybuf_rem(in) - rem), 0);
+
+    if (ybuf_rem(in) < ctx->need)                /* still incomplete */
+      continue;
+
+    if ((ret = ycmd_server_process_buf(ctx, in)) != 0)
+      break;
+  }
+
+  /* idle connections don't hold input, output is written by caller */
+  if (ybuf_rem(in) == 0)
+  {
+    ybuf_put(ctx->ibuf);
+    ctx->ibuf = NULL;
+  }
+
+  return ret;
+}
+
+/**
+ * Process input delivered by the caller. Refer ycommand.h for details.
+ */
+int ycmd_server_input(ynet_ctx_t *ctx, char *ptr, int len, int exec)
+{
+  int         ret = 0;
+  ybuf_t      view;
+  ybuf_t     *in  = ctx->ibuf;
+
+  if (ctx->lost)                         /* nothing after it is decoded */
+    return y_error(EPROTO);
+
+  if (ynet_out_get(ctx, ycmd_out_rel) == NULL)
+    return -1;
+
+  /* nothing pending, execute straight from the caller's memory */
+  if (exec && len && (in == NULL || ybuf_rem(in) == 0))
+  {
+    ybuf_view(&view, ptr, len, len);
+
+    ycmd_server_process_buf(ctx, &view);
+
+    ptr = view.sp;                          /* partial or held requests */
+    len = ybuf_rem(&view);
+    exec = FALSE;
+  }
+
+  if (len)
+  {
+    if (in == NULL && (in = ctx->ibuf = ybuf_get()) == NULL)
+      return y_error(ENOMEM);
+
+    if ((ret = ybuf_reserve(in, len)) != 0)
+      return ret;
+
+    memcpy(in->ep, ptr, len);
+    in->ep  += len;
+    in->fre -= len;
+  }
+
+  if (in && exec && ybuf_rem(in) >= ctx->need)
+    ycmd_server_process_buf(ctx, in);
+
+  if (in && ybuf_rem(in) == 0)
+  {
+    ybuf_put(ctx->ibuf);
+    ctx->ibuf = NULL;
+  }
+
+  return (ctx->lost) ? y_error(EPROTO) : ret;
+}
+
+#define ycmd_is_ws(c) ((c) == ' ' || (c) == '\n')
+
+static inline void ycmd_token_skip_ws(ybuf_t *buf)
+{
+  int   ind;
+  int   rem = ybuf_rem(buf);
+  char *cp  = buf->sp;
+
+  for (ind = 0; (ind < rem) && ycmd_is_ws(cp[ind]); ind++);
+
+  buf->sp  += ind;
+}
+
+static inline int ycmd_token_get(ybuf_t *buf, ytoken_t *tok, int consume)
+{
+  int   ind;
+  int   rem;
+  char *cp;
+
+  ycmd_token_skip_ws(buf);
+
+  rem = ybuf_rem(buf);
+
+  if (!rem)
+    return -1;
+
+  cp  = buf->sp;
+
+  for (ind = 0; (ind < rem) && !ycmd_is_ws(cp[ind]); ind++);
+
+  tok->len = ind;
+  tok->str = buf->sp;
+
+  if (consume)
+    buf->sp  += ind;
+
+  return 0;
+}
+
+/**
+ * Send a request, the value is sent by reference.
+ */
+static int ycmd_client_send_req(ynet_ctx_t *sctx, ycmd_req_t *req)
+{
+  int    ret;
+  int    cnt = 1;
+  ybuf_t sbuf;
+  struct iovec iov[3];
+  static char suffix = CMD_SUFFIX_1;
+  static __thread uint32_t rid;
+
+  ybuf_init(&sbuf);
+
+  req->proto = sctx->proto;
+  req->rid   = ++rid;
+
+  if ((ret = ycmd_encode_hdr(&sbuf, req)) != 0)
+    return ret;
+
+  ycmd_ybuf_dump(YTRACE_LEVEL1, "ycmd_client_send_req", &sbuf, TRUE); 
+
+  iov[0].iov_base = sbuf.sp;
+  iov[0].iov_len  = ybuf_rem(&sbuf);
+
+  if (req->val.len > 0)
+  {
+    iov[cnt].iov_base = req->val.str;
+    iov[cnt].iov_len  = req->val.len;
+    cnt++;
+  }
+
+  if (req->proto == YPROTO_TEXT && req->cmd == CMD_SET)
+  {
+    iov[cnt].iov_base = &suffix;
+    iov[cnt].iov_len  = 1;
+    cnt++;
+  }
+
+  return ynet_sendv(sctx, iov, cnt);
+}
+
+/**
+ * Receive a binary protocol response. Value is copied to 'val', '*vlen'
+ * being its capacity. Part of the value which doesn't fit is discarded
+ * and E2BIG returned. Returns -1 with errno set to the status sent by 
+ * server on failure.
+ */
+static int ycmd_client_recv_bin(ynet_ctx_t *sctx, char *val, int *vlen)
+{
+  int        ret;
+  int        rem;
+  int        pos;
+  int        cnt;
+  int        len;
+  int        cap = (val) ? *vlen : 0;
+  char       tmp[MSG_MAX];
+  ybuf_t     rbuf;
+  ybin_hdr_t hdr;
+
+  ybuf_init(&rbuf);
+
+  while ((rem = ybuf_rem(&rbuf)) < YBIN_HDR_LEN)
+  {
+    if ((ret = ynet_recv(sctx, &rbuf)) != 0)
+      return ret;
+
+    if (ybuf_rem(&rbuf) == rem)                          /* peer went away */
+      return y_error(ECONNRESET);
+  }
+
+  ybin_hdr_decode(rbuf.sp, &hdr);
+
+  rbuf.sp += YBIN_HDR_LEN;
+
+  if (hdr.magic != YBIN_MAGIC_RES)
+    return y_error(EPROTO);
+
+  len = hdr.vlen;
+  cap = min(cap, len);
+  rem = min(ybuf_rem(&rbuf), len);
+
+  if (cap)
+    memcpy(val, rbuf.sp, min(rem, cap));
+
+  if (rem < cap && (ret = ynet_recv_full(sctx, val + rem, cap - rem)) != 0)
+    return ret;
+
+  for (pos = (rem > cap) ? rem : cap; pos < len; pos += cnt) /* discard */
+  {
+    cnt = min(len - pos, sizeof(tmp));
+
+    if ((ret = ynet_recv_full(sctx, tmp, cnt)) != 0)
+      return ret;
+  }
+
+  if (val)
+    *vlen = cap;
+
+  if (hdr.flags)
+    return y_error(hdr.flags);
+
+  return (len > cap && val) ? y_error(E2BIG) : 0;
+}
+
+/**
+ * Receive a result only response. Returns 0 or -1 with errno set to 
+ * the error code sent by server.
+ */
+static int ycmd_client_recv_ret(ynet_ctx_t *sctx)
+{
+  ybuf_t rbuf;
+  int    ret;
+  int    cret;
+
+  if (sctx->proto == YPROTO_BIN)
+    return ycmd_client_recv_bin(sctx, NULL, NULL);
+
+  ybuf_init(&rbuf);
+
+  if ((ret = ynet_recv(sctx, &rbuf)) != 0)
+    return ret;
+
+  if ((ret = ycmd_decode_int(&rbuf, &cret)) != 0)
+    return ret;
+
+  return (cret) ? y_error(cret) : 0;
+}
+
+int ycmd_client_process_set(ynet_ctx_t *sctx, char *key, int klen, char *val, int vlen, int expiry)
+{
+  int        ret;
+  ycmd_req_t req = { .cmd = CMD_SET, .key = { klen, key }, 
+                     .val = { vlen, val } };
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_set : key = [%.*s] val = [%.*s]\n", klen, key, vlen, val);
+
+  if ((ret = ycmd_client_send_req(sctx, &req)) != 0)
+    return ret;
+
+  return ycmd_client_recv_ret(sctx);
+}
+
+int ycmd_client_process_select(ynet_ctx_t *sctx, char *name, int len)
+{
+  int        ret;
+  ycmd_req_t req = { .cmd = CMD_SELECT, .key = { len, name } };
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_select : ns = [%.*s]\n",
+             len, name);
+
+  if ((ret = ycmd_client_send_req(sctx, &req)) != 0)
+    return ret;
+
+  return ycmd_client_recv_ret(sctx);
+}
+
+int ycmd_client_process_flush(ynet_ctx_t *sctx)
+{
+  int        ret;
+  ycmd_req_t req = { .cmd = CMD_FLUSH };
+
+  if ((ret = ycmd_client_send_req(sctx, &req)) != 0)
+    return ret;
+
+  return ycmd_client_recv_ret(sctx);
+}
+
+int ycmd_client_process_bulk(ynet_ctx_t *sctx, char *data, int len, int cnt)
+{
+  ybuf_t     rbuf;
+  int        ret;
+  int        cret;
+  int        done;
+  int        dlen = sizeof(uint32_t);
+  uint32_t   rdone = 0;
+  ycmd_req_t req = { .cmd = CMD_BULK, .cnt = cnt, .val = { len, data } };
+
+  if ((ret = ycmd_client_send_req(sctx, &req)) != 0)
+    return ret;
+
+  if (sctx->proto == YPROTO_BIN)
+  {
+    if ((ret = ycmd_client_recv_bin(sctx, (char *)&rdone, &dlen)) != 0)
+      return ret;
+
+    return le32toh(rdone);
+  }
+
+  ybuf_init(&rbuf);
+
+  if ((ret = ynet_recv(sctx, &rbuf)) != 0)
+    return ret;
+
+  if ((ret = ycmd_decode_int(&rbuf, &cret)) != 0)
+    return ret;
+
+  if ((ret = ycmd_decode_int(&rbuf, &done)) != 0)
+    return ret;
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_bulk : %d of %d (%d)\n",
+             done, cnt, cret);
+
+  return (cret) ? y_error(cret) : done;
+}
+
+/**
+ * Decode response. Refer ycommand.h for details.
+ */
+int ycmd_decode_res(ybuf_t *buf, ycmd_req_t *req, int *err)
+{
+  int        ret = 0;
+  char      *start = buf->sp;
+  size_t     len;
+  uint32_t   cnt;
+  ybin_hdr_t hdr;
+
+  req->need    = 0;
+  req->val.str = NULL;
+  req->val.len = 0;
+
+  if (req->proto == YPROTO_BIN)
+  {
+    if (ybuf_rem(buf) < YBIN_HDR_LEN)
+    {
+      req->need = YBIN_HDR_LEN;
+      return y_error(EAGAIN);
+    }
+
+    ybin_hdr_decode(buf->sp, &hdr);
+
+    if (hdr.magic != YBIN_MAGIC_RES)
+      return y_error(EPROTO);
+
+    if (hdr.vlen > YCMD_BULK_MAX)
+      return y_error(E2BIG);
+
+    len = YBIN_HDR_LEN + (size_t)hdr.klen + hdr.vlen;
+
+    if (ybuf_rem(buf) < len)
+    {
+      req->need = len;
+      return y_error(EAGAIN);
+    }
+
+    *err         = hdr.flags;
+    req->rid     = hdr.rid;
+    req->val.str = buf->sp + YBIN_HDR_LEN + hdr.klen;
+    req->val.len = hdr.vlen;
+
+    if (req->cmd == CMD_BULK && hdr.vlen == sizeof(cnt))
+    {
+      memcpy(&cnt, req->val.str, sizeof(cnt));
+      req->cnt = le32toh(cnt);
+    }
+
+    buf->sp += len;
+
+    return 0;
+  }
+
+  if ((ret = ycmd_decode_int(buf, err)) == 0)
+  {
+    if ((req->cmd == CMD_GET || req->cmd == CMD_STATS) && *err == 0)
+    {
+      ret = ycmd_decode_str(buf, &req->val);
+
+      if (ret != 0 && errno == EAGAIN && req->val.len >= 0)
+      {
+        if (req->val.len > YCMD_BULK_MAX)
+          return y_error(E2BIG);
+
+        req->need = (buf->sp - start) + req->val.len + 3;
+      }
+    }
+    else if (req->cmd == CMD_BULK)
+      ret = ycmd_decode_int(buf, &req->cnt);
+  }
+
+  if (ret != 0 && errno == EAGAIN)
+    buf->sp = start;
+
+  return ret;
+}
+
+int ycmd_client_process_pipe(ynet_ctx_t *sctx, char *data, int len, 
+                             int *cmds, int cnt, ycmd_res_cb_t cb, void *arg)
+{
+  int          ret;
+  int          ind;
+  int          err;
+  int          rem;
+  int          done = 0;
+  char        *mem  = NULL;
+  char        *nmem;
+  ybuf_t       rbuf;
+  ycmd_req_t   res;
+  struct iovec iov;
+
+  iov.iov_base = data;
+  iov.iov_len  = len;
+
+  if ((ret = ynet_sendv(sctx, &iov, 1)) != 0)          /* all in one write */
+    return ret;
+
+  ybuf_init(&rbuf);
+
+  for (ind = 0; ind < cnt; )
+  {
+    res.proto = sctx->proto;
+    res.cmd   = cmds[ind];
+
+    if ((ret = ycmd_decode_res(&rbuf, &res, &err)) == 0)
+    {
+      /* binary ones carry their index, maybe answered out of order */
+      if (cb)
+        (*cb)(arg, ((res.proto == YPROTO_BIN) && (res.rid < cnt)) ? 
+                   (int)res.rid : ind, err, res.val.str, res.val.len);
+
+      if (err == 0)
+        done++;
+
+      ind++;
+      continue;
+    }
+
+    if (errno != EAGAIN)
+      break;
+
+    ybuf_compact(&rbuf);
+
+    rem = ybuf_rem(&rbuf);
+
+    if (res.need > rbuf.max)                /* larger than the buffer */
+    {
+      if ((nmem = (char *)malloc(res.need)) == NULL)
+      {
+        ret = y_error(ENOMEM);
+        break;
+      }
+
+      memcpy(nmem, rbuf.sp, rem);
+
+      ybuf_view(&rbuf, nmem, rem, res.need);
+
+      free(mem);
+      mem = nmem;
+    }
+
+    if ((ret = ynet_recv(sctx, &rbuf)) != 0)
+      break;
+
+    if (ybuf_rem(&rbuf) == rem)
+    {
+      ret = y_error(ECONNRESET);
+      break;
+    }
+
+    ret = 0;
+  }
+
+  free(mem);
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_pipe : %d of %d : ret = %d\n",
+             done, cnt, ret);
+
+  return (ret) ? ret : done;
+}
+
+/**
+ * Receive a string of given length, of which the remaining part of 'rbuf'
+ * is the beginning. Values larger than the receive buffer are read 
+ * directly into 'val'. '*vlen' is the capacity of 'val' if not zero, the
+ * part which doesn't fit is discarded and E2BIG returned.
+ */
+static int ycmd_client_recv_str(ynet_ctx_t *sctx, ybuf_t *rbuf, int len,
+                                char *val, int *vlen)
+{
+  int   ret;
+  int   rem;
+  int   pos;
+  int   cnt;
+  int   cap = (*vlen > 0) ? *vlen : len;
+  char  tmp[MSG_MAX];
+  char *cp;
+
+  if ((rem = ybuf_rem(rbuf)) < 2)    /* make sure prefix is in the buffer */
+  {
+    if ((ret = ynet_recv_full(sctx, rbuf->ep, 2 - rem)) != 0)
+      return ret;
+
+    rbuf->ep  += 2 - rem;
+    rbuf->fre -= 2 - rem;
+  }
+
+  cp = rbuf->sp;
+
+  if (cp[0] != CMD_PREFIX_1 || cp[1] != CMD_PREFIX_2)
+    return y_error(EINVAL);
+
+  rbuf->sp += 2;
+
+  cp    = rbuf->sp;
+  rem   = ybuf_rem(rbuf);
+  *vlen = min(len, cap);
+
+  if (rem > len)                              /* complete in the buffer */
+  {
+    memcpy(val, cp, *vlen);
+
+    if (cp[len] != CMD_SUFFIX_1)
+      return y_error(EINVAL);
+
+    return (len > cap) ? y_error(E2BIG) : 0;
+  }
+
+  memcpy(val, cp, min(rem, *vlen));
+
+  for (pos = rem; pos < *vlen; pos += cnt)
+  {
+    cnt = *vlen - pos;
+
+    if ((ret = ynet_recv_full(sctx, val + pos, cnt)) != 0)
+      return ret;
+  }
+
+  for (cnt = 0; pos < len + 1; pos += cnt)   /* discard rest and suffix */
+  {
+    cnt = min(len + 1 - pos, sizeof(tmp));
+
+    if ((ret = ynet_recv_full(sctx, tmp, cnt)) != 0)
+      return ret;
+  }
+
+  if (tmp[cnt - 1] != CMD_SUFFIX_1)
+    return y_error(EINVAL);
+
+  return (len > cap) ? y_error(E2BIG) : 0;
+}
+
+/**
+ * Receive a response carrying a value, copied to 'val'. '*vlen' is the
+ * capacity of 'val', 0 if unknown.
+ */
+static int ycmd_client_recv_val(ynet_ctx_t *sctx, char *val, int *vlen)
+{
+  ybuf_t     rbuf;
+  int        ret;
+  int        cret;
+  int        len;
+
+  if (sctx->proto == YPROTO_BIN)
+  {
+    if (*vlen <= 0)
+      *vlen = INT_MAX;                       /* no capacity, same as text */
+
+    return ycmd_client_recv_bin(sctx, val, vlen);
+  }
+
+  ybuf_init(&rbuf);
+
+  if ((ret = ynet_recv(sctx, &rbuf)) != 0)
+    return ret;
+
+  ycmd_ybuf_dump(YTRACE_LEVEL1, "ycmd_client_recv_val", &rbuf, TRUE);  
+
+  if ((ret = ycmd_decode_int(&rbuf, &cret)) != 0)
+    return ret;
+
+  if (cret != 0)
+    return y_error(cret);
+
+  if ((ret = ycmd_decode_int(&rbuf, &len)) != 0)
+    return ret;
+
+  return ycmd_client_recv_str(sctx, &rbuf, len, val, vlen);
+}
+
+int ycmd_client_process_get(ynet_ctx_t *sctx, char *key, int klen, char *val, int *vlen)
+{
+  int        ret;
+  ycmd_req_t req = { .cmd = CMD_GET, .key = { klen, key } };
+
+  ytrace_msg(YTRACE_LEVEL1, "ycmd_client_process_get : key = [%.*s]\n", klen, key);
+
+  if ((ret = ycmd_client_send_req(sctx, &req)) != 0)
+    return ret;
+
+  return ycmd_client_recv_val(sctx, val, vlen);
+}
+
+int ycmd_client_process_stats(ynet_ctx_t *sctx, char *val, int *vlen)
+{
+  int        ret;
+  ycmd_req_t req = { .cmd = CMD_STATS };
+
+  if ((ret = ycmd_client_send_req(sctx, &req)) != 0)
+    return ret;
+
+  return ycmd_client_recv_val(sctx, val, vlen);
+}
+
+int ycmd_client_process(ynet_ctx_t *sctx, ybuf_t *buf)
+{
+  ycmd_t    cmn;
+  ybuf_t    out;
+  ytoken_t  cmd;
+  ytoken_t  key;
+  ytoken_t  val;
+  int      len = 0;
+  int      ret = y_error(EINVAL);
+
+  if (ycmd_token_get(buf, &cmd, TRUE) < 0)
+  {
+    printf("ERROR : unknown command [%.*s]\n", (int)ybuf_rem(buf), buf->sp);
+    return 0;
+  }
+
+  /* ycmd_ybuf_dump("ycmd_client_process_2", buf); */
+  /* ycmd_token_dump("cmd", &cmd); */
+
+  cmn = ycmd_get_ycmd_id(&cmd);
+
+  if (cmn == CMD_QUIT)
+    return y_error(EINVAL);
+
+  ybuf_init(&out);
+
+  switch (cmn)
+  {
+    case CMD_GET:
+    {
+      if (ycmd_token_get(buf, &key, TRUE) < 0)
+        break;
+      
+      len = sizeof(out.buf);
       ret = ycmd_client_process_get(sctx, key.str, key.len, out.buf, &len);
 
       break;
@@ -562,6 +1861,28 @@ int ycmd_client_process(ynet_ctx_t *sctx, ybuf_t *buf)
       
       ret = ycmd_client_process_set(sctx, key.str, key.len, val.str, val.len, 0);
 
+      break;
+    }
+    case CMD_SELECT:
+    {
+      if (ycmd_token_get(buf, &key, TRUE) < 0)
+        break;
+      
+      ret = ycmd_client_process_select(sctx, key.str, key.len);
+
+      break;
+    }
+    case CMD_FLUSH:
+    {
+      ret = ycmd_client_process_flush(sctx);
+
+      break;
+    }
+    case CMD_STATS:
+    {
+      len = sizeof(out.buf);
+      ret = ycmd_client_process_stats(sctx, out.buf, &len);
+
       break;
     }
   }
@@ -634,3 +1955,58 @@ int ycmd_client_process(ynet_ctx_t *sctx, ybuf_t *buf)
 
   return 0;
 }
+
+#ifdef TEST_CMD
+
+/*
+ * Standalone test, build with
+ *   gcc -DTEST_CMD -I. ycommand.c ynet.c yshm.c yresp.c ymc.c yhash.c yns.c
+ *       ynuma.c xxhash.c ylock.c ytrace.c ycommon.c -lpthread
+ */
+
+/*
+ * Decode a text request, expecting 'err' (0 for success).
+ */
+static int test_decode(char *str, int err)
+{
+  int         ret;
+  ybuf_t      buf;
+  ycmd_req_t  req;
+
+  ybuf_init(&buf);
+
+  memcpy(buf.ep, str, strlen(str));
+  buf.ep  += strlen(str);
+  buf.fre -= strlen(str);
+
+  memset(&req, 0, sizeof(req));
+
+  ret = (ycmd_decode_req(&buf, &req) == 0) ? 0 : errno;
+
+  printf("%s : [%s] : %d, expected %d\n", (ret == err) ? "PASS" : "FAIL",
+         str, ret, err);
+
+  return (ret == err) ? 0 : -1;
+}
+
+int main()
+{
+  int ret = 0;
+
+  ret |= test_decode("#:1~#:3~#:abc~", 0);
+  ret |= test_decode("#:1~#:1000~#:abc~", EAGAIN);
+  ret |= test_decode("#:1~#:999999999~#:abc~", E2BIG);
+
+  /* lengths past an int, wrapping negative, are refused */
+  ret |= test_decode("#:1~#:3000000000~#:abc~", EINVAL);
+  ret |= test_decode("#:1~#:4294967299~#:abc~", EINVAL);
+  ret |= test_decode("#:1~#:99999999999999999999~#:abc~", EINVAL);
+  ret |= test_decode("#:3000000001~#:3~#:abc~", EINVAL);
+
+  /* an unknown command is refused, not skipped to the end */
+  ret |= test_decode("#:77~#:3~#:abc~#:1~#:3~#:abc~", EINVAL);
+
+  return ret;
+}
+
+#endif
@@ -20,11 +20,246 @@
 #define _YCOMMAND_H
 
 #include <ynet.h>
+#include <ybin.h>
+#include <yhash.h>
 
+/**
+ * Bulk load payload is a stream of records, each a pair of native 32 bit
+ * key and value lengths followed by key and value bytes.
+ */
+#define YCMD_BULK_HDR  (2 * sizeof(uint32_t))         /**< record header */
+#define YCMD_BULK_MAX  (256 * 1024 * 1024)      /**< max payload per batch */
+
+/**
+ * Number of parallel workers used by a bulk load on server.
+ */
+extern int ycmd_bulk_workers;
+
+/**
+ * Token, a string which is not necessarily null terminated.
+ */
+struct ytoken_t
+{
+  int   len;
+  char *str;
+};
+typedef struct ytoken_t ytoken_t;
+
+/**
+ * @struct ycmd_req_t
+ *
+ * @brief  Request decoded from either wire protocol. Key and value refer
+ *         to the buffer the request was decoded from.
+ */
+struct ycmd_req_t
+{
+  int       proto;                                      /* YPROTO_* */
+  int       cmd;                                           /* CMD_* */
+  int       flags;                             /* binary header flags */
+  uint32_t  rid;                               /* request id, binary */
+  int       cnt;                                /* record count, bulk */
+  int       need;        /* bytes needed for whole request, incomplete */
+  ytoken_t  key;
+  ytoken_t  val;
+};
+typedef struct ycmd_req_t ycmd_req_t;
+
+/**
+ * @brief Decode one request from buffer. Protocol is detected from first
+ *        byte, YBIN_MAGIC_REQ for binary and text otherwise.
+ *
+ * @param buf - buffer, consumed past the request on success
+ * @param req - decoded request
+ *
+ * @return 0 on success, -1 on failure with errno set. EAGAIN if request
+ *         is incomplete, with nothing consumed and req->need set to the 
+ *         total length if already known.
+ */
+int ycmd_decode_req(ybuf_t *buf, ycmd_req_t *req);
+
+/**
+ * @brief Encode a request except for its value (and the text suffix), 
+ *        for the value to be sent by reference.
+ *
+ * @param buf - buffer to append to
+ * @param req - request, with proto, cmd, key, value length (and cnt)
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_encode_hdr(ybuf_t *buf, ycmd_req_t *req);
+
+/**
+ * @brief Encode a whole request.
+ *
+ * @param buf - buffer to append to
+ * @param req - request
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_encode_req(ybuf_t *buf, ycmd_req_t *req);
+
+/**
+ * @brief Encode response to a request except for its value. For the text
+ *        protocol the value has to be followed by CMD_SUFFIX ('~').
+ *
+ * @param buf  - buffer to append to
+ * @param req  - request responded to
+ * @param err  - status, errno value or 0
+ * @param vlen - length of value, -1 for result only response
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_encode_res(ybuf_t *buf, ycmd_req_t *req, int err, int vlen);
+
+/**
+ * @brief Decode one response from buffer.
+ *
+ * @param buf - buffer, consumed past the response on success
+ * @param req - proto and cmd of the request responded to on input, value
+ *              (GET), loaded count (BULK) and need are set on output
+ * @param err - status sent by server
+ *
+ * @return 0 on success, -1 on failure with errno set. EAGAIN if response
+ *         is incomplete, with nothing consumed.
+ */
+int ycmd_decode_res(ybuf_t *buf, ycmd_req_t *req, int *err);
+
+/**
+ * Called for every response of a pipeline, with its index, status and
+ * value (GET). Value is valid only during the call.
+ */
+typedef int (*ycmd_res_cb_t)(void *arg, int ind, int err, char *val, int vlen);
+
+/**
+ * @brief Make sure the connection output queue can take one more request,
+ *        writing it out once it holds enough. Called before decoding 
+ *        each request.
+ *
+ * @param ctx - network context of the connection
+ *
+ * @return 0 if there is room, EAGAIN if the socket doesn't take more and
+ *         the request has to be held back.
+ */
+int ycmd_out_room(ynet_ctx_t *ctx);
+
+/**
+ * @brief Make room in the output buffer for a response header plus 'len'
+ *        more bytes.
+ *
+ * @param ctx - network context of the connection
+ * @param len - bytes needed beyond a response header
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_out_reserve(ynet_ctx_t *ctx, int len);
+
+#define YCMD_OUT_COPY_MAX  (128)            /**< values copied, not referred */
+
+/**
+ * @brief Bytes of a value ycmd_out_data is to copy rather than refer to.
+ *
+ * @param ctx - network context of the connection
+ * @param len - value length
+ *
+ * @return Value length if copied, 0 if referred.
+ */
+int ycmd_out_copy_len(ynet_ctx_t *ctx, int len);
+
+/**
+ * @brief Add a value to the response being built. Values upto 
+ *        YCMD_OUT_COPY_MAX bytes are copied, as are larger ones when the
+ *        output queue runs short of entries. Room for what is copied 
+ *        (ycmd_out_copy_len) has to be reserved by the caller along with
+ *        the response header, before encoding it, so that a response is
+ *        never left without its value. Others are queued by reference 
+ *        and 'obj' held till written. Either way the caller's hold on 
+ *        'obj' is taken over.
+ *
+ * @param ctx - network context of the connection
+ * @param ptr - value
+ * @param len - value length
+ * @param obj - object the value belongs to, held
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_out_data(ynet_ctx_t *ctx, char *ptr, int len, yhobj_t *obj);
+
+/**
+ * @brief Process incoming requests of a connection. Reads till the socket
+ *        has nothing more, executing every complete request. Responses
+ *        are queued in ctx->out, to be written by the caller through
+ *        ynet_out_flush. Requests are held back (ctx->held) while the
+ *        socket doesn't take more output; call again once it is drained.
+ *        Reading also stops once ctx->quota bytes are read, leaving it 0,
+ *        for the caller to process the connection again later. Requests
+ *        waiting on those in flight on lanes (ctx->mux) are held back as
+ *        well, to be resumed as those are answered. A request that can't
+ *        be decoded is answered with an error and nothing after it is
+ *        read (ctx->lost); the caller closes once the error is written.
+ *
+ * @param ctx - network context of the connection
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
 int ycmd_server_process(ynet_ctx_t *ctx);
+
+/**
+ * @brief Process input of a connection received by the caller, for 
+ *        backends reading on their own (io_uring). Complete requests are
+ *        executed straight from 'ptr' when nothing is pending, the rest is
+ *        copied to ctx->ibuf. Responses are queued as ycmd_server_process.
+ *        Fails with EPROTO once a request can't be decoded (ctx->lost).
+ *
+ * @param ctx  - network context of the connection
+ * @param ptr  - received bytes, NULL to resume held requests
+ * @param len  - number of bytes
+ * @param exec - FALSE to only queue the input, while output is in flight
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_server_input(ynet_ctx_t *ctx, char *ptr, int len, int exec);
+
+/**
+ * Queues binary requests flagged YBIN_FLAG_MUX to the lanes (ymux.h), set
+ * by the server when it starts them. Its requests are counted in ctx->mux
+ * till answered through ycmd_server_lane_done. NULL executes every 
+ * request in order.
+ */
+extern int (*ycmd_mux_submit)(ynet_ctx_t *ctx, ycmd_req_t *req);
+
+/**
+ * @brief Execute a GET or SET request on a lane, away from its connection.
+ *
+ * @param req - request
+ * @param ns  - namespace selected by the connection when it was queued
+ * @param obj - value of a GET, returned held
+ *
+ * @return 0 on success, errno value on failure.
+ */
+int ycmd_server_lane_exec(ycmd_req_t *req, int ns, yhobj_t **obj);
+
+/**
+ * @brief Respond to a request executed on a lane, by the thread 
+ *        processing its connection.
+ *
+ * @param ctx - network context of the connection
+ * @param req - request
+ * @param err - status returned by ycmd_server_lane_exec
+ * @param obj - value of a GET, held, taken over
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ycmd_server_lane_done(ynet_ctx_t *ctx, ycmd_req_t *req, int err,
+                          yhobj_t *obj);
 int ycmd_client_process(ynet_ctx_t *sctx, ybuf_t *buf);
 
 int ycmd_client_process_set(ynet_ctx_t *sctx, char *key, int klen, char *val, int vlen, int expiry);
 int ycmd_client_process_get(ynet_ctx_t *sctx, char *key, int klen, char *val, int *vlen);
+int ycmd_client_process_select(ynet_ctx_t *sctx, char *name, int len);
+int ycmd_client_process_flush(ynet_ctx_t *sctx);
+int ycmd_client_process_bulk(ynet_ctx_t *sctx, char *data, int len, int cnt);
+int ycmd_client_process_stats(ynet_ctx_t *sctx, char *val, int *vlen);
+int ycmd_client_process_pipe(ynet_ctx_t *sctx, char *data, int len, 
+                             int *cmds, int cnt, ycmd_res_cb_t cb, void *arg);
 
 #endif /* ycommand.h */
@@ -18,6 +18,7 @@
 #include <sys/time.h>
 
 #include <ycommon.h>
+#include <ylock.h>
 
 __thread int ythread_myind;
 
@@ -29,3 +30,169 @@ size_t ytime_get(void)
 
   return (tval.tv_sec * 1000000 + tval.tv_usec);
 }
+
+/**
+ * Get object of a descriptor. Refer ycommon.h for details.
+ */
+void * yfd_get(yfd_tab_t *tab, int fd, int create)
+{
+  char  *leaf;
+  char  *nleaf;
+  void **slot;
+
+  if ((fd < 0) || (fd >= YFD_ROOT * YFD_LEAF))
+  {
+    y_error(EMFILE);
+    return NULL;
+  }
+
+  slot = &tab->leaf[fd >> YFD_LEAF_BITS];
+  leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+  if (!leaf && create)
+  {
+    if ((nleaf = calloc(YFD_LEAF, tab->size)) == NULL)
+    {
+      y_error(ENOMEM);
+      return NULL;
+    }
+
+    /* threads accepting into the same range race, one leaf wins */
+    if (__atomic_compare_exchange_n(slot, (void **)&leaf, nleaf, FALSE,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      leaf = nleaf;
+    else
+      free(nleaf);
+  }
+
+  if (!leaf)
+  {
+    y_error(ENOENT);
+    return NULL;
+  }
+
+  return leaf + (fd & (YFD_LEAF - 1)) * tab->size;
+}
+
+/**
+ * Allocate leaves upfront. Refer ycommon.h for details.
+ */
+int yfd_reserve(yfd_tab_t *tab, int nfd)
+{
+  int    ind;
+  char  *leaf;
+  void  *none;
+
+  if ((nfd < 0) || (nfd > YFD_ROOT * YFD_LEAF))
+    return y_error(EMFILE);
+
+  for (ind = 0; ind < (nfd + YFD_LEAF - 1) >> YFD_LEAF_BITS; ind++)
+  {
+    if (__atomic_load_n(&tab->leaf[ind], __ATOMIC_ACQUIRE))
+      continue;
+
+    if ((leaf = malloc(YFD_LEAF * tab->size)) == NULL)
+      return y_error(ENOMEM);
+
+    memset(leaf, 0, YFD_LEAF * tab->size);    /* zeroed, pages faulted in */
+
+    none = NULL;
+
+    if (!__atomic_compare_exchange_n(&tab->leaf[ind], &none, leaf, FALSE,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      free(leaf);
+  }
+
+  return 0;
+}
+
+/**
+ * Buffer pool.
+ */
+static ybuf_t  *ybuf_pool;                                 /* free buffers */
+static int      ybuf_pool_cnt;                     /* buffers in free list */
+static ylock_t  ybuf_pool_lock;
+
+/**
+ * Get buffer. Refer ycommon.h for details.
+ */
+ybuf_t * ybuf_get(void)
+{
+  ybuf_t *buf;
+
+  ylock_acq(&ybuf_pool_lock, YLOCK_EXCL);
+
+  if ((buf = ybuf_pool) != NULL)
+  {
+    ybuf_pool = buf->next;
+    ybuf_pool_cnt--;
+  }
+
+  ylock_rel(&ybuf_pool_lock, YLOCK_EXCL);
+
+  if ((buf == NULL) && ((buf = (ybuf_t *)malloc(sizeof(ybuf_t))) == NULL))
+    return NULL;
+
+  ybuf_init(buf);
+
+  return buf;
+}
+
+/**
+ * Put buffer. Refer ycommon.h for details.
+ */
+void ybuf_put(ybuf_t *buf)
+{
+  if (buf == NULL)
+    return;
+
+  if (buf->bp != buf->buf)                                       /* grown */
+    free(buf->bp);
+
+  ylock_acq(&ybuf_pool_lock, YLOCK_EXCL);
+
+  if (ybuf_pool_cnt < YBUF_POOL_MAX)
+  {
+    buf->next = ybuf_pool;
+    ybuf_pool = buf;
+    ybuf_pool_cnt++;
+    buf       = NULL;
+  }
+
+  ylock_rel(&ybuf_pool_lock, YLOCK_EXCL);
+
+  free(buf);
+}
+
+/**
+ * Reserve room in buffer. Refer ycommon.h for details.
+ */
+int ybuf_reserve(ybuf_t *buf, int len)
+{
+  int   rem = ybuf_rem(buf);
+  int   size;
+  char *mem;
+
+  if (buf->fre >= len)
+    return 0;
+
+  if (buf->max - rem >= len)
+  {
+    ybuf_compact(buf);
+    return 0;
+  }
+
+  for (size = buf->max * 2; size - rem < len; size *= 2);
+
+  if ((mem = (char *)malloc(size)) == NULL)
+    return y_error(ENOMEM);
+
+  memcpy(mem, buf->sp, rem);
+
+  if (buf->bp != buf->buf)
+    free(buf->bp);
+
+  ybuf_view(buf, mem, rem, size);
+
+  return 0;
+}
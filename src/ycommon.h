@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/signal.h>
 #include <sys/types.h>
 #include <linux/unistd.h>
@@ -40,6 +41,11 @@
 #define CMD_NONE       0
 #define CMD_GET        1
 #define CMD_SET        2
+#define CMD_SELECT     3
+#define CMD_FLUSH      4
+#define CMD_BULK       5
+#define CMD_STATS      6
+#define CMD_PING       7
 #define CMD_CLIENT   100
 #define CMD_QUIT     101
 #define CMD_UNKNOWN  999
@@ -48,6 +54,16 @@ typedef int ycmd_t;
 
 #define CMD_GET_STR "GET"
 #define CMD_SET_STR "SET"
+#define CMD_SELECT_STR "SELECT"
+#define CMD_FLUSH_STR  "FLUSH"
+#define CMD_STATS_STR  "STATS"
+
+/* Wire protocols */
+#define YPROTO_TEXT    0                        /* '#:' framed text protocol */
+#define YPROTO_BIN     1                 /* fixed header binary, see ybin.h */
+#define YPROTO_RESP    2               /* redis RESP2, own port, see yresp.h */
+#define YPROTO_MC      3   /* memcached text and binary, own port, see ymc.h */
+#define YPROTO_SHM     4      /* native over shared memory rings, yshm.h */
 
 /* Internal states */
 enum ystate_t
@@ -69,6 +85,7 @@ struct ybuf_t
   char  *bp;
   char  *sp; /* start pointer */
   char  *ep;
+  struct ybuf_t *next;                                  /* pool free list */
   char   buf[MSG_MAX];
 };
 typedef struct ybuf_t ybuf_t;
@@ -85,6 +102,40 @@ typedef struct ybuf_t ybuf_t;
 
 #define ybuf_rem(b) ((b)->ep - (b)->sp)
 
+/* Empty the buffer, keeping its memory */
+#define ybuf_reset(b) \
+        do \
+        { \
+          (b)->sp  = (b)->ep = (b)->bp; \
+          (b)->fre = (b)->max; \
+        } \
+        while (FALSE)
+
+/* Make buffer refer to external memory at 'ptr' of size 'cap', holding
+ * 'len' bytes of data */
+#define ybuf_view(b, ptr, len, cap) \
+        do \
+        { \
+          (b)->max = (cap); \
+          (b)->fre = (cap) - (len); \
+          (b)->bp  = (b)->sp = (ptr); \
+          (b)->ep  = (b)->bp + (len); \
+        } \
+        while (FALSE)
+
+/* Move unconsumed data to the beginning to make room at the end */
+#define ybuf_compact(b) \
+        do \
+        { \
+          int _rem = ybuf_rem(b); \
+          if ((b)->sp != (b)->bp) \
+            memmove((b)->bp, (b)->sp, _rem); \
+          (b)->sp  = (b)->bp; \
+          (b)->ep  = (b)->bp + _rem; \
+          (b)->fre = (b)->max - _rem; \
+        } \
+        while (FALSE)
+
 #define ybuf_mark(s, m) \
         do \
         { \
@@ -94,6 +145,43 @@ typedef struct ybuf_t ybuf_t;
 
 
 #define min(x, y) ( (x) < (y) ? (x) : (y) )
+#define max(x, y) ( (x) > (y) ? (x) : (y) )
+
+/**
+ * @section - Buffer Pool
+ *            Heap buffers used for connection input and output. They start
+ *            with the embedded MSG_MAX bytes and grow on demand, free ones
+ *            are kept in a pool for reuse.
+ */
+#define YBUF_POOL_MAX (1024)             /**< max free buffers kept in pool */
+
+/**
+ * @brief Get an empty buffer from pool, allocated if pool is empty.
+ *
+ * @return Buffer on success, NULL on failure with errno set.
+ */
+ybuf_t * ybuf_get(void);
+
+/**
+ * @brief Return a buffer to pool. Memory grown beyond MSG_MAX is released.
+ *
+ * @param buf - buffer, NULL is ignored
+ *
+ * @return None.
+ */
+void ybuf_put(ybuf_t *buf);
+
+/**
+ * @brief Make room for 'len' more bytes at the end of a pool buffer. Moves
+ *        unconsumed data to the beginning if that is enough, grows the 
+ *        buffer otherwise.
+ *
+ * @param buf - buffer
+ * @param len - bytes needed
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ybuf_reserve(ybuf_t *buf, int len);
 
 typedef uint64_t hash_t;
 typedef struct ythread_ctx_t ythread_ctx_t;
@@ -194,4 +282,45 @@ typedef struct ylink_head_t ylink_head_t;
 
 size_t ytime_get(void);
 
+/**
+ * @brief Table of objects indexed by descriptor, in two levels. Leaves of
+ *        YFD_LEAF zeroed objects are allocated on first use of a
+ *        descriptor in their range and kept, as descriptors get reused.
+ *        Set size on definition : yfd_tab_t tab = { sizeof(obj) }.
+ */
+#define YFD_LEAF_BITS (10)
+#define YFD_LEAF      (1 << YFD_LEAF_BITS)            /**< objects per leaf */
+#define YFD_ROOT      (4096)                     /**< leaves, upto 4M fds */
+
+struct yfd_tab_t
+{
+  size_t  size;                                      /**< object size */
+  void   *leaf[YFD_ROOT];
+};
+typedef struct yfd_tab_t yfd_tab_t;
+
+/**
+ * @brief Look up the object of a descriptor.
+ *
+ * @param tab    - table
+ * @param fd     - descriptor
+ * @param create - allocate its leaf if not there yet
+ *
+ * @return Object, NULL with errno set if fd is out of range (EMFILE),
+ *         its leaf isn't there (ENOENT) or can't be allocated.
+ */
+void * yfd_get(yfd_tab_t *tab, int fd, int create);
+
+/**
+ * @brief Allocate the leaves of descriptors below 'nfd' upfront, with
+ *        their pages touched, so that first use of a descriptor doesn't
+ *        allocate or fault. Leaves already there are left as they are.
+ *
+ * @param tab - table
+ * @param nfd - descriptors to cover
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yfd_reserve(yfd_tab_t *tab, int nfd);
+
 #endif /* common.h */
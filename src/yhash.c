@@ -15,21 +15,17 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <ctype.h>
+
 #include <yhash.h>
 #include <xxhash.h>
 #include <ytrace.h>
-
-#ifdef TEST_HASH
-#define ytrace_msg printf
-#endif
-
-static yhobj_t  *yhobj_freed;                          /**< free object list */
-yhtab_t         *yhtab_global;                /**< global hash table pointer */
+#include <ynuma.h>
 
 /**
  * Create a heap object for given key and data 
  */
-static yhobj_t * yhobj_create(uint64_t hash, char *key, int klen,
+static yhobj_t * yhobj_create(yhtab_t *ht, uint64_t hash, char *key, int klen,
                               char *data, int dlen)
 {
   int      len;
@@ -40,11 +36,17 @@ static yhobj_t * yhobj_create(uint64_t hash, char *key, int klen,
   len = yhobj_size(klen, dlen);
   obj = (yhobj_t *)malloc(len);
 
-  obj->len  = len;
-  obj->hash = hash;
-  obj->next = NULL;
+  if (obj == NULL)
+    return NULL;
 
-  ylock_init(&obj->lock);
+  obj->len     = len;
+  obj->ref      = 1;
+  obj->hash     = hash;
+  obj->flags    = 0;
+  obj->exptime  = 0;
+  obj->cas      = __sync_add_and_fetch(&ht->cas, 1);
+  obj->blk      = NULL;
+  obj->next     = NULL;
 
   kobj = yhobj_key(obj);
 
@@ -54,10 +56,34 @@ static yhobj_t * yhobj_create(uint64_t hash, char *key, int klen,
   vobj = yhobj_val(obj);
   vobj->len = dlen;
   memcpy(vobj->data, data, dlen);
+
+  __sync_fetch_and_add(&ht->mem, len);
   
   return obj;
 }
 
+/**
+ * Free a heap object, or its share of the block it was carved out of.
+ */
+static void yhobj_free(yhobj_t *obj)
+{
+  yhblk_t *blk = obj->blk;
+
+  if (blk == NULL)
+    free(obj);
+  else if (__sync_sub_and_fetch(&blk->ref, 1) == 0)
+    free(blk);
+}
+
+/**
+ * Release object. Refer yhash.h for details.
+ */
+void yhobj_release(yhobj_t *obj)
+{
+  if (__sync_sub_and_fetch(&obj->ref, 1) == 0)
+    yhobj_free(obj);
+}
+
 /**
  * Dump given heap object
  */
@@ -75,8 +101,8 @@ void yhobj_dump(char *prefix, yhobj_t *obj)
              vobj->len, vobj->data, vobj->len);
 
   ytrace_msg(YTRACE_LEVEL1,
-            "len = %d : lock = 0x%x : hash = 0x%lx : next = %p\n",
-             obj->len, obj->lock, obj->hash, obj->next);
+            "len = %d : ref = %d : hash = 0x%lx : next = %p\n",
+             obj->len, obj->ref, obj->hash, obj->next);
 }
 
 /**
@@ -89,8 +115,16 @@ yhtab_t * yhtab_create(int ncnt, int smax)
 
   ht = (yhtab_t *)malloc(sizeof(yhtab_t) + smax * sizeof(yhslot_t *));
 
+  if (ht == NULL)
+    return NULL;
+
   ylock_init(&ht->lock);
 
+  ht->gcn     = 0;
+  ht->mem     = 0;
+  ht->mem_max = 0;
+  ht->evict   = YHTAB_EVICT_NONE;
+
   ht->smax = smax;
   ht->ncnt = ncnt;
   ht->nbit = 0;
@@ -100,9 +134,16 @@ yhtab_t * yhtab_create(int ncnt, int smax)
 
   ht->scnt = 1;
 
-  ht->sarr[0] = (yhslot_t *)malloc(sizeof(yhslot_t) * ncnt);
+  /* calloc, so that untouched slots of a large table cost no memory */
+  ht->sarr[0] = (yhslot_t *)calloc(ncnt, sizeof(yhslot_t));
 
-  memset(ht->sarr[0], 0, sizeof(yhslot_t) * ncnt);
+  if (ht->sarr[0] == NULL)
+  {
+    free(ht);
+    return NULL;
+  }
+
+  ynuma_place(ht->sarr[0], ncnt * sizeof(yhslot_t));
 
   ytrace_msg(YTRACE_LEVEL1, "yhtab_create : ht = %p : arr[0] = %p\n",
              ht, ht->sarr[0]);
@@ -110,6 +151,95 @@ yhtab_t * yhtab_create(int ncnt, int smax)
   return ht;
 }
 
+/**
+ * Set table limits. Refer yhash.h for details.
+ */
+int yhtab_limit(yhtab_t *ht, size_t mem_max, int evict)
+{
+  if (evict != YHTAB_EVICT_NONE && evict != YHTAB_EVICT_RANDOM)
+    return y_error(EINVAL);
+
+  ht->mem_max = mem_max;
+  ht->evict   = evict;
+
+  return 0;
+}
+
+/**
+ * Destroy table. Refer yhash.h for details.
+ */
+int yhtab_destroy(yhtab_t *ht)
+{
+  int       ind;
+  int       ind2;
+  yhslot_t *slot;
+  yhobj_t  *obj;
+  yhobj_t  *next;
+
+  for (ind = 0; ind < ht->scnt; ind++)
+  {
+    for (ind2 = 0; ind2 < ht->ncnt; ind2++)
+    {
+      slot = &ht->sarr[ind][ind2]; 
+
+      for (obj = slot->obj; obj; obj = next)
+      {
+        next = obj->next;
+        yhobj_release(obj);                  /* held ones are freed later */
+      }
+    }
+
+    free(ht->sarr[ind]);
+  }
+
+  ytrace_msg(YTRACE_LEVEL1, "yhtab_destroy : ht = %p\n", ht);
+
+  free(ht);
+
+  return 0;
+}
+
+/**
+ * Visit live objects. Refer yhash.h for details.
+ */
+ssize_t yhtab_walk(yhtab_t *ht, int (*fn)(void *arg, yhobj_t *obj), 
+                   void *arg)
+{
+  int       ind;
+  int       ind2;
+  ssize_t   cnt = 0;
+  yhslot_t *slot;
+  yhobj_t  *obj;
+
+  for (ind = 0; ind < ht->scnt; ind++)
+  {
+    for (ind2 = 0; ind2 < ht->ncnt; ind2++)
+    {
+      slot = &ht->sarr[ind][ind2]; 
+
+      yhslot_lock(slot, YLOCK_SHARED);
+
+      for (obj = slot->obj; obj; obj = obj->next)
+      {
+        if (!yhobj_live(obj))
+          continue;
+
+        if (fn(arg, obj) != 0)
+        {
+          yhslot_unlock(slot, YLOCK_SHARED);
+          return -1;
+        }
+
+        cnt++;
+      }
+
+      yhslot_unlock(slot, YLOCK_SHARED);
+    }
+  }
+
+  return cnt;
+}
+
 void yhtab_dump(yhtab_t *ht)
 {
   int       ind;
@@ -148,7 +278,7 @@ void yhtab_dump(yhtab_t *ht)
 }
 
 static yhobj_t *yhtab_scan_slot(yhslot_t *slot, hash_t hash,
-                                char *key, int klen, ylock_mode_t lmode)
+                                char *key, int klen)
 {
   yhobj_t  *obj;
   yhdata_t *kobj;
@@ -160,46 +290,91 @@ static yhobj_t *yhtab_scan_slot(yhslot_t *slot, hash_t hash,
       kobj = yhobj_key(obj);
 
       if ((kobj->len == klen) && (memcmp(key, kobj->data, klen) == 0))
-      {
-        yhobj_lock(obj, lmode);
         break;
-      }
     }
   }
 
   return obj;
 }
 
-static int yhtab_slot_delete(yhslot_t *slot, yhobj_t *dobj)
+/**
+ * Unlink an object and drop the table reference. Slot should be locked in
+ * exclusive mode. Object is freed once readers holding it release it.
+ */
+static int yhtab_slot_delete(yhtab_t *ht, yhslot_t *slot, yhobj_t *dobj)
 {
-  yhobj_t *obj;
+  yhobj_t **pobj;
 
-  if (slot->obj == dobj)
+  for (pobj = &slot->obj; *pobj; pobj = &(*pobj)->next)
   {
-    slot->obj = dobj->next;
-  
-    /* TODO : take lock on yhobj_freed */
-    dobj->next = yhobj_freed;
-    yhobj_freed  = dobj;
+    if (*pobj == dobj)
+    {
+      *pobj = dobj->next;
+      __sync_fetch_and_sub(&ht->mem, dobj->len);
+      yhobj_release(dobj);
+      return 0;
+    }
+  }
 
+  return -1;
+}
+
+/**
+ * Make room for 'need' more bytes as per the eviction policy. 
+ * 
+ * Slots are visited from a position derived from the incoming hash, so 
+ * the victims are effectively random. Slots are only tried, never waited
+ * on. Hence it is safe to call while holding a slot lock. Objects held by
+ * readers are unlinked as well, they are freed on release.
+ */
+static int yhtab_evict(yhtab_t *ht, hash_t hash, size_t need)
+{
+  int       sind;
+  int       ind;
+  int       nvis = 0;
+  yhslot_t *slot;
+  yhobj_t  *obj;
+  yhobj_t  *next;
+
+  if (ht->mem_max == 0 || ht->mem + need <= ht->mem_max)
     return 0;
-  }
-  
-  for (obj = slot->obj; obj; obj = obj->next)
+
+  if (ht->evict == YHTAB_EVICT_NONE || need > ht->mem_max)
+    return y_error(ENOMEM);
+
+  sind = yhtab_sind(ht, hash);
+
+  for (ind = 1; (ind < ht->ncnt) && (nvis < YHTAB_EVICT_SCAN); ind++)
   {
-    if (obj->next == dobj)
+    if (ht->mem + need <= ht->mem_max)
+      break;
+
+    slot = yhtab_slot(ht, sind, hash + ind);
+
+    if (slot->obj == NULL)
+      continue;
+
+    nvis++;
+
+    if (ylock_try(&slot->lock, YLOCK_EXCL) != 0)
+      continue;
+
+    for (obj = slot->obj; obj && (ht->mem + need > ht->mem_max); obj = next)
     {
-      obj->next = dobj->next;
-      dobj->next = yhobj_freed;
-      yhobj_freed = dobj;
-      return 0;
+      next = obj->next;
+
+      ytrace_msg(YTRACE_LEVEL1, "yhtab_evict : evicting object = %p\n", obj);
+
+      yhtab_slot_delete(ht, slot, obj);
     }
+
+    yhslot_unlock(slot, YLOCK_EXCL);
   }
 
-  return -1;
+  return (ht->mem + need <= ht->mem_max) ? 0 : y_error(ENOMEM);
 }
 
-yhobj_t *yhtab_lookup(yhtab_t *ht, char *key, int klen, ylock_mode_t lmode)
+yhobj_t *yhtab_lookup(yhtab_t *ht, char *key, int klen)
 {
   uint64_t hash;
   yhslot_t *slot;
@@ -214,7 +389,7 @@ yhobj_t *yhtab_lookup(yhtab_t *ht, char *key, int klen, ylock_mode_t lmode)
   {
     slot = yhtab_slot(ht, sind, hash);
 
-    obj  = yhtab_scan_slot(slot, hash, key, klen, lmode);
+    obj  = yhtab_scan_slot(slot, hash, key, klen);
 
     if (obj) 
       break;
@@ -228,120 +403,668 @@ yhobj_t *yhtab_lookup(yhtab_t *ht, char *key, int klen, ylock_mode_t lmode)
   return obj;
 }
 
-int yhtab_get(yhobj_t **robj, yhtab_t *ht, char *key, int klen,
-              ylock_mode_t lmode)
+/**
+ * Lock the slot of given hash, retrying if the table changes meanwhile.
+ */
+static yhslot_t * yhtab_slot_acq(yhtab_t *ht, hash_t hash, int mode)
 {
-  int    gcn;
-  int    sind;
-  int    rlen;
+  int       gcn;
+  int       sind;
   yhslot_t *slot;
-  yhobj_t *obj = NULL;
-  yhdata_t *vobj;
-  hash_t hash;
+
+  while (TRUE)
+  {
+    gcn  = ht->gcn;
+
+    sind = yhtab_sind(ht, hash);
+    slot = yhtab_slot(ht, sind, hash);
+
+    yhslot_lock(slot, mode);
+
+    if (ht->gcn == gcn)
+      return slot;
+
+    yhslot_unlock(slot, mode);
+  }
+}
+
+/**
+ * Find a live object, slot locked exclusive. Expired one is deleted.
+ */
+static yhobj_t * yhtab_scan_live(yhtab_t *ht, yhslot_t *slot, hash_t hash,
+                                 char *key, int klen)
+{
+  yhobj_t *obj = yhtab_scan_slot(slot, hash, key, klen);
+
+  if (obj && !yhobj_live(obj))
+  {
+    yhtab_slot_delete(ht, slot, obj);
+    obj = NULL;
+  }
+
+  return obj;
+}
+
+int yhtab_get(yhobj_t **robj, yhtab_t *ht, char *key, int klen)
+{
+  yhslot_t *slot;
+  yhobj_t  *obj;
+  hash_t    hash;
 
   hash = hash_compute(key, klen);
 
   ytrace_msg(YTRACE_LEVEL1, "\nyhtab_get : key = [%.*s] %d (hash = 0x%x)\n", 
              klen, key, klen, hash);
 
-yhtab_get_retry_1:
+  slot = yhtab_slot_acq(ht, hash, YLOCK_SHARED);
 
-  gcn  = ht->gcn;
+  if ((obj = yhtab_scan_slot(slot, hash, key, klen)) && yhobj_live(obj))
+    yhobj_hold(obj);                  /* slot lock keeps the count stable */
+  else 
+    obj = NULL;
 
-  sind = yhtab_sind(ht, hash);
-  slot = yhtab_slot(ht, sind, hash);
+  ytrace_msg(YTRACE_LEVEL1, "yhtab_get : slot %p : obj = %p\n", slot, obj);
 
-  yhslot_lock(slot, YLOCK_SHARED);
+  yhslot_unlock(slot, YLOCK_SHARED);
+
+  *robj = obj;
+
+  return (obj) ? 0 : y_error(ENOENT);
+}
+
+/**
+ * Lookup several keys. Refer yhash.h for details.
+ */
+int yhtab_mget(yhtab_t *ht, yhget_t *recs, int cnt)
+{
+  int       ind;
+  int       found = 0;
+  yhslot_t *slot;
+  yhobj_t  *obj;
 
-  if (ht->gcn != gcn)
+  for (ind = 0; ind < cnt; ind++)         /* hash all, bring slots in cache */
   {
-    yhslot_unlock(slot, lmode);
-    goto yhtab_get_retry_1;
+    recs[ind].hash = hash_compute(recs[ind].key, recs[ind].klen);
+
+    __builtin_prefetch(yhtab_slot(ht, yhtab_sind(ht, recs[ind].hash), 
+                                  recs[ind].hash));
   }
 
-  obj = yhtab_scan_slot(slot, hash, key, klen, lmode);
+  for (ind = 0; ind < cnt; ind++)
+  {
+    slot = yhtab_slot_acq(ht, recs[ind].hash, YLOCK_SHARED);
+
+    obj = yhtab_scan_slot(slot, recs[ind].hash, recs[ind].key, 
+                          recs[ind].klen);
 
-  ytrace_msg(YTRACE_LEVEL1, "yhtab_get : sind = %d : slot %p : obj = %p\n", 
-             sind, slot, obj);
+    if (obj && yhobj_live(obj))
+    {
+      yhobj_hold(obj);
+      found++;
+    }
+    else 
+      obj = NULL;
 
-  yhslot_unlock(slot, lmode);
+    yhslot_unlock(slot, YLOCK_SHARED);
 
-  *robj = obj;
+    recs[ind].obj = obj;
+  }
 
-  return (obj) ? 0 : y_error(EINVAL);
+  return found;
 }
 
 int yhtab_set(yhobj_t **robj, yhtab_t *ht, char *key, int klen,
-              char *val, int vlen, ylock_mode_t lmode)
+              char *val, int vlen)
+{
+  return yhtab_store(robj, ht, key, klen, val, vlen, NULL, YHTAB_STORE_SET);
+}
+
+/**
+ * Store a key. Refer yhash.h for details.
+ */
+int yhtab_store(yhobj_t **robj, yhtab_t *ht, char *key, int klen, 
+                char *val, int vlen, yhmeta_t *meta, int mode)
 {
-  int    gcn;
-  int    sind;
+  int    ret = 0;
   int    rlen;
+  size_t need;
   yhslot_t *slot;
   yhobj_t *obj = NULL;
+  yhobj_t *dobj = NULL;
   yhdata_t *vobj;
   hash_t hash;
 
   hash = hash_compute(key, klen);
 
   ytrace_msg(YTRACE_LEVEL1, 
-             "\nyhtab_set : key = [%.*s] %d [%.*s] %d (hash = 0x%x)\n", 
-              klen, key, klen, vlen, val, vlen, hash);
-
-yhtab_set_retry_1:
+             "\nyhtab_store : key = [%.*s] %d [%.*s] %d (hash = 0x%x) : "
+             "mode = %d\n", klen, key, klen, vlen, val, vlen, hash, mode);
 
-  gcn  = ht->gcn;
+  slot = yhtab_slot_acq(ht, hash, YLOCK_EXCL);
 
-  sind = yhtab_sind(ht, hash);
-  slot = yhtab_slot(ht, sind, hash);
+  obj = yhtab_scan_live(ht, slot, hash, key, klen);
 
-  yhslot_lock(slot, YLOCK_SHARED);
+  if (obj && mode == YHTAB_STORE_ADD)
+    ret = y_error(EEXIST);
+  else if (!obj && (mode == YHTAB_STORE_REPLACE || mode == YHTAB_STORE_CAS))
+    ret = y_error(ENOENT);
+  else if (obj && mode == YHTAB_STORE_CAS && obj->cas != meta->cas)
+    ret = y_error(EEXIST);
 
-  if (ht->gcn != gcn)
+  if (ret != 0)
   {
-    yhslot_unlock(slot, YLOCK_SHARED);
-    goto yhtab_set_retry_1;
+    yhslot_unlock(slot, YLOCK_EXCL);
+
+    if (robj)
+      *robj = NULL;
+
+    return ret;
   }
 
-  if (obj = yhtab_scan_slot(slot, hash, key, klen, lmode))
+  if (obj)
   {
     vobj = yhobj_val(obj);
 
-    rlen = obj->len - ((char *)vobj - (char *)obj);
+    rlen = obj->len - ((char *)vobj - (char *)obj) - sizeof(yhdata_t);
 
-    ytrace_msg(YTRACE_LEVEL1, "yhtab_set : remaining length = %d\n", rlen);
+    ytrace_msg(YTRACE_LEVEL1, "yhtab_store : remaining length = %d\n", rlen);
 
-    if (rlen >= vlen)
+    /* 
+     * Readers take their hold under the slot lock, so with the slot held
+     * exclusive an unheld object can be updated in place. A held one is
+     * replaced, never waited on.
+     */
+    if ((rlen >= vlen) && (obj->ref == 1))
     {
       vobj->len = vlen;
       memcpy((void *)vobj->data, val, vlen);
+
+      obj->cas = __sync_add_and_fetch(&ht->cas, 1);
     }
     else 
     {
-      ytrace_msg(YTRACE_LEVEL1,
-                "yhtab_set : deleting exiting object = %p\n", obj);
-      yhtab_slot_delete(slot, obj);
-      obj = NULL;
+      dobj = obj;                  /* replaced once the new one is ready */
+      obj  = NULL;
     }
   }
 
   if (obj == NULL)
   {
-    obj = yhobj_create(hash, key, klen, val, vlen);
+    need = yhobj_size(klen, vlen);
+
+    if (dobj)                            /* its room is given back below */
+      need = (need > dobj->len) ? need - dobj->len : 0;
+
+    if ((ret = yhtab_evict(ht, hash, need)) == 0)
+    {
+      if ((obj = yhobj_create(ht, hash, key, klen, val, vlen)) == NULL)
+        ret = y_error(ENOMEM);
+    }
+
+    if (ret != 0)                       /* the old value, if any, stays */
+    {
+      yhslot_unlock(slot, YLOCK_EXCL);
+
+      if (robj)
+        *robj = NULL;
+
+      return ret;
+    }
+
+    if (dobj)
+    {
+      ytrace_msg(YTRACE_LEVEL1,
+                "yhtab_store : deleting exiting object = %p\n", dobj);
+      yhtab_slot_delete(ht, slot, dobj);
+    }
 
     obj->next = slot->obj;
     slot->obj = obj;
-    yhobj_lock(obj, lmode);
   }
 
-  ytrace_msg(YTRACE_LEVEL1, "yhtab_set : sind = %d : slot %p : obj = %p\n",
-             sind, slot, obj);
+  obj->flags   = (meta) ? meta->flags   : 0;
+  obj->exptime = (meta) ? meta->exptime : 0;
 
-  yhslot_unlock(slot, YLOCK_SHARED);
+  if (meta)
+    meta->cas = obj->cas;
 
-  *robj = obj;
+  if (robj)
+    yhobj_hold(obj);
+
+  ytrace_msg(YTRACE_LEVEL1, "yhtab_store : slot %p : obj = %p\n", slot, obj);
+
+  yhslot_unlock(slot, YLOCK_EXCL);
+
+  if (robj)
+    *robj = obj;
+
+  return 0;
+}
+
+/**
+ * Delete a key. Refer yhash.h for details.
+ */
+int yhtab_del(yhtab_t *ht, char *key, int klen, uint64_t cas)
+{
+  int       ret = 0;
+  yhslot_t *slot;
+  yhobj_t  *obj;
+  hash_t    hash;
+
+  hash = hash_compute(key, klen);
+  slot = yhtab_slot_acq(ht, hash, YLOCK_EXCL);
+
+  if ((obj = yhtab_scan_live(ht, slot, hash, key, klen)) == NULL)
+    ret = y_error(ENOENT);
+  else if (cas && obj->cas != cas)
+    ret = y_error(EEXIST);
+  else 
+    yhtab_slot_delete(ht, slot, obj);
+
+  yhslot_unlock(slot, YLOCK_EXCL);
+
+  return ret;
+}
+
+#define YHTAB_NUM_MAX (20)               /**< digits of largest uint64_t */
+
+/**
+ * Add to a decimal value. Refer yhash.h for details.
+ */
+int yhtab_incr(yhtab_t *ht, char *key, int klen, uint64_t delta, int decr,
+               uint64_t *val, yhmeta_t *meta)
+{
+  int       ind;
+  int       len;
+  int       rlen;
+  int       ret = 0;
+  uint64_t  num = 0;
+  char      str[YHTAB_NUM_MAX + 1];
+  yhslot_t *slot;
+  yhobj_t  *obj;
+  yhobj_t  *nobj;
+  yhdata_t *vobj;
+  hash_t    hash;
+
+  hash = hash_compute(key, klen);
+  slot = yhtab_slot_acq(ht, hash, YLOCK_EXCL);
+
+  do 
+  {
+    if ((obj = yhtab_scan_live(ht, slot, hash, key, klen)) == NULL)
+    {
+      if (meta == NULL)
+      {
+        ret = y_error(ENOENT);
+        break;
+      }
+
+      num = *val;
+    }
+    else 
+    {
+      vobj = yhobj_val(obj);
+
+      if (vobj->len == 0 || vobj->len > YHTAB_NUM_MAX)
+      {
+        ret = y_error(EINVAL);
+        break;
+      }
+
+      for (ind = 0; ind < vobj->len && isdigit(vobj->data[ind]); ind++)
+      {
+        if (num > (UINT64_MAX - (vobj->data[ind] - '0')) / 10)
+          break;
+
+        num = num * 10 + (vobj->data[ind] - '0');
+      }
+
+      if (ind != vobj->len)
+      {
+        ret = y_error(EINVAL);
+        break;
+      }
 
-  return (obj) ? 0 : y_error(EINVAL);
+      if (decr)
+        num = (num > delta) ? num - delta : 0;
+      else 
+        num += delta;
+    }
+
+    len = snprintf(str, sizeof(str), "%llu", (unsigned long long)num);
+
+    if (obj)
+    {
+      rlen = obj->len - ((char *)vobj - (char *)obj) - sizeof(yhdata_t);
+
+      if ((rlen >= len) && (obj->ref == 1))            /* same as store */
+      {
+        vobj->len = len;
+        memcpy(vobj->data, str, len);
+
+        obj->cas = __sync_add_and_fetch(&ht->cas, 1);
+        break;
+      }
+    }
+
+    if ((ret = yhtab_evict(ht, hash, yhobj_size(klen, len))) != 0)
+      break;
+
+    if ((nobj = yhobj_create(ht, hash, key, klen, str, len)) == NULL)
+    {
+      ret = y_error(ENOMEM);
+      break;
+    }
+
+    nobj->flags   = (obj) ? obj->flags   : meta->flags;
+    nobj->exptime = (obj) ? obj->exptime : meta->exptime;
+
+    if (obj)
+      yhtab_slot_delete(ht, slot, obj);
+
+    obj = nobj;
+
+    obj->next = slot->obj;
+    slot->obj = obj;
+  }
+  while (FALSE);
+
+  if (ret == 0)
+  {
+    *val = num;
+
+    if (meta)
+      meta->cas = obj->cas;
+  }
+
+  yhslot_unlock(slot, YLOCK_EXCL);
+
+  return ret;
+}
+
+/**
+ * Change expiry of a key. Refer yhash.h for details.
+ */
+int yhtab_touch(yhtab_t *ht, char *key, int klen, uint32_t exptime)
+{
+  int       ret = 0;
+  yhslot_t *slot;
+  yhobj_t  *obj;
+  hash_t    hash;
+
+  hash = hash_compute(key, klen);
+  slot = yhtab_slot_acq(ht, hash, YLOCK_EXCL);
+
+  if ((obj = yhtab_scan_live(ht, slot, hash, key, klen)) == NULL)
+    ret = y_error(ENOENT);
+  else 
+    obj->exptime = exptime;
+
+  yhslot_unlock(slot, YLOCK_EXCL);
+
+  return ret;
+}
+
+/**
+ * Bulk load worker. Owns a contiguous range of slots, its objects are
+ * carved out of a block allocated before any worker starts.
+ */
+struct yhload_wrk_t
+{
+  yhtab_t   *ht;
+  yhload_t  *recs;
+  int        cnt;
+  size_t     tot;                                  /* size of its block */
+  yhblk_t   *blk;
+  int        done;
+};
+typedef struct yhload_wrk_t yhload_wrk_t;
+
+/**
+ * Bulk load pool thread, created on first use and kept for later loads.
+ */
+struct yhload_thr_t
+{
+  pthread_t     hdl;
+  int           go;                         /* set while a range is posted */
+  yhload_wrk_t *wrk;
+};
+typedef struct yhload_thr_t yhload_thr_t;
+
+static yhload_thr_t yhload_pool[YHTAB_LOAD_THREADS];
+static int          yhload_nthr;
+static ylock_t      yhload_lock;                /* one load uses the pool */
+
+#define yhload_align(len) (((len) + 7) & ~7)
+
+static int yhload_cmp(const void *a, const void *b)
+{
+  return ((yhload_t *)a)->sind - ((yhload_t *)b)->sind;
+}
+
+static void yhtab_load_worker(yhload_wrk_t *wrk)
+{
+  yhtab_t      *ht  = wrk->ht;
+  yhload_t     *rec;
+  yhslot_t     *slot = NULL;
+  yhobj_t      *obj;
+  yhblk_t      *blk = wrk->blk;
+  yhdata_t     *kobj;
+  yhdata_t     *vobj;
+  char         *cp;
+  int           ind;
+  int           len;
+
+  if (wrk->cnt == 0)
+    return;
+
+  qsort(wrk->recs, wrk->cnt, sizeof(yhload_t), yhload_cmp);
+
+  blk->ref = wrk->cnt;
+  cp       = (char *)blk + yhload_align(sizeof(yhblk_t));
+
+  for (ind = 0; ind < wrk->cnt; ind++)
+  {
+    rec = &wrk->recs[ind];
+
+    if ((slot == NULL) || (ind && rec->sind != rec[-1].sind))  /* next slot */
+    {
+      if (slot)
+        yhslot_unlock(slot, YLOCK_EXCL);
+
+      slot = yhtab_slot(ht, yhtab_sind(ht, rec->hash), rec->hash);
+
+      yhslot_lock(slot, YLOCK_EXCL);
+    }
+
+    if (obj = yhtab_scan_slot(slot, rec->hash, rec->key, rec->klen))
+      yhtab_slot_delete(ht, slot, obj);
+
+    len = yhobj_size(rec->klen, rec->vlen);
+    obj = (yhobj_t *)cp;
+    cp += yhload_align(len);
+
+    obj->len     = len;
+    obj->ref     = 1;
+    obj->hash    = rec->hash;
+    obj->flags   = 0;
+    obj->exptime = 0;
+    obj->cas     = __sync_add_and_fetch(&ht->cas, 1);
+    obj->blk     = blk;
+
+    kobj = yhobj_key(obj);
+    kobj->len = rec->klen;
+    memcpy(kobj->data, rec->key, rec->klen);
+
+    vobj = yhobj_val(obj);
+    vobj->len = rec->vlen;
+    memcpy(vobj->data, rec->val, rec->vlen);
+
+    __sync_fetch_and_add(&ht->mem, len);
+
+    obj->next = slot->obj;
+    slot->obj = obj;
+  }
+
+  if (slot)
+    yhslot_unlock(slot, YLOCK_EXCL);
+
+  wrk->done = wrk->cnt;
+}
+
+static void * yhload_pool_run(void *arg)
+{
+  yhload_thr_t *thr = (yhload_thr_t *)arg;
+
+  while (TRUE)
+  {
+    while (__atomic_load_n(&thr->go, __ATOMIC_ACQUIRE) == 0)
+      ylock_mem_wait(&thr->go, 0, 0);
+
+    yhtab_load_worker(thr->wrk);
+
+    __atomic_store_n(&thr->go, 0, __ATOMIC_RELEASE);
+    ylock_mem_post(&thr->go);
+  }
+
+  return NULL;
+}
+
+/**
+ * Post ranges 1.. to pool threads, creating the missing ones. Called with
+ * yhload_lock held. Returns the number of ranges posted.
+ */
+static int yhload_post(yhload_wrk_t *wrk, int nworker)
+{
+  int           part;
+  yhload_thr_t *thr;
+
+  for (part = 1; part < nworker; part++)
+  {
+    thr = &yhload_pool[part - 1];
+
+    if (part > yhload_nthr)
+    {
+      if (pthread_create(&thr->hdl, NULL, yhload_pool_run, thr) != 0)
+        break;
+
+      pthread_detach(thr->hdl);
+      yhload_nthr++;
+    }
+
+    thr->wrk = &wrk[part];
+    __atomic_store_n(&thr->go, 1, __ATOMIC_RELEASE);
+    ylock_mem_post(&thr->go);
+  }
+
+  return part - 1;
+}
+
+/**
+ * Bulk load. Refer yhash.h for details.
+ */
+int yhtab_load(yhtab_t *ht, yhload_t *recs, int cnt, int nworker)
+{
+  int           ind;
+  int           part;
+  int           pool;
+  int           posted = 0;
+  int           done   = 0;
+  int           pcnt[YHTAB_LOAD_THREADS + 2];
+  size_t        need = 0;
+  yhload_t     *tmp;
+  yhload_wrk_t *wrk;
+
+  nworker = min(nworker, cnt / YHTAB_LOAD_MIN);
+  nworker = min(nworker, YHTAB_LOAD_THREADS + 1);
+
+  if (nworker < 1)
+    nworker = 1;
+
+  memset(pcnt, 0, sizeof(pcnt));
+
+  for (ind = 0; ind < cnt; ind++)      /* hash and count records per range */
+  {
+    recs[ind].hash = hash_compute(recs[ind].key, recs[ind].klen);
+    recs[ind].sind = recs[ind].hash % ht->ncnt;
+
+    pcnt[(uint64_t)recs[ind].sind * nworker / ht->ncnt + 1]++;
+    need += yhobj_size(recs[ind].klen, recs[ind].vlen);
+  }
+
+  if (cnt && yhtab_evict(ht, recs[0].hash, need) != 0)
+    return y_error(ENOMEM);
+
+  tmp = (yhload_t *)malloc(cnt * sizeof(yhload_t));
+  wrk = (yhload_wrk_t *)calloc(nworker, sizeof(yhload_wrk_t));
+
+  if (tmp == NULL || wrk == NULL)
+    goto nomem;
+
+  for (part = 1; part <= nworker; part++)
+    pcnt[part] += pcnt[part - 1];
+
+  for (part = 0; part < nworker; part++)
+  {
+    wrk[part].ht   = ht;
+    wrk[part].recs = &tmp[pcnt[part]];
+    wrk[part].cnt  = pcnt[part + 1] - pcnt[part];
+    wrk[part].tot  = yhload_align(sizeof(yhblk_t));
+  }
+
+  for (ind = 0; ind < cnt; ind++)                  /* partition by range */
+  {
+    part = (uint64_t)recs[ind].sind * nworker / ht->ncnt;
+    tmp[pcnt[part]++] = recs[ind];
+
+    wrk[part].tot += yhload_align(yhobj_size(recs[ind].klen, recs[ind].vlen));
+  }
+
+  for (part = 0; part < nworker; part++)   /* all blocks, before any slot */
+  {
+    if (wrk[part].cnt && (wrk[part].blk = malloc(wrk[part].tot)) == NULL)
+      goto nomem;
+  }
+
+  /* a concurrent load runs its ranges inline rather than wait for the pool */
+  pool = (nworker > 1) && (ylock_try(&yhload_lock, YLOCK_EXCL) == 0);
+
+  if (pool)
+    posted = yhload_post(wrk, nworker);
+
+  yhtab_load_worker(&wrk[0]);                 /* first range done inline */
+
+  for (part = posted + 1; part < nworker; part++)
+    yhtab_load_worker(&wrk[part]);              /* no thread, do it here */
+
+  for (part = 1; part <= posted; part++)
+  {
+    while (__atomic_load_n(&yhload_pool[part - 1].go, __ATOMIC_ACQUIRE))
+      ylock_mem_wait(&yhload_pool[part - 1].go, 1, 0);
+  }
+
+  if (pool)
+    ylock_rel(&yhload_lock, YLOCK_EXCL);
+
+  for (part = 0; part < nworker; part++)
+    done += wrk[part].done;
+
+  ytrace_msg(YTRACE_LEVEL1, "yhtab_load : ht = %p : loaded %d of %d (%d, "
+             "%d pooled)\n", ht, done, cnt, nworker, posted);
+
+  free(tmp);
+  free(wrk);
+
+  return done;
+
+nomem:
+  for (part = 0; wrk && part < nworker; part++)
+    free(wrk[part].blk);
+
+  free(tmp);
+  free(wrk);
+
+  return y_error(ENOMEM);
 }
 
 int yhtab_resize(yhtab_t *ht, int ncnt)
@@ -392,6 +1115,244 @@ int yhtab_resize(yhtab_t *ht, int ncnt)
 }
 
 #ifdef TEST_HASH
+
+/*
+ * Standalone test, build with
+ *   gcc -DTEST_HASH -I. yhash.c ynuma.c xxhash.c ylock.c ytrace.c ycommon.c 
+ *       -lpthread
+ */
+
+#define TEST_SETS (100000)
+
+static volatile int test_sets_done;
+
+/*
+ * Writer for the stalled reader test. Keeps updating the key held by the 
+ * reader with values of different sizes.
+ */
+static void * test_writer(void *arg)
+{
+  int      ind;
+  char     val[64];
+  yhtab_t *ht = (yhtab_t *)arg;
+
+  for (ind = 0; ind < TEST_SETS; ind++)
+  {
+    snprintf(val, sizeof(val), "writer-%d-%.*s", ind, ind % 32,
+             "................................");
+
+    if (yhtab_set(NULL, ht, "test1", 5, val, strlen(val)) != 0)
+      printf("yhtab_set failed : %d\n", errno);
+  }
+
+  test_sets_done = TRUE;
+
+  return NULL;
+}
+
+/*
+ * A reader holding an object (e.g. stuck sending it to a slow client) 
+ * should neither delay writers to that key nor see its value change.
+ */
+static int test_stalled_reader(yhtab_t *ht)
+{
+  pthread_t  hdl;
+  yhobj_t   *obj;
+  yhdata_t  *vobj;
+  size_t     beg;
+  char      *val = "held-value";
+  int        ret = 0;
+
+  yhtab_set(NULL, ht, "test1", 5, val, strlen(val));
+
+  if (yhtab_get(&obj, ht, "test1", 5) != 0)
+    return -1;
+
+  beg = ytime_get();
+
+  pthread_create(&hdl, NULL, test_writer, ht);
+
+  while (!test_sets_done && (ytime_get() - beg < 10 * 1000000))
+    usleep(1000);                                 /* reader stays stalled */
+
+  vobj = yhobj_val(obj);
+
+  if (!test_sets_done)
+  {
+    printf("FAIL : writer blocked by a stalled reader\n");
+    ret = -1;
+  }
+  else if ((vobj->len != strlen(val)) || memcmp(vobj->data, val, vobj->len))
+  {
+    printf("FAIL : held value changed to [%.*s]\n", vobj->len, vobj->data);
+    ret = -1;
+  }
+  else 
+    printf("PASS : %d sets in %zu us while reader stalled\n", 
+           TEST_SETS, ytime_get() - beg);
+
+  yhobj_release(obj);
+
+  pthread_join(hdl, NULL);
+
+  return ret;
+}
+
+/*
+ * Replacing a held object over the memory limit must fail with the old
+ * value still stored.
+ */
+static int test_store_nomem(yhtab_t *ht)
+{
+  int       ret = 0;
+  char     *key = "nomem";
+  char     *val = "old";
+  char     *big = "a value that does not fit in the old object";
+  yhobj_t  *held;
+  yhobj_t  *obj;
+  yhdata_t *vobj;
+
+  yhtab_set(&held, ht, key, strlen(key), val, strlen(val));
+
+  yhtab_limit(ht, ht->mem, YHTAB_EVICT_NONE);
+
+  if ((yhtab_set(NULL, ht, key, strlen(key), big, strlen(big)) != -1) ||
+      (errno != ENOMEM))
+  {
+    printf("FAIL : set over the limit did not fail\n");
+    ret = -1;
+  }
+  else if (yhtab_get(&obj, ht, key, strlen(key)) != 0)
+  {
+    printf("FAIL : failed set lost the old value\n");
+    ret = -1;
+  }
+  else
+  {
+    vobj = yhobj_val(obj);
+
+    if ((vobj->len != strlen(val)) || memcmp(vobj->data, val, vobj->len))
+    {
+      printf("FAIL : failed set changed the value\n");
+      ret = -1;
+    }
+    else
+      printf("PASS : failed set of a held key kept its value\n");
+
+    yhobj_release(obj);
+  }
+
+  yhtab_limit(ht, 0, YHTAB_EVICT_NONE);
+  yhobj_release(held);
+
+  return ret;
+}
+
+#define TEST_LOADS (100000)
+
+/*
+ * Loader for the bulk load test, keys "load-<n>" with the loader's tag as
+ * value. Both loaders contend for the pool, one runs its ranges inline.
+ */
+static void * test_loader(void *arg)
+{
+  yhtab_t  *ht = (yhtab_t *)arg;
+  yhload_t *recs;
+  char     *keys;
+  int       ind;
+  int       ret;
+
+  recs = (yhload_t *)malloc(TEST_LOADS * sizeof(yhload_t));
+  keys = (char *)malloc(TEST_LOADS * 16);
+
+  for (ind = 0; ind < TEST_LOADS; ind++)
+  {
+    recs[ind].key  = &keys[ind * 16];
+    recs[ind].klen = sprintf(recs[ind].key, "load-%d", ind);
+    recs[ind].val  = "loaded";
+    recs[ind].vlen = 6;
+  }
+
+  ret = yhtab_load(ht, recs, TEST_LOADS, 8);
+
+  free(recs);
+  free(keys);
+
+  return (void *)(long)ret;
+}
+
+/*
+ * Bulk load test. Two concurrent loads of the same keys must each load all
+ * of them, and a load over the memory limit must fail without touching the
+ * table.
+ */
+static int test_load(yhtab_t *ht)
+{
+  int        ind;
+  int        len;
+  int        found = 0;
+  char       key[16];
+  void      *ret[2];
+  pthread_t  hdl[2];
+  yhobj_t   *obj;
+  yhdata_t  *vobj;
+  yhload_t   rec;
+
+  for (ind = 0; ind < 2; ind++)
+    pthread_create(&hdl[ind], NULL, test_loader, ht);
+
+  for (ind = 0; ind < 2; ind++)
+    pthread_join(hdl[ind], &ret[ind]);
+
+  for (ind = 0; ind < TEST_LOADS; ind++)
+  {
+    len = sprintf(key, "load-%d", ind);
+
+    if (yhtab_get(&obj, ht, key, len) == 0)
+    {
+      found++;
+      yhobj_release(obj);
+    }
+  }
+
+  if (((long)ret[0] != TEST_LOADS) || ((long)ret[1] != TEST_LOADS) ||
+      (found != TEST_LOADS))
+  {
+    printf("FAIL : loaded %ld and %ld, found %d of %d\n", (long)ret[0],
+           (long)ret[1], found, TEST_LOADS);
+    return -1;
+  }
+
+  yhtab_limit(ht, ht->mem, YHTAB_EVICT_NONE);
+
+  rec.key  = "load-0";
+  rec.klen = 6;
+  rec.val  = "over the limit";
+  rec.vlen = 14;
+
+  if ((yhtab_load(ht, &rec, 1, 1) != -1) || (errno != ENOMEM) ||
+      (yhtab_get(&obj, ht, rec.key, rec.klen) != 0))
+  {
+    printf("FAIL : load over the limit\n");
+    return -1;
+  }
+
+  vobj = yhobj_val(obj);
+  len  = vobj->len;
+  yhobj_release(obj);
+  yhtab_limit(ht, 0, YHTAB_EVICT_NONE);
+
+  if (len != 6)
+  {
+    printf("FAIL : load over the limit changed the table\n");
+    return -1;
+  }
+
+  printf("PASS : %d records loaded twice concurrently\n", TEST_LOADS);
+
+  return 0;
+}
+
 int main()
 {
   yhtab_t *ht;
@@ -402,34 +1363,39 @@ int main()
   char *val2 = "xyz";
   char *val3 = "adsfasdfasdfasdfasdfasdfasdf";
 
-  yhtab_resize(&yhtab, 1024*1024);
-
-  obj = yhobj_create(0x1234, key, strlen(key), val, strlen(val));
-
-  yhobj_dump(" ", obj);
-  
   ht = yhtab_create(YHTAB_NCNT_DEFAULT, YHTAB_SMAX_DEFAULT);
 
   ytrace_msg(YTRACE_LEVEL1, "created hd = %p\n", ht);
 
-  yhtab_set(ht, key, strlen(key), val, strlen(val), YLOCK_NONE);
+  yhtab_set(NULL, ht, key, strlen(key), val, strlen(val));
   yhtab_dump(ht);
 
-  yhtab_set(ht, key, strlen(key), val, strlen(val), YLOCK_NONE);
+  yhtab_set(NULL, ht, key, strlen(key), val, strlen(val));
   yhtab_dump(ht);
 
-  yhtab_set(ht, key, strlen(key), val2, strlen(val2), YLOCK_NONE);
+  yhtab_set(NULL, ht, key, strlen(key), val2, strlen(val2));
   yhtab_dump(ht);
 
-  yhtab_set(ht, key, strlen(key), val3, strlen(val3), YLOCK_NONE);
+  yhtab_set(NULL, ht, key, strlen(key), val3, strlen(val3));
   yhtab_dump(ht);
 
-  yhtab_set(ht, key, strlen(key), val, strlen(val), YLOCK_NONE);
+  yhtab_set(NULL, ht, key, strlen(key), val, strlen(val));
   yhtab_dump(ht);
 
-  yhtab_set(ht, key2, strlen(key2), val, strlen(val), YLOCK_NONE);
+  yhtab_set(NULL, ht, key2, strlen(key2), val, strlen(val));
   yhtab_dump(ht);
 
+  if (test_stalled_reader(ht) != 0)
+    return 1;
+
+  if (test_store_nomem(ht) != 0)
+    return 1;
+
+  if (test_load(ht) != 0)
+    return 1;
+
+  yhtab_destroy(ht);
+
   return 0;
 }
 
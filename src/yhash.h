@@ -17,6 +17,7 @@
  */
 #ifndef _YHASH_H
 
+#include <time.h>
 #include <ycommon.h>
 #include <ylock.h>
 
@@ -25,6 +26,17 @@
 #define YHTAB_NCNT_DEFAULT (1024*1024)
 #define YHTAB_SMAX_DEFAULT (1024)
 
+/**
+ * Eviction policies, applied once a table reaches its memory limit. 
+ */
+#define YHTAB_EVICT_NONE   0          /**< reject writes with ENOMEM */
+#define YHTAB_EVICT_RANDOM 1          /**< evict from pseudo-random slots */
+
+#define YHTAB_EVICT_SCAN   (64)       /**< max slots visited per eviction */
+
+#define YHTAB_LOAD_MIN     (4096)    /**< min records per bulk load worker */
+#define YHTAB_LOAD_THREADS (63)      /**< max bulk load pool threads */
+
 struct yhdata_t
 {
   int  len;
@@ -32,15 +44,74 @@ struct yhdata_t
 };
 typedef struct yhdata_t yhdata_t;
 
+/**
+ * Block of objects allocated at once by a bulk load. Freed when the last
+ * object carved out of it is freed.
+ */
+struct yhblk_t
+{
+  int   ref;                             /* objects still alive in block */
+};
+typedef struct yhblk_t yhblk_t;
+
 struct yhobj_t
 {
   int             len;
-  ylock_t         lock;
+  int             ref;               /* table reference plus reader holds */
   uint64_t        hash;
+  uint32_t        flags;                  /* opaque client flags, 0 if none */
+  uint32_t        exptime;      /* expiry, unix time in secs, 0 for never */
+  uint64_t        cas;                   /* version, changes on every write */
+  yhblk_t        *blk;                      /* owning block, NULL if none */
   struct yhobj_t *next;
 };
 typedef struct yhobj_t yhobj_t;
 
+/**
+ * Attributes stored along with a value.
+ */
+struct yhmeta_t
+{
+  uint32_t  flags;
+  uint32_t  exptime;                           /* unix time in secs, 0 never */
+  uint64_t  cas;         /* expected version for YHTAB_STORE_CAS, new one out */
+};
+typedef struct yhmeta_t yhmeta_t;
+
+/**
+ * Store modes, yhtab_store.
+ */
+#define YHTAB_STORE_SET      0                     /**< insert or update */
+#define YHTAB_STORE_ADD      1       /**< insert only, EEXIST if present */
+#define YHTAB_STORE_REPLACE  2        /**< update only, ENOENT if absent */
+#define YHTAB_STORE_CAS      3     /**< update if version matches, EEXIST */
+
+/**
+ * One key of a multi key lookup.
+ */
+struct yhget_t
+{
+  char     *key;
+  int       klen;
+  hash_t    hash;                                             /* internal */
+  yhobj_t  *obj;                          /* returned held, NULL if absent */
+};
+typedef struct yhget_t yhget_t;
+
+/**
+ * One record of a bulk load. 
+ */
+struct yhload_t
+{
+  hash_t  hash;
+  int     sind;                                  /* slot index, internal */
+  int     klen;
+  int     vlen;
+  char   *key;
+  char   *val;
+};
+typedef struct yhload_t yhload_t;
+
 struct yhslot_t
 {
   ylock_t   lock;
@@ -54,6 +125,11 @@ struct yhtab_t
   ylock_t     lock;
   int         gcn;
 
+  size_t      mem;                            /* bytes used by all objects */
+  size_t      mem_max;                          /* memory limit, 0 for none */
+  int         evict;                                   /* eviction policy */
+  uint64_t    cas;                                /* last object version */
+
   int         ncnt;                          /* number of slots in each sarr */
   int         nbit;
 
@@ -74,14 +150,24 @@ typedef struct yhtab_t yhtab_t;
           (yhdata_t *)((char *)yhobj_key(obj) + \
                sizeof(yhdata_t)+(yhobj_key(obj))->len)
 
+/**
+ * Object is alive unless its expiry has passed, clock read only if needed.
+ */
+#define yhobj_live(obj) \
+          (((obj)->exptime == 0) || ((obj)->exptime > (uint32_t)time(NULL)))
+
 #define yhtab_lock(ht, mode)    ylock_acq(&(ht)->lock, mode)
 #define yhtab_unlock(ht, mode)  ylock_rel(&(ht)->lock, mode)
 
-#define yhobj_lock(ho, mode)    ylock_acq(&(ho)->lock, mode)
-#define yhobj_unlock(ho, mode)  ylock_rel(&(ho)->lock, mode)
+/**
+ * Hold an object beyond the slot lock, e.g. while its value is being sent.
+ * Should be taken with the slot locked. A held object is never modified in
+ * place, and is freed on the last release once unlinked.
+ */
+#define yhobj_hold(ho)          __sync_fetch_and_add(&(ho)->ref, 1)
 
-#define yhslot_lock(sl, mode)   ylock_acq(&ht->lock, mode)
-#define yhslot_unlock(sl, mode) ylock_rel(&ht->lock, mode)
+#define yhslot_lock(sl, mode)   ylock_acq(&(sl)->lock, mode)
+#define yhslot_unlock(sl, mode) ylock_rel(&(sl)->lock, mode)
 
 #define yhtab_sind(ht, hash) \
           (((hash) >> ((ht)->nbit)) % (ht)->scnt)
@@ -90,14 +176,175 @@ typedef struct yhtab_t yhtab_t;
 
 #define hash_compute(key, len) (uint64_t)(XXH64((void *)key, len, 0))
 
-extern yhtab_t *yhtab_global;
-
 yhtab_t * yhtab_create(int ncnt, int smax);
 
-int yhtab_get(yhobj_t **robj, yhtab_t *ht, char *key, int klen,
-              ylock_mode_t lmode);
+/**
+ * @brief Release an object held through yhobj_hold. 
+ * 
+ * @param obj - heap object
+ * 
+ * @return None.
+ */
+void yhobj_release(yhobj_t *obj);
+
+/**
+ * @brief Set memory limit and eviction policy of a table.
+ * 
+ * @param ht      - hash table
+ * @param mem_max - memory limit in bytes, 0 for unlimited
+ * @param evict   - one of YHTAB_EVICT_* 
+ * 
+ * @return 0 on success, -1 on failure with errno set. 
+ */
+int yhtab_limit(yhtab_t *ht, size_t mem_max, int evict);
+
+/**
+ * @brief Destroy a table along with all its objects. Caller should make 
+ *        sure no other thread is referring to the table anymore.
+ * 
+ * @param ht - hash table
+ * 
+ * @return 0 on success.
+ */
+int yhtab_destroy(yhtab_t *ht);
+
+/**
+ * @brief Lookup a key. Object is returned held, no lock is left behind, 
+ *        caller should release it through yhobj_release.
+ * 
+ * @param robj - returned object
+ * @param ht   - hash table
+ * @param key  - key
+ * @param klen - key length
+ * 
+ * @return 0 on success, -1 on failure with errno set, ENOENT if the key
+ *         is not found. 
+ */
+int yhtab_get(yhobj_t **robj, yhtab_t *ht, char *key, int klen);
 
+/**
+ * @brief Insert or update a key. Never waits for readers holding the 
+ *        current object, it is replaced instead.
+ * 
+ * @param robj - returned object, held, if not NULL
+ * @param ht   - hash table
+ * @param key  - key
+ * @param klen - key length
+ * @param val  - value
+ * @param vlen - value length
+ * 
+ * @return 0 on success, -1 on failure with errno set. 
+ */
 int yhtab_set(yhobj_t **robj, yhtab_t *ht, char *key, int klen, 
-              char *val, int vlen, ylock_mode_t lmode);
+              char *val, int vlen);
+
+/**
+ * @brief Store a key as per given mode, along with its attributes.
+ *        yhtab_set is YHTAB_STORE_SET without attributes.
+ * 
+ * @param robj - returned object, held, if not NULL
+ * @param ht   - hash table
+ * @param key  - key
+ * @param klen - key length
+ * @param val  - value
+ * @param vlen - value length
+ * @param meta - attributes, NULL for none. New version is returned in cas.
+ * @param mode - YHTAB_STORE_*
+ * 
+ * @return 0 on success, -1 on failure with errno set. EEXIST if the key is
+ *         present for ADD or has another version for CAS, ENOENT if the
+ *         key is absent for REPLACE and CAS.
+ */
+int yhtab_store(yhobj_t **robj, yhtab_t *ht, char *key, int klen, 
+                char *val, int vlen, yhmeta_t *meta, int mode);
+
+/**
+ * @brief Delete a key.
+ * 
+ * @param ht   - hash table
+ * @param key  - key
+ * @param klen - key length
+ * @param cas  - expected version, 0 for any
+ * 
+ * @return 0 on success, -1 on failure with errno set. ENOENT if absent,
+ *         EEXIST on version mismatch.
+ */
+int yhtab_del(yhtab_t *ht, char *key, int klen, uint64_t cas);
+
+/**
+ * @brief Add to or subtract from a decimal value. Increment wraps at 
+ *        2^64, decrement stops at 0.
+ * 
+ * @param ht    - hash table
+ * @param key   - key
+ * @param klen  - key length
+ * @param delta - amount
+ * @param decr  - subtract instead of add
+ * @param val   - initial value on input if 'meta' is set, result on output
+ * @param meta  - attributes of the key created with initial value if 
+ *                absent, NULL to fail instead. New version returned in cas.
+ * 
+ * @return 0 on success, -1 on failure with errno set. ENOENT if absent, 
+ *         EINVAL if the value is not a decimal number.
+ */
+int yhtab_incr(yhtab_t *ht, char *key, int klen, uint64_t delta, int decr,
+               uint64_t *val, yhmeta_t *meta);
+
+/**
+ * @brief Change expiry of a key.
+ * 
+ * @param ht      - hash table
+ * @param key     - key
+ * @param klen    - key length
+ * @param exptime - expiry, unix time in secs, 0 for never
+ * 
+ * @return 0 on success, -1 on failure with errno set. ENOENT if absent.
+ */
+int yhtab_touch(yhtab_t *ht, char *key, int klen, uint32_t exptime);
+
+/**
+ * @brief Lookup several keys in one pass. All keys are hashed and their
+ *        slots prefetched before any is looked up.
+ * 
+ * @param ht   - hash table
+ * @param recs - keys, found objects are returned held in obj
+ * @param cnt  - number of keys
+ * 
+ * @return number of keys found.
+ */
+int yhtab_mget(yhtab_t *ht, yhget_t *recs, int cnt);
+
+/**
+ * @brief Bulk load records into table. Records are partitioned by slot
+ *        range and inserted by parallel workers, each taking a slot lock 
+ *        once per slot it touches rather than once per key. Objects of a
+ *        worker are allocated in a single block, every block before any
+ *        record is published, so a failed load leaves the table as it was.
+ *        Ranges past the first run on a pool of threads kept across loads,
+ *        or inline on the caller while another load holds the pool.
+ * 
+ * @param ht      - hash table
+ * @param recs    - records to load, reordered in place
+ * @param cnt     - number of records
+ * @param nworker - maximum number of parallel workers
+ * 
+ * @return number of records loaded, -1 on failure with errno set. 
+ */
+int yhtab_load(yhtab_t *ht, yhload_t *recs, int cnt, int nworker);
+
+/**
+ * @brief Visit every live object of a table, slot by slot, each slot
+ *        locked SHARED while its objects are visited. The table should
+ *        not grow meanwhile, its namespace frozen (yns_freeze).
+ * 
+ * @param ht  - hash table
+ * @param fn  - called for each object, non-zero return stops the walk
+ * @param arg - argument of fn
+ * 
+ * @return number of objects visited, -1 if fn stopped the walk, errno as
+ *         fn left it.
+ */
+ssize_t yhtab_walk(yhtab_t *ht, int (*fn)(void *arg, yhobj_t *obj), 
+                   void *arg);
 
 #endif
@@ -34,6 +34,20 @@
 #define YLOCK_STATE_MASK     ((1<<29) - 1)
 #define YLOCK_STATE_VAL(val) ((val) & YLOCK_STATE_MASK)
 
+#if defined(__x86_64__) || defined(__i386__)
+#define ylock_relax()     __builtin_ia32_pause()
+#else
+#define ylock_relax()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/**
+ * Park word transition, TRUE if it was 'val'.
+ */
+#define ylock_park_cas(park, val, nval) \
+         ({ int _v = (val); \
+            __atomic_compare_exchange_n((park), &_v, (nval), FALSE, \
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+
 /**
  * Compare and Swap 
  */
@@ -274,3 +288,74 @@ void ylock_dump(ylock_t *lock)
             (val & YLOCK_STATE_EXCL)   ? "[excl]"    : "");
 }
 
+
+/**
+ * Park the calling thread. Refer ylock.h for details.
+ *
+ * A thread leaves the park word only through a compare and swap from a 
+ * parked state, so exactly one of it and a waker wins, and the waker 
+ * knows whether it woke the thread.
+ */
+int ylock_park(int *park, int spin, int (*ready)(void *arg), void *arg)
+{
+  int        ind;
+  static int nspin = -1;
+
+  if (spin < 0)
+  {
+    if (nspin < 0)
+      nspin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? YLOCK_PARK_SPIN_MAX : 0;
+
+    spin = nspin;
+  }
+
+  __atomic_store_n(park, YLOCK_PARK_SPIN, __ATOMIC_SEQ_CST);
+
+  for (ind = 0; TRUE; ind++)
+  {
+    if (__atomic_load_n(park, __ATOMIC_ACQUIRE) == YLOCK_PARK_RUN)
+      return TRUE;
+
+    if (ready && ready(arg))
+    {
+      /* lost to a waker if it fails, the wake is taken anyway */
+      return !ylock_park_cas(park, YLOCK_PARK_SPIN, YLOCK_PARK_RUN);
+    }
+
+    if (ind >= spin)
+      break;
+
+    ylock_relax();
+  }
+
+  if (!ylock_park_cas(park, YLOCK_PARK_SPIN, YLOCK_PARK_SLEEP))
+    return TRUE;
+
+  while (__atomic_load_n(park, __ATOMIC_ACQUIRE) == YLOCK_PARK_SLEEP)
+    ylock_mem_wait(park, YLOCK_PARK_SLEEP, 0);
+
+  return TRUE;
+}
+
+/**
+ * Wake a parked thread. Refer ylock.h for details.
+ */
+int ylock_unpark(int *park)
+{
+  int val = __atomic_load_n(park, __ATOMIC_SEQ_CST);
+
+  while (val != YLOCK_PARK_RUN)
+  {
+    if (ylock_park_cas(park, val, YLOCK_PARK_RUN))
+    {
+      if (val == YLOCK_PARK_SLEEP)
+        ylock_mem_post(park);
+
+      return TRUE;
+    }
+
+    val = __atomic_load_n(park, __ATOMIC_SEQ_CST);
+  }
+
+  return FALSE;
+}
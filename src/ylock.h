@@ -120,4 +120,65 @@ int ylock_acq_int(ylock_t *lock, ylock_mode_t mode, int wait, char *str);
  */
 int ylock_rel_int(ylock_t *lock, ylock_mode_t mode, char *str);
 
+/**
+ * @brief Park word states. A thread parks on its own word, spinning on
+ *        it for a while before it sleeps on it (futex). A waker only
+ *        makes a system call for a thread that is asleep.
+ */
+#define YLOCK_PARK_RUN    0                           /**< running, or woken */
+#define YLOCK_PARK_SPIN   1                           /**< parked, spinning */
+#define YLOCK_PARK_SLEEP  2                           /**< parked, asleep */
+
+/**
+ * @brief Spin rounds before a parked thread sleeps, none on a single cpu
+ *        where spinning only delays the thread to wake it.
+ */
+#define YLOCK_PARK_SPIN_MAX  (2048)
+
+/**
+ * @brief Park the calling thread till ylock_unpark, or till 'ready' says
+ *        there is work. 'ready' is checked after the word is set, so work
+ *        queued before a waker looks at the word is never missed.
+ * 
+ * @param park  - park word of the thread
+ * @param spin  - spin rounds before sleeping, -1 for YLOCK_PARK_SPIN_MAX
+ *                on more than one cpu
+ * @param ready - work check, may be NULL
+ * @param arg   - argument of ready
+ * 
+ * @return TRUE if woken by ylock_unpark, FALSE if ready.
+ */
+int ylock_park(int *park, int spin, int (*ready)(void *arg), void *arg);
+
+/**
+ * @brief Wake a parked thread.
+ * 
+ * @param park - park word of the thread
+ * 
+ * @return TRUE if it was parked and is woken by this call, FALSE if it
+ *         was running or woken already.
+ */
+int ylock_unpark(int *park);
+
+/**
+ * @brief Wait while a memory location holds 'val' (futex). May return
+ *        early, callers check the location again.
+ * 
+ * @param ptr     - memory location
+ * @param val     - value to wait out
+ * @param timeout - unused, waits till posted
+ * 
+ * @return None.
+ */
+void ylock_mem_wait(int *ptr, int val, size_t timeout);
+
+/**
+ * @brief Wake every thread waiting on a memory location.
+ * 
+ * @param ptr - memory location
+ * 
+ * @return None.
+ */
+void ylock_mem_post(int *ptr);
+
 #endif /* ylock.h */
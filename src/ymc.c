@@ -0,0 +1,1127 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ycommon.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include <ytrace.h>
+#include <yns.h>
+#include <ycommand.h>
+#include <ymc.h>
+
+/**
+ * Commands, common to both protocols.
+ */
+#define YMC_CMD_NONE      0                            /* unknown command */
+#define YMC_CMD_GET       1
+#define YMC_CMD_GETS      2
+#define YMC_CMD_SET       3
+#define YMC_CMD_ADD       4
+#define YMC_CMD_REPLACE   5
+#define YMC_CMD_CAS       6
+#define YMC_CMD_DELETE    7
+#define YMC_CMD_INCR      8
+#define YMC_CMD_DECR      9
+#define YMC_CMD_TOUCH    10
+#define YMC_CMD_FLUSH    11
+#define YMC_CMD_VERSION  12
+#define YMC_CMD_STATS    13
+#define YMC_CMD_NOOP     14
+#define YMC_CMD_QUIT     15
+
+#define YMC_TOK_MAX      (8)            /* tokens of a text command, at most */
+#define YMC_VERSION      "1.6.0-yari"
+
+/**
+ * A decoded request. Key and value point into the input buffer.
+ */
+struct ymc_req_t
+{
+  int       bin;                                        /* binary protocol */
+  int       cmd;                                             /* YMC_CMD_* */
+  int       opcode;                              /* binary, echoed back */
+  int       quiet;                     /* noreply or a quiet binary opcode */
+  int       withkey;                  /* binary GETK, key echoed in reply */
+  uint32_t  opaque;                              /* binary, echoed back */
+  uint32_t  flags;
+  int64_t   exptime;                                           /* as sent */
+  uint64_t  cas;
+  uint64_t  delta;
+  uint64_t  initial;
+  int       noinit;                /* binary incr fails if the key is absent */
+  int       need;                 /* bytes needed to decode, on EAGAIN */
+  char     *err;                     /* text CLIENT_ERROR message if set */
+  ytoken_t  key;                    /* key, all keys of a text get */
+  ytoken_t  val;
+};
+typedef struct ymc_req_t ymc_req_t;
+
+/**
+ * Text commands.
+ */
+struct ymc_cmd_t
+{
+  char *name;
+  int   len;
+  int   cmd;
+};
+typedef struct ymc_cmd_t ymc_cmd_t;
+
+#define YMC_CMD(name, cmd) { name, sizeof(name) - 1, cmd }
+
+static ymc_cmd_t ymc_cmds[] =
+{
+  YMC_CMD("get",       YMC_CMD_GET),
+  YMC_CMD("gets",      YMC_CMD_GETS),
+  YMC_CMD("set",       YMC_CMD_SET),
+  YMC_CMD("add",       YMC_CMD_ADD),
+  YMC_CMD("replace",   YMC_CMD_REPLACE),
+  YMC_CMD("cas",       YMC_CMD_CAS),
+  YMC_CMD("delete",    YMC_CMD_DELETE),
+  YMC_CMD("incr",      YMC_CMD_INCR),
+  YMC_CMD("decr",      YMC_CMD_DECR),
+  YMC_CMD("touch",     YMC_CMD_TOUCH),
+  YMC_CMD("flush_all", YMC_CMD_FLUSH),
+  YMC_CMD("version",   YMC_CMD_VERSION),
+  YMC_CMD("stats",     YMC_CMD_STATS),
+  YMC_CMD("quit",      YMC_CMD_QUIT),
+  { NULL, 0, YMC_CMD_NONE }
+};
+
+/**
+ * Binary opcodes, as command and quietness.
+ */
+struct ymc_op_t
+{
+  int cmd;
+  int quiet;
+  int withkey;
+};
+typedef struct ymc_op_t ymc_op_t;
+
+static ymc_op_t ymc_ops[YMC_OP_MAX] =
+{
+  [YMC_OP_GET]      = { YMC_CMD_GET,     FALSE, FALSE },
+  [YMC_OP_SET]      = { YMC_CMD_SET,     FALSE, FALSE },
+  [YMC_OP_ADD]      = { YMC_CMD_ADD,     FALSE, FALSE },
+  [YMC_OP_REPLACE]  = { YMC_CMD_REPLACE, FALSE, FALSE },
+  [YMC_OP_DELETE]   = { YMC_CMD_DELETE,  FALSE, FALSE },
+  [YMC_OP_INCR]     = { YMC_CMD_INCR,    FALSE, FALSE },
+  [YMC_OP_DECR]     = { YMC_CMD_DECR,    FALSE, FALSE },
+  [YMC_OP_QUIT]     = { YMC_CMD_QUIT,    FALSE, FALSE },
+  [YMC_OP_FLUSH]    = { YMC_CMD_FLUSH,   FALSE, FALSE },
+  [YMC_OP_GETQ]     = { YMC_CMD_GET,     TRUE,  FALSE },
+  [YMC_OP_NOOP]     = { YMC_CMD_NOOP,    FALSE, FALSE },
+  [YMC_OP_VERSION]  = { YMC_CMD_VERSION, FALSE, FALSE },
+  [YMC_OP_GETK]     = { YMC_CMD_GET,     FALSE, TRUE  },
+  [YMC_OP_GETKQ]    = { YMC_CMD_GET,     TRUE,  TRUE  },
+  [YMC_OP_STAT]     = { YMC_CMD_STATS,   FALSE, FALSE },
+  [YMC_OP_SETQ]     = { YMC_CMD_SET,     TRUE,  FALSE },
+  [YMC_OP_ADDQ]     = { YMC_CMD_ADD,     TRUE,  FALSE },
+  [YMC_OP_REPLACEQ] = { YMC_CMD_REPLACE, TRUE,  FALSE },
+  [YMC_OP_DELETEQ]  = { YMC_CMD_DELETE,  TRUE,  FALSE },
+  [YMC_OP_INCRQ]    = { YMC_CMD_INCR,    TRUE,  FALSE },
+  [YMC_OP_DECRQ]    = { YMC_CMD_DECR,    TRUE,  FALSE },
+  [YMC_OP_QUITQ]    = { YMC_CMD_QUIT,    TRUE,  FALSE },
+  [YMC_OP_FLUSHQ]   = { YMC_CMD_FLUSH,   TRUE,  FALSE },
+  [YMC_OP_TOUCH]    = { YMC_CMD_TOUCH,   FALSE, FALSE },
+};
+
+/**
+ * Split a text line into space separated tokens, at most 'max'.
+ */
+static int ymc_text_tokens(char *cp, char *ep, ytoken_t *tok, int max)
+{
+  int cnt = 0;
+
+  while (cnt < max)
+  {
+    while (cp < ep && *cp == ' ')
+      cp++;
+
+    if (cp == ep)
+      break;
+
+    tok[cnt].str = cp;
+
+    while (cp < ep && *cp != ' ')
+      cp++;
+
+    tok[cnt].len = cp - tok[cnt].str;
+    cnt++;
+  }
+
+  return cnt;
+}
+
+/**
+ * Unsigned decimal token.
+ */
+static int ymc_text_num(ytoken_t *tok, uint64_t *val)
+{
+  int      ind;
+  uint64_t num = 0;
+
+  if (tok->len == 0 || tok->len > 20)
+    return y_error(EINVAL);
+
+  for (ind = 0; ind < tok->len; ind++)
+  {
+    if (!isdigit((unsigned char)tok->str[ind]))
+      return y_error(EINVAL);
+
+    if (num > (UINT64_MAX - (tok->str[ind] - '0')) / 10)
+      return y_error(ERANGE);
+
+    num = num * 10 + (tok->str[ind] - '0');
+  }
+
+  *val = num;
+
+  return 0;
+}
+
+/**
+ * Signed decimal token, expiry times may be negative.
+ */
+static int ymc_text_snum(ytoken_t *tok, int64_t *val)
+{
+  int      ret;
+  uint64_t num;
+  ytoken_t tmp = *tok;
+
+  if (tmp.len && tmp.str[0] == '-')
+  {
+    tmp.str++;
+    tmp.len--;
+  }
+
+  if ((ret = ymc_text_num(&tmp, &num)) != 0)
+    return ret;
+
+  if (num > INT32_MAX)
+    return y_error(ERANGE);
+
+  *val = (tmp.str != tok->str) ? -(int64_t)num : (int64_t)num;
+
+  return 0;
+}
+
+/**
+ * Trailing noreply of a text command.
+ */
+static inline int ymc_text_noreply(ytoken_t *tok)
+{
+  return (tok->len == 7 && memcmp(tok->str, "noreply", 7) == 0);
+}
+
+/**
+ * Decode a text request. A malformed command line is consumed and
+ * reported through the request, only an over long line is fatal.
+ */
+static int ymc_text_decode_req(ybuf_t *buf, ymc_req_t *req)
+{
+  int        ntok;
+  int        llen;
+  int        ind;
+  int        rem = ybuf_rem(buf);
+  char      *cp  = buf->sp;
+  char      *ep;
+  char      *nl;
+  uint64_t   num;
+  ytoken_t   tok[YMC_TOK_MAX];
+  ymc_cmd_t *mc;
+
+  if ((nl = memchr(cp, '\n', min(rem, YMC_LINE_MAX))) == NULL)
+  {
+    if (rem >= YMC_LINE_MAX)
+      return y_error(E2BIG);
+
+    req->need = rem + 1;
+    return y_error(EAGAIN);
+  }
+
+  llen = nl + 1 - cp;
+  ep   = (nl > cp && nl[-1] == '\r') ? nl - 1 : nl;
+  ntok = ymc_text_tokens(cp, ep, tok, YMC_TOK_MAX);
+
+  if (ntok == 0)
+  {
+    buf->sp += llen;
+    return 0;                                   /* req->cmd is YMC_CMD_NONE */
+  }
+
+  for (mc = ymc_cmds; mc->name; mc++)
+  {
+    if (mc->len == tok[0].len && memcmp(mc->name, tok[0].str, mc->len) == 0)
+      break;
+  }
+
+  req->cmd = mc->cmd;
+  req->err = "bad command line format";
+
+  switch (req->cmd)
+  {
+    case YMC_CMD_GET:
+    case YMC_CMD_GETS:
+      if (ntok < 2)
+        break;
+
+      req->key.str = tok[1].str;                 /* all keys, split later */
+      req->key.len = ep - tok[1].str;
+
+      for (cp = req->key.str; cp < ep; cp += ind)
+      {
+        for (ind = 0; (cp + ind < ep) && (cp[ind] != ' '); ind++)
+          ;
+
+        if (ind > YMC_KEY_MAX)
+          break;
+
+        ind = max(ind, 1);
+      }
+
+      if (cp >= ep)
+        req->err = NULL;
+
+      break;
+
+    case YMC_CMD_SET:
+    case YMC_CMD_ADD:
+    case YMC_CMD_REPLACE:
+    case YMC_CMD_CAS:
+      ind = (req->cmd == YMC_CMD_CAS) ? 6 : 5;
+
+      if ((ntok < ind) || (ntok > ind + 1) ||
+          (tok[1].len > YMC_KEY_MAX) ||
+          (ymc_text_num(&tok[2], &num) != 0) || (num > UINT32_MAX) ||
+          (ymc_text_snum(&tok[3], &req->exptime) != 0) ||
+          (ymc_text_num(&tok[4], &req->delta) != 0) ||
+          ((req->cmd == YMC_CMD_CAS) &&
+           (ymc_text_num(&tok[5], &req->cas) != 0)) ||
+          ((ntok == ind + 1) && !ymc_text_noreply(&tok[ind])))
+        break;
+
+      if (req->delta > YCMD_BULK_MAX)
+        return y_error(E2BIG);
+
+      req->flags = num;
+      req->key   = tok[1];
+      req->quiet = (ntok == ind + 1);
+
+      if (rem < llen + req->delta + 2)
+      {
+        req->need = llen + req->delta + 2;
+        return y_error(EAGAIN);
+      }
+
+      req->val.str = buf->sp + llen;
+      req->val.len = req->delta;
+
+      llen += req->delta + 2;
+
+      if (memcmp(req->val.str + req->val.len, "\r\n", 2) != 0)
+      {
+        req->err = "bad data chunk";
+        break;
+      }
+
+      req->err = NULL;
+      break;
+
+    case YMC_CMD_DELETE:
+    case YMC_CMD_TOUCH:
+      ind = (req->cmd == YMC_CMD_TOUCH) ? 3 : 2;
+
+      if ((ntok < ind) || (ntok > ind + 1) || (tok[1].len > YMC_KEY_MAX) ||
+          ((req->cmd == YMC_CMD_TOUCH) &&
+           (ymc_text_snum(&tok[2], &req->exptime) != 0)) ||
+          ((ntok == ind + 1) && !ymc_text_noreply(&tok[ind])))
+        break;
+
+      req->key   = tok[1];
+      req->quiet = (ntok == ind + 1);
+      req->err   = NULL;
+      break;
+
+    case YMC_CMD_INCR:
+    case YMC_CMD_DECR:
+      if ((ntok < 3) || (ntok > 4) || (tok[1].len > YMC_KEY_MAX) ||
+          ((ntok == 4) && !ymc_text_noreply(&tok[3])))
+        break;
+
+      if (ymc_text_num(&tok[2], &req->delta) != 0)
+      {
+        req->err = "invalid numeric delta argument";
+        break;
+      }
+
+      req->key    = tok[1];
+      req->quiet  = (ntok == 4);
+      req->noinit = TRUE;
+      req->err    = NULL;
+      break;
+
+    case YMC_CMD_FLUSH:
+      req->quiet = ((ntok > 1) && ymc_text_noreply(&tok[ntok - 1]));
+      req->err   = NULL;
+      break;
+
+    default:
+      req->err = NULL;
+      break;
+  }
+
+  buf->sp += llen;
+
+  return 0;
+}
+
+/**
+ * Decode a binary request.
+ */
+static int ymc_bin_decode_req(ybuf_t *buf, ymc_req_t *req)
+{
+  int        rem = ybuf_rem(buf);
+  char      *cp;
+  uint32_t   u32;
+  uint64_t   u64;
+  ymc_hdr_t  hdr;
+
+  if (rem < YMC_HDR_LEN)
+  {
+    req->need = YMC_HDR_LEN;
+    return y_error(EAGAIN);
+  }
+
+  ymc_hdr_decode(buf->sp, &hdr);
+
+  if ((hdr.blen > YCMD_BULK_MAX) || (hdr.klen + hdr.elen > hdr.blen))
+    return y_error(E2BIG);
+
+  if (rem < YMC_HDR_LEN + hdr.blen)
+  {
+    req->need = YMC_HDR_LEN + hdr.blen;
+    return y_error(EAGAIN);
+  }
+
+  cp = buf->sp + YMC_HDR_LEN;
+
+  req->bin     = TRUE;
+  req->opcode  = hdr.opcode;
+  req->opaque  = hdr.opaque;
+  req->cas     = hdr.cas;
+  req->key.str = cp + hdr.elen;
+  req->key.len = hdr.klen;
+  req->val.str = req->key.str + hdr.klen;
+  req->val.len = hdr.blen - hdr.elen - hdr.klen;
+
+  buf->sp += YMC_HDR_LEN + hdr.blen;
+
+  if (hdr.opcode >= YMC_OP_MAX)
+    return 0;                                   /* req->cmd is YMC_CMD_NONE */
+
+  req->cmd     = ymc_ops[hdr.opcode].cmd;
+  req->quiet   = ymc_ops[hdr.opcode].quiet;
+  req->withkey = ymc_ops[hdr.opcode].withkey;
+  req->err     = "Invalid arguments";
+
+  switch (req->cmd)
+  {
+    case YMC_CMD_GET:
+    case YMC_CMD_DELETE:
+      if (hdr.elen != 0 || hdr.klen == 0 || req->val.len != 0)
+        return 0;
+
+      break;
+
+    case YMC_CMD_SET:
+    case YMC_CMD_ADD:
+    case YMC_CMD_REPLACE:
+      if (hdr.elen != 8 || hdr.klen == 0)
+        return 0;
+
+      memcpy(&u32, cp, 4);      req->flags   = be32toh(u32);
+      memcpy(&u32, cp + 4, 4);  req->exptime = (int32_t)be32toh(u32);
+
+      if (req->cmd == YMC_CMD_SET && hdr.cas != 0)
+        req->cmd = YMC_CMD_CAS;
+
+      break;
+
+    case YMC_CMD_INCR:
+    case YMC_CMD_DECR:
+      if (hdr.elen != 20 || hdr.klen == 0 || req->val.len != 0)
+        return 0;
+
+      memcpy(&u64, cp, 8);       req->delta   = be64toh(u64);
+      memcpy(&u64, cp + 8, 8);   req->initial = be64toh(u64);
+      memcpy(&u32, cp + 16, 4);  u32          = be32toh(u32);
+
+      req->noinit  = (u32 == 0xffffffff);
+      req->exptime = (int32_t)u32;
+      break;
+
+    case YMC_CMD_TOUCH:
+      if (hdr.elen != 4 || hdr.klen == 0)
+        return 0;
+
+      memcpy(&u32, cp, 4);  req->exptime = (int32_t)be32toh(u32);
+      break;
+
+    case YMC_CMD_FLUSH:                      /* optional delay is ignored */
+      break;
+
+    default:
+      if (hdr.elen != 0 || hdr.klen != 0 || req->val.len != 0)
+        return 0;
+
+      break;
+  }
+
+  req->err = NULL;
+
+  return 0;
+}
+
+/**
+ * Decode a request, binary or text as told by its first byte.
+ */
+static int ymc_decode_req(ybuf_t *buf, ymc_req_t *req)
+{
+  memset(req, 0, sizeof(ymc_req_t));
+
+  if ((uint8_t)buf->sp[0] == YMC_MAGIC_REQ)
+    return ymc_bin_decode_req(buf, req);
+
+  return ymc_text_decode_req(buf, req);
+}
+
+/**
+ * Expiry as sent, to unix time in secs. Upto YMC_REL_MAX is relative to
+ * now, negative has already expired.
+ */
+static uint32_t ymc_exptime(int64_t exptime)
+{
+  if (exptime == 0)
+    return 0;
+
+  if (exptime < 0)
+    return 1;
+
+  if (exptime <= YMC_REL_MAX)
+    return time(NULL) + exptime;
+
+  return exptime;
+}
+
+/**
+ * Copy a string to output.
+ */
+static int ymc_out_str(ynet_ctx_t *ctx, char *str, int len)
+{
+  ybuf_t *buf = ctx->out->buf;
+
+  if (ycmd_out_reserve(ctx, len) != 0)
+    return -1;
+
+  memcpy(buf->ep, str, len);
+
+  buf->ep  += len;
+  buf->fre -= len;
+
+  return 0;
+}
+
+#define ymc_out_lit(ctx, lit) ymc_out_str(ctx, lit, sizeof(lit) - 1)
+
+/**
+ * Add a binary response header, with extras and key. Value of 'vlen'
+ * bytes is added by the caller, room for the part of it copied is
+ * reserved.
+ */
+static int ymc_out_bin(ynet_ctx_t *ctx, ymc_req_t *req, int status,
+                       char *ext, int elen, char *key, int klen, int vlen,
+                       uint64_t cas)
+{
+  ybuf_t    *buf = ctx->out->buf;
+  ymc_hdr_t  hdr;
+
+  if (ycmd_out_reserve(ctx, YMC_HDR_LEN + elen + klen +
+                            ycmd_out_copy_len(ctx, vlen)) != 0)
+    return -1;
+
+  hdr.magic  = YMC_MAGIC_RES;
+  hdr.opcode = req->opcode;
+  hdr.klen   = klen;
+  hdr.elen   = elen;
+  hdr.dtype  = 0;
+  hdr.status = status;
+  hdr.blen   = elen + klen + vlen;
+  hdr.opaque = req->opaque;
+  hdr.cas    = cas;
+
+  ymc_hdr_encode(buf->ep, &hdr);
+  buf->ep += YMC_HDR_LEN;
+
+  if (elen)
+    memcpy(buf->ep, ext, elen);
+
+  buf->ep += elen;
+
+  if (klen)
+    memcpy(buf->ep, key, klen);
+
+  buf->ep += klen;
+
+  buf->fre -= YMC_HDR_LEN + elen + klen;
+
+  return 0;
+}
+
+/**
+ * Add a binary error response, the message is the value.
+ */
+static int ymc_out_bin_err(ynet_ctx_t *ctx, ymc_req_t *req, int status)
+{
+  char *msg;
+
+  switch (status)
+  {
+    case YMC_ST_NOENT:      msg = "Not found";                   break;
+    case YMC_ST_EXISTS:     msg = "Data exists for key.";        break;
+    case YMC_ST_TOOBIG:     msg = "Too large.";                  break;
+    case YMC_ST_NOTSTORED:  msg = "Not stored.";                 break;
+    case YMC_ST_NONNUM:     msg = "Non-numeric server-side value for incr or decr"; break;
+    case YMC_ST_UNKNOWN:    msg = "Unknown command";             break;
+    case YMC_ST_NOMEM:      msg = "Out of memory";               break;
+    default:                msg = "Invalid arguments";           break;
+  }
+
+  if (ymc_out_bin(ctx, req, status, NULL, 0, NULL, 0, strlen(msg), 0) != 0)
+    return -1;
+
+  return ymc_out_str(ctx, msg, strlen(msg));
+}
+
+/**
+ * Add a value, for text protocol with its VALUE line and terminator.
+ */
+static int ymc_out_val(ynet_ctx_t *ctx, ymc_req_t *req, char *key, int klen,
+                       yhobj_t *obj)
+{
+  int       len;
+  uint32_t  flags;
+  ybuf_t   *buf = ctx->out->buf;
+  yhdata_t *val = yhobj_val(obj);
+
+  if (req->bin)
+  {
+    flags = htobe32(obj->flags);
+    len   = ymc_out_bin(ctx, req, YMC_ST_OK, (char *)&flags, 4, key,
+                        (req->withkey) ? klen : 0, val->len, obj->cas);
+  }
+  else if ((len = ycmd_out_reserve(ctx, klen + 64 +
+                                   ycmd_out_copy_len(ctx, val->len))) == 0)
+  {
+    if (req->cmd == YMC_CMD_GETS)
+      len = sprintf(buf->ep, "VALUE %.*s %u %d %" PRIu64 "\r\n",
+                    klen, key, obj->flags, val->len, obj->cas);
+    else
+      len = sprintf(buf->ep, "VALUE %.*s %u %d\r\n",
+                    klen, key, obj->flags, val->len);
+
+    buf->ep  += len;
+    buf->fre -= len;
+    len       = 0;
+  }
+
+  if (len != 0)
+  {
+    yhobj_release(obj);
+    return -1;
+  }
+
+  if (ycmd_out_data(ctx, val->data, val->len, obj) != 0)  /* obj released */
+    return -1;
+
+  return (req->bin) ? 0 : ymc_out_lit(ctx, "\r\n");
+}
+
+/**
+ * Text get and gets, keys looked up YMC_MGET_MAX at a time.
+ */
+static int ymc_text_get(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int       ret = 0;
+  int       cnt;
+  int       ind;
+  char     *cp  = req->key.str;
+  char     *ep  = cp + req->key.len;
+  ytoken_t  tok[YMC_MGET_MAX];
+  yhget_t   recs[YMC_MGET_MAX];
+  yhtab_t  *ht;
+
+  while ((cnt = ymc_text_tokens(cp, ep, tok, YMC_MGET_MAX)) > 0)
+  {
+    cp = tok[cnt - 1].str + tok[cnt - 1].len;
+
+    for (ind = 0; ind < cnt; ind++)
+    {
+      recs[ind].key  = tok[ind].str;
+      recs[ind].klen = tok[ind].len;
+      recs[ind].obj  = NULL;
+    }
+
+    if ((ht = yns_acq(ctx->ns)) == NULL)
+      return ymc_out_lit(ctx, "SERVER_ERROR no such namespace\r\n");
+
+    yhtab_mget(ht, recs, cnt);
+
+    yns_rel(ctx->ns);
+
+    for (ind = 0; ind < cnt; ind++)
+    {
+      if (recs[ind].obj == NULL)
+        continue;
+
+      if (ret == 0)
+        ret = ymc_out_val(ctx, req, recs[ind].key, recs[ind].klen,
+                          recs[ind].obj);
+      else
+        yhobj_release(recs[ind].obj);
+    }
+  }
+
+  return (ret == 0) ? ymc_out_lit(ctx, "END\r\n") : ret;
+}
+
+/**
+ * Binary get, quiet ones reply only on a hit.
+ */
+static int ymc_bin_get(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int      ret;
+  yhobj_t *obj = NULL;
+  yhtab_t *ht;
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    return ymc_out_bin_err(ctx, req, YMC_ST_INVAL);
+
+  ret = yhtab_get(&obj, ht, req->key.str, req->key.len); /* returned held */
+
+  yns_rel(ctx->ns);
+
+  if (ret == 0)
+    return ymc_out_val(ctx, req, req->key.str, req->key.len, obj);
+
+  return (req->quiet) ? 0 : ymc_out_bin_err(ctx, req, YMC_ST_NOENT);
+}
+
+/**
+ * Reply to a request without a value. 'res' is the text reply, status
+ * the binary one.
+ */
+static int ymc_out_res(ynet_ctx_t *ctx, ymc_req_t *req, char *res,
+                       int status, uint64_t cas)
+{
+  if (req->bin)
+  {
+    if (status != YMC_ST_OK)
+      return ymc_out_bin_err(ctx, req, status);
+
+    if (req->quiet)
+      return 0;
+
+    return ymc_out_bin(ctx, req, YMC_ST_OK, NULL, 0, NULL, 0, 0, cas);
+  }
+
+  return (req->quiet) ? 0 : ymc_out_str(ctx, res, strlen(res));
+}
+
+/**
+ * set, add, replace and cas.
+ */
+static int ymc_store(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int       ret;
+  int       mode;
+  yhtab_t  *ht;
+  yhmeta_t  meta;
+
+  switch (req->cmd)
+  {
+    case YMC_CMD_ADD:      mode = YHTAB_STORE_ADD;      break;
+    case YMC_CMD_REPLACE:  mode = YHTAB_STORE_REPLACE;  break;
+    case YMC_CMD_CAS:      mode = YHTAB_STORE_CAS;      break;
+    default:               mode = YHTAB_STORE_SET;      break;
+  }
+
+  meta.flags   = req->flags;
+  meta.exptime = ymc_exptime(req->exptime);
+  meta.cas     = req->cas;
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    ret = y_error(EINVAL);
+  else
+  {
+    ret = yhtab_store(NULL, ht, req->key.str, req->key.len,
+                      req->val.str, req->val.len, &meta, mode);
+
+    yns_rel(ctx->ns);
+  }
+
+  if (ret == 0)
+    return ymc_out_res(ctx, req, "STORED\r\n", YMC_ST_OK, meta.cas);
+
+  switch (errno)
+  {
+    case EEXIST:
+      return ymc_out_res(ctx, req, (mode == YHTAB_STORE_CAS) ?
+                                   "EXISTS\r\n" : "NOT_STORED\r\n",
+                         YMC_ST_EXISTS, 0);
+    case ENOENT:
+      return ymc_out_res(ctx, req, (mode == YHTAB_STORE_CAS) ?
+                                   "NOT_FOUND\r\n" : "NOT_STORED\r\n",
+                         YMC_ST_NOENT, 0);
+    case ENOMEM:
+      return ymc_out_res(ctx, req,
+                         "SERVER_ERROR out of memory storing object\r\n",
+                         YMC_ST_NOMEM, 0);
+  }
+
+  return ymc_out_res(ctx, req, "NOT_STORED\r\n", YMC_ST_NOTSTORED, 0);
+}
+
+static int ymc_delete(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int      ret;
+  yhtab_t *ht;
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    ret = y_error(ENOENT);
+  else
+  {
+    ret = yhtab_del(ht, req->key.str, req->key.len, req->cas);
+
+    yns_rel(ctx->ns);
+  }
+
+  if (ret == 0)
+    return ymc_out_res(ctx, req, "DELETED\r\n", YMC_ST_OK, 0);
+
+  if (errno == EEXIST)
+    return ymc_out_res(ctx, req, "EXISTS\r\n", YMC_ST_EXISTS, 0);
+
+  return ymc_out_res(ctx, req, "NOT_FOUND\r\n", YMC_ST_NOENT, 0);
+}
+
+static int ymc_incr(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int       ret;
+  int       len;
+  char      res[32];
+  uint64_t  val = req->initial;
+  yhtab_t  *ht;
+  yhmeta_t  meta = { 0, ymc_exptime(req->exptime), 0 };
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    ret = y_error(ENOENT);
+  else
+  {
+    ret = yhtab_incr(ht, req->key.str, req->key.len, req->delta,
+                     (req->cmd == YMC_CMD_DECR), &val,
+                     (req->noinit) ? NULL : &meta);
+
+    yns_rel(ctx->ns);
+  }
+
+  if (ret != 0)
+  {
+    if (errno == EINVAL)
+      return ymc_out_res(ctx, req, "CLIENT_ERROR cannot increment or "
+                         "decrement non-numeric value\r\n", YMC_ST_NONNUM, 0);
+
+    if (errno == ENOMEM)
+      return ymc_out_res(ctx, req, "SERVER_ERROR out of memory\r\n",
+                         YMC_ST_NOMEM, 0);
+
+    return ymc_out_res(ctx, req, "NOT_FOUND\r\n", YMC_ST_NOENT, 0);
+  }
+
+  if (req->quiet)
+    return 0;
+
+  if (req->bin)
+  {
+    val = htobe64(val);
+
+    if (ymc_out_bin(ctx, req, YMC_ST_OK, NULL, 0, NULL, 0, 8, meta.cas) != 0)
+      return -1;
+
+    return ymc_out_str(ctx, (char *)&val, 8);
+  }
+
+  len = snprintf(res, sizeof(res), "%" PRIu64 "\r\n", val);
+
+  return ymc_out_str(ctx, res, len);
+}
+
+static int ymc_touch(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int      ret;
+  yhtab_t *ht;
+
+  if ((ht = yns_acq(ctx->ns)) == NULL)
+    ret = y_error(ENOENT);
+  else
+  {
+    ret = yhtab_touch(ht, req->key.str, req->key.len,
+                      ymc_exptime(req->exptime));
+
+    yns_rel(ctx->ns);
+  }
+
+  if (ret == 0)
+    return ymc_out_res(ctx, req, "TOUCHED\r\n", YMC_ST_OK, 0);
+
+  return ymc_out_res(ctx, req, "NOT_FOUND\r\n", YMC_ST_NOENT, 0);
+}
+
+/**
+ * One counter, as a STAT line or a binary response.
+ */
+static int ymc_stat(ynet_ctx_t *ctx, ymc_req_t *req, char *name, size_t num)
+{
+  int  len;
+  char val[32];
+
+  len = snprintf(val, sizeof(val), "%zu", num);
+
+  if (req->bin)
+  {
+    return ((ymc_out_bin(ctx, req, YMC_ST_OK, NULL, 0, name, strlen(name),
+                         len, 0) != 0) ||
+            (ymc_out_str(ctx, val, len) != 0)) ? -1 : 0;
+  }
+
+  return ((ymc_out_lit(ctx, "STAT ") != 0) ||
+          (ymc_out_str(ctx, name, strlen(name)) != 0) ||
+          (ymc_out_lit(ctx, " ") != 0) ||
+          (ymc_out_str(ctx, val, len) != 0) ||
+          (ymc_out_lit(ctx, "\r\n") != 0)) ? -1 : 0;
+}
+
+/**
+ * Server counters, as STAT lines or one binary response each, closed by
+ * END or an empty binary response. Scheduler counters follow, per server
+ * thread.
+ */
+static int ymc_stats(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  int           ind;
+  int           cnt;
+  char          name[32];
+  ynet_stats_t  st;
+  struct
+  {
+    char   *name;
+    size_t  val;
+  } stats[6];
+
+  ynet_stats_fold();
+  ynet_stats_get(&st);
+
+  stats[0].name = "cmd_total";  stats[0].val = st.requests;
+  stats[1].name = "reads";      stats[1].val = st.reads;
+  stats[2].name = "writes";     stats[2].val = st.writes;
+  stats[3].name = "polls";      stats[3].val = st.polls;
+  stats[4].name = "parks";      stats[4].val = st.parks;
+  stats[5].name = "yields";     stats[5].val = st.yields;
+
+  for (ind = 0; ind < 6; ind++)
+  {
+    if (ymc_stat(ctx, req, stats[ind].name, stats[ind].val) != 0)
+      return -1;
+  }
+
+  cnt = __atomic_load_n(&ynet_sched_nthread, __ATOMIC_ACQUIRE);
+
+  if (cnt && ymc_stat(ctx, req, "threads", cnt) != 0)
+    return -1;
+
+  for (ind = 0; ind < cnt; ind++)
+  {
+    snprintf(name, sizeof(name), "thread_%d_conns", ind);
+
+    if (ymc_stat(ctx, req, name, __atomic_load_n(
+                   &ynet_sched_stats[ind].conns, __ATOMIC_RELAXED)) != 0)
+      return -1;
+
+    snprintf(name, sizeof(name), "thread_%d_migrations", ind);
+
+    if (ymc_stat(ctx, req, name, __atomic_load_n(
+                   &ynet_sched_stats[ind].migrations, __ATOMIC_RELAXED)) != 0)
+      return -1;
+  }
+
+  if (req->bin)
+    return ymc_out_bin(ctx, req, YMC_ST_OK, NULL, 0, NULL, 0, 0, 0);
+
+  return ymc_out_lit(ctx, "END\r\n");
+}
+
+static int ymc_version(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  if (req->bin)
+  {
+    if (ymc_out_bin(ctx, req, YMC_ST_OK, NULL, 0, NULL, 0,
+                    sizeof(YMC_VERSION) - 1, 0) != 0)
+      return -1;
+
+    return ymc_out_lit(ctx, YMC_VERSION);
+  }
+
+  return ymc_out_lit(ctx, "VERSION " YMC_VERSION "\r\n");
+}
+
+/**
+ * Execute a decoded request.
+ */
+static int ymc_server_exec(ynet_ctx_t *ctx, ymc_req_t *req)
+{
+  ytrace_msg(YTRACE_LEVEL1, "ymc_server_exec : cmd = %d : bin = %d\n",
+             req->cmd, req->bin);
+
+  ynet_tstats.requests++;
+
+  if (req->err)
+  {
+    if (req->bin)
+      return ymc_out_bin_err(ctx, req, YMC_ST_INVAL);
+
+    if ((ymc_out_lit(ctx, "CLIENT_ERROR ") != 0) ||
+        (ymc_out_str(ctx, req->err, strlen(req->err)) != 0))
+      return -1;
+
+    return ymc_out_lit(ctx, "\r\n");
+  }
+
+  switch (req->cmd)
+  {
+    case YMC_CMD_GET:
+    case YMC_CMD_GETS:
+      return (req->bin) ? ymc_bin_get(ctx, req) : ymc_text_get(ctx, req);
+
+    case YMC_CMD_SET:
+    case YMC_CMD_ADD:
+    case YMC_CMD_REPLACE:
+    case YMC_CMD_CAS:
+      return ymc_store(ctx, req);
+
+    case YMC_CMD_DELETE:
+      return ymc_delete(ctx, req);
+
+    case YMC_CMD_INCR:
+    case YMC_CMD_DECR:
+      return ymc_incr(ctx, req);
+
+    case YMC_CMD_TOUCH:
+      return ymc_touch(ctx, req);
+
+    case YMC_CMD_FLUSH:
+      if (yns_flush(ctx->ns) != 0)
+        return ymc_out_res(ctx, req, "SERVER_ERROR flush failed\r\n",
+                           YMC_ST_INVAL, 0);
+
+      return ymc_out_res(ctx, req, "OK\r\n", YMC_ST_OK, 0);
+
+    case YMC_CMD_VERSION:
+      return ymc_version(ctx, req);
+
+    case YMC_CMD_STATS:
+      return ymc_stats(ctx, req);
+
+    case YMC_CMD_NOOP:
+      return ymc_out_res(ctx, req, "", YMC_ST_OK, 0);
+
+    case YMC_CMD_QUIT:                   /* peer closes, binary one acked */
+      return (req->bin) ? ymc_out_res(ctx, req, "", YMC_ST_OK, 0) : 0;
+  }
+
+  if (req->bin)
+    return ymc_out_bin_err(ctx, req, YMC_ST_UNKNOWN);
+
+  return ymc_out_lit(ctx, "ERROR\r\n");
+}
+
+/**
+ * Process memcached requests. Refer ymc.h for details.
+ */
+int ymc_server_process_buf(ynet_ctx_t *ctx, ybuf_t *in)
+{
+  int        bin;
+  ymc_req_t  req;
+
+  ctx->need = 0;
+  ctx->held = FALSE;
+
+  while (ybuf_rem(in))
+  {
+    if (ycmd_out_room(ctx) != 0)
+    {
+      ctx->held = TRUE;
+      break;
+    }
+
+    bin = ((uint8_t)in->sp[0] == YMC_MAGIC_REQ);
+
+    if (ymc_decode_req(in, &req) == 0)
+    {
+      ymc_server_exec(ctx, &req);
+      continue;
+    }
+
+    if (errno == EAGAIN)
+    {
+      ctx->need = req.need;
+      break;
+    }
+
+    ytrace_msg(YTRACE_LEVEL1, "ymc_server_process_buf : decode failed : "
+               "%d\n", errno);
+
+    if (bin)
+    {
+      req.bin    = TRUE;
+      req.opcode = (uint8_t)in->sp[1];
+      memcpy(&req.opaque, in->sp + 12, 4);
+
+      ymc_out_bin_err(ctx, &req, YMC_ST_TOOBIG);
+    }
+    else
+      ymc_out_lit(ctx, "SERVER_ERROR object too large for cache\r\n");
+
+    in->sp = in->ep;                       /* framing lost, drop the rest */
+  }
+
+  if (ybuf_rem(in) == 0)
+    ybuf_reset(in);
+
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YMC_H
+
+#define _YMC_H
+
+#include <endian.h>
+#include <ycommon.h>
+#include <ynet.h>
+
+/**
+ * @file ymc.h - memcached Protocol Front End
+ *
+ * Served on its own listener port, YNET_MC_PORT by default. Both memcached protocols are accepted,
+ * detected per request from its first byte, YMC_MAGIC_REQ for binary and
+ * text otherwise. Supported are get, gets, set, add, replace, cas, delete,
+ * incr, decr, touch, flush_all, version, stats and their binary
+ * counterparts including quiet ones. Multi key text gets are looked up
+ * YMC_MGET_MAX keys per table pass.
+ *
+ * Binary header, big endian :
+ *
+ *   0      1       2        4       5       6        8        12       16
+ *   +------+-------+--------+-------+-------+--------+--------+--------+
+ *   |magic |opcode |key len |ext len|type   |status  |body len|opaque  |
+ *   +------+-------+--------+-------+-------+--------+--------+--------+
+ *   |cas                                                               |
+ *   +------------------------------------------------------------------+
+ */
+
+#define YMC_MAGIC_REQ     (0x80)                          /**< request magic */
+#define YMC_MAGIC_RES     (0x81)                         /**< response magic */
+#define YMC_HDR_LEN       (24)                           /**< header length */
+
+#define YMC_KEY_MAX       (250)                     /**< maximum key length */
+#define YMC_LINE_MAX      (2048)       /**< maximum text command line length */
+#define YMC_MGET_MAX      (64)             /**< keys looked up per table pass */
+#define YMC_REL_MAX       (60 * 60 * 24 * 30)  /**< max relative expiry, secs */
+
+/**
+ * Binary opcodes.
+ */
+#define YMC_OP_GET        (0x00)
+#define YMC_OP_SET        (0x01)
+#define YMC_OP_ADD        (0x02)
+#define YMC_OP_REPLACE    (0x03)
+#define YMC_OP_DELETE     (0x04)
+#define YMC_OP_INCR       (0x05)
+#define YMC_OP_DECR       (0x06)
+#define YMC_OP_QUIT       (0x07)
+#define YMC_OP_FLUSH      (0x08)
+#define YMC_OP_GETQ       (0x09)
+#define YMC_OP_NOOP       (0x0a)
+#define YMC_OP_VERSION    (0x0b)
+#define YMC_OP_GETK       (0x0c)
+#define YMC_OP_GETKQ      (0x0d)
+#define YMC_OP_STAT       (0x10)
+#define YMC_OP_SETQ       (0x11)
+#define YMC_OP_ADDQ       (0x12)
+#define YMC_OP_REPLACEQ   (0x13)
+#define YMC_OP_DELETEQ    (0x14)
+#define YMC_OP_INCRQ      (0x15)
+#define YMC_OP_DECRQ      (0x16)
+#define YMC_OP_QUITQ      (0x17)
+#define YMC_OP_FLUSHQ     (0x18)
+#define YMC_OP_TOUCH      (0x1c)
+#define YMC_OP_MAX        (0x1d)
+
+/**
+ * Binary response status.
+ */
+#define YMC_ST_OK         (0x00)
+#define YMC_ST_NOENT      (0x01)
+#define YMC_ST_EXISTS     (0x02)
+#define YMC_ST_TOOBIG     (0x03)
+#define YMC_ST_INVAL      (0x04)
+#define YMC_ST_NOTSTORED  (0x05)
+#define YMC_ST_NONNUM     (0x06)
+#define YMC_ST_UNKNOWN    (0x81)
+#define YMC_ST_NOMEM      (0x82)
+
+/**
+ * @struct ymc_hdr_t
+ *
+ * @brief  Binary header in host byte order.
+ */
+struct ymc_hdr_t
+{
+  uint8_t   magic;
+  uint8_t   opcode;
+  uint16_t  klen;                                         /**< key length */
+  uint8_t   elen;                                      /**< extras length */
+  uint8_t   dtype;                                /**< data type, always 0 */
+  uint16_t  status;                      /**< response status, vbucket id */
+  uint32_t  blen;                  /**< body length, extras + key + value */
+  uint32_t  opaque;                     /**< echoed back in the response */
+  uint64_t  cas;
+};
+typedef struct ymc_hdr_t ymc_hdr_t;
+
+/**
+ * @brief Encode header in wire format.
+ *
+ * @param dp  - destination, YMC_HDR_LEN bytes
+ * @param hdr - header
+ *
+ * @return None.
+ */
+static inline void ymc_hdr_encode(char *dp, ymc_hdr_t *hdr)
+{
+  uint16_t  u16;
+  uint32_t  u32;
+  uint64_t  u64;
+
+  dp[0] = hdr->magic;
+  dp[1] = hdr->opcode;
+  u16   = htobe16(hdr->klen);    memcpy(dp + 2,  &u16, 2);
+  dp[4] = hdr->elen;
+  dp[5] = hdr->dtype;
+  u16   = htobe16(hdr->status);  memcpy(dp + 6,  &u16, 2);
+  u32   = htobe32(hdr->blen);    memcpy(dp + 8,  &u32, 4);
+  u32   = hdr->opaque;           memcpy(dp + 12, &u32, 4);   /* as received */
+  u64   = htobe64(hdr->cas);     memcpy(dp + 16, &u64, 8);
+}
+
+/**
+ * @brief Decode header from wire format.
+ *
+ * @param sp  - source, YMC_HDR_LEN bytes
+ * @param hdr - header
+ *
+ * @return None.
+ */
+static inline void ymc_hdr_decode(char *sp, ymc_hdr_t *hdr)
+{
+  uint16_t  u16;
+  uint32_t  u32;
+  uint64_t  u64;
+
+  hdr->magic  = sp[0];
+  hdr->opcode = sp[1];
+  memcpy(&u16, sp + 2,  2);  hdr->klen   = be16toh(u16);
+  hdr->elen   = sp[4];
+  hdr->dtype  = sp[5];
+  memcpy(&u16, sp + 6,  2);  hdr->status = be16toh(u16);
+  memcpy(&u32, sp + 8,  4);  hdr->blen   = be32toh(u32);
+  memcpy(&u32, sp + 12, 4);  hdr->opaque = u32;
+  memcpy(&u64, sp + 16, 8);  hdr->cas    = be64toh(u64);
+}
+
+/**
+ * @brief Execute every complete memcached request in the input buffer,
+ *        same contract as the native protocols (ycmd_server_process).
+ *
+ * @param ctx - network context of the connection
+ * @param in  - input buffer
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ymc_server_process_buf(ynet_ctx_t *ctx, ybuf_t *in);
+
+#endif /* ymc.h */
@@ -0,0 +1,175 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <pthread.h>
+
+#include <ytrace.h>
+#include <ylock.h>
+#include <ynets.h>
+#include <ymux.h>
+#include <ynuma.h>
+#include <xxhash.h>
+
+/**
+ * @struct ymux_lane_t
+ *
+ * @brief  Lane, a thread running the tasks queued to it in order.
+ */
+struct ymux_lane_t
+{
+  yqueue_t   queue;                             /* tasks, by address */
+  int        park __attribute__((aligned(64)));   /* parked on when idle */
+  pthread_t  hdl;
+};
+typedef struct ymux_lane_t ymux_lane_t;
+
+static ymux_lane_t *ymux_lanes;
+static int          ymux_nlane;
+
+/**
+ * Whether a lane has tasks queued.
+ */
+static int ymux_lane_ready(void *arg)
+{
+  return !yqueue_is_empty(&((ymux_lane_t *)arg)->queue);
+}
+
+/**
+ * Lane driver, runs its tasks and hands them back to their connections.
+ */
+static void * ymux_lane_run(void *arg)
+{
+  uint64_t     val;
+  ymux_task_t *task;
+  ymux_lane_t *lane = (ymux_lane_t *)arg;
+
+  if (ynuma_thread_place(lane - ymux_lanes) >= 0)
+    ynuma_local(lane->queue.cells, 
+                (lane->queue.mask + 1) * sizeof(yqueue_cell_t));
+
+  while (TRUE)
+  {
+    while (yqueue_pop(&lane->queue, &val))
+    {
+      task = (ymux_task_t *)(uintptr_t)val;
+
+      task->err = ycmd_server_lane_exec(&task->req, task->ns, &task->obj);
+
+      ynet_conn_complete(task->fd, task);
+    }
+
+    ynet_stats_fold();
+
+    ylock_park(&lane->park, -1, ymux_lane_ready, lane);
+  }
+
+  return NULL;
+}
+
+/**
+ * Start the lanes. Refer ymux.h for details.
+ */
+int ymux_init(int nlane)
+{
+  int ind;
+
+  if (nlane <= 0 || nlane > YMUX_LANE_MAX)
+    return y_error(EINVAL);
+
+  ymux_lanes = (ymux_lane_t *)aligned_alloc(64, nlane * sizeof(ymux_lane_t));
+
+  if (ymux_lanes == NULL)
+    return y_error(ENOMEM);
+
+  for (ind = 0; ind < nlane; ind++)
+  {
+    ymux_lanes[ind].park = YLOCK_PARK_RUN;
+
+    if (yqueue_create(&ymux_lanes[ind].queue, YMUX_QUEUE_MAX) != 0)
+      return -1;
+
+    if (pthread_create(&ymux_lanes[ind].hdl, NULL, ymux_lane_run,
+                       &ymux_lanes[ind]) != 0)
+      return y_error(EAGAIN);
+  }
+
+  ymux_nlane      = nlane;
+  ycmd_mux_submit = ymux_submit;
+
+  ytrace_msg(YTRACE_DEFAULT, "ymux_init : %d lanes\n", nlane);
+
+  return 0;
+}
+
+/**
+ * Queue a request to its lane. Refer ymux.h for details.
+ */
+int ymux_submit(ynet_ctx_t *ctx, ycmd_req_t *req)
+{
+  int          len  = req->key.len + req->val.len;
+  ymux_lane_t *lane;
+  ymux_task_t *task;
+
+  if (ctx->mux >= YMUX_CONN_MAX)
+    return y_error(EAGAIN);
+
+  if ((task = (ymux_task_t *)malloc(sizeof(ymux_task_t) + len)) == NULL)
+    return y_error(ENOMEM);
+
+  task->fd  = ctx->sfd;
+  task->gen = ynet_conn_gen(ctx->sfd);
+  task->ns  = ctx->ns;
+  task->obj = NULL;
+  task->req = *req;
+
+  task->req.key.str = task->data;
+  task->req.val.str = task->data + req->key.len;
+
+  memcpy(task->req.key.str, req->key.str, req->key.len);
+  memcpy(task->req.val.str, req->val.str, req->val.len);
+
+  lane = &ymux_lanes[(hash_compute(req->key.str, req->key.len) + ctx->ns) %
+                     ymux_nlane];
+
+  if (!yqueue_push(&lane->queue, (uintptr_t)task))
+  {
+    free(task);
+    return y_error(EAGAIN);
+  }
+
+  ctx->mux++;
+
+  ylock_unpark(&lane->park);
+
+  return 0;
+}
+
+/**
+ * Finish a completed task. Refer ymux.h for details.
+ */
+void ymux_done(ynet_ctx_t *ctx, ymux_task_t *task, int live)
+{
+  if (live)
+  {
+    ycmd_server_lane_done(ctx, &task->req, task->err, task->obj);
+    ctx->mux--;
+  }
+  else if (task->obj)
+    yhobj_release(task->obj);
+
+  free(task);
+}
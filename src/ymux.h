@@ -0,0 +1,106 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YMUX_H
+
+#define _YMUX_H
+
+#include <ycommon.h>
+#include <ynet.h>
+#include <yqueue.h>
+#include <yhash.h>
+#include <ycommand.h>
+
+/**
+ * @file ymux.h - Request Multiplexing
+ *
+ * Binary GET and SET requests flagged YBIN_FLAG_MUX are not executed by
+ * the thread processing their connection, but handed as tasks to a pool
+ * of lanes, each a thread with a lock-free queue. The connection carries
+ * on decoding and the lanes run its requests in parallel. A completed
+ * task is pushed to a list of its connection and the connection is
+ * scheduled as for an event (ynets.h), so the thread processing it
+ * writes the response, with the request id echoed, as it completes.
+ *
+ * The lane is picked by namespace and key, so requests on one key run in
+ * the order they came, one at a time. Any other request waits for those
+ * in flight on its connection before it is executed, and is answered in
+ * order after them. Upto YMUX_CONN_MAX requests of a connection are in
+ * flight, more are held back as on a full output queue.
+ *
+ * Connections over io_uring or shm rings, and other protocols, ignore
+ * the flag and answer in order.
+ */
+
+#define YMUX_LANE_MAX   (1024)                       /**< lanes at most */
+#define YMUX_QUEUE_MAX  (4096)                    /**< tasks queued per lane */
+#define YMUX_CONN_MAX   (256)             /**< in flight per connection */
+
+/**
+ * @struct ymux_task_t
+ *
+ * @brief  Request in flight. Key and value are copied in after it, the
+ *         input buffer moves on.
+ */
+struct ymux_task_t
+{
+  struct ymux_task_t *next;     /**< completed list of the connection */
+  int                 fd;                 /**< connection descriptor */
+  uint32_t            gen;    /**< connection generation, when queued */
+  int                 ns;                        /**< namespace selected */
+  int                 err;                 /**< status, errno value or 0 */
+  yhobj_t            *obj;                       /**< value of GET, held */
+  ycmd_req_t          req;                   /**< key and value in data */
+  char                data[];
+};
+typedef struct ymux_task_t ymux_task_t;
+
+/**
+ * @brief Start the lanes, and route flagged requests of the server
+ *        through them (ycmd_mux_submit).
+ *
+ * @param nlane - number of lanes
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ymux_init(int nlane);
+
+/**
+ * @brief Queue a request to its lane. Called by the thread processing
+ *        the connection, which counts it in ctx->mux till ymux_done.
+ *
+ * @param ctx - network context of the connection
+ * @param req - decoded request, copied
+ *
+ * @return 0 on success, -1 on failure with errno set, EAGAIN if the lane
+ *         or the connection has no room for more.
+ */
+int ymux_submit(ynet_ctx_t *ctx, ycmd_req_t *req);
+
+/**
+ * @brief Finish a completed task : respond to it if its connection is
+ *        the one it was queued for, release its value and free it.
+ *
+ * @param ctx  - network context of the connection
+ * @param task - completed task
+ * @param live - FALSE if the connection was closed since it was queued
+ *
+ * @return None.
+ */
+void ymux_done(ynet_ctx_t *ctx, ymux_task_t *task, int live);
+
+#endif /* ymux.h */
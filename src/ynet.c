@@ -18,11 +18,23 @@
 #include <sys/types.h>   
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <poll.h>
 
 #include <ycommon.h>
 #include <ytrace.h>
 #include <ynet.h>
+#include <yshm.h>
+
+/**
+ * Globals.
+ */
+__thread ynet_stats_t  ynet_tstats;                 /**< this thread counters */
+static   ynet_stats_t  ynet_stats;                       /**< global counters */
+
+ynet_sched_stats_t ynet_sched_stats[YNET_SCHED_MAX];
+int                ynet_sched_nthread;
 
 /**
  * Connect to given address. Refer ynet.h for details
@@ -68,6 +80,47 @@ int ynet_connect(ynet_ctx_t *ctx, struct sockaddr_in *srv)
   
 }
 
+/**
+ * Connect to Unix domain socket. Refer ynet.h for details
+ */
+int ynet_connect_unix(ynet_ctx_t *ctx, char *path)
+{
+  struct sockaddr_un serv_addr;
+
+  if (path == NULL)
+    path = YNET_UNIX_PATH;
+
+  if (strlen(path) >= sizeof(serv_addr.sun_path))
+    return y_error(ENAMETOOLONG);
+
+  ctx->sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (ctx->sfd < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "socket creation failed : %d\n", errno);
+    return -1;
+  }
+
+  bzero((char *) &serv_addr, sizeof(serv_addr));
+
+  serv_addr.sun_family = AF_UNIX;
+  strcpy(serv_addr.sun_path, path);
+
+  if (connect(ctx->sfd, (struct sockaddr *)&serv_addr,
+              sizeof(serv_addr)) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "connect failed : %s : %d\n", path, errno);
+    close(ctx->sfd);
+    ctx->sfd = -1;
+
+    return -1;
+  }
+
+  ytrace_msg(YTRACE_LEVEL1, "connected to %s, fd = %d\n", path, ctx->sfd);
+
+  return 0;
+}
+
 /**
  * Send buffer to given network context. Refer ynet.h for details. 
  */
@@ -78,6 +131,19 @@ int ynet_send(ynet_ctx_t *ctx, ybuf_t *buf)
 
   ytrace_msg(YTRACE_LEVEL1, "ynet_send : enter\n",  ctx->sfd, rem);
 
+  if (ctx->class == YNET_CLASS_SHM)
+  {
+    struct iovec iov = { buf->sp, rem };
+
+    if (yshm_sendv(ctx, &iov, 1) != 0)
+      return -1;
+
+    buf->sp += rem;
+    return 0;
+  }
+
+  ynet_tstats.writes++;
+
   rc = write(ctx->sfd, (void *)buf->sp, rem);
 
   if (rc < 0)
@@ -90,6 +156,108 @@ int ynet_send(ynet_ctx_t *ctx, ybuf_t *buf)
   return 0;
 }
 
+/**
+ * Wait till the socket is ready for given events. 
+ */
+static int ynet_poll(ynet_ctx_t *ctx, int events)
+{
+  int           rc;
+  struct pollfd pfd;
+
+  pfd.fd     = ctx->sfd;
+  pfd.events = events;
+
+  do 
+  {
+    ynet_tstats.polls++;
+
+    rc = poll(&pfd, 1, YNET_IO_TIMEOUT);
+  }
+  while (rc < 0 && errno == EINTR);
+
+  if (rc == 0)
+    return y_error(ETIMEDOUT);
+
+  return (rc < 0) ? y_error(errno) : 0;
+}
+
+/**
+ * Send vector to given network context. Refer ynet.h for details. 
+ */
+int ynet_sendv(ynet_ctx_t *ctx, struct iovec *iov, int cnt)
+{
+  int rc;
+
+  if (ctx->class == YNET_CLASS_SHM)
+    return yshm_sendv(ctx, iov, cnt);
+
+  while (cnt)
+  {
+    ynet_tstats.writes++;
+
+    rc = writev(ctx->sfd, iov, cnt);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      if ((errno == EAGAIN) && (ynet_poll(ctx, POLLOUT) == 0))
+        continue;
+
+      return y_error(errno);
+    }
+
+    for (; cnt && rc >= iov->iov_len; iov++, cnt--)
+      rc -= iov->iov_len;
+
+    if (cnt)
+    {
+      iov->iov_base = (char *)iov->iov_base + rc;
+      iov->iov_len -= rc;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Receive fully from given network context. Refer ynet.h for details. 
+ */
+int ynet_recv_full(ynet_ctx_t *ctx, char *ptr, int len)
+{
+  int rc;
+
+  if (ctx->class == YNET_CLASS_SHM)
+    return (yshm_recv(ctx, ptr, len, TRUE) < 0) ? -1 : 0;
+
+  while (len)
+  {
+    ynet_tstats.reads++;
+
+    rc = read(ctx->sfd, ptr, len);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      if ((errno == EAGAIN) && (ynet_poll(ctx, POLLIN) == 0))
+        continue;
+
+      return y_error(errno);
+    }
+
+    if (rc == 0)
+      return y_error(ECONNRESET);
+
+    ptr += rc;
+    len -= rc;
+  }
+
+  return 0;
+}
+
 /**
  * Receive from given network context. Refer ynet.h for details. 
  */
@@ -100,7 +268,14 @@ int ynet_recv(ynet_ctx_t *ctx, ybuf_t *buf)
   ytrace_msg(YTRACE_LEVEL1, "sfd = %d, buf bp = %p, fre = %d \n",
              ctx->sfd, buf->ep, buf->fre);
 
-  rc = read(ctx->sfd, (void *)buf->ep, buf->fre);
+  if (ctx->class == YNET_CLASS_SHM)
+    rc = yshm_recv(ctx, buf->ep, buf->fre, FALSE);
+  else
+  {
+    ynet_tstats.reads++;
+
+    rc = read(ctx->sfd, (void *)buf->ep, buf->fre);
+  }
 
   if (rc < 0)
     return y_error(errno);
@@ -114,11 +289,269 @@ int ynet_recv(ynet_ctx_t *ctx, ybuf_t *buf)
   return 0;
 }
 
+/**
+ * Get output queue. Refer ynet.h for details.
+ */
+ynet_out_t * ynet_out_get(ynet_ctx_t *ctx, void (*rel)(void *ref))
+{
+  ynet_out_t *out = ctx->out;
+
+  if (out == NULL)
+  {
+    if ((out = (ynet_out_t *)malloc(sizeof(ynet_out_t))) == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    out->head = 0;
+    out->cnt  = 0;
+    out->mark = 0;
+    out->buf  = NULL;
+
+    ctx->out = out;
+  }
+
+  if (out->buf == NULL && (out->buf = ybuf_get()) == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  out->rel = rel;
+
+  return out;
+}
+
+/**
+ * Cover bytes gathered since last entry with an entry. Buffer entries
+ * hold offsets, resolved on write.
+ */
+static inline void ynet_out_close(ynet_out_t *out)
+{
+  int len = ynet_out_used(out);
+
+  if (len == out->mark)
+    return;
+
+  out->iov[out->cnt].iov_base = (void *)(size_t)out->mark;
+  out->iov[out->cnt].iov_len  = len - out->mark;
+  out->ref[out->cnt] = NULL;
+  out->cnt++;
+
+  out->mark = len;
+}
+
+/**
+ * Queue data by reference. Refer ynet.h for details.
+ */
+void ynet_out_ref(ynet_out_t *out, char *ptr, int len, void *ref)
+{
+  ynet_out_close(out);
+
+  out->iov[out->cnt].iov_base = ptr;
+  out->iov[out->cnt].iov_len  = len;
+  out->ref[out->cnt] = ref;
+  out->cnt++;
+}
+
+/**
+ * Resolve output queue into a vector. Refer ynet.h for details.
+ */
+int ynet_out_iov(ynet_ctx_t *ctx, struct iovec *iov)
+{
+  int         ind;
+  int         cnt;
+  ynet_out_t *out = ctx->out;
+
+  if (out == NULL || out->buf == NULL)
+    return 0;
+
+  ynet_out_close(out);
+
+  for (ind = out->head, cnt = 0; ind < out->cnt; ind++, cnt++)
+  {
+    iov[cnt] = out->iov[ind];
+
+    if (out->ref[ind] == NULL)
+      iov[cnt].iov_base = out->buf->bp + (size_t)iov[cnt].iov_base;
+  }
+
+  return cnt;
+}
+
+/**
+ * Consume written output. Refer ynet.h for details.
+ */
+int ynet_out_done(ynet_ctx_t *ctx, int len)
+{
+  ynet_out_t *out = ctx->out;
+
+  for (; out->head < out->cnt && len >= out->iov[out->head].iov_len; 
+       out->head++)
+  {
+    len -= out->iov[out->head].iov_len;
+
+    if (out->ref[out->head])
+      out->rel(out->ref[out->head]);
+  }
+
+  if (out->head < out->cnt)            /* partly written, keep the rest */
+  {
+    out->iov[out->head].iov_base = (char *)out->iov[out->head].iov_base + len;
+    out->iov[out->head].iov_len -= len;
+
+    return EAGAIN;
+  }
+
+  out->head = 0;
+  out->cnt  = 0;
+  out->mark = 0;
+
+  ybuf_reset(out->buf);
+
+  return 0;
+}
+
+/**
+ * Write output queue. Refer ynet.h for details.
+ */
+int ynet_out_flush(ynet_ctx_t *ctx)
+{
+  int           rc;
+  int           cnt;
+  struct iovec  iov[YNET_OUT_IOV];
+
+  if (ctx->async)
+    return EAGAIN;
+
+  while ((cnt = ynet_out_iov(ctx, iov)) > 0)
+  {
+    ynet_tstats.writes++;
+
+    rc = writev(ctx->sfd, iov, cnt);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        ynet_tstats.parks++;
+        return EAGAIN;
+      }
+
+      return y_error(errno);
+    }
+
+    if (ynet_out_done(ctx, rc) == 0)
+      break;
+  }
+
+  return 0;
+}
+
+/**
+ * Release output queue. Refer ynet.h for details.
+ */
+void ynet_out_put(ynet_ctx_t *ctx, int all)
+{
+  int         ind;
+  ynet_out_t *out = ctx->out;
+
+  if (out == NULL)
+    return;
+
+  for (ind = out->head; ind < out->cnt; ind++)
+  {
+    if (out->ref[ind])
+      out->rel(out->ref[ind]);
+  }
+
+  ybuf_put(out->buf);
+
+  out->head = 0;
+  out->cnt  = 0;
+  out->mark = 0;
+  out->buf  = NULL;
+
+  if (all)
+  {
+    free(out);
+    ctx->out = NULL;
+  }
+}
+
+/**
+ * Fold counters. Refer ynet.h for details.
+ */
+void ynet_stats_fold(void)
+{
+  ynet_stats_t *ts = &ynet_tstats;
+
+  if (ts->reads)    __sync_fetch_and_add(&ynet_stats.reads,    ts->reads);
+  if (ts->writes)   __sync_fetch_and_add(&ynet_stats.writes,   ts->writes);
+  if (ts->polls)    __sync_fetch_and_add(&ynet_stats.polls,    ts->polls);
+  if (ts->requests) __sync_fetch_and_add(&ynet_stats.requests, ts->requests);
+  if (ts->parks)    __sync_fetch_and_add(&ynet_stats.parks,    ts->parks);
+  if (ts->yields)   __sync_fetch_and_add(&ynet_stats.yields,   ts->yields);
+
+  memset(ts, 0, sizeof(*ts));
+}
+
+/**
+ * Get counters. Refer ynet.h for details.
+ */
+void ynet_stats_get(ynet_stats_t *stats)
+{
+  stats->reads    = __sync_fetch_and_add(&ynet_stats.reads,    0);
+  stats->writes   = __sync_fetch_and_add(&ynet_stats.writes,   0);
+  stats->polls    = __sync_fetch_and_add(&ynet_stats.polls,    0);
+  stats->requests = __sync_fetch_and_add(&ynet_stats.requests, 0);
+  stats->parks    = __sync_fetch_and_add(&ynet_stats.parks,    0);
+  stats->yields   = __sync_fetch_and_add(&ynet_stats.yields,   0);
+}
+
+/**
+ * Format scheduler counters. Refer ynet.h for details.
+ */
+int ynet_sched_stats_str(char *buf, int len)
+{
+  int ind;
+  int off;
+  int cnt = __atomic_load_n(&ynet_sched_nthread, __ATOMIC_ACQUIRE);
+
+  off = snprintf(buf, len, "conns");
+
+  for (ind = 0; ind < cnt && off < len; ind++)
+  {
+    off += snprintf(buf + off, len - off, "%s%zu", ind ? "/" : " ",
+                    __atomic_load_n(&ynet_sched_stats[ind].conns,
+                                    __ATOMIC_RELAXED));
+  }
+
+  if (off < len)
+    off += snprintf(buf + off, len - off, " migrations");
+
+  for (ind = 0; ind < cnt && off < len; ind++)
+  {
+    off += snprintf(buf + off, len - off, "%s%zu", ind ? "/" : " ",
+                    __atomic_load_n(&ynet_sched_stats[ind].migrations,
+                                    __ATOMIC_RELAXED));
+  }
+
+  return (off < len) ? off : len - 1;
+}
+
 /**
  * Close given network context. Refer ynet.h for details
  */
 int ynet_close(ynet_ctx_t *ctx)
 {
+  if (ctx->class == YNET_CLASS_SHM)
+    yshm_detach(ctx);
+
   close(ctx->sfd);
   return 0;
 }
@@ -18,6 +18,7 @@
 #ifndef _YNET_H
 
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #define _YNET_H
 
@@ -27,7 +28,13 @@
  * @brief Server host and port information. 
  */
 #define YNET_SER_PORT     22000
+#define YNET_RESP_PORT    6380             /**< RESP listener, if enabled */
+#define YNET_MC_PORT      11211       /**< memcached listener, if enabled */
 #define YNET_SER_HOST    "127.0.0.1"
+#define YNET_UNIX_PATH   "/tmp/yari.sock"  /**< Unix listener, if enabled */
+#define YNET_SHM_PATH    "/tmp/yari.shm"   /**< shm handshake, if enabled */
+
+#define YNET_IO_TIMEOUT  (30000)   /**< ms to wait on a stalled peer */
 
 /**
  * @brief Network class for given context ( associate socket fd with 
@@ -39,11 +46,83 @@
 #define YNET_CLASS_MSG    3
 #define YNET_CLASS_PIPE   4
 #define YNET_CLASS_EVENT  5
+#define YNET_CLASS_SHM    6         /**< shared memory rings, see yshm.h */
+
+#define YNET_OUT_IOV      (128)            /**< max queued output entries */
+
+/**
+ * @struct ynet_out_t
+ *
+ * @brief  Output queue of a connection. Bytes are gathered in 'buf' and 
+ *         data owned by others is queued by reference, released through
+ *         'rel' once written. Entries of buffer parts hold offsets, as the
+ *         buffer may move while it grows.
+ */
+struct ynet_out_t
+{
+  int           head;                    /* first entry not fully written */
+  int           cnt;                                    /* entries queued */
+  int           mark;                /* buffer offset not yet in an entry */
+  ybuf_t       *buf;                              /* from buffer pool */
+  void        (*rel)(void *ref);                /* release of references */
+  struct iovec  iov[YNET_OUT_IOV];
+  void         *ref[YNET_OUT_IOV];  /* reference of entry, NULL for buffer */
+};
+typedef struct ynet_out_t ynet_out_t;
+
+/**
+ * @struct ynet_stats_t
+ *
+ * @brief  Network counters. Counted per thread and folded into the global
+ *         counters through ynet_stats_fold.
+ */
+struct ynet_stats_t
+{
+  size_t  reads;                                        /* read syscalls */
+  size_t  writes;                               /* write/writev syscalls */
+  size_t  polls;          /* epoll/poll related syscalls, io_uring_enter */
+  size_t  requests;                                /* requests executed */
+  size_t  parks;                      /* output parked on a full socket */
+  size_t  yields;          /* connections requeued on a used up quota */
+};
+typedef struct ynet_stats_t ynet_stats_t;
+
+extern __thread ynet_stats_t ynet_tstats;        /**< this thread counters */
+
+#define YNET_SCHED_MAX    (1024)       /**< server threads with counters */
+
+/**
+ * @struct ynet_sched_stats_t
+ *
+ * @brief  Scheduler counters of a server thread, for checking balance.
+ *         Updated atomically, by whichever thread accepts, closes or
+ *         moves a connection.
+ */
+struct ynet_sched_stats_t
+{
+  size_t  conns;                    /* connections homed on the thread */
+  size_t  migrations;             /* connections moved to the thread */
+};
+typedef struct ynet_sched_stats_t ynet_sched_stats_t;
+
+extern ynet_sched_stats_t ynet_sched_stats[YNET_SCHED_MAX];
+extern int                ynet_sched_nthread;   /**< threads registered */
 
 struct ynet_ctx_t
 {
   int class;
   int sfd;
+  int ns;                                  /* namespace selected, server */
+  int proto;         /* wire protocol (YPROTO_*), of listener on server */
+  int need;                      /* bytes to complete partial input, server */
+  int held;                   /* input held back on full output, server */
+  int quota;             /* bytes left to read this pass, -1 unlimited */
+  int async;       /* output written by the caller (io_uring), server */
+  int mux;            /* requests in flight on lanes (ymux.h), server */
+  int lost;       /* framing lost, closed once answered, server */
+  ybuf_t *ibuf;                       /* pending input, server, from pool */
+  ynet_out_t *out;                              /* output queue, server */
+  struct yshm_t *shm;                /* rings of a YNET_CLASS_SHM context */
 };
 typedef struct ynet_ctx_t ynet_ctx_t;
 
@@ -55,6 +134,17 @@ typedef struct ynet_ctx_t ynet_ctx_t;
         {                           \
           (ctx)->class = (cls);     \
           (ctx)->sfd   = (fd);      \
+          (ctx)->ns    = 0;         \
+          (ctx)->proto = YPROTO_TEXT; \
+          (ctx)->need  = 0;           \
+          (ctx)->held  = FALSE;       \
+          (ctx)->quota = -1;          \
+          (ctx)->async = FALSE;       \
+          (ctx)->mux   = 0;           \
+          (ctx)->lost  = FALSE;       \
+          (ctx)->ibuf  = NULL;        \
+          (ctx)->out   = NULL;        \
+          (ctx)->shm   = NULL;        \
         }                           \
         while (FALSE)
 
@@ -69,13 +159,15 @@ typedef struct ynet_ctx_t ynet_ctx_t;
 int ynet_connect(ynet_ctx_t *ctx, struct sockaddr_in *srv);
 
 /**
- * @brief Wait on given network context. 
+ * @brief Connect to a Unix domain stream socket of a server on the same
+ *        host.
  * 
- * @param ctx - network context 
+ * @param ctx  - network context 
+ * @param path - socket path, YNET_UNIX_PATH if NULL
  * 
- * @return 0 on success, -1 on failure. 
+ * @return 0 on success, -1 on failure with errno set. 
  */
-int ynet_wait(ynet_ctx_t *ctx);
+int ynet_connect_unix(ynet_ctx_t *ctx, char *path);
 
 /**
  * @brief Send given buffer content on given network context. 
@@ -87,6 +179,30 @@ int ynet_wait(ynet_ctx_t *ctx);
  */
 int ynet_send(ynet_ctx_t *ctx, ybuf_t *buf);
 
+/**
+ * @brief Send given vector completely on given network context. Waits for
+ *        the socket to drain if it is non-blocking and full. 
+ * 
+ * @param ctx - network context 
+ * @param iov - vector, modified as it is consumed
+ * @param cnt - number of entries in vector
+ * 
+ * @return 0 on success, -1 on failure. 
+ */
+int ynet_sendv(ynet_ctx_t *ctx, struct iovec *iov, int cnt);
+
+/**
+ * @brief Receive exactly len bytes from given network context. Waits for 
+ *        data if the socket is non-blocking and empty. 
+ * 
+ * @param ctx - network context 
+ * @param ptr - destination
+ * @param len - bytes to receive
+ * 
+ * @return 0 on success, -1 on failure. 
+ */
+int ynet_recv_full(ynet_ctx_t *ctx, char *ptr, int len);
+
 /**
  * @brief Receive from given network context and place the data in buffer. 
  * 
@@ -97,6 +213,112 @@ int ynet_send(ynet_ctx_t *ctx, ybuf_t *buf);
  */
 int ynet_recv(ynet_ctx_t *ctx, ybuf_t *buf);
 
+/**
+ * @brief Get output queue of given context, created on first use.
+ * 
+ * @param ctx - network context 
+ * @param rel - release function for queued references
+ * 
+ * @return Output queue on success, NULL on failure with errno set. 
+ */
+ynet_out_t * ynet_out_get(ynet_ctx_t *ctx, void (*rel)(void *ref));
+
+/**
+ * @brief Queue data by reference, 'ref' is released once it is written.
+ *        Caller should make sure an entry is free.
+ * 
+ * @param out - output queue
+ * @param ptr - data
+ * @param len - length of data
+ * @param ref - reference to release, NULL if none
+ * 
+ * @return None.
+ */
+void ynet_out_ref(ynet_out_t *out, char *ptr, int len, void *ref);
+
+/**
+ * @brief Number of free entries in output queue.
+ */
+#define ynet_out_nfree(out) (YNET_OUT_IOV - (out)->cnt)
+
+/**
+ * @brief Bytes gathered in output queue buffer.
+ */
+#define ynet_out_used(out)  ((out)->buf->ep - (out)->buf->bp)
+
+/**
+ * @brief Write as much of the output queue as the socket takes, with a
+ *        single writev unless the socket accepts part of it. Never waits.
+ * 
+ * @param ctx - network context 
+ * 
+ * @return 0 if everything is written, -1 on failure with errno set, 
+ *         EAGAIN if the socket is full and output is left queued. Always
+ *         EAGAIN for an async context, whose output is written by caller.
+ */
+int ynet_out_flush(ynet_ctx_t *ctx);
+
+/**
+ * @brief Resolve queued output into a vector for writing. Queue must not
+ *        be added to till the write completes (ynet_out_done).
+ * 
+ * @param ctx - network context 
+ * @param iov - vector, YNET_OUT_IOV entries
+ * 
+ * @return Number of entries, 0 if nothing is queued.
+ */
+int ynet_out_iov(ynet_ctx_t *ctx, struct iovec *iov);
+
+/**
+ * @brief Consume written bytes from output queue, releasing references 
+ *        fully written. Queue is emptied once all is written.
+ * 
+ * @param ctx - network context 
+ * @param len - bytes written
+ * 
+ * @return 0 if everything is written, EAGAIN if output is left queued.
+ */
+int ynet_out_done(ynet_ctx_t *ctx, int len);
+
+/**
+ * @brief Release output queue. Buffer goes back to pool, references not
+ *        yet written are released. Queue is freed if 'all' is set, else
+ *        kept for reuse.
+ * 
+ * @param ctx - network context 
+ * @param all - free the queue itself too
+ * 
+ * @return None.
+ */
+void ynet_out_put(ynet_ctx_t *ctx, int all);
+
+/**
+ * @brief Fold this thread counters into the global counters.
+ * 
+ * @return None.
+ */
+void ynet_stats_fold(void);
+
+/**
+ * @brief Get global counters.
+ * 
+ * @param stats - counters
+ * 
+ * @return None.
+ */
+void ynet_stats_get(ynet_stats_t *stats);
+
+/**
+ * @brief Format the scheduler counters of the server threads, as
+ *        "conns c0/c1/.. migrations m0/m1/..", truncated to the buffer.
+ * 
+ * @param buf - buffer
+ * @param len - size of buffer
+ * 
+ * @return Length of the text, not more than len - 1.
+ */
+int ynet_sched_stats_str(char *buf, int len);
+
 /**
  * @brief Close given network context
  * 
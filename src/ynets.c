@@ -15,66 +15,80 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE                                             /* accept4 */
 #include <sys/types.h>   
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
-#include <sys/eventfd.h>
 
 #include <ytrace.h>
 #include <ynet.h>
 #include <ynets.h>
 #include <ythread.h>
 #include <ycommand.h>
+#include <yshm.h>
+#include <ymux.h>
 
 typedef struct epoll_event epoll_event;
 
-#define YNET_MAX_ENTRIES (4096)
 #define YNEVENT (1024)
+#define YNET_EPOLL_EVENTS (EPOLLIN | EPOLLET | EPOLLPRI | EPOLLRDHUP)
+#define YNET_LSNR_SCAN_MAX (4096)       /* listeners, waiters, looked up */
 
 /**
- * ynet_ctx_arr   - Maximum network contexts
- * ynet_conn_ctx  - Maximum incoming connections
- * 
- * These are based on socket fds. Hence the ulimit max fds should be less
- * than this value. 
+ * Network and connection context of a descriptor.
  */
-static ynet_ctx_t       ynet_ctx_arr[YNET_MAX_ENTRIES];
-static ynet_conn_ctx_t  ynet_conn_ctx[YNET_MAX_ENTRIES];
-static int              ynet_conn_ctx_max = YNET_MAX_ENTRIES;
+struct ynet_fd_ent_t
+{
+  ynet_ctx_t       nctx;
+  ynet_conn_ctx_t  conn;
+};
+typedef struct ynet_fd_ent_t ynet_fd_ent_t;
 
-typedef struct ynet_lsnr_ctx_t ynet_lsnr_ctx_t;
+/**
+ * ynet_fd_tab - Contexts of every descriptor in use, indexed by fd.
+ */
+static yfd_tab_t ynet_fd_tab = { sizeof(ynet_fd_ent_t) };
 
-static int ynet_waiter_wakeup(ynet_waiter_ctx_t *wctx, 
-                              ythread_ctx_t *myctx, int n);
+#define ynet_fd_get(fd, create) \
+          ((ynet_fd_ent_t *)yfd_get(&ynet_fd_tab, (fd), (create)))
 
 /**
- * Create event context. Refer ynets.h for details. 
+ * ynet_threads - Server threads by slot, for the affinity scheduler.
  */
-int ynet_event_create(ynet_event_ctx_t *ectx, int maxevents)
-{
-  ylock_init(&ectx->lock);
- 
-  ectx->events = (epoll_event *)malloc(maxevents * sizeof(epoll_event));
+static ythread_ctx_t *ynet_threads[YNET_SCHED_MAX];
 
-  if (!ectx->events)
-    return y_error(ENOMEM);
+int ynet_affinity;                          /* home threads, off */
+int ynet_conn_quota = YNET_CONN_QUOTA_DEFAULT;  /* bytes read per pass */
+int ynet_busy_spin;                         /* busy polling, usecs, off */
+int ynet_busy_read;
+int ynet_backlog   = YNET_BACKLOG_DEFAULT;
+int ynet_acceptors = 1;                  /* one listener per TCP port */
 
-  ectx->max = maxevents;
+static int ynet_lsnr_paused;                /* no accepting, handoff */
 
-  ynet_event_ctx_reset(ectx);
+static __thread int ynet_requeued;        /* this thread requeued one */
 
-  return 0;
-}
+static int ynet_waiter_wakeup(ynet_waiter_ctx_t *wctx, 
+                              ythread_ctx_t *myctx, int n);
+ynet_conn_ctx_t * ynet_event_conn_dequeue(ynet_waiter_ctx_t *wctx,
+                                          ythread_ctx_t *tctx);
+static int ynet_conn_event_add(ynet_conn_ctx_t *conn, uint32_t events);
+int ynet_conn_process(ynet_waiter_ctx_t *wctx, ynet_conn_ctx_t *conn);
 
 /**
  * Create waiter context. Refer ynets.h for details. 
  */
-int ynet_waiter_create(ynet_waiter_ctx_t *wctx, ynet_event_ctx_t *ectx)
+int ynet_waiter_create(ynet_waiter_ctx_t *wctx, yqueue_t *queue)
 {
-  int         sfd;
-  ynet_ctx_t *nctx;
+  int            sfd;
+  ynet_ctx_t    *nctx;
+  ynet_fd_ent_t *ent;
+  epoll_event    event;
 
   sfd = epoll_create(1024);
 
@@ -84,16 +98,42 @@ int ynet_waiter_create(ynet_waiter_ctx_t *wctx, ynet_event_ctx_t *ectx)
     return y_error(errno);
   }
 
-  nctx = &ynet_ctx_arr[sfd];
+  if ((ent = ynet_fd_get(sfd, TRUE)) == NULL)
+  {
+    close(sfd);
+    return -1;
+  }
+
+  nctx = &ent->nctx;
 
   ynet_ctx_init(nctx, YNET_CLASS_WAIT, sfd);
 
+  if ((wctx->bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "eventfd failed : %d\n", errno);
+    close(sfd);
+    return y_error(errno);
+  }
+
+  event.data.fd = wctx->bell;
+  event.events  = EPOLLIN | EPOLLET;
+
+  if (epoll_ctl(sfd, EPOLL_CTL_ADD, wctx->bell, &event) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "bell add failed : %d\n", errno);
+    close(wctx->bell);
+    close(sfd);
+    return y_error(errno);
+  }
+
   ylock_init(&wctx->lock);
 
   wctx->tctx = NULL;
   wctx->nctx = nctx;
-  wctx->ectx = ectx;
+  wctx->queue = queue;
   wctx->gen  = 0;
+  wctx->woken = 0;
+  wctx->wnext = 0;
 
   ylink_head_init(&wctx->whead);
 
@@ -105,66 +145,44 @@ int ynet_waiter_create(ynet_waiter_ctx_t *wctx, ynet_event_ctx_t *ectx)
 }
 
 /**
- * @brief  Queue 'n' events to global event context. Should be a quick
- *         operation, as other threads might wait on this event list to
- *         dequeue the same. 
- *
- * @return Number of events enqueued into the global enqueue list. 
+ * Make a socket non-blocking, for one not created or accepted so.
  */
-static int ynet_event_enqueue(ynet_event_ctx_t *ectx,
-                              struct epoll_event *events, int n)
-{
-  int   enq = 0;
-  int   ind1;
-  int   ind2;
-
-  ytrace_msg(YTRACE_LEVEL1,
-            "ynet_event_enqueue : %p : n = %d : head = %d, tail = %d\n",
-            ectx, n, ectx->head, ectx->tail);
-
-  if (ynet_event_ctx_nfree(ectx) >= n)
-  {
-    for (ind1 = 0; ind1 < n; ind1++)
-    {
-      ind2 = ectx->tail;
-      ectx->events[ind2] = events[ind1];
-      ectx->tail = (ectx->tail + 1) % ectx->max;
-    }
-
-    ytrace_msg(YTRACE_LEVEL1,
-              "ynet_event_enqueue : added %d events (head = %d, tail = %d)\n",
-              n, ectx->head, ectx->tail);
-    enq = n;
-  }
-  
-  return enq;
-}
-
-static int ynet_wait_ctx_add(ynet_ctx_t *wctx, ynet_ctx_t *nctx)
+static int ynet_nonblock_set(int sfd)
 {
   int flag;
-  struct epoll_event event;
 
-  if ((flag = fcntl(nctx->sfd, F_GETFL, 0)) < 0)
+  if ((flag = fcntl(sfd, F_GETFL, 0)) < 0)
   {
     ytrace_msg(YTRACE_ERROR,
-              "ynet_wait_ctx_add : fcntl get failed on fd = %d, errno = %d\n",
-              nctx->sfd, errno);
+              "ynet_nonblock_set : fcntl get failed on fd = %d, errno = %d\n",
+              sfd, errno);
 
     return y_error(errno);
   }
 
-  if (fcntl(nctx->sfd, F_SETFL, flag|O_NONBLOCK) < 0)
+  if (!(flag & O_NONBLOCK) && (fcntl(sfd, F_SETFL, flag|O_NONBLOCK) < 0))
   {
     ytrace_msg(YTRACE_ERROR,
-              "ynet_wait_ctx_add : fcntl set failed on fd = %d, errno = %d\n",
-              nctx->sfd, errno);
+              "ynet_nonblock_set : fcntl set failed on fd = %d, errno = %d\n",
+              sfd, errno);
 
     return y_error(errno);
   }
 
+  return 0;
+}
+
+/**
+ * Add a non-blocking socket to an epoll set.
+ */
+static int ynet_wait_ctx_add(ynet_ctx_t *wctx, ynet_ctx_t *nctx)
+{
+  struct epoll_event event;
+
   event.data.fd = nctx->sfd;
-  event.events  = EPOLLIN | EPOLLET | EPOLLPRI | EPOLLRDHUP;
+  event.events  = YNET_EPOLL_EVENTS;
+
+  ynet_tstats.polls++;
 
   if (epoll_ctl(wctx->sfd, EPOLL_CTL_ADD, nctx->sfd, &event) < 0)
   {
@@ -177,6 +195,29 @@ static int ynet_wait_ctx_add(ynet_ctx_t *wctx, ynet_ctx_t *nctx)
   return 0;
 }
 
+/**
+ * Arm or disarm write readiness events of a connection.
+ */
+static int ynet_wait_ctx_out(ynet_ctx_t *wctx, ynet_ctx_t *nctx, int on)
+{
+  struct epoll_event event;
+
+  event.data.fd = nctx->sfd;
+  event.events  = YNET_EPOLL_EVENTS | ((on) ? EPOLLOUT : 0);
+
+  ynet_tstats.polls++;
+
+  if (epoll_ctl(wctx->sfd, EPOLL_CTL_MOD, nctx->sfd, &event) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, 
+               "wait mod failed wctx = %p(%d), nctx = %p(%d), err = %d\n",
+               wctx, wctx->sfd, nctx, nctx->sfd, errno);
+    return -1;
+  }
+
+  return 0;
+}
+
 static int ynet_wait_ctx_rem(ynet_ctx_t *wctx, ynet_ctx_t *nctx)
 {
   epoll_ctl(wctx->sfd, EPOLL_CTL_DEL, nctx->sfd, NULL);
@@ -184,62 +225,206 @@ static int ynet_wait_ctx_rem(ynet_ctx_t *wctx, ynet_ctx_t *nctx)
   return 0;
 }
 
-ynet_ctx_t * ynet_lsnr_create(ynet_waiter_ctx_t *wctx)
+/**
+ * Create a listening socket. Refer ynets.h for details.
+ */
+int ynet_lsnr_socket(int port, int reuseport)
 {
   int sfd;
-  ynet_conn_ctx_t *conn;
-  ynet_ctx_t *nctx;
+  int one = 1;
   struct sockaddr_in serv_addr;
 
-  sfd = socket(AF_INET, SOCK_STREAM, 0);
+  sfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
   if (sfd < 0)
   {
     ytrace_msg(YTRACE_ERROR, "socket creation failed : %d\n", errno);
-    return NULL;
+    return -1;
+  }
+
+  /* restarts shouldn't wait for connections of the last run to expire */
+  setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  /* every reactor listens on the port, kernel picks one per connection */
+  if (reuseport &&
+      (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0))
+  {
+    ytrace_msg(YTRACE_ERROR, "SO_REUSEPORT failed : %d\n", errno);
+    close(sfd);
+    return -1;
   }
 
   bzero((char *) &serv_addr, sizeof(serv_addr));
 
   serv_addr.sin_family      = AF_INET;
   serv_addr.sin_addr.s_addr = INADDR_ANY;
-  serv_addr.sin_port        = htons(YNET_SER_PORT);
+  serv_addr.sin_port        = htons(port);
 
   if (bind(sfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
   {
     ytrace_msg(YTRACE_ERROR, "bind failed : %d\n", errno);
+    close(sfd);
+    return -1;
+  }
+
+  ynet_busy_read_set(sfd);                  /* inherited by connections */
+  ynet_nodelay_set(sfd);
+
+  if (listen(sfd, ynet_backlog) < 0)  /* connection bursts of many clients */
+  {
+    ytrace_msg(YTRACE_ERROR, "listen failed : %d\n", errno);
+    close(sfd);
+    return -1;
+  }
+
+  return sfd;
+}
+
+/**
+ * Check a TCP port is free. Refer ynets.h for details.
+ */
+int ynet_lsnr_probe(int port)
+{
+  int sfd;
+  int one = 1;
+  int ret = 0;
+  struct sockaddr_in serv_addr;
+
+  if ((sfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  /* as the listeners, connections of the last run don't count */
+  setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  bzero((char *) &serv_addr, sizeof(serv_addr));
+
+  serv_addr.sin_family      = AF_INET;
+  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  serv_addr.sin_port        = htons(port);
+
+  /* without SO_REUSEPORT, fails on any listener bound to it */
+  if (bind(sfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+    ret = -1;
+
+  close(sfd);
+
+  return ret;
+}
+
+ynet_ctx_t * ynet_lsnr_create(ynet_waiter_ctx_t *wctx, int port, int proto)
+{
+  int sfd;
+  ynet_ctx_t *nctx;
+
+  sfd = ynet_lsnr_socket(port, ynet_waiter_is_reactor(wctx) ||
+                              (ynet_acceptors > 1));
+
+  if (sfd < 0)
+    return NULL;
+
+  if ((nctx = ynet_lsnr_attach(wctx, sfd, proto)) == NULL)
+  {
     close(sfd);
     return NULL;
   }
 
-  listen(sfd, 5);
+  ytrace_msg(YTRACE_DEFAULT, "listen channel created : port = %d, fd = %d, "
+             "proto = %d\n", port, nctx->sfd, proto);
+
+  return nctx;
+}
+
+/**
+ * Create a Unix domain listening socket. Refer ynets.h for details.
+ */
+int ynet_lsnr_unix_socket(char *path)
+{
+  int sfd;
+  struct sockaddr_un serv_addr;
 
-  nctx = &ynet_ctx_arr[sfd];
-  conn = &ynet_conn_ctx[sfd];
+  if (strlen(path) >= sizeof(serv_addr.sun_path))
+    return y_error(ENAMETOOLONG);
 
-  ylock_init(&conn->lock);
+  sfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
-  conn->nctx  = nctx;
-  conn->state = YSTATE_WAITING;
+  if (sfd < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "socket creation failed : %d\n", errno);
+    return -1;
+  }
+
+  bzero((char *) &serv_addr, sizeof(serv_addr));
 
-  ynet_ctx_init(conn->nctx, YNET_CLASS_LSNR, sfd);
+  serv_addr.sun_family = AF_UNIX;
+  strcpy(serv_addr.sun_path, path);
 
-  if (!conn->init)
+  unlink(path);                            /* left behind by the last run */
+
+  if (bind(sfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
   {
-    ynet_event_create(&conn->ectx, YNET_EVENT_CTX_MAX);
-    conn->init = 1;
+    ytrace_msg(YTRACE_ERROR, "bind failed : %s : %d\n", path, errno);
+    close(sfd);
+    return -1;
   }
 
-  if (ynet_wait_ctx_add(wctx->nctx, conn->nctx) < 0)
+  if (listen(sfd, ynet_backlog) < 0)  /* connection bursts of many clients */
   {
+    ytrace_msg(YTRACE_ERROR, "listen failed : %s : %d\n", path, errno);
     close(sfd);
-    nctx->class = YNET_CLASS_NONE;
-    conn->state = YSTATE_FREE;
+    return -1;
+  }
+
+  ytrace_msg(YTRACE_DEFAULT, "unix listener : path = %s, fd = %d\n",
+             path, sfd);
+
+  return sfd;
+}
+
+/**
+ * Add a listening socket to a waiter. Refer ynets.h for details.
+ */
+ynet_ctx_t * ynet_lsnr_attach(ynet_waiter_ctx_t *wctx, int sfd, int proto)
+{
+  int fresh;
+  ynet_conn_ctx_t *conn;
+  ynet_ctx_t *nctx;
+  ynet_fd_ent_t *ent;
+
+  if ((ent = ynet_fd_get(sfd, TRUE)) == NULL)
+    return NULL;
+
+  nctx = &ent->nctx;
+  conn = &ent->conn;
+
+  fresh = (nctx->class != YNET_CLASS_LSNR || nctx->sfd != sfd);
+
+  if (fresh)                         /* not attached to another reactor */
+  {
+    ylock_init(&conn->lock);
+
+    conn->nctx  = nctx;
+    conn->state = YSTATE_WAITING;
+
+    ynet_ctx_init(conn->nctx, YNET_CLASS_LSNR, sfd);
+
+    nctx->proto = proto;                    /* inherited by connections */
+
+    conn->pend = 0;
+    conn->home = -1;                                  /* any thread */
+  }
+
+  if ((ynet_nonblock_set(sfd) != 0) ||
+      (ynet_wait_ctx_add(wctx->nctx, conn->nctx) < 0))
+  {
+    if (fresh)
+    {
+      nctx->class = YNET_CLASS_NONE;
+      conn->state = YSTATE_FREE;
+    }
+
     return NULL;
   }
 
-  ytrace_msg(YTRACE_DEFAULT, "listen channel created : port = %d, fd = %d\n",
-             YNET_SER_PORT, nctx->sfd);
   ytrace_msg(YTRACE_LEVEL1,
             "listen channel context : conn = %p, nctx = %p, wctx = %p\n",
              conn, nctx, wctx);
@@ -247,96 +432,428 @@ ynet_ctx_t * ynet_lsnr_create(ynet_waiter_ctx_t *wctx)
   return nctx;
 }
 
-int ynet_lsnr_destroy(ynet_lsnr_ctx_t *ctx)
+/**
+ * Descriptors of contexts of a class, in use.
+ */
+static int ynet_fd_scan(int class, int *fds, int max)
 {
-  return 0;
+  int            fd;
+  int            cnt = 0;
+  ynet_fd_ent_t *ent;
+
+  for (fd = 0; fd < YFD_ROOT * YFD_LEAF && cnt < max; fd++)
+  {
+    if ((ent = ynet_fd_get(fd, FALSE)) == NULL)
+    {
+      fd |= YFD_LEAF - 1;                          /* no leaf, skip over */
+      continue;
+    }
+
+    if ((ent->nctx.class == class) && (ent->nctx.sfd == fd))
+      fds[cnt++] = fd;
+  }
+
+  return cnt;
 }
 
-ynet_ctx_t * ynet_post_create(void)
+/**
+ * Listening sockets. Refer ynets.h for details.
+ */
+int ynet_lsnr_list(int *fds, int *protos, int max)
 {
-  int         efd;
-  ynet_ctx_t *pctx; 
+  int ind;
+  int cnt = ynet_fd_scan(YNET_CLASS_LSNR, fds, max);
 
-  efd = eventfd(0, 0);
+  for (ind = 0; ind < cnt; ind++)
+    protos[ind] = ynet_fd_get(fds[ind], FALSE)->nctx.proto;
+
+  return cnt;
+}
 
-  if (efd < 0)
+/**
+ * Stop or go on accepting. Refer ynets.h for details.
+ */
+void ynet_lsnr_pause(int pause)
+{
+  int                ind;
+  int                ind2;
+  int                nlsnr;
+  int                nwait;
+  int                lfds[YNET_LSNR_SCAN_MAX];
+  int                wfds[YNET_LSNR_SCAN_MAX];
+  ynet_conn_ctx_t   *conn;
+  struct epoll_event event;
+
+  __atomic_store_n(&ynet_lsnr_paused, pause, __ATOMIC_RELEASE);
+
+  nlsnr = ynet_fd_scan(YNET_CLASS_LSNR, lfds, YNET_LSNR_SCAN_MAX);
+
+  if (pause)
   {
-    ytrace_msg(YTRACE_ERROR,
-              "ynet_post_create : eventfd create failed : errno = %d\n",
-              errno);
-    return NULL;
+    /* passes see the flag from now on, wait out the ones running */
+    for (ind = 0; ind < nlsnr; ind++)
+    {
+      conn = &ynet_fd_get(lfds[ind], FALSE)->conn;
+
+      ylock_acq(&conn->lock, YLOCK_EXCL);
+      ylock_rel(&conn->lock, YLOCK_EXCL);
+    }
+
+    return;
+  }
+
+  /* edges that came while paused are gone, re-arming reports them again,
+   * on the waiters a listener is attached to */
+  nwait = ynet_fd_scan(YNET_CLASS_WAIT, wfds, YNET_LSNR_SCAN_MAX);
+
+  for (ind = 0; ind < nwait; ind++)
+  {
+    for (ind2 = 0; ind2 < nlsnr; ind2++)
+    {
+      event.data.fd = lfds[ind2];
+      event.events  = YNET_EPOLL_EVENTS;
+
+      epoll_ctl(wfds[ind], EPOLL_CTL_MOD, lfds[ind2], &event);
+    }
   }
+}
 
-  pctx = &ynet_ctx_arr[efd];
+/**
+ * Allocate contexts upfront. Refer ynets.h for details.
+ */
+int ynet_conn_reserve(int nconn)
+{
+  return yfd_reserve(&ynet_fd_tab, nconn);
+}
 
-  ynet_ctx_init(pctx, YNET_CLASS_EVENT, efd);
+/**
+ * Set SO_BUSY_POLL. Refer ynets.h for details.
+ */
+void ynet_busy_read_set(int sfd)
+{
+  static int warned;
+
+  if (ynet_busy_read == 0)
+    return;
+
+  if ((setsockopt(sfd, SOL_SOCKET, SO_BUSY_POLL, &ynet_busy_read,
+                  sizeof(ynet_busy_read)) < 0) && !warned)
+  {
+    warned = TRUE;
+    ytrace_msg(YTRACE_ERROR, "SO_BUSY_POLL failed : %d\n", errno);
+  }
+}
 
-  ytrace_msg(YTRACE_LEVEL1, "ynet_post_create : pctx = %p : efd = %d\n",
-             pctx, efd);
+/**
+ * Set TCP_NODELAY. Refer ynets.h for details.
+ */
+void ynet_nodelay_set(int sfd)
+{
+  int one = 1;
 
-  return pctx;
+  setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 }
 
-int ynet_wait(ynet_ctx_t *pctx)
+/**
+ * Wait for events of an epoll instance, spinning without blocking for 
+ * the busy poll budget first. With 'block' FALSE, only polls once.
+ */
+static int ynet_epoll_wait(int efd, epoll_event *events, int block)
 {
-  uint64_t val = 0;
+  int    nevn;
+  int    spin;
+  size_t beg = 0;
 
   while (TRUE)
   {
-    if (read(pctx->sfd, &val, sizeof(val)) < 0)
+    spin = ynet_busy_check(&beg);
+
+    if (yshm_poll(spin) && spin)       /* shm rings owned by this thread */
+      beg = 0;
+
+    ynet_tstats.polls++;
+
+    nevn = epoll_wait(efd, events, YNEVENT, (spin || !block) ? 0 : -1);
+
+    if (nevn < 0)
     {
-      if (errno == EAGAIN || errno == EINTR)
+      if ((errno == EINTR) || (errno == EAGAIN))
         continue;
-      
-      ytrace_msg(YTRACE_ERROR, "ynet_wait : read error : errno = %d\n", errno);
+
+      ytrace_msg(YTRACE_ERROR, "epoll exited with error = %d\n", errno);
       return y_error(errno);
     }
 
-    if (val)
-      break;
+    if (nevn || !block)
+      break;
+  }
+
+  return nevn;
+}
+
+/**
+ * Drain doorbell bytes of a shm connection, epoll is edge triggered.
+ */
+static void ynet_conn_bell(ynet_ctx_t *nctx)
+{
+  char junk[64];
+
+  do
+  {
+    ynet_tstats.reads++;
+  }
+  while (read(nctx->sfd, junk, sizeof(junk)) == sizeof(junk));
+}
+
+/**
+ * Ring the bell of a waiter, to end an epoll wait with nothing else to
+ * report.
+ */
+static void ynet_waiter_bell(ynet_waiter_ctx_t *wctx)
+{
+  uint64_t one = 1;
+
+  write(wctx->bell, &one, sizeof(one));
+}
+
+/**
+ * Take the rings of a waiter's bell, if that is what 'fd' reported.
+ */
+static int ynet_waiter_bell_take(ynet_waiter_ctx_t *wctx, int fd)
+{
+  uint64_t val;
+
+  if (fd != wctx->bell)
+    return FALSE;
+
+  ynet_tstats.reads++;
+
+  read(wctx->bell, &val, sizeof(val));
+
+  return TRUE;
+}
+
+/**
+ * Finish the requests of a connection completed on lanes, in the order 
+ * they completed. Those of a connection closed since are only freed, as
+ * all of them are if not 'live'.
+ */
+static void ynet_conn_drain(ynet_conn_ctx_t *conn, int live)
+{
+  ymux_task_t *task;
+  ymux_task_t *next;
+  ymux_task_t *prev = NULL;
+
+  task = __atomic_exchange_n(&conn->done, NULL, __ATOMIC_ACQUIRE);
+
+  for (; task; task = next)                   /* pushed last comes first */
+  {
+    next       = task->next;
+    task->next = prev;
+    prev       = task;
+  }
+
+  for (task = prev; task; task = next)
+  {
+    next = task->next;
+    ymux_done(conn->nctx, task, live && (task->gen == conn->gen));
+  }
+}
+
+/**
+ * Hand a completed request back to its connection. Refer ynets.h for
+ * details.
+ */
+void ynet_conn_complete(int fd, ymux_task_t *task)
+{
+  int                home;
+  int                woken = 0;
+  ythread_ctx_t     *tctx;
+  ynet_waiter_ctx_t *wctx;
+  ynet_conn_ctx_t   *conn = &ynet_fd_get(fd, FALSE)->conn;  /* had a request */
+
+  task->next = __atomic_load_n(&conn->done, __ATOMIC_RELAXED);
+
+  while (!__atomic_compare_exchange_n(&conn->done, &task->next, task, TRUE,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  if (__atomic_fetch_or(&conn->pend, YNET_PEND_MUX | YNET_PEND_SCHED,
+                        __ATOMIC_ACQ_REL) & YNET_PEND_SCHED)
+    return;                 /* queued or being processed, taken from there */
+
+  /* home thread or, of a shared waiter, any thread's waiter */
+  home = __atomic_load_n(&conn->home, __ATOMIC_RELAXED);
+  tctx = (home >= 0) ? ynet_threads[home] : NULL;
+  wctx = (tctx) ? tctx->wctx : ynet_threads[0]->wctx;
+
+  if (!tctx && ynet_waiter_is_reactor(wctx))  /* closed, freed on reuse */
+    return;
+
+  while (TRUE)
+  {
+    if (tctx && yqueue_push(&tctx->queue, (uint32_t)fd))
+    {
+      if ((woken = ylock_unpark(&tctx->park)))
+        __atomic_fetch_add(&wctx->woken, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    if (!ynet_waiter_is_reactor(wctx) && 
+        yqueue_push(wctx->queue, (uint32_t)fd))
+    {
+      woken = ynet_waiter_wakeup(wctx, NULL, 1);
+      break;
+    }
+
+    ynet_waiter_bell(wctx);              /* full, let the threads catch up */
+    sched_yield();
+  }
+
+  /* running threads see it before they block, except in epoll_wait */
+  if (!woken)
+    ynet_waiter_bell(wctx);
+}
+
+/**
+ * Generation of a connection. Refer ynets.h for details.
+ */
+uint32_t ynet_conn_gen(int fd)
+{
+  ynet_fd_ent_t *ent = ynet_fd_get(fd, FALSE);
+
+  return (ent) ? ent->conn.gen : 0;
+}
+
+/**
+ * Register a server thread. Refer ynets.h for details.
+ */
+int ynet_thread_attach(ythread_ctx_t *tctx)
+{
+  if (tctx->slot < 0 || tctx->slot >= YNET_SCHED_MAX)
+    return y_error(EINVAL);
+
+  tctx->overload = FALSE;
+
+  if (yqueue_create(&tctx->queue, YNET_HOME_QUEUE_MAX) != 0)
+    return -1;
+
+  ynet_threads[tctx->slot] = tctx;
+
+  if (tctx->slot >= ynet_sched_nthread)
+    __atomic_store_n(&ynet_sched_nthread, tctx->slot + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/**
+ * Home of a new connection : the accepting thread of a reactor, the
+ * thread with the fewest connections of a shared waiter with affinity,
+ * -1 (any thread) otherwise.
+ */
+static int ynet_thread_pick(ynet_waiter_ctx_t *wctx)
+{
+  int            ind;
+  int            best = -1;
+  size_t         cnt;
+  size_t         min  = 0;
+  ythread_ctx_t *self = ythread_self_ctx();
+
+  if (ynet_waiter_is_reactor(wctx))
+    return (self) ? self->slot : -1;
+
+  if (!ynet_affinity)
+    return -1;
+
+  for (ind = 0; ind < ynet_sched_nthread; ind++)
+  {
+    if (ynet_threads[ind] == NULL)
+      continue;
+
+    cnt = __atomic_load_n(&ynet_sched_stats[ind].conns, __ATOMIC_RELAXED);
+
+    if (best < 0 || cnt < min)
+    {
+      best = ind;
+      min  = cnt;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * Whether a thread's home queue backs up. Once over YNET_STEAL_HIGH, it
+ * stays overloaded till drained to YNET_STEAL_LOW, so that connections 
+ * don't move back and forth on every short burst.
+ */
+static int ynet_thread_overloaded(ythread_ctx_t *tctx)
+{
+  size_t cnt = yqueue_count(&tctx->queue);
+
+  if (tctx->overload)
+  {
+    if (cnt <= YNET_STEAL_LOW)
+      tctx->overload = FALSE;
   }
+  else if (cnt >= YNET_STEAL_HIGH)
+    tctx->overload = TRUE;
 
-  return 0;
+  return tctx->overload;
 }
 
-int ynet_post(ynet_ctx_t *pctx)
+/**
+ * An overloaded thread to steal from, other than 'tctx', NULL if none.
+ */
+static ythread_ctx_t * ynet_thread_victim(ythread_ctx_t *tctx)
 {
-  uint64_t val = 1;
+  int            ind;
+  int            cnt = ynet_sched_nthread;
+  ythread_ctx_t *vctx;
 
-  while (TRUE)
+  for (ind = 1; ind < cnt; ind++)
   {
-    if (write(pctx->sfd, &val, sizeof(val)) < 0)
-    {
-      if (errno == EAGAIN || errno == EINTR)
-        continue;
-      
-      ytrace_msg(YTRACE_ERROR, "ynet_wait : write error : errno = %d\n",
-                 errno);
-      return y_error(errno);
-    }
+    vctx = ynet_threads[(tctx->slot + ind) % cnt];
 
-    break;
+    if (vctx && ynet_thread_overloaded(vctx))
+      return vctx;
   }
 
-  return 0;
+  return NULL;
 }
 
+/**
+ * Whether a thread of a shared waiter has work : in its home queue, the
+ * shared queue, or an overloaded thread's queue.
+ */
+static int ynet_thread_ready(void *arg)
+{
+  ythread_ctx_t *tctx = (ythread_ctx_t *)arg;
+
+  return (!yqueue_is_empty(&tctx->queue) ||
+          !yqueue_is_empty(tctx->wctx->queue) ||
+          (ynet_thread_victim(tctx) != NULL));
+}
 
 static int ynet_lsnr_process(ynet_waiter_ctx_t *wctx, ynet_ctx_t *ctx)
 {
   int              sfd;
   ynet_ctx_t      *nctx;
   ynet_conn_ctx_t *conn;
-  struct sockaddr_in cli_addr;
-  int              clilen;
+  ynet_fd_ent_t   *ent;
+  ynet_out_t      *out;
+
+  /* handed off, connections are left to the new process */
+  if (__atomic_load_n(&ynet_lsnr_paused, __ATOMIC_ACQUIRE))
+    return 0;
 
   while (TRUE)
   {
-    sfd = accept(ctx->sfd, (struct sockaddr *) &cli_addr, &clilen);
+    sfd = accept4(ctx->sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
     if (sfd == -1)
     {
-      if (errno == EINTR)
+      /* reset by the peer while queued, go on with the rest */
+      if ((errno == EINTR) || (errno == ECONNABORTED))
         continue;
       else if (errno == EWOULDBLOCK)
         break;
@@ -349,25 +866,58 @@ static int ynet_lsnr_process(ynet_waiter_ctx_t *wctx, ynet_ctx_t *ctx)
       }
     }
 
-    ytrace_msg(YTRACE_DEFAULT, "new client connected (sfd = %d)\n", sfd);
+    ytrace_msg(YTRACE_LEVEL1, "new client connected (sfd = %d)\n", sfd);
+
+    if ((ent = ynet_fd_get(sfd, TRUE)) == NULL)
+    {
+      ytrace_msg(YTRACE_ERROR, "no context for fd = %d, errno = %d\n",
+                 sfd, errno);
+      close(sfd);
+      continue;
+    }
+
+    nctx = &ent->nctx;
+    conn = &ent->conn;
 
-    nctx = &ynet_ctx_arr[sfd];
+    /* the thread closing the last one on the descriptor may not be done
+     * with its context yet, the lock persists across connections */
+    ylock_acq(&conn->lock, YLOCK_EXCL);
 
-    nctx->sfd   = sfd;
-    nctx->class = YNET_CLASS_MSG;
+    out = nctx->out;                 /* left by the last one on the fd */
 
-    conn = &ynet_conn_ctx[sfd];
+    ynet_ctx_init(nctx, YNET_CLASS_MSG, sfd);
 
-    ylock_init(&conn->lock);
+    nctx->proto = ctx->proto;
+    nctx->out   = out;
 
-    if (!conn->init)
+    if ((ctx->proto == YPROTO_SHM) &&
+        (yshm_server_attach(nctx, ynet_waiter_is_reactor(wctx) &&
+                                  ynet_busy_spin) != 0))
     {
-      ynet_event_create(&conn->ectx, YNET_EVENT_CTX_MAX);
-      conn->init = 1;
+      close(sfd);
+      nctx->class = YNET_CLASS_NONE;
+      ylock_rel(&conn->lock, YLOCK_EXCL);
+      continue;
     }
 
-    conn->state = YSTATE_WAITING;
-    conn->nctx  = nctx;
+    if (ctx->proto == YPROTO_SHM)        /* native protocols over the rings */
+      nctx->proto = YPROTO_TEXT;
+
+    ynet_conn_drain(conn, FALSE);        /* late ones of the last holder */
+
+    conn->pend = 0;
+
+    conn->state   = YSTATE_WAITING;
+    conn->nctx    = nctx;
+    conn->pollout = FALSE;
+    conn->eof     = FALSE;
+    conn->home    = ynet_thread_pick(wctx);
+
+    if (conn->home >= 0)
+      __atomic_fetch_add(&ynet_sched_stats[conn->home].conns, 1,
+                         __ATOMIC_RELAXED);
+
+    ylock_rel(&conn->lock, YLOCK_EXCL);
 
     ynet_wait_ctx_add(wctx->nctx, nctx);
   }
@@ -375,60 +925,118 @@ static int ynet_lsnr_process(ynet_waiter_ctx_t *wctx, ynet_ctx_t *ctx)
   return 0;
 }
 
+/**
+ * @brief  Queue upto 'n' connections, by descriptor, to their home 
+ *         threads, waking them if parked, and those without a home or 
+ *         finding it full to the shared queue, in order, stopping when 
+ *         that is full. A parked thread is woken to steal from an 
+ *         overloaded home.
+ *
+ * @return Number of connections queued. 
+ */
+static int ynet_event_dispatch(ynet_waiter_ctx_t *wctx, ythread_ctx_t *myctx,
+                               int *fds, int n)
+{
+  int            enq;
+  int            home;
+  int            shared = 0;
+  int            wcnt;
+  ythread_ctx_t *tctx;
+
+  for (enq = 0; enq < n; enq++)
+  {
+    /* present, it just had an event */
+    home = __atomic_load_n(&ynet_fd_get(fds[enq], FALSE)->conn.home,
+                           __ATOMIC_RELAXED);
+    tctx = (home >= 0) ? ynet_threads[home] : NULL;
+
+    if (tctx && yqueue_push(&tctx->queue, (uint32_t)fds[enq]))
+    {
+      if ((tctx != myctx) && ylock_unpark(&tctx->park))
+        __atomic_fetch_add(&wctx->woken, 1, __ATOMIC_RELAXED);
+      else if (ynet_thread_overloaded(tctx))
+        ynet_waiter_wakeup(wctx, myctx, 1);
+
+      continue;
+    }
+
+    if (!yqueue_push(wctx->queue, (uint32_t)fds[enq]))
+      break;
+
+    shared++;
+  }
+
+  /* woken ones not running yet take shared ones, the waiter takes one */
+  wcnt = (int)yqueue_count(wctx->queue) - 1 -
+         __atomic_load_n(&wctx->woken, __ATOMIC_RELAXED);
+
+  if (wcnt > shared)
+    wcnt = shared;
+
+  if (wcnt > 0)
+    ynet_waiter_wakeup(wctx, myctx, wcnt);
+
+  ytrace_msg(YTRACE_LEVEL1, "ynet_event_dispatch : %p : queued %d of %d, "
+             "%d shared\n", wctx, enq, n, shared);
+
+  return enq;
+}
+
 int ynet_waiter_wait_on_wctx(ynet_waiter_ctx_t *wctx)
 {
-  int         tmp;
-  int         nevn;
-  ynet_ctx_t *nctx;
-  ynet_ctx_t *tctx;
-  ynet_event_ctx_t *ectx;
-  epoll_event events[YNEVENT];
+  int              ind;
+  int              nevn;
+  int              nfd  = 0;
+  int              done = 0;
+  int              block;
+  int              fds[YNEVENT];
+  ythread_ctx_t   *myctx = ythread_self_ctx();
+  ynet_ctx_t      *nctx;
+  ynet_conn_ctx_t *conn;
+  ynet_fd_ent_t   *ent;
+  epoll_event      events[YNEVENT];
 
   nctx = wctx->nctx;
-  ectx = wctx->ectx;
   
   ytrace_msg(YTRACE_LEVEL1,
             "ynet_waiter_wait_on_wctx : epoll wait in fd = %d\n",
              nctx->sfd);
 
-  do 
-  {
-    nevn = epoll_wait(nctx->sfd, events, YNEVENT, -1);
-
-    if (nevn < 0)
-    {
-      if ((errno == EINTR) || (errno == EAGAIN))
-        continue;
+  /* only a look with connections queued, requeued ones wait behind */
+  block = yqueue_is_empty(wctx->queue) &&
+          ((myctx == NULL) || yqueue_is_empty(&myctx->queue));
 
-      ytrace_msg(YTRACE_LEVEL1, "epoll exited with error = %d\n", errno);
-      return y_error(errno);
-    }
-    
-    break;
-  }
-  while (TRUE);
+  if ((nevn = ynet_epoll_wait(nctx->sfd, events, block)) < 0)
+    return -1;
 
   ytrace_msg(YTRACE_LEVEL1, "epoll returned = %d\n", nevn);
 
-  while (TRUE)
+  /* only connections not queued already */
+  for (ind = 0; ind < nevn; ind++)
   {
-    ylock_acq(&ectx->lock, YLOCK_EXCL);
+    if (ynet_waiter_bell_take(wctx, events[ind].data.fd))
+      continue;
 
-    tmp = ynet_event_enqueue(ectx, events, nevn);
+    if (((ent = ynet_fd_get(events[ind].data.fd, FALSE)) != NULL) &&
+        ynet_conn_event_add(&ent->conn, events[ind].events))
+      fds[nfd++] = events[ind].data.fd;
+  }
 
-    if (tmp == nevn)
-    {
-      ynet_waiter_wakeup(wctx, ythread_self_ctx(), nevn);
-      ylock_rel(&ectx->lock, YLOCK_EXCL);
-      break;
-    }
+  while (TRUE)
+  {
+    done += ynet_event_dispatch(wctx, myctx, fds + done, nfd - done);
 
-    ylock_rel(&ectx->lock, YLOCK_EXCL);
+    if (done == nfd)
+      break;
 
     ytrace_msg(YTRACE_LEVEL1,
-              "ynet_waiter_wait_on_wctx : enqueue is full, sleeping\n");
+              "ynet_waiter_wait_on_wctx : queue is full, helping out\n");
 
-    sleep(3);                                  /* TODO : sleep on waiter gen */
+    /* backpressure : no more epoll waits till the workers catch up */
+    if ((conn = ynet_event_conn_dequeue(wctx, myctx)) != NULL)
+      ynet_conn_process(wctx, conn);
+    else
+      sched_yield();            /* cells held by preempted workers */
   }
 
   return 0;
@@ -436,111 +1044,283 @@ int ynet_waiter_wait_on_wctx(ynet_waiter_ctx_t *wctx)
 
 int ynet_waiter_idle(ythread_ctx_t *tctx)
 {
-  ytrace_msg(YTRACE_LEVEL1, "ynet_waiter_idle : enter wait\n");
+  size_t             beg  = 0;
+  ynet_waiter_ctx_t *wctx = tctx->wctx;
+
+  /* peek at the queues while spinning, a stale post is harmless */
+  while (ynet_busy_check(&beg))
+  {
+    if (ynet_thread_ready(tctx))
+      return 0;
+  }
+
+  ytrace_msg(YTRACE_LEVEL1, "ynet_waiter_idle : park\n");
 
-  return ynet_wait(tctx->pctx);
+  if (ylock_park(&tctx->park, -1, ynet_thread_ready, tctx))
+    __atomic_fetch_sub(&wctx->woken, 1, __ATOMIC_RELAXED);
+
+  return 0;
 }
 
-/* ectx lock should be in exclusive mode */
+/**
+ * Wake upto 'n' parked threads, other than the waiting thread 'myctx'.
+ * The scan starts past the thread woken last, to spread the work. Returns
+ * the number woken.
+ */
 int ynet_waiter_wakeup(ynet_waiter_ctx_t *wctx, ythread_ctx_t *myctx, int n)
 {
-  int cnt;
-  int wcnt = n;
-  ylink_t *link;
+  int            ind;
+  int            cnt = ynet_sched_nthread;
+  int            beg = wctx->wnext;
+  int            woken = 0;
   ythread_ctx_t *tctx;
 
-  cnt = ylink_head_count(&wctx->whead);
-
   ytrace_msg(YTRACE_LEVEL1, "ynet_waiter_wakeup : waking up %d threads\n", n);
 
-  for (link = ylink_head_first(&wctx->whead);
-       link && cnt && wcnt;
-       cnt--, link = ylink_head_next(&wctx->whead, link))
+  for (ind = 0; ind < cnt && n; ind++)
   {
-    tctx = ylink_get_obj(link, ythread_ctx_t, wlink);
+    tctx = ynet_threads[(beg + ind) % cnt];
 
-    if (tctx == myctx)
+    if (!tctx || tctx == myctx || !ylock_unpark(&tctx->park))  /* running */
       continue;
 
-    ynet_post(tctx->pctx);
+    __atomic_fetch_add(&wctx->woken, 1, __ATOMIC_RELAXED);
+
+    wctx->wnext = (beg + ind + 1) % cnt;
 
     ytrace_msg(YTRACE_LEVEL1,
               "ynet_waiter_wakeup : (2) : woken up %d\n", tctx->ind);
 
-    wcnt--;
+    n--;
+    woken++;
   }
+
+  return woken;
+}
+
+/**
+ * Merge events into the pending word of a connection and mark it
+ * scheduled. Returns TRUE if it wasn't, the caller then has to queue or
+ * process it.
+ */
+static int ynet_conn_event_add(ynet_conn_ctx_t *conn, uint32_t events)
+{
+  uint32_t pend = YNET_PEND_SCHED;
+
+  if (events & (EPOLLIN|EPOLLPRI))
+    pend |= YNET_PEND_IN;
+
+  if (events & EPOLLOUT)
+    pend |= YNET_PEND_OUT;
+
+  if (events & (EPOLLHUP|EPOLLERR))
+    pend |= YNET_PEND_HUP;
+  else if (events & EPOLLRDHUP)              /* read upto the end of input */
+    pend |= YNET_PEND_RDHUP | YNET_PEND_IN;
+
+  pend = __atomic_fetch_or(&conn->pend, pend, __ATOMIC_ACQ_REL);
+
+  return !(pend & YNET_PEND_SCHED);
+}
+
+/**
+ * Done with a connection, clear its scheduled bit. Fails if events came
+ * in since they were last taken, the caller then makes another pass.
+ */
+static int ynet_conn_unsched(ynet_conn_ctx_t *conn)
+{
+  uint32_t exp = YNET_PEND_SCHED;
+
+  return __atomic_compare_exchange_n(&conn->pend, &exp, 0, FALSE,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Move a connection home to the thread that stole it.
+ */
+static void ynet_conn_migrate(ynet_conn_ctx_t *conn, ythread_ctx_t *from,
+                              ythread_ctx_t *tctx)
+{
+  if (conn->home != from->slot)               /* moved or closed already */
+    return;
+
+  __atomic_store_n(&conn->home, tctx->slot, __ATOMIC_RELAXED);
+
+  __atomic_fetch_sub(&ynet_sched_stats[from->slot].conns, 1,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ynet_sched_stats[tctx->slot].conns, 1,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ynet_sched_stats[tctx->slot].migrations, 1,
+                     __ATOMIC_RELAXED);
 }
 
-ynet_conn_ctx_t * ynet_event_conn_dequeue(ynet_event_ctx_t *ectx)
+/**
+ * Take connections off the queues of a thread, till a live one is found :
+ * its home queue first, then the shared queue, then the home queue of an
+ * overloaded thread. It is returned locked, for the caller to process. No 
+ * lock is held across connections. A connection is queued once till it 
+ * is processed, so its lock is only held by one finishing its previous 
+ * pass.
+ */
+ynet_conn_ctx_t * ynet_event_conn_dequeue(ynet_waiter_ctx_t *wctx,
+                                          ythread_ctx_t *tctx)
 {
+  int               fd;
+  uint64_t          val;
   ynet_conn_ctx_t  *conn = NULL;
   ynet_conn_ctx_t  *tcon = NULL;
-  ynet_event_ctx_t *tectx;
-  epoll_event      *event;
+  ythread_ctx_t    *from;
+  ynet_fd_ent_t    *ent;
 
-  ylock_acq(&ectx->lock, YLOCK_EXCL);
-
-  while (ectx->head != ectx->tail)
+  while (!conn)
   {
-    event = &ectx->events[ectx->head];
+    from = NULL;
+
+    if (!yqueue_pop(&tctx->queue, &val) &&
+        !yqueue_pop(wctx->queue, &val) &&
+        (((from = ynet_thread_victim(tctx)) == NULL) ||
+         !yqueue_pop(&from->queue, &val)))
+      break;
 
-    ytrace_msg(YTRACE_LEVEL1, "dequeue event : %p (head = %d) %d\n",
-               event, ectx->head, event->data.fd);
+    fd = (int)(uint32_t)val;
 
-    do 
-    {
-      if (event->data.fd >= ynet_conn_ctx_max)                    /* discard */
-        break;
+    ytrace_msg(YTRACE_LEVEL1, "dequeue connection : fd = %d\n", fd);
+
+    if ((ent = ynet_fd_get(fd, FALSE)) == NULL)                 /* discard */
+      continue;
       
-      tcon  = &ynet_conn_ctx[event->data.fd];
+    tcon = &ent->conn;
 
-      ylock_acq(&tcon->lock, YLOCK_EXCL);
+    ylock_acq(&tcon->lock, YLOCK_EXCL);
 
-      if (tcon->state == YSTATE_FREE) 
-      {
-        ytrace_msg(YTRACE_ERROR,
-                  "ynet_event_conn_dequeue : event in freed fd %d\n",
-                   event->data.fd);
-        ylock_rel(&tcon->lock, YLOCK_EXCL);
-        break;
-      }
+    if (tcon->state == YSTATE_FREE)     /* events raced with its closing */
+    {
+      ytrace_msg(YTRACE_LEVEL1,
+                "ynet_event_conn_dequeue : event in freed fd %d\n", fd);
+      __atomic_store_n(&tcon->pend, 0, __ATOMIC_RELEASE);
+      ynet_conn_drain(tcon, FALSE);
+      ylock_rel(&tcon->lock, YLOCK_EXCL);
+      continue;
+    }
 
-      tectx = &tcon->ectx;
+    if (from)
+      ynet_conn_migrate(tcon, from, tctx);
 
-      if (!ynet_event_ctx_nfree(tectx))
-      {
-        ytrace_msg(YTRACE_ERROR,
-                  "ynet_event_conn_dequeue : discarding event fd %d "
-                  "as it is full\n",
-                   event->data.fd);
-        ylock_rel(&tcon->lock, YLOCK_EXCL);
-        break;
-      }
+    conn = tcon;                       /* leave the connection locked */
+  }
 
-      tectx->events[tectx->tail] = *event;
-      tectx->tail = (tectx->tail + 1) % tectx->max;
+  return conn;
+}
 
-      if (tcon->state == YSTATE_WAITING)
-        conn = tcon;                 /* leave the connection locked */
-      else 
-      {
-        ytrace_msg(YTRACE_LEVEL1, 
-                  "ynet_event_conn_dequeue : task not in wait state %d\n",
-                   tcon->state);
-        ylock_rel(&tcon->lock, YLOCK_EXCL);
-      }
-    }
-    while (FALSE);
+/**
+ * Write responses queued during a ynet_conn_process pass. Requests held
+ * back on full output are resumed as the output drains. If the socket 
+ * doesn't take all of it, the rest stays parked and write readiness is 
+ * armed, so the connection is processed again once it can be written.
+ */
+static void ynet_conn_flush(ynet_waiter_ctx_t *wctx, ynet_conn_ctx_t *conn)
+{
+  int         ret;
+  ynet_ctx_t *nctx = conn->nctx;
 
-    ectx->head = (ectx->head + 1) % (ectx->max);  /* dequeued */
+  /* held on requests in flight, resumed as they are answered */
+  while (((ret = ynet_out_flush(nctx)) == 0) && nctx->held && !nctx->mux)
+    ycmd_server_process(nctx);
 
-    if (conn)
-      break;
+  if (ret == EAGAIN)
+  {
+    if (!conn->pollout && (ynet_wait_ctx_out(wctx->nctx, nctx, TRUE) == 0))
+      conn->pollout = TRUE;
+
+    return;
   }
 
-  ylock_rel(&ectx->lock, YLOCK_EXCL);
+  if (conn->pollout && (ynet_wait_ctx_out(wctx->nctx, nctx, FALSE) == 0))
+    conn->pollout = FALSE;
 
-  return conn;
+  ynet_out_put(nctx, FALSE);               /* idle, buffer back to pool */
+}
+
+/**
+ * Queue a connection that used up its quota back at the tail : to the 
+ * reactor thread processing it, its home thread, or the shared queue. It
+ * stays scheduled, with input pending, so no other event queues it. 
+ * FALSE if the queue is full.
+ */
+static int ynet_conn_requeue(ynet_waiter_ctx_t *wctx, ynet_conn_ctx_t *conn)
+{
+  int            home = conn->home;
+  yqueue_t      *queue;
+  ythread_ctx_t *tctx;
+
+  if (ynet_waiter_is_reactor(wctx))
+  {
+    if ((tctx = ythread_self_ctx()) == NULL)
+      return FALSE;
+
+    queue = &tctx->queue;
+  }
+  else if ((home >= 0) && (tctx = ynet_threads[home]))
+    queue = &tctx->queue;
+  else
+    queue = wctx->queue;
+
+  __atomic_fetch_or(&conn->pend, YNET_PEND_IN, __ATOMIC_RELEASE);
+
+  if (!yqueue_push(queue, (uint32_t)conn->nctx->sfd))
+    return FALSE;
+
+  /* the waiter helping out may requeue to a parked home thread */
+  if ((queue != wctx->queue) && (tctx != ythread_self_ctx()) &&
+      ylock_unpark(&tctx->park))
+    __atomic_fetch_add(&wctx->woken, 1, __ATOMIC_RELAXED);
+
+  ynet_tstats.yields++;
+  ynet_requeued = TRUE;
+
+  ytrace_msg(YTRACE_LEVEL1, "ynet_conn_requeue : %p : fd = %d\n", conn,
+             conn->nctx->sfd);
+
+  return TRUE;
+}
+
+/**
+ * Close a connection, releasing its lock. Output not written yet is
+ * dropped.
+ */
+static void ynet_conn_close(ynet_waiter_ctx_t *wctx, ynet_conn_ctx_t *conn)
+{
+  ynet_ctx_t *nctx = conn->nctx;
+
+  ytrace_msg(YTRACE_LEVEL1, "ynet_process : hup, closing conn %p\n", conn);
+
+  ynet_wait_ctx_rem(wctx->nctx, nctx);
+
+  ynet_close(nctx);
+
+  ybuf_put(nctx->ibuf);                  /* partial input, back to pool */
+  ynet_out_put(nctx, FALSE);         /* queue kept for the next on fd */
+
+  nctx->ibuf = NULL;
+  nctx->held = FALSE;
+  nctx->sfd = 0;
+  nctx->class = YNET_CLASS_NONE;
+
+  if (conn->home >= 0)
+    __atomic_fetch_sub(&ynet_sched_stats[conn->home].conns, 1,
+                       __ATOMIC_RELAXED);
+
+  conn->home = -1;
+  conn->eof  = FALSE;
+  conn->gen++;
+
+  ynet_conn_drain(conn, FALSE);               /* lanes may add more */
+
+  __atomic_store_n(&conn->pend, 0, __ATOMIC_RELEASE);
+
+  conn->state = YSTATE_FREE;
+
+  ylock_rel(&conn->lock, YLOCK_EXCL);
 }
 
 /* 
@@ -552,8 +1332,7 @@ ynet_conn_ctx_t * ynet_event_conn_dequeue(ynet_event_ctx_t *ectx)
 int ynet_conn_process(ynet_waiter_ctx_t *wctx, ynet_conn_ctx_t *conn)
 {
   ynet_ctx_t       *nctx;
-  epoll_event      *event;
-  ynet_event_ctx_t *ectx;
+  uint32_t          pend;
   int               ret = 0;
 
   if (conn->state != YSTATE_WAITING)
@@ -564,58 +1343,81 @@ int ynet_conn_process(ynet_waiter_ctx_t *wctx, ynet_conn_ctx_t *conn)
     exit(-1);
   }
 
-  ectx = &conn->ectx;
   nctx = conn->nctx;
   conn->state = YSTATE_RUNNING;
 
-  while (TRUE)
-  {
-    if (ynet_event_ctx_is_empty(ectx))
-      break;
-
-    event = &ectx->events[ectx->head];
-
-    ytrace_msg(YTRACE_LEVEL1,
-              "ynet_process : %p : fd = %d : evt = 0x%x : class = %d \n",
-               nctx, nctx->sfd, event->events, nctx->class);
+  nctx->quota = (ynet_conn_quota > 0) ? ynet_conn_quota : -1;
 
-    if (event->events & (EPOLLHUP|EPOLLERR|EPOLLRDHUP))
+  do
+  {
+    while ((pend = __atomic_exchange_n(&conn->pend, YNET_PEND_SCHED,
+                                       __ATOMIC_ACQ_REL) & ~YNET_PEND_SCHED))
     {
-      ytrace_msg(YTRACE_LEVEL1, "ynet_process : hup, closing conn %p\n", conn);
+      ytrace_msg(YTRACE_LEVEL1,
+                "ynet_process : %p : fd = %d : pend = 0x%x : class = %d \n",
+                 nctx, nctx->sfd, pend, nctx->class);
 
-      ynet_event_ctx_reset(ectx);
-
-      ynet_wait_ctx_rem(wctx->nctx, nctx);
+      /* input that came along with a hangup is read first */
+      switch (nctx->class)
+      {
+        case YNET_CLASS_WAIT:
+          printf("TODO\n");
+          break;
+        case YNET_CLASS_LSNR:
+          ret = ynet_lsnr_process(wctx, nctx);
+          break;
+        case YNET_CLASS_MSG:
+          if (pend & YNET_PEND_MUX)
+            ynet_conn_drain(conn, TRUE);
+
+          /* answers may let held requests go on */
+          if ((pend & YNET_PEND_IN) || ((pend & YNET_PEND_MUX) && nctx->held))
+            ret = ycmd_server_process(nctx);
+          break;
+        case YNET_CLASS_SHM:
+          if (pend & YNET_PEND_IN)
+          {
+            ynet_conn_bell(nctx);
+            ret = yshm_server_process(nctx);
+          }
+          break;
+        default:
+          printf("TODO : %d\n", nctx->class);
+      }
 
-      ynet_close(nctx);
+      /* a half closed connection gets its pipeline answered, others
+       * are done with, its output can't be written anymore */
+      if ((pend & YNET_PEND_HUP) ||
+          ((pend & YNET_PEND_RDHUP) && (nctx->class != YNET_CLASS_MSG)))
+      {
+        ynet_conn_close(wctx, conn);
+        return 0;
+      }
 
-      nctx->sfd = 0;
-      nctx->class = YNET_CLASS_NONE;
+      if (pend & YNET_PEND_RDHUP)
+        conn->eof = TRUE;
+    }
 
-      conn->state = YSTATE_FREE;
+    if (nctx->class == YNET_CLASS_MSG)
+      ynet_conn_flush(wctx, conn);
 
-      ylock_rel(&conn->lock, YLOCK_EXCL);
+    if (nctx->quota == 0)                 /* let the others have a turn */
+    {
+      if (ynet_conn_requeue(wctx, conn))
+        break;
 
-      return 0;
+      nctx->quota = ynet_conn_quota;            /* queue full, carry on */
     }
-
-    switch (nctx->class)
+    else if ((conn->eof || nctx->lost) && !nctx->held && !nctx->mux &&
+             !conn->pollout)
     {
-      case YNET_CLASS_WAIT:
-        printf("TODO\n");
-        break;
-      case YNET_CLASS_LSNR:
-        ret = ynet_lsnr_process(wctx, nctx);
-        break;
-      case YNET_CLASS_MSG:
-        ret = ycmd_server_process(nctx);
-        break;
-      default:
-        printf("TODO : %d\n", nctx->class);
+      ynet_conn_close(wctx, conn);  /* read to its end or lost, answered */
+      return 0;
     }
-
-    ectx->head = (ectx->head + 1) % (ectx->max);  /* dequeued */
   }
+  while (!ynet_conn_unsched(conn));   /* events came in during this pass */
+
+  ynet_stats_fold();
 
   conn->state = YSTATE_WAITING;
 
@@ -645,9 +1447,10 @@ int ynet_thread_wait(ythread_ctx_t *tctx)
   
   ylock_rel(&wctx->lock, YLOCK_EXCL);
 
+  /* not with its home queue backed up, no other thread takes that */
   if (wait_on_ctx)
     ynet_waiter_wait_on_wctx(wctx);
-  else 
+  else if (yqueue_is_empty(&tctx->queue))
     ynet_waiter_idle(tctx);
 
   ylock_acq(&wctx->lock, YLOCK_EXCL);
@@ -672,11 +1475,94 @@ int ynet_thread_process(ythread_ctx_t *tctx)
 
   ytrace_msg(YTRACE_LEVEL1, "ynet_thread_process : enter\n");
 
-  while (conn = ynet_event_conn_dequeue(wctx->ectx))
+  while (conn = ynet_event_conn_dequeue(wctx, tctx))
   {
     ytrace_msg(YTRACE_LEVEL1, "ynet_thread_process : processing conn = %p\n",
                conn);
     ynet_conn_process(wctx, conn);   
+
+    if (ynet_requeued)       /* look for other events before its next turn */
+    {
+      ynet_requeued = FALSE;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Wait on and process a reactor. Refer ynets.h for details.
+ */
+int ynet_reactor_process(ythread_ctx_t *tctx)
+{
+  int                ind;
+  int                nevn;
+  int                nreq;
+  uint64_t           val;
+  ynet_conn_ctx_t   *conn;
+  ynet_fd_ent_t     *ent;
+  ynet_waiter_ctx_t *wctx = tctx->wctx;
+  epoll_event        events[YNEVENT];
+
+  if ((nevn = ynet_epoll_wait(wctx->nctx->sfd, events, 
+                              yqueue_is_empty(&tctx->queue))) < 0)
+    return -1;
+
+  nreq = (int)yqueue_count(&tctx->queue);  /* requeued, or from lanes */
+
+  ytrace_msg(YTRACE_LEVEL1, "ynet_reactor_process : epoll returned = %d\n",
+             nevn);
+
+  for (ind = 0; ind < nevn; ind++)
+  {
+    if (ynet_waiter_bell_take(wctx, events[ind].data.fd) ||
+        ((ent = ynet_fd_get(events[ind].data.fd, FALSE)) == NULL))
+      continue;                                                 /* discard */
+
+    conn = &ent->conn;
+
+    ylock_acq(&conn->lock, YLOCK_EXCL);  /* uncontended, owned by reactor */
+
+    if (conn->state != YSTATE_WAITING)         /* closed earlier in batch */
+    {
+      ylock_rel(&conn->lock, YLOCK_EXCL);
+      continue;
+    }
+
+    /* already scheduled only when queued, it is processed from there */
+    if (!ynet_conn_event_add(conn, events[ind].events))
+    {
+      ylock_rel(&conn->lock, YLOCK_EXCL);
+      continue;
+    }
+
+    ynet_conn_process(wctx, conn);                  /* releases the lock */
+  }
+
+  /* then those requeued or completed on lanes by now, in order */
+  for (ind = 0; ind < nreq && yqueue_pop(&tctx->queue, &val); ind++)
+  {
+    if ((ent = ynet_fd_get((int)(uint32_t)val, FALSE)) == NULL)
+      continue;
+
+    conn = &ent->conn;
+
+    ylock_acq(&conn->lock, YLOCK_EXCL);
+
+    if (conn->state != YSTATE_WAITING)           /* closed in the meantime */
+    {
+      if (conn->state == YSTATE_FREE)          /* a lane scheduled it late */
+      {
+        __atomic_store_n(&conn->pend, 0, __ATOMIC_RELEASE);
+        ynet_conn_drain(conn, FALSE);
+      }
+
+      ylock_rel(&conn->lock, YLOCK_EXCL);
+      continue;
+    }
+
+    ynet_conn_process(wctx, conn);                  /* releases the lock */
   }
 
   return 0;
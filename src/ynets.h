@@ -18,12 +18,14 @@
 #ifndef _YNETS_H
 
 #include <sys/epoll.h>
+#include <sched.h>
 
 #define _YNETS_H
 
 #include <ycommon.h>
 #include <ynet.h>
 #include <ylock.h>
+#include <yqueue.h>
 
 /**
  * @file ynets.h - Network Server Related Interfaces
@@ -31,43 +33,83 @@
  */
 
 /**
- * @section - Event Queue Management
- *            Tracks list of events in a circular fashion. Used for global
- *            event queue and per-connection queued events. 
+ * @section - Event Coalescing
+ *            Sockets are edge triggered, so another event of a socket 
+ *            already waiting to be processed adds nothing but its kind. A
+ *            connection keeps the kinds pending in one atomic word, next
+ *            to a scheduled bit. Whoever sets the scheduled bit queues the
+ *            connection, by descriptor, to the shared lock-free queue 
+ *            (yqueue.h), so it is queued at most once however many events
+ *            arrive. The thread processing it clears the bit only when no
+ *            event came in meanwhile, else it makes another pass. A lane
+ *            completing a request of the connection (ymux.h) schedules it
+ *            the same way, with YNET_PEND_MUX, ringing the bell of the 
+ *            waiter when no thread is woken for it.
  */
 
-#define YNET_EVENT_CTX_MAX (1024)                /**< maximum event contexts */
+#define YNET_PEND_IN       (0x1)                  /**< readable, or accept */
+#define YNET_PEND_OUT      (0x2)                            /**< writable */
+#define YNET_PEND_HUP      (0x4)                    /**< hangup or error */
+#define YNET_PEND_SCHED    (0x8)          /**< queued or being processed */
+#define YNET_PEND_MUX      (0x10)       /**< requests completed on lanes */
+#define YNET_PEND_RDHUP    (0x20)           /**< peer done sending, half close */
 
-/** 
- * @struct ynet_event_ctx_t
- *
- * @brief  Event context tracking the pending events in circular list.
+#define YNET_EVENT_QUEUE_MAX (4096)        /**< shared waiter queue capacity */
+
+/**
+ * @section - Connection Affinity
+ *            With ynet_affinity, in shared waiter mode every connection 
+ *            has a home thread, picked as the one with the fewest 
+ *            connections when it is accepted, and the waiter queues it to
+ *            that thread's own queue, so its buffers and state stay in 
+ *            that core's caches.
+ *            A thread whose queue backs up to YNET_STEAL_HIGH counts as
+ *            overloaded till it drains to YNET_STEAL_LOW. Idle threads 
+ *            then take connections off its queue, and those move home to
+ *            them. Listeners, and connections finding their home queue 
+ *            full, go through the shared queue to any thread. Without it,
+ *            or on few cpus where a handoff per request costs more than 
+ *            the cache misses saved, every connection goes that way.
  */
-struct ynet_event_ctx_t
-{
-  ylock_t   lock;
-  int       max;
-  int       tail;
-  int       head;
-  struct epoll_event *events;
-};
-typedef struct ynet_event_ctx_t ynet_event_ctx_t;
+#define YNET_HOME_QUEUE_MAX  (1024)          /**< home queue capacity */
+#define YNET_STEAL_HIGH      (8)       /**< backlog to become overloaded */
+#define YNET_STEAL_LOW       (2)    /**< backlog to stop being overloaded */
+
+extern int ynet_affinity;             /**< home threads, shared waiter */
 
 /**
- * Macros tracking the circular list in event context.
+ * @section - Fair Scheduling
+ *            A pass over a connection reads at most ynet_conn_quota bytes
+ *            of requests. A connection that uses it up, a pipelining or
+ *            bulk loading client, keeps its scheduled bit and is queued 
+ *            back at the tail, behind those that were waiting : of the
+ *            shared waiter, of its home thread, or of the reactor thread,
+ *            which takes it after its next round of events. So one heavy
+ *            client doesn't hold a thread and the clients sharing it see
+ *            bounded latency. Responses of the pass are written before it
+ *            is requeued. 0 turns it off. Shm rings and io_uring 
+ *            connections aren't sliced. A client half closing after its 
+ *            pipeline (RDHUP) still has it read over as many passes as it
+ *            takes, and is closed once every request is answered and the
+ *            output written. Hangups and errors close at once.
  */
-#define ynet_event_ctx_nused(ctx) \
-          (((ctx)->head + (ctx)->max - (ctx)->tail) % (ctx)->max)
-#define ynet_event_ctx_nfree(ctx) \
-          ((ctx)->max - ynet_event_ctx_nused(ctx))
-#define ynet_event_ctx_is_empty(ctx) ((ctx)->head == (ctx)->tail)
-#define ynet_event_ctx_reset(ctx)    ((ctx)->head = (ctx)->tail = 0)
+#define YNET_CONN_QUOTA_DEFAULT (64 * 1024)   /**< bytes read per pass */
+
+extern int ynet_conn_quota;            /**< bytes read per pass, 0 if off */
 
 /** 
  * @struct ynet_waiter_ctx_t
  * 
  * @brief  Waiter context. It tracks one listening port and events 
  *         associated with that. 
+ *
+ *         Shared by all threads, one of them waits on it and queues the 
+ *         events to queue for others to pick up. A reactor waiter has no
+ *         queue; it is owned by one thread, which waits on it and 
+ *         processes its events itself. Its listeners are created with 
+ *         SO_REUSEPORT, so that every reactor has one on each port and
+ *         the kernel spreads incoming connections across them. Accepted
+ *         connections stay with the reactor that accepted them.
  */
 struct ynet_waiter_ctx_t
 {
@@ -75,80 +117,260 @@ struct ynet_waiter_ctx_t
   size_t            gen;                                /* generation count */
   ynet_ctx_t       *nctx;          /* network context for this wait context */
   ythread_ctx_t    *tctx; /* current thread context waiting on this context */
-  ynet_event_ctx_t *ectx;     /* event context to queue the incoming events */
+  yqueue_t         *queue;              /* queue to hand over incoming events */
+  int               woken;        /* threads unparked, not running yet */
+  int               wnext;             /* slot to wake first, rotating */
+  int               bell;     /* eventfd in the epoll set, to end a wait */
   ylink_head_t      whead;                              /* thread wait head */
 };
 typedef struct ynet_waiter_ctx_t ynet_waiter_ctx_t;
 
+#define ynet_waiter_is_reactor(wctx) ((wctx)->queue == NULL)
+
 /**
  * @struct ynet_conn_ctx_t
  * 
  * @brief  connection context, one per incoming connection. It is simply 
- *         based on the accepted socket descriptor. 
+ *         based on the accepted socket descriptor, looked up in a two 
+ *         level table indexed by descriptor, whose leaves are allocated
+ *         as descriptors get used. Kept small, as most connections are 
+ *         idle : its events are merged into the pending word.
  */
 struct ynet_conn_ctx_t
 {
   ylock_t           lock;                                     /* lock object */
-  int               init;                                     /* initialized */
   ystate_t          state;                                  /* current state */
+  int               pollout;               /* EPOLLOUT armed, output parked */
+  int               eof;          /* peer half closed, close once answered */
   ynet_ctx_t       *nctx;             /* network context for this connection */
-  ynet_event_ctx_t  ectx;         /* event context queue for this connection */
+  uint32_t          pend;           /* YNET_PEND_*, atomic, lock not needed */
+  int               home;           /* slot of its thread, -1 for any */
+  uint32_t          gen;            /* bumped on close, for late tasks */
+  struct ymux_task_t *done;         /* completed on lanes, atomic, LIFO */
 };
 typedef struct ynet_conn_ctx_t ynet_conn_ctx_t;
 
 /**
- * @brief Initialize event context. Create event objects based on maxevents.
+ * @section - Busy Polling
+ *            Trades CPU for wakeup latency. A thread whose event source 
+ *            runs dry keeps polling it without blocking (epoll timeout 0,
+ *            io_uring_enter without wait, event queue peek) for upto
+ *            ynet_busy_spin usecs, and blocks once idle longer. Accepted 
+ *            sockets can in addition get SO_BUSY_POLL, for blocking reads
+ *            and polls on them to spin on the device queue.
+ */
+#define YNET_BUSY_SPIN_DEFAULT (50)           /**< spin budget if not given */
+
+extern int ynet_busy_spin;               /**< spin budget, usecs, 0 if off */
+extern int ynet_busy_read;     /**< SO_BUSY_POLL of sockets, usecs, 0 if off */
+
+/**
+ * @brief Check whether an idle thread should keep spinning.
  * 
- * @param ectx      - Context to initialize
- * @param maxevents - Number of event objects to create internally
+ * @param beg - start of the idle period (ytime_get), set when 0
+ * 
+ * @return TRUE while idle for less than ynet_busy_spin usecs.
+ */
+static inline int ynet_busy_check(size_t *beg)
+{
+  size_t now;
+
+  if (ynet_busy_spin == 0)
+    return FALSE;
+
+  now = ytime_get();
+
+  if (*beg == 0)
+    *beg = now;
+  else
+    sched_yield();           /* let a runnable peer have an idle core */
+
+  return (now - *beg) < ynet_busy_spin;
+}
+
+/**
+ * @section - Accepting
+ *            Connections are accepted with accept4, non-blocking and 
+ *            close-on-exec in one call, and go straight to epoll. Socket
+ *            options they need are set on the listener and inherited. 
+ *            Listeners queue upto ynet_backlog connections not accepted
+ *            yet (capped by net.core.somaxconn). A shared waiter opens 
+ *            ynet_acceptors listeners per TCP port (1 by default), more
+ *            than one share it with SO_REUSEPORT, so that the kernel 
+ *            spreads a burst of connections over them and as many threads
+ *            accept it in parallel; reactors have theirs.
+ *            Contexts of the first descriptors are allocated at startup
+ *            (ynet_conn_reserve), and a closed connection leaves its 
+ *            output queue to the next one on its descriptor, so accepting
+ *            doesn't allocate once the server is warm.
+ */
+#define YNET_BACKLOG_DEFAULT      (SOMAXCONN)   /**< listen queue length */
+#define YNET_CONN_RESERVE_DEFAULT (1024)   /**< contexts allocated upfront */
+
+extern int ynet_backlog;               /**< listen queue length, listen(2) */
+extern int ynet_acceptors;   /**< listeners per TCP port, shared waiter */
+
+/**
+ * @brief Allocate and fault in contexts of descriptors upto 'nconn', 
+ *        before connections arrive.
+ * 
+ * @param nconn - descriptors to cover
  * 
  * @return 0 on success, -1 on failure with errno set. 
  */
-int ynet_event_create(ynet_event_ctx_t *ectx, int maxevents);
+int ynet_conn_reserve(int nconn);
+
+/**
+ * @brief Apply SO_BUSY_POLL to a listening socket, if configured. The
+ *        connections it accepts inherit it.
+ * 
+ * @param sfd - socket
+ * 
+ * @return None. Failure (no CAP_NET_ADMIN beyond net.core.busy_read) is
+ *         traced once and the socket left as is.
+ */
+void ynet_busy_read_set(int sfd);
+
+/**
+ * @brief Turn off Nagle on a listening TCP socket, inherited by the 
+ *        connections it accepts. Responses are written
+ *        once per pass, and a pass cut short by the read quota must not
+ *        wait on the peer's delayed ack for its last partial segment.
+ * 
+ * @param sfd - socket
+ * 
+ * @return None. Unix sockets don't take it, and are left as is.
+ */
+void ynet_nodelay_set(int sfd);
 
 /**
  * @brief Initialize waiter context.
  * 
  * @param wctx  - Context to initialize
- * @param ectx  - Event context to be associated with this waiter context
+ * @param queue - Event queue to be associated with this waiter context,
+ *                NULL for a reactor
  * 
  * @return 0 on success, -1 on failure with errno set. 
  */
-int ynet_waiter_create(ynet_waiter_ctx_t *wctx, ynet_event_ctx_t *ectx);
+int ynet_waiter_create(ynet_waiter_ctx_t *wctx, yqueue_t *queue);
+
+/**
+ * @brief Create a bound, listening TCP socket on all addresses.
+ * 
+ * @param port      - TCP port to listen on
+ * @param reuseport - share the port with other listeners (SO_REUSEPORT)
+ * 
+ * @return Socket on success, -1 on failure with errno set. 
+ */
+int ynet_lsnr_socket(int port, int reuseport);
+
+/**
+ * @brief Check that no socket, of this process or another, is bound to a
+ *        TCP port. Listeners sharing a port with SO_REUSEPORT would join
+ *        one of another server run by the same user rather than fail, so
+ *        this is checked before the first of them is created.
+ * 
+ * @param port - TCP port
+ * 
+ * @return 0 if the port is free, -1 with errno set (EADDRINUSE) if not.
+ */
+int ynet_lsnr_probe(int port);
+
+/**
+ * @brief Create a bound, listening Unix domain stream socket, replacing 
+ *        whatever is at 'path'. It has no SO_REUSEPORT, the one socket is
+ *        attached to every reactor instead.
+ * 
+ * @param path - socket path
+ * 
+ * @return Socket on success, -1 on failure with errno set. 
+ */
+int ynet_lsnr_unix_socket(char *path);
+
+/**
+ * @brief Add a listening socket to a waiter. A socket may be attached to
+ *        several reactors, each accepting connections into its own set.
+ * 
+ * @param wctx  - waiter context
+ * @param sfd   - listening socket
+ * @param proto - wire protocol of accepted connections, YPROTO_*
+ * 
+ * @return Listener context on success, NULL on failure with errno set. 
+ */
+ynet_ctx_t * ynet_lsnr_attach(ynet_waiter_ctx_t *wctx, int sfd, int proto);
 
 /**
  * @brief Allocate a listener context
  * 
- * @param wctx  - Waiter context to be associated with this lister
+ * @param wctx  - Waiter context to be associated with this lister. 
+ *                Listeners of a reactor share the port with other 
+ *                reactors (SO_REUSEPORT), as do those of a shared waiter
+ *                with ynet_acceptors above 1.
+ * @param port  - TCP port to listen on
+ * @param proto - wire protocol of accepted connections, YPROTO_TEXT for
+ *                the native protocols (text and binary, detected per 
+ *                request) or YPROTO_RESP
  * 
  * @return Valid context on success, NULL on failure with errno set. 
  */
-ynet_ctx_t * ynet_lsnr_create(ynet_waiter_ctx_t *wctx);
+ynet_ctx_t * ynet_lsnr_create(ynet_waiter_ctx_t *wctx, int port, int proto);
 
 /**
- * @brief Allocate a post context
+ * @brief Listening sockets of the epoll waiters and reactors, each once
+ *        however many reactors it is attached to. For a handoff (yupg.h).
  * 
- * @return Valid context on success, NULL on failure with errno set. 
+ * @param fds    - filled with the sockets
+ * @param protos - filled with their protocols, YPROTO_*
+ * @param max    - room in fds and protos
+ * 
+ * @return Number of listeners, upto max.
  */
-ynet_ctx_t * ynet_post_create(void);
+int ynet_lsnr_list(int *fds, int *protos, int max);
 
 /**
- * @brief Post a context
+ * @brief Stop or go on accepting on every listener. Returns once no
+ *        accept pass is running, connections coming in meanwhile stay
+ *        queued on the listeners, for whichever process shares them.
+ *        On going on, waiters are made to look at the listeners again.
  * 
- * @param pctx  - Post context
+ * @param pause - TRUE to stop, FALSE to go on
  * 
- * @return 0 on success, -1 on failure with errno set. 
+ * @return None.
+ */
+void ynet_lsnr_pause(int pause);
+
+/**
+ * @brief Hand a request completed on a lane back to its connection, from
+ *        the lane. The connection is scheduled as for an event, with 
+ *        YNET_PEND_MUX, and its thread responds to it (ymux.h). 
+ * 
+ * @param fd   - connection descriptor
+ * @param task - completed task, pushed to conn->done
+ * 
+ * @return None.
  */
-int ynet_post(ynet_ctx_t *pctx);
+void ynet_conn_complete(int fd, struct ymux_task_t *task);
 
 /**
- * @brief Wait on a Post context
+ * @brief Generation of a connection, to tell a task of a closed one 
+ *        from a task of the connection now on the descriptor.
  * 
- * @param pctx  - Post context
+ * @param fd - connection descriptor
+ * 
+ * @return Generation, 0 for a descriptor never seen.
+ */
+uint32_t ynet_conn_gen(int fd);
+
+/**
+ * @brief Register a server thread with the scheduler, before it starts.
+ *        Every thread gets its own queue : its home queue under a shared
+ *        waiter, connections it requeued under a reactor.
+ * 
+ * @param tctx  - Thread context, with its slot and waiter set
  * 
  * @return 0 on success, -1 on failure with errno set. 
  */
-int ynet_wait(ynet_ctx_t *pctx);
+int ynet_thread_attach(ythread_ctx_t *tctx);
 
 /**
  * @brief Make current thread to wait on internal context. Waits 
@@ -169,4 +391,14 @@ int ynet_thread_wait(ythread_ctx_t *tctx);
  */
 int ynet_thread_process(ythread_ctx_t *tctx);
 
+/**
+ * @brief Wait on the reactor of current thread and process the events
+ *        returned, each connection in turn on this thread.
+ * 
+ * @param tctx  - Thread context, owning a reactor waiter context
+ * 
+ * @return 0 on success, -1 on failure with errno set. 
+ */
+int ynet_reactor_process(ythread_ctx_t *tctx);
+
 #endif /* ynets.h */
@@ -0,0 +1,360 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ycommon.h>
+#include <ctype.h>
+
+#include <ytrace.h>
+#include <yns.h>
+
+/**
+ * Globals.
+ */
+static yns_t    yns_arr[YNS_MAX];                          /**< namespaces */
+static ylock_t  yns_lock;                /**< serializes namespace creation */
+static int      yns_frozen;           /**< yns_acq waits while it is set */
+static int      yns_held[YNS_MAX];          /**< locked EXCL by yns_freeze */
+
+/**
+ * Parse a memory size with optional k/m/g suffix.
+ */
+static size_t yns_parse_mem(char *str)
+{
+  char   *ep;
+  size_t  val = strtoull(str, &ep, 10);
+
+  switch (*ep)
+  {
+    case 'g': case 'G': val <<= 10;
+      /* fall through */
+    case 'm': case 'M': val <<= 10;
+      /* fall through */
+    case 'k': case 'K': val <<= 10;
+  }
+
+  return val;
+}
+
+/**
+ * Create namespace, yns_lock should be held.
+ */
+static int yns_create_int(int id, char *name, int ncnt, size_t mem_max,
+                          int evict)
+{
+  yns_t   *ns;
+  yhtab_t *ht;
+
+  if (id < 0 || id >= YNS_MAX)
+    return y_error(EINVAL);
+
+  ns = &yns_arr[id];
+
+  if (ns->init)
+    return y_error(EEXIST);
+
+  if ((ht = yhtab_create(ncnt, YHTAB_SMAX_DEFAULT)) == NULL)
+    return y_error(ENOMEM);
+
+  if (yhtab_limit(ht, mem_max, evict) != 0)
+  {
+    yhtab_destroy(ht);
+    return y_error(EINVAL);
+  }
+
+  ylock_init(&ns->lock);
+
+  ns->ncnt    = ncnt;
+  ns->mem_max = mem_max;
+  ns->evict   = evict;
+  ns->ht      = ht;
+
+  if (name)
+    snprintf(ns->name, sizeof(ns->name), "%s", name);
+  else
+    snprintf(ns->name, sizeof(ns->name), "%d", id);
+
+  __sync_synchronize();                    /* publish before marking init */
+
+  ns->init = TRUE;
+
+  ytrace_msg(YTRACE_DEFAULT,
+            "namespace created : id = %d, name = %s, slots = %d, "
+            "memory = %zu, evict = %d\n",
+             id, ns->name, ncnt, mem_max, evict);
+
+  return 0;
+}
+
+/**
+ * Create namespace. Refer yns.h for details.
+ */
+int yns_create(int id, char *name, int ncnt, size_t mem_max, int evict)
+{
+  int ret;
+
+  ylock_acq(&yns_lock, YLOCK_EXCL);
+
+  ret = yns_create_int(id, name, ncnt, mem_max, evict);
+
+  ylock_rel(&yns_lock, YLOCK_EXCL);
+
+  return ret;
+}
+
+/**
+ * Configure namespace. Refer yns.h for details.
+ */
+int yns_config(char *spec)
+{
+  int     id;
+  int     ret;
+  int     ncnt    = YHTAB_NCNT_DEFAULT;
+  size_t  mem_max = 0;
+  int     evict   = YHTAB_EVICT_NONE;
+  char    buf[256];
+  char   *name;
+  char   *tok;
+  char   *save;
+
+  snprintf(buf, sizeof(buf), "%s", spec);
+
+  if ((name = strtok_r(buf, ":", &save)) == NULL)
+    return y_error(EINVAL);
+
+  if (tok = strtok_r(NULL, ":", &save))
+    ncnt = atoi(tok);
+
+  if (tok = strtok_r(NULL, ":", &save))
+    mem_max = yns_parse_mem(tok);
+
+  if (tok = strtok_r(NULL, ":", &save))
+  {
+    if (strcasecmp(tok, "random") == 0)
+      evict = YHTAB_EVICT_RANDOM;
+    else if (strcasecmp(tok, "none") != 0)
+      return y_error(EINVAL);
+  }
+
+  if (ncnt <= 0)
+    return y_error(EINVAL);
+
+  ylock_acq(&yns_lock, YLOCK_EXCL);
+
+  for (id = 0; id < YNS_MAX && yns_arr[id].init; id++);
+
+  ret = yns_create_int(id, name, ncnt, mem_max, evict);
+
+  ylock_rel(&yns_lock, YLOCK_EXCL);
+
+  return ret;
+}
+
+/**
+ * Lookup namespace. Refer yns.h for details.
+ */
+int yns_lookup(char *name, int len)
+{
+  int ind;
+  int id = 0;
+
+  /* past YNS_MAX the id stays there, however many digits follow */
+  for (ind = 0; ind < len && isdigit(name[ind]); ind++)
+  {
+    if (id < YNS_MAX)
+      id = id * 10 + (name[ind] - '0');
+  }
+
+  if (len && ind == len)                                      /* numbered */
+  {
+    if (id < 0 || id >= YNS_MAX)
+      return y_error(EINVAL);
+
+    if (!yns_arr[id].init)
+    {
+      ylock_acq(&yns_lock, YLOCK_EXCL);
+
+      if (!yns_arr[id].init)
+        yns_create_int(id, NULL, YHTAB_NCNT_DEFAULT, 0, YHTAB_EVICT_NONE);
+
+      ylock_rel(&yns_lock, YLOCK_EXCL);
+    }
+
+    return (yns_arr[id].init) ? id : y_error(ENOMEM);
+  }
+
+  for (ind = 0; ind < YNS_MAX; ind++)
+  {
+    if (yns_arr[ind].init &&
+        (strlen(yns_arr[ind].name) == len) &&
+        (strncmp(yns_arr[ind].name, name, len) == 0))
+      return ind;
+  }
+
+  return y_error(ENOENT);
+}
+
+/**
+ * Pin namespace. Refer yns.h for details.
+ */
+yhtab_t * yns_acq(int id)
+{
+  yns_t *ns;
+
+  if (id < 0 || id >= YNS_MAX || !yns_arr[id].init)
+    return NULL;
+
+  ns = &yns_arr[id];
+
+  while (__atomic_load_n(&yns_frozen, __ATOMIC_ACQUIRE))
+    ylock_mem_wait(&yns_frozen, TRUE, 0);
+
+  ylock_acq(&ns->lock, YLOCK_SHARED);
+
+  return ns->ht;
+}
+
+/**
+ * Unpin namespace. Refer yns.h for details.
+ */
+int yns_rel(int id)
+{
+  return ylock_rel(&yns_arr[id].lock, YLOCK_SHARED);
+}
+
+/**
+ * Free a table swapped out by yns_flush, off the worker thread.
+ */
+static void * yns_reap_run(void *arg)
+{
+  yhtab_destroy((yhtab_t *)arg);
+
+  return NULL;
+}
+
+/**
+ * Flush namespace. Refer yns.h for details.
+ */
+int yns_flush(int id)
+{
+  yns_t     *ns;
+  yhtab_t   *nht;
+  yhtab_t   *oht;
+  pthread_t  hdl;
+
+  if (id < 0 || id >= YNS_MAX || !yns_arr[id].init)
+    return y_error(EINVAL);
+
+  ns = &yns_arr[id];
+
+  if ((nht = yhtab_create(ns->ncnt, YHTAB_SMAX_DEFAULT)) == NULL)
+    return y_error(ENOMEM);
+
+  yhtab_limit(nht, ns->mem_max, ns->evict);
+
+  ylock_acq(&ns->lock, YLOCK_EXCL);
+
+  oht    = ns->ht;
+  ns->ht = nht;
+
+  ylock_rel(&ns->lock, YLOCK_EXCL);
+
+  /*
+   * Nobody can see the old table anymore. Freeing it walks every slot,
+   * that is left to a thread of its own, so the reply is not held up.
+   */
+  if (pthread_create(&hdl, NULL, yns_reap_run, oht) == 0)
+    pthread_detach(hdl);
+  else
+    yhtab_destroy(oht);
+
+  ytrace_msg(YTRACE_LEVEL1, "yns_flush : id = %d : old = %p : new = %p\n",
+             id, oht, nht);
+
+  return 0;
+}
+
+/**
+ * Get namespace. Refer yns.h for details.
+ */
+yns_t * yns_get(int id)
+{
+  if (id < 0 || id >= YNS_MAX || !yns_arr[id].init)
+    return NULL;
+
+  return &yns_arr[id];
+}
+
+/**
+ * Lock every namespace not locked yet by yns_freeze.
+ */
+static void yns_hold_all(void)
+{
+  int id;
+
+  for (id = 0; id < YNS_MAX; id++)
+  {
+    if (yns_arr[id].init && !yns_held[id])
+    {
+      ylock_acq(&yns_arr[id].lock, YLOCK_EXCL);
+      yns_held[id] = TRUE;
+    }
+  }
+}
+
+/**
+ * Freeze namespaces. Refer yns.h for details.
+ */
+void yns_freeze(void)
+{
+  /* the gate keeps readers from starving the EXCL ones below */
+  __atomic_store_n(&yns_frozen, TRUE, __ATOMIC_RELEASE);
+
+  yns_hold_all();
+
+  /* a command holding its namespace may create another, take the creation
+   * lock after the others and then the ones created in between */
+  ylock_acq(&yns_lock, YLOCK_EXCL);
+
+  yns_hold_all();
+
+  ytrace_msg(YTRACE_DEFAULT, "namespaces frozen\n");
+}
+
+/**
+ * Thaw namespaces. Refer yns.h for details.
+ */
+void yns_thaw(void)
+{
+  int id;
+
+  for (id = 0; id < YNS_MAX; id++)
+  {
+    if (yns_held[id])
+    {
+      yns_held[id] = FALSE;
+      ylock_rel(&yns_arr[id].lock, YLOCK_EXCL);
+    }
+  }
+
+  ylock_rel(&yns_lock, YLOCK_EXCL);
+
+  __atomic_store_n(&yns_frozen, FALSE, __ATOMIC_RELEASE);
+
+  ylock_mem_post(&yns_frozen);
+
+  ytrace_msg(YTRACE_DEFAULT, "namespaces thawed\n");
+}
@@ -0,0 +1,147 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YNS_H
+
+#define _YNS_H
+
+#include <ycommon.h>
+#include <ylock.h>
+#include <yhash.h>
+
+/**
+ * @file yns.h - Namespace (logical database) Interfaces
+ *
+ * Every namespace owns its own hash table with its own size, memory limit
+ * and eviction policy. Connections pick one through SELECT, namespace 0
+ * is the default one.
+ */
+
+#define YNS_MAX         (16)                      /**< maximum namespaces */
+#define YNS_NAME_MAX    (32)               /**< maximum namespace name len */
+#define YNS_DEFAULT     (0)                          /**< default namespace */
+
+/**
+ * @struct yns_t
+ *
+ * @brief  Namespace. Table pointer is protected by the lock, held in
+ *         SHARED mode for the duration of a command and in EXCL mode to
+ *         swap the table on flush.
+ */
+struct yns_t
+{
+  ylock_t   lock;                                            /* lock object */
+  int       init;                                            /* initialized */
+  int       ncnt;                                  /* number of table slots */
+  int       evict;                                       /* eviction policy */
+  size_t    mem_max;                              /* memory limit, 0 for none */
+  yhtab_t  *ht;                                            /* current table */
+  char      name[YNS_NAME_MAX];                                     /* name */
+};
+typedef struct yns_t yns_t;
+
+/**
+ * @brief Create namespace with given id and parameters.
+ *
+ * @param id      - namespace id (0 to YNS_MAX - 1)
+ * @param name    - name, NULL to use the id itself as name
+ * @param ncnt    - number of slots in the table
+ * @param mem_max - memory limit in bytes, 0 for unlimited
+ * @param evict   - eviction policy (YHTAB_EVICT_*)
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yns_create(int id, char *name, int ncnt, size_t mem_max, int evict);
+
+/**
+ * @brief Create namespace from a configuration string of form
+ *        name[:slots[:memory[:policy]]], policy being "none" or "random".
+ *        Memory accepts k/m/g suffixes. Assigned the next free id.
+ *
+ * @param spec - configuration string
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yns_config(char *spec);
+
+/**
+ * @brief Find a namespace by name or number. Numbered namespaces which
+ *        are not configured are created with default parameters.
+ *
+ * @param name - name or number
+ * @param len  - length of name
+ *
+ * @return namespace id on success, -1 on failure with errno set.
+ */
+int yns_lookup(char *name, int len);
+
+/**
+ * @brief Pin a namespace and get its current table.
+ *
+ * @param id - namespace id
+ *
+ * @return table, NULL if namespace doesn't exist.
+ */
+yhtab_t * yns_acq(int id);
+
+/**
+ * @brief Unpin a namespace pinned through yns_acq.
+ *
+ * @param id - namespace id
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yns_rel(int id);
+
+/**
+ * @brief Flush all keys of a namespace. Swaps an empty table in, the
+ *        old table is freed in the background once it is no longer
+ *        visible.
+ *
+ * @param id - namespace id
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yns_flush(int id);
+
+/**
+ * @brief Get a namespace, for a walk over all of them.
+ *
+ * @param id - namespace id
+ *
+ * @return namespace, NULL if it doesn't exist.
+ */
+yns_t * yns_get(int id);
+
+/**
+ * @brief Freeze every namespace, for an image of all of them that no
+ *        command changes. Commands not started yet wait in yns_acq, the
+ *        ones running are waited for, and no namespace is created or
+ *        flushed till yns_thaw. Tables stay readable by the caller.
+ *
+ * @return None.
+ */
+void yns_freeze(void);
+
+/**
+ * @brief Let commands go on after yns_freeze, from the freezing thread.
+ *
+ * @return None.
+ */
+void yns_thaw(void);
+
+#endif /* yns.h */
@@ -0,0 +1,380 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE                              /* sched_setaffinity */
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <ycommon.h>
+#include <ytrace.h>
+#include <ynuma.h>
+
+#define YNUMA_MASK_LONGS ((YNUMA_NODE_MAX + 63) / 64 + 1)  /* spare word */
+#define YNUMA_MASK_BITS  (YNUMA_MASK_LONGS * 64)      /* maxnode of calls */
+
+#define ynuma_mask_set(m, n)  ((m)[(n) / 64] |= 1UL << ((n) % 64))
+
+/**
+ * Globals.
+ */
+int ynuma_mode;                                        /* placement, off */
+int ynuma_nnode = 1;
+
+static int ynuma_node_of[YNUMA_CPU_MAX];       /* node by cpu, -1 if none */
+static int ynuma_cpus[YNUMA_CPU_MAX];             /* workers' cpus, in order */
+static int ynuma_ncpu;                                /* 0 if not pinned */
+static int ynuma_used[YNUMA_NODE_MAX];          /* nodes of workers' cpus */
+static int ynuma_nused;
+
+/**
+ * Parse a cpu list, "0-3,8,10-11", into an array.
+ */
+static int ynuma_parse_list(char *str, int *arr, int max)
+{
+  int   cnt = 0;
+  long  beg;
+  long  end;
+  char *ep;
+
+  while (*str)
+  {
+    beg = end = strtol(str, &ep, 10);
+
+    if (ep == str)
+      return y_error(EINVAL);
+
+    if (*ep == '-')
+    {
+      str = ep + 1;
+      end = strtol(str, &ep, 10);
+
+      if (ep == str)
+        return y_error(EINVAL);
+    }
+
+    if ((beg < 0) || (end < beg) || (end >= YNUMA_CPU_MAX))
+      return y_error(EINVAL);
+
+    for (; beg <= end && cnt < max; beg++)
+      arr[cnt++] = beg;
+
+    str = ep;
+
+    if (*str == ',')
+      str++;
+    else if (*str && *str != '\n')
+      return y_error(EINVAL);
+    else
+      break;
+  }
+
+  return cnt;
+}
+
+/**
+ * Read which cpus every node has, from sysfs.
+ */
+static void ynuma_topology(void)
+{
+  int   ind;
+  int   cnt;
+  int   node;
+  int   cpus[YNUMA_CPU_MAX];
+  char  path[64];
+  char  buf[4096];
+  FILE *fp;
+
+  for (ind = 0; ind < YNUMA_CPU_MAX; ind++)
+    ynuma_node_of[ind] = -1;
+
+  ynuma_nnode = 0;
+
+  for (node = 0; node < YNUMA_NODE_MAX; node++)
+  {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+
+    if ((fp = fopen(path, "r")) == NULL)
+      continue;
+
+    if (fgets(buf, sizeof(buf), fp) &&
+        ((cnt = ynuma_parse_list(buf, cpus, YNUMA_CPU_MAX)) > 0))
+    {
+      for (ind = 0; ind < cnt; ind++)
+        ynuma_node_of[cpus[ind]] = node;
+    }
+
+    fclose(fp);
+
+    ynuma_nnode = node + 1;
+  }
+
+  if (ynuma_nnode == 0)              /* no topology exposed, one node */
+  {
+    cnt = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (ind = 0; ind < cnt && ind < YNUMA_CPU_MAX; ind++)
+      ynuma_node_of[ind] = 0;
+
+    ynuma_nnode = 1;
+  }
+}
+
+/**
+ * Read topology, take options. Refer ynuma.h for details.
+ */
+int ynuma_init(char *cpus, char *mode)
+{
+  int ind;
+  int node;
+
+  ynuma_topology();
+
+  if (mode == NULL)
+    ynuma_mode = YNUMA_OFF;
+  else if (strcmp(mode, "local") == 0)
+    ynuma_mode = YNUMA_LOCAL;
+  else if (strcmp(mode, "interleave") == 0)
+    ynuma_mode = YNUMA_INTERLEAVE;
+  else if (strcmp(mode, "partition") == 0)
+    ynuma_mode = YNUMA_PARTITION;
+  else
+    return y_error(EINVAL);
+
+  if (cpus)
+  {
+    if ((ynuma_ncpu = ynuma_parse_list(cpus, ynuma_cpus,
+                                       YNUMA_CPU_MAX)) <= 0)
+      return y_error(EINVAL);
+
+    for (ind = 0; ind < ynuma_ncpu; ind++)
+    {
+      if (ynuma_node_of[ynuma_cpus[ind]] < 0)           /* not online */
+        return y_error(EINVAL);
+    }
+  }
+  else if (ynuma_mode != YNUMA_OFF)          /* every cpu, node by node */
+  {
+    for (node = 0; node < ynuma_nnode; node++)
+      ynuma_ncpu += ynuma_node_cpus(node, ynuma_cpus + ynuma_ncpu,
+                                    YNUMA_CPU_MAX - ynuma_ncpu);
+  }
+
+  /* table memory goes to the nodes workers run on, once each */
+  for (ind = 0; ind < ynuma_ncpu; ind++)
+  {
+    for (node = 0; (node < ynuma_nused) && 
+                   (ynuma_used[node] != ynuma_node_of[ynuma_cpus[ind]]);
+         node++);
+
+    if (node == ynuma_nused)
+      ynuma_used[ynuma_nused++] = ynuma_node_of[ynuma_cpus[ind]];
+  }
+
+  return 0;
+}
+
+/**
+ * Workers pinned. Refer ynuma.h for details.
+ */
+int ynuma_pinned(void)
+{
+  return (ynuma_ncpu > 0);
+}
+
+/**
+ * Node of a cpu. Refer ynuma.h for details.
+ */
+int ynuma_cpu_node(int cpu)
+{
+  if (cpu < 0 || cpu >= YNUMA_CPU_MAX || ynuma_node_of[cpu] < 0)
+    return 0;
+
+  return ynuma_node_of[cpu];
+}
+
+/**
+ * Cpus of a node. Refer ynuma.h for details.
+ */
+int ynuma_node_cpus(int node, int *cpus, int max)
+{
+  int cpu;
+  int cnt = 0;
+
+  for (cpu = 0; cpu < YNUMA_CPU_MAX && cnt < max; cpu++)
+  {
+    if (ynuma_node_of[cpu] == node)
+      cpus[cnt++] = cpu;
+  }
+
+  return cnt;
+}
+
+/**
+ * Pin calling thread. Refer ynuma.h for details.
+ */
+int ynuma_pin(int cpu)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/**
+ * Place a worker or lane. Refer ynuma.h for details.
+ */
+int ynuma_thread_place(int ind)
+{
+  int cpu;
+
+  if (ynuma_ncpu == 0)
+    return -1;
+
+  cpu = ynuma_cpus[ind % ynuma_ncpu];
+
+  if (ynuma_pin(cpu) != 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "ynuma : pin to cpu %d failed : %d\n", cpu,
+               errno);
+    return -1;
+  }
+
+  /* pinned, the node it faults pages on is its own */
+  if ((ynuma_mode != YNUMA_OFF) &&
+      (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) != 0))
+    ytrace_msg(YTRACE_ERROR, "ynuma : local policy failed : %d\n", errno);
+
+  ytrace_msg(YTRACE_LEVEL1, "ynuma : thread %d : cpu %d, node %d\n", ind,
+             cpu, ynuma_cpu_node(cpu));
+
+  return cpu;
+}
+
+/**
+ * Allocation policy of calling thread. Refer ynuma.h for details.
+ */
+int ynuma_policy(int node)
+{
+  int           ind;
+  unsigned long mask[YNUMA_MASK_LONGS];
+
+  memset(mask, 0, sizeof(mask));
+
+  if (node == -1)
+    return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+
+  if (node == YNUMA_ALL)
+  {
+    for (ind = 0; ind < ynuma_nnode; ind++)
+      ynuma_mask_set(mask, ind);
+
+    return syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask, 
+                   YNUMA_MASK_BITS);
+  }
+
+  if (node < 0 || node >= YNUMA_NODE_MAX)
+    return y_error(EINVAL);
+
+  ynuma_mask_set(mask, node);
+
+  return syscall(SYS_set_mempolicy, MPOL_BIND, mask, YNUMA_MASK_BITS);
+}
+
+/**
+ * Bind the whole pages of a range, moving those already there.
+ */
+static int ynuma_bind(void *ptr, size_t len, int mode, unsigned long *mask)
+{
+  size_t    page = getpagesize();
+  uintptr_t beg  = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+  uintptr_t end  = ((uintptr_t)ptr + len) & ~(page - 1);
+
+  if (end <= beg)
+    return 0;
+
+  return syscall(SYS_mbind, beg, end - beg, mode, mask, YNUMA_MASK_BITS,
+                 MPOL_MF_MOVE);
+}
+
+/**
+ * Place a slot array. Refer ynuma.h for details.
+ */
+void ynuma_place(void *ptr, size_t len)
+{
+  int           ind;
+  int           ret = 0;
+  size_t        beg;
+  size_t        end;
+  unsigned long mask[YNUMA_MASK_LONGS];
+
+  if ((ynuma_mode < YNUMA_INTERLEAVE) || (ynuma_nused == 0))
+    return;
+
+  if (ynuma_mode == YNUMA_INTERLEAVE)
+  {
+    memset(mask, 0, sizeof(mask));
+
+    for (ind = 0; ind < ynuma_nused; ind++)
+      ynuma_mask_set(mask, ynuma_used[ind]);
+
+    ret = ynuma_bind(ptr, len, MPOL_INTERLEAVE, mask);
+  }
+
+  /* a range per node, preferred so that a full node spills over */
+  for (ind = 0; (ynuma_mode == YNUMA_PARTITION) && (ind < ynuma_nused); 
+       ind++)
+  {
+    memset(mask, 0, sizeof(mask));
+    ynuma_mask_set(mask, ynuma_used[ind]);
+
+    beg = len * ind / ynuma_nused;
+    end = len * (ind + 1) / ynuma_nused;
+
+    ret |= ynuma_bind((char *)ptr + beg, end - beg, MPOL_PREFERRED, mask);
+  }
+
+  if (ret != 0)
+    ytrace_msg(YTRACE_ERROR, "ynuma : place %p (%zu) failed : %d\n", ptr,
+               len, errno);
+}
+
+/**
+ * Move a buffer to the local node. Refer ynuma.h for details.
+ */
+void ynuma_local(void *ptr, size_t len)
+{
+  unsigned int  cpu;
+  unsigned int  node;
+  unsigned long mask[YNUMA_MASK_LONGS];
+
+  if ((ynuma_mode == YNUMA_OFF) ||
+      (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) ||
+      (node >= YNUMA_NODE_MAX))
+    return;
+
+  memset(mask, 0, sizeof(mask));
+  ynuma_mask_set(mask, node);
+
+  if (ynuma_bind(ptr, len, MPOL_PREFERRED, mask) != 0)
+    ytrace_msg(YTRACE_ERROR, "ynuma : move %p (%zu) failed : %d\n", ptr,
+               len, errno);
+}
@@ -0,0 +1,151 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YNUMA_H
+
+#define _YNUMA_H
+
+#include <ycommon.h>
+
+/**
+ * @file ynuma.h - CPU and Memory Placement
+ *
+ * Worker threads are plain pthreads, free to run on any cpu, and memory
+ * lands on the node of whichever thread touches it first. On a host with
+ * several nodes a thread thus ends up far from its memory. With a cpu
+ * list (--cpus) worker i is pinned to the i'th cpu of the list, modulo
+ * its length, and lane i (ymux.h) next to it. With a mode (--numa) the
+ * workers are pinned to all cpus, node by node, if no list is given,
+ * and memory is placed:
+ *   - local      : every worker allocates on its own node (MPOL_LOCAL),
+ *                  its buffers, connections and malloc arena, and its
+ *                  home queue is moved there
+ *   - interleave : as local, and the slot arrays of tables are spread
+ *                  page by page over the nodes of the workers, so that
+ *                  no node serves all lookups
+ *   - partition  : as local, and the slot array of a table is cut in one
+ *                  range per node of the workers, each on its node
+ * Objects are allocated by the thread that writes them, so they stay on
+ * its node in every mode.
+ *
+ * Topology comes from /sys/devices/system/node, placement is done with
+ * sched_setaffinity, set_mempolicy and mbind system calls, no libnuma.
+ */
+
+#define YNUMA_NODE_MAX   (64)                       /**< nodes handled */
+#define YNUMA_CPU_MAX    (1024)                      /**< cpus handled */
+
+#define YNUMA_OFF        (0)               /**< first touch, as it comes */
+#define YNUMA_LOCAL      (1)          /**< per thread memory on its node */
+#define YNUMA_INTERLEAVE (2)        /**< slot arrays over nodes, by page */
+#define YNUMA_PARTITION  (3)       /**< slot arrays over nodes, by range */
+
+#define YNUMA_ALL        (-2)       /**< ynuma_policy : interleave over all */
+
+extern int ynuma_mode;                                  /**< YNUMA_* */
+extern int ynuma_nnode;                    /**< nodes of the host, 1 if no
+                                                   topology is exposed */
+
+/**
+ * @brief Read the topology and take the placement options.
+ *
+ * @param cpus - cpu list for the workers, e.g. "0-3,8-11", NULL for none
+ * @param mode - "local", "interleave" or "partition", NULL for none
+ *
+ * @return 0 on success, -1 on failure with errno set (EINVAL).
+ */
+int ynuma_init(char *cpus, char *mode);
+
+/**
+ * @brief Whether workers are pinned, a cpu list or a mode given.
+ *
+ * @return TRUE if pinned.
+ */
+int ynuma_pinned(void);
+
+/**
+ * @brief Node of a cpu.
+ *
+ * @param cpu - cpu number
+ *
+ * @return Node, 0 if not known.
+ */
+int ynuma_cpu_node(int cpu);
+
+/**
+ * @brief Cpus of a node.
+ *
+ * @param node - node number
+ * @param cpus - filled with the cpus
+ * @param max  - room in cpus
+ *
+ * @return Number of cpus, upto max.
+ */
+int ynuma_node_cpus(int node, int *cpus, int max);
+
+/**
+ * @brief Pin the calling thread to a cpu.
+ *
+ * @param cpu - cpu number
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ynuma_pin(int cpu);
+
+/**
+ * @brief Place the calling worker or lane, as per the options : pin it to
+ *        its cpu and, with a mode, have it allocate on its node.
+ *
+ * @param ind - worker or lane index, 0 based
+ *
+ * @return Cpu pinned to, -1 if not pinned.
+ */
+int ynuma_thread_place(int ind);
+
+/**
+ * @brief Set where the calling thread allocates from now on.
+ *
+ * @param node - node to allocate on, YNUMA_ALL to interleave over every
+ *               node, -1 for the default (first touch)
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int ynuma_policy(int node);
+
+/**
+ * @brief Place the slot array of a table as per the mode, before it is
+ *        touched. Only its whole pages are placed.
+ *
+ * @param ptr - slot array
+ * @param len - bytes
+ *
+ * @return None. Failures are traced, memory is left as it is.
+ */
+void ynuma_place(void *ptr, size_t len);
+
+/**
+ * @brief Move the whole pages of a buffer to the node of the calling
+ *        thread, with a mode.
+ *
+ * @param ptr - buffer
+ * @param len - bytes
+ *
+ * @return None. Failures are traced, memory is left as it is.
+ */
+void ynuma_local(void *ptr, size_t len);
+
+#endif /* ynuma.h */
@@ -0,0 +1,187 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YQUEUE_H
+
+#define _YQUEUE_H
+
+#include <ycommon.h>
+
+/**
+ * @file yqueue.h - Bounded Lock-free MPMC Queue
+ *
+ * Any number of producers and consumers, of 64 bit values. Every cell
+ * carries a sequence number telling whose turn it is : a producer may
+ * fill cell 'pos' once its sequence is pos, a consumer may take it once
+ * it is pos + 1, and hands it back for the next round at pos + size. A
+ * producer or consumer claims its position with one compare and swap on
+ * tail or head, and doesn't wait on any other thread, except on a slow
+ * peer that claimed the cell right before it and is still copying.
+ *
+ * Full and empty are reported to the caller, which decides what to do.
+ */
+
+/**
+ * @struct yqueue_cell_t
+ *
+ * @brief  Queue cell.
+ */
+struct yqueue_cell_t
+{
+  size_t    seq;                            /**< turn, see above */
+  uint64_t  val;
+};
+typedef struct yqueue_cell_t yqueue_cell_t;
+
+/**
+ * @struct yqueue_t
+ *
+ * @brief  Queue, positions on own cache lines.
+ */
+struct yqueue_t
+{
+  size_t         tail __attribute__((aligned(64)));   /**< next to enqueue */
+  size_t         head __attribute__((aligned(64)));   /**< next to dequeue */
+  size_t         mask __attribute__((aligned(64)));      /**< cells - 1 */
+  yqueue_cell_t *cells;
+};
+typedef struct yqueue_t yqueue_t;
+
+/**
+ * @brief Create a queue.
+ *
+ * @param q   - queue
+ * @param max - capacity, rounded up to a power of 2
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+static inline int yqueue_create(yqueue_t *q, int max)
+{
+  size_t ind;
+  size_t cnt = 2;
+
+  while (cnt < max)
+    cnt <<= 1;
+
+  q->cells = (yqueue_cell_t *)malloc(cnt * sizeof(yqueue_cell_t));
+
+  if (q->cells == NULL)
+    return y_error(ENOMEM);
+
+  for (ind = 0; ind < cnt; ind++)
+    q->cells[ind].seq = ind;
+
+  q->mask = cnt - 1;
+  q->head = q->tail = 0;
+
+  return 0;
+}
+
+/**
+ * @brief Enqueue a value.
+ *
+ * @return TRUE if queued, FALSE if the queue is full.
+ */
+static inline int yqueue_push(yqueue_t *q, uint64_t val)
+{
+  long           dif;
+  size_t         pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  yqueue_cell_t *cell;
+
+  while (TRUE)
+  {
+    cell = &q->cells[pos & q->mask];
+    dif  = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)pos;
+
+    if (dif == 0)
+    {
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, TRUE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (dif < 0)                    /* not consumed a round ago */
+      return FALSE;
+    else
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  }
+
+  cell->val = val;
+
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+  return TRUE;
+}
+
+/**
+ * @brief Dequeue a value.
+ *
+ * @return TRUE if dequeued to val, FALSE if the queue is empty.
+ */
+static inline int yqueue_pop(yqueue_t *q, uint64_t *val)
+{
+  long           dif;
+  size_t         pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  yqueue_cell_t *cell;
+
+  while (TRUE)
+  {
+    cell = &q->cells[pos & q->mask];
+    dif  = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) -
+           (long)(pos + 1);
+
+    if (dif == 0)
+    {
+      if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, TRUE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (dif < 0)                            /* not produced yet */
+      return FALSE;
+    else
+      pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  }
+
+  *val = cell->val;
+
+  __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+  return TRUE;
+}
+
+/**
+ * @brief Peek whether the queue looks empty, without claiming anything.
+ *        A stale answer is possible while producers are running.
+ */
+static inline int yqueue_is_empty(yqueue_t *q)
+{
+  return (__atomic_load_n(&q->head, __ATOMIC_RELAXED) >=
+          __atomic_load_n(&q->tail, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Number of values queued, stale while producers and consumers
+ *        are running.
+ */
+static inline size_t yqueue_count(yqueue_t *q)
+{
+  size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+  return (tail > head) ? (tail - head) : 0;
+}
+
+#endif /* yqueue.h */
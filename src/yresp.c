@@ -0,0 +1,313 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ycommon.h>
+#include <ctype.h>
+
+#include <ytrace.h>
+#include <yresp.h>
+
+/**
+ * RESP commands and their arity, command name included. amax -1 means
+ * any number of extra arguments, which are ignored.
+ */
+struct yresp_cmd_t
+{
+  char *name;
+  int   len;
+  int   cmd;
+  int   amin;
+  int   amax;
+};
+typedef struct yresp_cmd_t yresp_cmd_t;
+
+#define YRESP_CMD(name, cmd, amin, amax) \
+        { name, sizeof(name) - 1, cmd, amin, amax }
+
+static yresp_cmd_t yresp_cmds[] =
+{
+  YRESP_CMD("GET",     CMD_GET,    2,  2),
+  YRESP_CMD("SET",     CMD_SET,    3, -1),
+  YRESP_CMD("SELECT",  CMD_SELECT, 2,  2),
+  YRESP_CMD("FLUSHDB", CMD_FLUSH,  1,  2),
+  YRESP_CMD("PING",    CMD_PING,   1,  2),
+  YRESP_CMD("ECHO",    CMD_PING,   2,  2),
+  YRESP_CMD("INFO",    CMD_STATS,  1,  2),
+  YRESP_CMD("QUIT",    CMD_QUIT,   1,  1),
+};
+
+#define YRESP_NCMD (sizeof(yresp_cmds) / sizeof(yresp_cmds[0]))
+
+/**
+ * Decode a length line, '<type><digits>\r\n'.
+ */
+static int yresp_decode_num(char **cpp, char *ep, char type, int *val)
+{
+  char *cp  = *cpp;
+  char *sp  = cp;
+  int   num = 0;
+
+  if (cp >= ep)
+    return y_error(EAGAIN);
+
+  if (*cp++ != type)
+    return y_error(EPROTO);
+
+  for (; cp < ep && *cp != '\r'; cp++)
+  {
+    if (!isdigit(*cp) || (cp - sp) > 9)
+      return y_error(EPROTO);
+
+    num = num * 10 + (*cp - '0');
+  }
+
+  if (cp + 1 >= ep)
+    return ((ep - sp) > YRESP_NUM_MAX) ? y_error(EPROTO) : y_error(EAGAIN);
+
+  if (cp[1] != '\n' || cp == sp + 1)
+    return y_error(EPROTO);
+
+  *val = num;
+  *cpp = cp + 2;
+
+  return 0;
+}
+
+/**
+ * Decode an array of bulk strings.
+ */
+static int yresp_decode_multi(ybuf_t *buf, ycmd_req_t *req, ytoken_t *argv,
+                              int *argc, char **end)
+{
+  int   ret;
+  int   ind;
+  int   len;
+  int   cnt;
+  char *cp = buf->sp;
+  char *ep = buf->ep;
+
+  if ((ret = yresp_decode_num(&cp, ep, '*', &cnt)) != 0)
+    return ret;
+
+  if (cnt <= 0 || cnt > YRESP_ARGC_MAX)
+    return y_error(EPROTO);
+
+  for (ind = 0; ind < cnt; ind++)
+  {
+    if ((ret = yresp_decode_num(&cp, ep, '$', &len)) != 0)
+      return ret;
+
+    if (len > YCMD_BULK_MAX)
+      return y_error(E2BIG);
+
+    if (ep - cp < len + 2)
+    {
+      req->need = (cp - buf->sp) + len + 2;
+      return y_error(EAGAIN);
+    }
+
+    if (cp[len] != '\r' || cp[len + 1] != '\n')
+      return y_error(EPROTO);
+
+    if (ind < YRESP_ARG_MAX)
+    {
+      argv[ind].str = cp;
+      argv[ind].len = len;
+    }
+
+    cp += len + 2;
+  }
+
+  *argc = cnt;
+  *end  = cp;
+
+  return 0;
+}
+
+/**
+ * Decode an inline command, space separated arguments till newline.
+ */
+static int yresp_decode_inline(ybuf_t *buf, ytoken_t *argv, int *argc,
+                               char **end)
+{
+  int   cnt = 0;
+  char *cp  = buf->sp;
+  char *ep;
+  char *nl;
+
+  if ((nl = memchr(cp, '\n', ybuf_rem(buf))) == NULL)
+    return (ybuf_rem(buf) > YRESP_LINE_MAX) ? y_error(E2BIG) : 
+                                               y_error(EAGAIN);
+
+  ep = (nl > cp && nl[-1] == '\r') ? nl - 1 : nl;
+
+  while (cp < ep)
+  {
+    for (; cp < ep && *cp == ' '; cp++);
+
+    if (cp == ep)
+      break;
+
+    if (cnt < YRESP_ARG_MAX)
+      argv[cnt].str = cp;
+
+    for (; cp < ep && *cp != ' '; cp++);
+
+    if (cnt < YRESP_ARG_MAX)
+      argv[cnt].len = cp - argv[cnt].str;
+
+    cnt++;
+  }
+
+  *argc = cnt;
+  *end  = nl + 1;
+
+  return 0;
+}
+
+/**
+ * Decode request. Refer yresp.h for details.
+ */
+int yresp_decode_req(ybuf_t *buf, ycmd_req_t *req)
+{
+  int          ret;
+  int          ind;
+  int          argc = 0;
+  char        *end;
+  ytoken_t     argv[YRESP_ARG_MAX];
+  yresp_cmd_t *ent;
+
+  memset(req, 0, sizeof(*req));
+
+  req->proto = YPROTO_RESP;
+
+  if (ybuf_rem(buf) == 0)
+    return y_error(EAGAIN);
+
+  if (buf->sp[0] == '*')
+    ret = yresp_decode_multi(buf, req, argv, &argc, &end);
+  else 
+    ret = yresp_decode_inline(buf, argv, &argc, &end);
+
+  if (ret != 0)
+    return ret;
+
+  buf->sp = end;
+
+  if (argc == 0)                              /* empty inline, ignored */
+    return 0;
+
+  req->cmd = CMD_UNKNOWN;
+
+  for (ind = 0; ind < YRESP_NCMD; ind++)
+  {
+    ent = &yresp_cmds[ind];
+
+    if ((argv[0].len == ent->len) &&
+        (strncasecmp(argv[0].str, ent->name, ent->len) == 0))
+      break;
+  }
+
+  if ((ind == YRESP_NCMD) || (argc < ent->amin) ||
+      (ent->amax > 0 && argc > ent->amax))
+  {
+    ytrace_msg(YTRACE_LEVEL1, "yresp_decode_req : unknown [%.*s] : %d\n",
+               argv[0].len, argv[0].str, argc);
+    return 0;
+  }
+
+  req->cmd = ent->cmd;
+
+  if (argc > 1 && ent->cmd != CMD_STATS && ent->cmd != CMD_FLUSH)
+    req->key = argv[1];
+
+  if (argc > 2)
+    req->val = argv[2];
+
+  return 0;
+}
+
+/**
+ * Append a string.
+ */
+static inline int yresp_encode_str(ybuf_t *buf, char *str, int len)
+{
+  if (buf->fre < len)
+    return y_error(EINVAL);
+
+  memcpy(buf->ep, str, len);
+
+  buf->ep  += len;
+  buf->fre -= len;
+
+  return 0;
+}
+
+#define yresp_encode_lit(buf, lit) yresp_encode_str(buf, lit, sizeof(lit) - 1)
+
+/**
+ * Encode reply. Refer yresp.h for details.
+ */
+int yresp_encode_res(ybuf_t *buf, ycmd_req_t *req, int err, int vlen)
+{
+  int  len;
+  char num[16];
+  char *cp;
+
+  if (err == ENOENT && req->cmd == CMD_GET)                       /* miss */
+    return yresp_encode_lit(buf, "$-1\r\n");
+
+  if (err)
+  {
+    if (req->cmd == CMD_UNKNOWN)
+      return yresp_encode_lit(buf, 
+               "-ERR unknown command or wrong number of arguments\r\n");
+
+    len = snprintf(buf->ep, buf->fre, "-ERR %s\r\n", strerror(err));
+
+    if (len >= buf->fre)
+      return y_error(EINVAL);
+
+    buf->ep  += len;
+    buf->fre -= len;
+
+    return 0;
+  }
+
+  if (vlen < 0)
+  {
+    if (req->cmd == CMD_PING)
+      return yresp_encode_lit(buf, "+PONG\r\n");
+
+    return yresp_encode_lit(buf, "+OK\r\n");
+  }
+
+  cp    = num + sizeof(num);
+  *--cp = '\n';
+  *--cp = '\r';
+
+  do 
+  {
+    *--cp = '0' + vlen % 10;
+    vlen /= 10;
+  }
+  while (vlen);
+
+  *--cp = '$';
+
+  return yresp_encode_str(buf, cp, num + sizeof(num) - cp);
+}
@@ -0,0 +1,74 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YRESP_H
+
+#define _YRESP_H
+
+#include <ycommon.h>
+#include <ycommand.h>
+
+/**
+ * @file yresp.h - Redis Serialization Protocol (RESP2)
+ *
+ * Served on its own listener port. Requests are arrays of bulk strings
+ *
+ *   *<argc>\r\n $<len>\r\n <arg>\r\n ...
+ *
+ * or inline commands, space separated arguments ended by a newline. Both
+ * are decoded in place, arguments refer to the receive buffer. Requests
+ * are mapped onto the same commands as the native protocols:
+ *
+ *   GET key, SET key value [options ignored], SELECT index, FLUSHDB,
+ *   PING [message], ECHO message, INFO, QUIT
+ *
+ * Replies are simple strings (+OK, +PONG), bulk strings ($-1 on a miss)
+ * and errors (-ERR ...).
+ */
+
+#define YRESP_ARG_MAX    (8)          /**< arguments kept, rest are skipped */
+#define YRESP_ARGC_MAX   (1024 * 1024)          /**< max arguments accepted */
+#define YRESP_NUM_MAX    (16)           /**< max length of a length line */
+#define YRESP_LINE_MAX   (64 * 1024)       /**< max length of inline command */
+
+/**
+ * @brief Decode one RESP request from buffer.
+ *
+ * @param buf - buffer, consumed past the request on success
+ * @param req - decoded request. Key and value refer to the buffer. need is
+ *              set when the request is incomplete and its length known.
+ *
+ * @return 0 on success, -1 on failure with errno set. EAGAIN if the
+ *         request is incomplete, with nothing consumed. Unknown commands
+ *         decode to CMD_UNKNOWN.
+ */
+int yresp_decode_req(ybuf_t *buf, ycmd_req_t *req);
+
+/**
+ * @brief Encode reply to a request except for its value, which has to be
+ *        followed by CRLF.
+ *
+ * @param buf  - buffer to append to
+ * @param req  - request replied to
+ * @param err  - status, errno value or 0
+ * @param vlen - length of value, -1 for result only reply
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yresp_encode_res(ybuf_t *buf, ycmd_req_t *req, int err, int vlen);
+
+#endif /* yresp.h */
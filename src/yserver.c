@@ -21,50 +21,302 @@
 #include <ynet.h>
 #include <ynets.h>
 #include <yhash.h>
+#include <yns.h>
+#include <ycommand.h>
 #include <ythread.h>
+#include <ymux.h>
+#include <yupg.h>
+#include <ynuma.h>
 #include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
 
 #define NTHREAD  (1024)
-#define LCTX_MAX (16)
 #define WCTX_MAX (16)
 
-ynet_ctx_t *glctx[LCTX_MAX];
-ynet_ctx_t *gwctx[LCTX_MAX];
 ythread_ctx_t gtctx[NTHREAD];
 
-ynet_event_ctx_t  ynet_event_ctx;
+yqueue_t          ynet_event_queue;
 ynet_waiter_ctx_t ynet_waiter_ctx;
+ynet_waiter_ctx_t ynet_reactor_ctx[NTHREAD];           /* one per thread */
+yuring_ctx_t     *yuring_ctx[NTHREAD];                 /* one per thread */
 
 #define YARI_SERVER_DEFAULT_NTHREADS (4)
 
 int nthreads = YARI_SERVER_DEFAULT_NTHREADS;
+int resp_port;                               /* RESP listener, 0 if none */
+int mc_port;                            /* memcached listener, 0 if none */
+char *unix_path;                       /* Unix domain listener, if any */
+int unix_sfd = -1;                  /* shared by every reactor and ring */
+char *shm_path;                    /* shared memory handshake, if any */
+int shm_sfd = -1;                                /* shared by every reactor */
+int reactor;                       /* reactor per thread, shared waiter if 0 */
+int uring;                              /* io_uring per thread, if available */
+int acceptors;                      /* TCP listeners per port, 1 if 0 */
+int conns = YNET_CONN_RESERVE_DEFAULT;      /* contexts allocated upfront */
+char *handoff_path;                       /* handoff socket, if served */
+char *takeover_path;          /* handoff socket taken over from, if any */
+yupg_lsnr_t upg_lsnrs[YUPG_LSNR_MAX];             /* listeners taken over */
+int upg_nlsnr;
+char *cpu_list;                          /* cpus of the workers, if pinned */
+char *numa_mode;                          /* memory placement, if any */
+char *ns_specs[YNS_MAX];        /* namespaces, created once placement is set */
+int ns_nspec;
+
+/*
+ * Listener taken over for a protocol on a TCP port, or on a Unix socket
+ * (port 0), -1 if none.
+ */
+int upg_find(int port, int proto)
+{
+  int ind;
+
+  for (ind = 0; ind < upg_nlsnr; ind++)
+  {
+    if ((upg_lsnrs[ind].port == port) && (upg_lsnrs[ind].proto == proto))
+      return upg_lsnrs[ind].sfd;
+  }
+
+  return -1;
+}
+
+/*
+ * Whether waiter 'w' of 'nw' attaches TCP listener 'lind' taken over. The
+ * listeners of a port are spread over the waiters, a waiter left without
+ * one shares one.
+ */
+int upg_pick(int lind, int w, int nw)
+{
+  int ind;
+  int pos = 0;
+  int grp = 0;
+
+  for (ind = 0; ind < upg_nlsnr; ind++)
+  {
+    if ((upg_lsnrs[ind].port == upg_lsnrs[lind].port) &&
+        (upg_lsnrs[ind].proto == upg_lsnrs[lind].proto))
+    {
+      pos += (ind < lind);
+      grp++;
+    }
+  }
+
+  return (pos % nw == w) || ((grp < nw) && (pos == w % grp));
+}
+
+/*
+ * Listeners sharing a port with SO_REUSEPORT would silently join another
+ * server's, exit instead if one of the ports not taken over is bound.
+ */
+void check_ports()
+{
+  int ind;
+  int ports[3]  = {YNET_SER_PORT, resp_port, mc_port};
+  int protos[3] = {YPROTO_TEXT, YPROTO_RESP, YPROTO_MC};
+
+  if (!reactor && !uring && (ynet_acceptors <= 1))
+    return;
+
+  for (ind = 0; ind < 3; ind++)
+  {
+    if (ports[ind] && (upg_find(ports[ind], protos[ind]) < 0) &&
+        (ynet_lsnr_probe(ports[ind]) != 0))
+    {
+      printf("port %d in use : errno = %d\n", ports[ind], errno);
+      exit(0);
+    }
+  }
+}
+
+/*
+ * Listeners of waiter context 'w' of 'nw', taken over or on every
+ * configured port.
+ */
+void create_lsnrs(ynet_waiter_ctx_t *wctx, int w, int nw)
+{
+  int ind;
+
+  for (ind = 0; ind < upg_nlsnr; ind++)
+  {
+    if (upg_lsnrs[ind].port && upg_pick(ind, w, nw) &&
+        (ynet_lsnr_attach(wctx, upg_lsnrs[ind].sfd, 
+                          upg_lsnrs[ind].proto) == NULL))
+      exit(0);
+  }
+
+  /* a reactor has one of its own, a shared waiter ynet_acceptors */
+  for (ind = 0; ind < (ynet_waiter_is_reactor(wctx) ? 1 : ynet_acceptors); 
+       ind++)
+  {
+    if ((upg_find(YNET_SER_PORT, YPROTO_TEXT) < 0) &&
+        (ynet_lsnr_create(wctx, YNET_SER_PORT, YPROTO_TEXT) == NULL))
+      exit(0);
+
+    if (resp_port && (upg_find(resp_port, YPROTO_RESP) < 0) &&
+        (ynet_lsnr_create(wctx, resp_port, YPROTO_RESP) == NULL))
+      exit(0);
+
+    if (mc_port && (upg_find(mc_port, YPROTO_MC) < 0) &&
+        (ynet_lsnr_create(wctx, mc_port, YPROTO_MC) == NULL))
+      exit(0);
+  }
+
+  if ((unix_sfd >= 0) &&
+      (ynet_lsnr_attach(wctx, unix_sfd, YPROTO_TEXT) == NULL))
+    exit(0);
+
+  if ((shm_sfd >= 0) && (ynet_lsnr_attach(wctx, shm_sfd, YPROTO_SHM) == NULL))
+    exit(0);
+}
+
+/*
+ * Listeners of ring 'w' of 'nw', taken over or on every configured port.
+ */
+void create_uring_lsnrs(yuring_ctx_t *ctx, int w, int nw)
+{
+  int ind;
+
+  for (ind = 0; ind < upg_nlsnr; ind++)
+  {
+    if ((upg_lsnrs[ind].port && upg_pick(ind, w, nw) &&
+        (yuring_lsnr_attach(ctx, upg_lsnrs[ind].sfd,
+                            upg_lsnrs[ind].proto) != 0)))
+      exit(0);
+  }
+
+  if ((upg_find(YNET_SER_PORT, YPROTO_TEXT) < 0) &&
+      (yuring_lsnr_add(ctx, YNET_SER_PORT, YPROTO_TEXT) != 0))
+    exit(0);
+
+  if (resp_port && (upg_find(resp_port, YPROTO_RESP) < 0) &&
+      (yuring_lsnr_add(ctx, resp_port, YPROTO_RESP) != 0))
+    exit(0);
+
+  if (mc_port && (upg_find(mc_port, YPROTO_MC) < 0) &&
+      (yuring_lsnr_add(ctx, mc_port, YPROTO_MC) != 0))
+    exit(0);
+
+  if ((unix_sfd >= 0) && (yuring_lsnr_attach(ctx, unix_sfd, YPROTO_TEXT) != 0))
+    exit(0);
+}
+
+/*
+ * Connections are bounded by the descriptor limit, take the hard one.
+ */
+void raise_fd_limit(void)
+{
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    return;
+
+  rl.rlim_cur = rl.rlim_max;
+
+  if (setrlimit(RLIMIT_NOFILE, &rl) == 0)
+    printf("# descriptor limit     = %lu\n", (unsigned long)rl.rlim_cur);
+}
 
 void create_ds(void)
 {
   int ret;
+  int ind;
+
+  for (ind = 0; uring && ind < nthreads; ind++)
+  {
+    if ((yuring_ctx[ind] = yuring_create()) == NULL)
+    {
+      /* old kernel or io_uring disabled, epoll reactors instead */
+      printf("# io_uring unavailable = errno %d, using epoll reactors\n",
+             errno);
+      uring   = FALSE;
+      reactor = TRUE;
+      break;
+    }
+  }
+
+  /* taken over ones go on being served, configured or not */
+  unix_sfd = upg_find(0, YPROTO_TEXT);
+  shm_sfd  = upg_find(0, YPROTO_SHM);
+
+  if ((shm_sfd >= 0) && uring)
+  {
+    close(shm_sfd);
+    shm_sfd = -1;
+  }
 
-  if ((ret = ynet_event_create(&ynet_event_ctx, YNET_EVENT_CTX_MAX)) != 0)
+  if (unix_path && (unix_sfd < 0) &&
+      ((unix_sfd = ynet_lsnr_unix_socket(unix_path)) < 0))
   {
-    ytrace_msg(YTRACE_ERROR, "waiter context creation failed [%d]\n", ret);
+    printf("unix listener [%s] failed : errno = %d\n", unix_path, errno);
     exit(0);
   }
 
-  if ((ret = ynet_waiter_create(&ynet_waiter_ctx, &ynet_event_ctx)) != 0)
+  if (shm_path && uring)
   {
-    ytrace_msg(YTRACE_ERROR, "waiter context creation failed [%d]\n", ret);
+    /* rings are polled from the epoll loops only */
+    printf("# shm transport needs epoll, not served with io_uring\n");
+    shm_path = NULL;
+  }
+
+  if (shm_path && (shm_sfd < 0) &&
+      ((shm_sfd = ynet_lsnr_unix_socket(shm_path)) < 0))
+  {
+    printf("shm listener [%s] failed : errno = %d\n", shm_path, errno);
     exit(0);
   }
 
-  if ((glctx[0] = ynet_lsnr_create(&ynet_waiter_ctx)) == NULL)
+  if (uring)
+  {
+    for (ind = 0; ind < nthreads; ind++)
+      create_uring_lsnrs(yuring_ctx[ind], ind, nthreads);
+  }
+  else if (reactor)
+  {
+    for (ind = 0; ind < nthreads; ind++)
+    {
+      if ((ret = ynet_waiter_create(&ynet_reactor_ctx[ind], NULL)) != 0)
+      {
+        ytrace_msg(YTRACE_ERROR, "reactor creation failed [%d]\n", ret);
+        exit(0);
+      }
+
+      create_lsnrs(&ynet_reactor_ctx[ind], ind, nthreads);
+    }
+  }
+  else
+  {
+    if ((ret = yqueue_create(&ynet_event_queue, YNET_EVENT_QUEUE_MAX)) != 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "waiter context creation failed [%d]\n", ret);
+      exit(0);
+    }
+
+    if ((ret = ynet_waiter_create(&ynet_waiter_ctx, &ynet_event_queue)) != 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "waiter context creation failed [%d]\n", ret);
+      exit(0);
+    }
+
+    create_lsnrs(&ynet_waiter_ctx, 0, 1);
+  }
+
+  /* flagged requests of epoll connections run on lanes, one per thread */
+  if (!uring && (ymux_init(nthreads) != 0))
+  {
+    printf("request lanes failed : errno = %d\n", errno);
     exit(0);
+  }
 
-  if ((yhtab_global = yhtab_create(YHTAB_NCNT_DEFAULT, 
-                                   YHTAB_SMAX_DEFAULT)) == NULL)
+  /* first configured namespace, if any, is the default one */
+  if ((yns_create(YNS_DEFAULT, "default", YHTAB_NCNT_DEFAULT, 0,
+                  YHTAB_EVICT_NONE) != 0) && (errno != EEXIST))
     exit(0);
 }
 
 void parse_cmd_line(int argc, char *argv[])
 {
+  int ind;
+
   while (1)
   {
     int c;  
@@ -72,6 +324,24 @@ void parse_cmd_line(int argc, char *argv[])
     {
       /* Flag based options */
       {"threads",    required_argument, NULL, 't'}, 
+      {"namespace",  required_argument, NULL, 'n'}, 
+      {"resp",       optional_argument, NULL, 'r'}, 
+      {"memcached",  optional_argument, NULL, 'm'}, 
+      {"reactor",          no_argument, NULL, 'R'},
+      {"uring",            no_argument, NULL, 'U'},
+      {"busy-poll",  optional_argument, NULL, 'b'}, 
+      {"busy-read",  required_argument, NULL, 'B'}, 
+      {"unix",       optional_argument, NULL, 'u'}, 
+      {"shm",        optional_argument, NULL, 's'}, 
+      {"affinity",         no_argument, NULL, 'A'},
+      {"quota",      required_argument, NULL, 'q'}, 
+      {"acceptors",  required_argument, NULL, 'a'}, 
+      {"backlog",    required_argument, NULL, 'L'}, 
+      {"conns",      required_argument, NULL, 'c'}, 
+      {"handoff",    optional_argument, NULL, 'H'}, 
+      {"takeover",   optional_argument, NULL, 'T'}, 
+      {"cpus",       required_argument, NULL, 'P'}, 
+      {"numa",       required_argument, NULL, 'N'}, 
       {"verbose",          no_argument, NULL, 'v'},
       {0, 0, 0, 0}
     };
@@ -79,7 +349,7 @@ void parse_cmd_line(int argc, char *argv[])
     /* getopt_long stores the option index here. */
     int option_index = 0;
 
-    c = getopt_long(argc, argv, "t:v",
+    c = getopt_long(argc, argv, "t:n:r::m::RUb::B:u::s::Aq:a:L:c:H::T::P:N:v",
                     long_options, &option_index);
 
     /* Detect the end of the options. */
@@ -95,12 +365,183 @@ void parse_cmd_line(int argc, char *argv[])
        nthreads = atol(optarg);
        break;  
 
+      case 'n':                         /* name[:slots[:memory[:policy]]] */
+       if (ns_nspec == YNS_MAX)
+       {
+         printf("namespaces upto %d\n", YNS_MAX);
+         exit(-1);
+       }
+
+       ns_specs[ns_nspec++] = optarg;
+       break;  
+
+      case 'r':                               /* RESP listener [port] */
+       resp_port = (optarg) ? atol(optarg) : YNET_RESP_PORT;
+       break;  
+
+      case 'm':                          /* memcached listener [port] */
+       mc_port = (optarg) ? atol(optarg) : YNET_MC_PORT;
+       break;  
+
+      case 'R':                  /* epoll and listeners per thread */
+       reactor = TRUE;
+       break;  
+
+      case 'U':                      /* io_uring per thread, else epoll */
+       uring = TRUE;
+       break;  
+
+      case 'b':                         /* spin before blocking [usecs] */
+       ynet_busy_spin = (optarg) ? atol(optarg) : YNET_BUSY_SPIN_DEFAULT;
+       break;  
+
+      case 'B':                         /* SO_BUSY_POLL of sockets, usecs */
+       ynet_busy_read = atol(optarg);
+       break;  
+
+      case 'u':                    /* Unix domain listener [path] */
+       unix_path = (optarg) ? optarg : YNET_UNIX_PATH;
+       break;  
+
+      case 's':                  /* shared memory transport [path] */
+       shm_path = (optarg) ? optarg : YNET_SHM_PATH;
+       break;  
+
+      case 'A':                    /* home thread per connection */
+       ynet_affinity = TRUE;
+       break;  
+
+      case 'q':               /* bytes read per connection pass, 0 off */
+       ynet_conn_quota = atol(optarg);
+       break;  
+
+      case 'a':                    /* TCP listeners per port, shared */
+       acceptors = atol(optarg);
+       break;  
+
+      case 'L':                             /* listen queue length */
+       ynet_backlog = atol(optarg);
+       break;  
+
+      case 'c':                    /* connection contexts allocated upfront */
+       conns = atol(optarg);
+       break;  
+
+      case 'H':                       /* serve handoffs on [path] */
+       handoff_path = (optarg) ? optarg : YUPG_PATH;
+       break;  
+
+      case 'T':            /* take over from the server on [path] */
+       takeover_path = (optarg) ? optarg : YUPG_PATH;
+       break;  
+
+      case 'P':                    /* pin workers, cpu list "0-3,8" */
+       cpu_list = optarg;
+       break;  
+
+      case 'N':                /* local, interleave or partition memory */
+       numa_mode = optarg;
+       break;  
+
       default:
        exit(-1);
     }
   }
 
+  ycmd_bulk_workers = nthreads;
+
+  if (nthreads <= 0 || nthreads > NTHREAD)
+  {
+    printf("threads 1..%d\n", NTHREAD);
+    exit(-1);
+  }
+
+  if (acceptors < 0 || ynet_backlog <= 0 || conns < 0)
+  {
+    printf("acceptors, conns 0 or more, backlog positive\n");
+    exit(-1);
+  }
+
+  if (ynuma_init(cpu_list, numa_mode) != 0)
+  {
+    printf("invalid cpus [%s] or numa mode [%s]\n", 
+           (cpu_list) ? cpu_list : "", (numa_mode) ? numa_mode : "");
+    exit(-1);
+  }
+
+  /* slot arrays of tables are placed as they are allocated */
+  for (ind = 0; ind < ns_nspec; ind++)
+  {
+    if (yns_config(ns_specs[ind]) != 0)
+    {
+      printf("invalid namespace [%s] : errno = %d\n", ns_specs[ind], errno);
+      exit(-1);
+    }
+  }
+
+  /* one listener per port, shared with SO_REUSEPORT only if asked */
+  if (acceptors)
+    ynet_acceptors = acceptors;
+
   printf("# of server threads    = %d\n", nthreads);
+  printf("# event model          = %s\n", 
+         (uring) ? "io_uring per thread" :
+         (reactor) ? "reactor per thread" : "shared waiter");
+
+  if (ynet_affinity && !reactor && !uring)
+    printf("# connection affinity  = on\n");
+
+  if (!reactor && !uring)
+    printf("# acceptors            = %d per port\n", ynet_acceptors);
+
+  printf("# listen backlog       = %d\n", ynet_backlog);
+
+  if (cpu_list)
+    printf("# cpus pinned          = %s\n", cpu_list);
+  else if (ynuma_pinned())
+    printf("# cpus pinned          = all, node by node\n");
+
+  if (ynuma_mode != YNUMA_OFF)
+    printf("# numa placement       = %s, %d node(s)\n", numa_mode, 
+           ynuma_nnode);
+
+  if (ynet_conn_quota > 0 && !uring)
+    printf("# read quota           = %d bytes\n", ynet_conn_quota);
+
+  if (ynet_busy_spin)
+    printf("# busy poll            = %d us\n", ynet_busy_spin);
+
+  if (ynet_busy_read)
+    printf("# busy read            = %d us\n", ynet_busy_read);
+
+  if (resp_port)
+    printf("# RESP port            = %d\n", resp_port);
+
+  if (mc_port)
+    printf("# memcached port       = %d\n", mc_port);
+
+  if (unix_path)
+    printf("# unix socket          = %s\n", unix_path);
+
+  if (shm_path)
+    printf("# shm handshake socket = %s\n", shm_path);
+
+  /* the next upgrade takes over from this one, on the same path */
+  if (takeover_path && !handoff_path)
+    handoff_path = takeover_path;
+
+  if (handoff_path && uring)
+  {
+    /* listeners of rings are not in the tables handed over */
+    printf("# handoff needs epoll, not served with io_uring\n");
+    handoff_path = NULL;
+  }
+
+  if (takeover_path)
+    printf("# takeover from        = %s\n", takeover_path);
+
+  if (handoff_path)
+    printf("# handoff socket       = %s\n", handoff_path);
 }
 
 
@@ -110,13 +551,40 @@ int main(int argc, char *argv[])
 
   parse_cmd_line(argc, argv);
 
+  /* peers gone before their responses are written, writes get EPIPE */
+  signal(SIGPIPE, SIG_IGN);
+
+  raise_fd_limit();
+
+  /* connection storms shouldn't wait on allocations of first use */
+  if (ynet_conn_reserve(conns) != 0)
+    printf("# connection contexts  = %d not reserved : errno %d\n", conns,
+           errno);
+
+  /* connections queue on the old listeners till they are attached */
+  if (takeover_path &&
+      ((upg_nlsnr = yupg_takeover(takeover_path, upg_lsnrs,
+                                  YUPG_LSNR_MAX)) < 0))
+  {
+    printf("takeover [%s] failed : errno = %d\n", takeover_path, errno);
+    exit(0);
+  }
+
+  check_ports();
+
   create_ds();
 
   for (i=0; i<nthreads; i++)
   {
-    ythread_create(&gtctx[i], i, &ynet_waiter_ctx);
+    gtctx[i].uring = yuring_ctx[i];
+
+    ythread_create(&gtctx[i], i, 
+                   (reactor) ? &ynet_reactor_ctx[i] : &ynet_waiter_ctx);
   }
 
+  if (handoff_path && (yupg_serve(handoff_path) != 0))
+    printf("# handoff [%s] not served : errno = %d\n", handoff_path, errno);
+
   for (i=0; i<nthreads; i++)
   {
     ythread_join(&gtctx[i]);
@@ -0,0 +1,635 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <ycommon.h>
+#include <ytrace.h>
+#include <ynet.h>
+#include <ycommand.h>
+#include <yshm.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define yshm_relax()      __builtin_ia32_pause()
+#else
+#define yshm_relax()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#define yshm_load(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define yshm_store(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define yshm_fence()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define yshm_claim(p)     __atomic_exchange_n((p), 0, __ATOMIC_SEQ_CST)
+
+#define yshm_mask(p)      ((p) & (YSHM_RING_SIZE - 1))
+
+#define YSHM_WAIT_SLICE   (100)   /* ms per futex wait, liveness checked */
+
+/**
+ * Rings polled by this server thread, reactor connections.
+ */
+static __thread ynet_ctx_t *yshm_own[YSHM_OWN_MAX];
+static __thread int         yshm_nown;
+
+/**
+ * Client spin rounds, none on a single cpu where it delays the server.
+ */
+static int yshm_spin = -1;
+
+static int yshm_futex_wait(uint32_t *addr, uint32_t val, int ms)
+{
+  struct timespec ts;
+
+  ts.tv_sec  = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+
+  return syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void yshm_futex_wake(uint32_t *addr)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Map a channel, data of each ring twice back to back so that a span
+ * crossing the end of the ring is contiguous.
+ */
+static yshm_t * yshm_map(int fd)
+{
+  int     ind;
+  char   *base;
+  char   *addr;
+  size_t  pg   = getpagesize();
+  size_t  size = YSHM_RING_SIZE;
+  size_t  len  = pg + 4 * size;
+  yshm_t *shm;
+
+  if ((shm = calloc(1, sizeof(*shm))) == NULL)
+    return NULL;
+
+  base = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (base == MAP_FAILED)
+  {
+    free(shm);
+    return NULL;
+  }
+
+  addr = mmap(base, pg, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+              fd, 0);
+
+  for (ind = 0; (addr != MAP_FAILED) && (ind < 4); ind++)
+  {
+    addr = mmap(base + pg + ind * size, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, pg + (ind / 2) * size);
+  }
+
+  if (addr == MAP_FAILED)
+  {
+    munmap(base, len);
+    free(shm);
+    return NULL;
+  }
+
+  shm->hdr = (yshm_hdr_t *)base;
+  shm->req = base + pg;
+  shm->res = base + pg + 2 * size;
+  shm->len = len;
+
+  return shm;
+}
+
+/**
+ * Release a channel. Refer yshm.h for details.
+ */
+void yshm_detach(ynet_ctx_t *ctx)
+{
+  int     ind;
+  yshm_t *shm = ctx->shm;
+
+  if (shm == NULL)
+    return;
+
+  for (ind = 0; shm->own && ind < yshm_nown; ind++)
+  {
+    if (yshm_own[ind] == ctx)
+    {
+      yshm_own[ind] = yshm_own[--yshm_nown];
+      break;
+    }
+  }
+
+  munmap(shm->hdr, shm->len);
+  free(shm);
+
+  ctx->shm = NULL;
+}
+
+/**
+ * Set up and hand over a channel. Refer yshm.h for details.
+ */
+int yshm_server_attach(ynet_ctx_t *ctx, int own)
+{
+  int             fd;
+  int             ret;
+  char            tag = 'Y';
+  char            cbuf[CMSG_SPACE(sizeof(int))];
+  yshm_t         *shm;
+  struct iovec    iov;
+  struct msghdr   msg;
+  struct cmsghdr *cmsg;
+
+  if ((fd = syscall(SYS_memfd_create, "yari-shm", MFD_CLOEXEC)) < 0)
+    return -1;
+
+  if ((ftruncate(fd, getpagesize() + 2 * YSHM_RING_SIZE) < 0) ||
+      ((shm = yshm_map(fd)) == NULL))
+  {
+    close(fd);
+    return -1;
+  }
+
+  shm->hdr->magic          = YSHM_MAGIC;
+  shm->hdr->size           = YSHM_RING_SIZE;
+  shm->hdr->req.cons_sleep = TRUE;            /* server waits for a bell */
+
+  memset(&msg, 0, sizeof(msg));
+  memset(cbuf, 0, sizeof(cbuf));
+
+  iov.iov_base = &tag;
+  iov.iov_len  = 1;
+
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ret = sendmsg(ctx->sfd, &msg, MSG_NOSIGNAL);
+
+  close(fd);                                  /* mapping keeps it alive */
+
+  if (ret < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "yshm : handover failed : %d\n", errno);
+    munmap(shm->hdr, shm->len);
+    free(shm);
+    return -1;
+  }
+
+  ctx->class = YNET_CLASS_SHM;
+  ctx->shm   = shm;
+  ctx->async = TRUE;                 /* output moved by yshm_server_out */
+
+  if (own && (yshm_nown < YSHM_OWN_MAX))
+  {
+    yshm_own[yshm_nown++] = ctx;
+    shm->own = TRUE;
+  }
+
+  ytrace_msg(YTRACE_DEFAULT, "yshm : channel on fd = %d, polled = %d\n",
+             ctx->sfd, shm->own);
+
+  return 0;
+}
+
+/**
+ * Move queued responses to the response ring, as much as fits.
+ */
+static int yshm_server_out(ynet_ctx_t *ctx, int *rest)
+{
+  int           ind;
+  int           cnt;
+  int           len;
+  uint32_t      tail;
+  uint32_t      room;
+  uint32_t      moved = 0;
+  yshm_t       *shm   = ctx->shm;
+  yshm_ring_t  *ring  = &shm->hdr->res;
+  struct iovec  iov[YNET_OUT_IOV];
+
+  *rest = shm->pend = FALSE;
+
+  if ((cnt = ynet_out_iov(ctx, iov)) == 0)
+  {
+    ynet_out_put(ctx, FALSE);
+    return 0;
+  }
+
+  tail = ring->tail;
+  room = YSHM_RING_SIZE - (tail - yshm_load(&ring->head));
+
+  for (ind = 0; (ind < cnt) && room; ind++)
+  {
+    len = min(iov[ind].iov_len, room);
+
+    memcpy(shm->res + yshm_mask(tail), iov[ind].iov_base, len);
+
+    tail  += len;
+    room  -= len;
+    moved += len;
+  }
+
+  if (moved)
+  {
+    yshm_store(&ring->tail, tail);
+    yshm_fence();
+
+    if (ring->cons_sleep && yshm_claim(&ring->cons_sleep))
+      yshm_futex_wake(&ring->cons_sleep);
+  }
+
+  if (ynet_out_done(ctx, moved) == 0)
+    ynet_out_put(ctx, FALSE);
+  else
+    *rest = shm->pend = TRUE;
+
+  return moved;
+}
+
+/**
+ * Execute what the request ring holds, in place.
+ */
+static int yshm_server_in(ynet_ctx_t *ctx)
+{
+  uint32_t     len;
+  uint32_t     head;
+  yshm_t      *shm  = ctx->shm;
+  yshm_ring_t *ring = &shm->hdr->req;
+
+  head = ring->head;
+  len  = yshm_load(&ring->tail) - head;
+
+  if ((len == 0) || ctx->held)
+    return 0;
+
+  if (ycmd_server_input(ctx, shm->req + yshm_mask(head), len, TRUE) != 0)
+    return -1;
+
+  yshm_store(&ring->head, head + len);
+  yshm_fence();
+
+  if (ring->prod_sleep && yshm_claim(&ring->prod_sleep))
+    yshm_futex_wake(&ring->prod_sleep);
+
+  return len;
+}
+
+/**
+ * Run a channel till it makes no more progress.
+ */
+static int yshm_server_pass(ynet_ctx_t *ctx)
+{
+  int ret;
+  int rest;
+  int done;
+  int prog = 0;
+
+  do
+  {
+    done = yshm_server_out(ctx, &rest);
+
+    if (!rest && ctx->held)             /* drained, resume held requests */
+    {
+      if (ycmd_server_input(ctx, NULL, 0, TRUE) != 0)
+        return -1;
+
+      done += yshm_server_out(ctx, &rest);
+    }
+
+    if ((ret = yshm_server_in(ctx)) < 0)
+      return -1;
+
+    done += ret;
+
+    if (ret)
+      done += yshm_server_out(ctx, &rest);
+
+    prog += done;
+  }
+  while (done);
+
+  return prog;
+}
+
+/**
+ * Announce the server idle on a channel. Returns TRUE if there is work
+ * after all, the bell may have been missed.
+ */
+static int yshm_server_sleep(ynet_ctx_t *ctx)
+{
+  yshm_hdr_t *hdr = ctx->shm->hdr;
+
+  if (ctx->shm->pend)
+  {
+    yshm_store(&hdr->res.prod_sleep, TRUE);       /* bell on free space */
+    yshm_fence();
+
+    if (yshm_load(&hdr->res.head) != hdr->res.tail - YSHM_RING_SIZE)
+      return TRUE;
+  }
+
+  yshm_store(&hdr->req.cons_sleep, TRUE);
+  yshm_fence();
+
+  return (!ctx->held && (yshm_load(&hdr->req.tail) != hdr->req.head));
+}
+
+/**
+ * Process a channel on a bell. Refer yshm.h for details.
+ */
+int yshm_server_process(ynet_ctx_t *ctx)
+{
+  do
+  {
+    yshm_store(&ctx->shm->hdr->req.cons_sleep, FALSE);
+
+    if (yshm_server_pass(ctx) < 0)
+      return -1;
+  }
+  while (yshm_server_sleep(ctx));
+
+  return 0;
+}
+
+/**
+ * Poll rings of this thread. Refer yshm.h for details.
+ */
+int yshm_poll(int awake)
+{
+  int ind;
+  int ret;
+  int cnt = 0;
+
+  for (ind = 0; ind < yshm_nown; ind++)
+  {
+    if (awake)
+    {
+      yshm_store(&yshm_own[ind]->shm->hdr->req.cons_sleep, FALSE);
+      ret = yshm_server_pass(yshm_own[ind]);
+    }
+    else
+    {
+      ret = yshm_server_process(yshm_own[ind]);
+    }
+
+    if (ret < 0)                         /* closed on the resulting hangup */
+      shutdown(yshm_own[ind]->sfd, SHUT_RDWR);
+    else if (ret > 0)
+      cnt++;
+  }
+
+  return cnt;
+}
+
+/**
+ * Connect over shared memory. Refer yshm.h for details.
+ */
+int yshm_connect(ynet_ctx_t *ctx, char *path)
+{
+  int             fd = -1;
+  char            tag;
+  char            cbuf[CMSG_SPACE(sizeof(int))];
+  yshm_t         *shm;
+  struct iovec    iov;
+  struct msghdr   msg;
+  struct cmsghdr *cmsg;
+
+  if (ynet_connect_unix(ctx, (path) ? path : YNET_SHM_PATH) != 0)
+    return -1;
+
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base = &tag;
+  iov.iov_len  = 1;
+
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  if ((recvmsg(ctx->sfd, &msg, MSG_CMSG_CLOEXEC) == 1) &&
+      ((cmsg = CMSG_FIRSTHDR(&msg)) != NULL) &&
+      (cmsg->cmsg_type == SCM_RIGHTS))
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (fd < 0)
+  {
+    close(ctx->sfd);
+    return y_error(EPROTO);
+  }
+
+  shm = yshm_map(fd);
+
+  close(fd);
+
+  if ((shm == NULL) || (shm->hdr->magic != YSHM_MAGIC) ||
+      (shm->hdr->size != YSHM_RING_SIZE))
+  {
+    if (shm)
+    {
+      munmap(shm->hdr, shm->len);
+      free(shm);
+    }
+
+    close(ctx->sfd);
+    return y_error(EPROTO);
+  }
+
+  ctx->class = YNET_CLASS_SHM;
+  ctx->shm   = shm;
+
+  return 0;
+}
+
+/**
+ * Wake the server, a byte on the socket.
+ */
+static void yshm_bell(ynet_ctx_t *ctx)
+{
+  char tag = 0;
+
+  ynet_tstats.writes++;
+
+  while ((write(ctx->sfd, &tag, 1) < 0) && (errno == EINTR));
+}
+
+/**
+ * Wait till the server moves 'pos' on from 'old', spinning first. The
+ * server only ever writes to the socket by closing it.
+ */
+static int yshm_wait(ynet_ctx_t *ctx, uint32_t *word, uint32_t *pos,
+                     uint32_t old)
+{
+  int           ind;
+  int           waited = 0;
+  struct pollfd pfd;
+
+  if (yshm_spin < 0)
+    yshm_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? YSHM_SPIN : 0;
+
+  for (ind = 0; ind < yshm_spin; ind++)
+  {
+    if (yshm_load(pos) != old)
+      return 0;
+
+    yshm_relax();
+  }
+
+  while (TRUE)
+  {
+    yshm_store(word, TRUE);
+    yshm_fence();
+
+    if (yshm_load(pos) != old)
+      break;
+
+    ynet_tstats.polls++;
+
+    if ((yshm_futex_wait(word, TRUE, YSHM_WAIT_SLICE) == 0) ||
+        (errno != ETIMEDOUT))
+      continue;
+
+    pfd.fd     = ctx->sfd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, 0) != 0)
+      return y_error(ECONNRESET);
+
+    if ((waited += YSHM_WAIT_SLICE) >= YNET_IO_TIMEOUT)
+      return y_error(ETIMEDOUT);
+  }
+
+  yshm_store(word, FALSE);
+
+  return 0;
+}
+
+/**
+ * Send to request ring. Refer yshm.h for details.
+ */
+int yshm_sendv(ynet_ctx_t *ctx, struct iovec *iov, int cnt)
+{
+  int          len;
+  char        *ptr;
+  uint32_t     head;
+  uint32_t     tail;
+  yshm_t      *shm  = ctx->shm;
+  yshm_ring_t *ring = &shm->hdr->req;
+
+  tail = ring->tail;
+
+  for (; cnt; iov++, cnt--)
+  {
+    ptr = iov->iov_base;
+    len = iov->iov_len;
+
+    while (len)
+    {
+      head = yshm_load(&ring->head);
+
+      if (tail - head == YSHM_RING_SIZE)      /* full, let server drain */
+      {
+        yshm_store(&ring->tail, tail);
+        yshm_fence();
+
+        if (ring->cons_sleep && yshm_claim(&ring->cons_sleep))
+          yshm_bell(ctx);
+
+        if (yshm_wait(ctx, &ring->prod_sleep, &ring->head, head) != 0)
+          return -1;
+
+        continue;
+      }
+
+      head = min(len, YSHM_RING_SIZE - (tail - head));
+
+      memcpy(shm->req + yshm_mask(tail), ptr, head);
+
+      tail += head;
+      ptr  += head;
+      len  -= head;
+    }
+  }
+
+  yshm_store(&ring->tail, tail);
+  yshm_fence();
+
+  if (ring->cons_sleep && yshm_claim(&ring->cons_sleep))
+    yshm_bell(ctx);
+
+  return 0;
+}
+
+/**
+ * Receive from response ring. Refer yshm.h for details.
+ */
+int yshm_recv(ynet_ctx_t *ctx, char *ptr, int len, int full)
+{
+  int          cnt;
+  int          got  = 0;
+  uint32_t     head;
+  uint32_t     tail;
+  yshm_t      *shm  = ctx->shm;
+  yshm_ring_t *ring = &shm->hdr->res;
+
+  head = ring->head;
+
+  while (got < len)
+  {
+    tail = yshm_load(&ring->tail);
+
+    if (tail == head)
+    {
+      if (got && !full)
+        break;
+
+      if (yshm_wait(ctx, &ring->cons_sleep, &ring->tail, tail) != 0)
+        return -1;
+
+      continue;
+    }
+
+    cnt = min(tail - head, len - got);
+
+    memcpy(ptr + got, shm->res + yshm_mask(head), cnt);
+
+    head += cnt;
+    got  += cnt;
+
+    yshm_store(&ring->head, head);
+    yshm_fence();
+
+    if (ring->prod_sleep && yshm_claim(&ring->prod_sleep))
+      yshm_bell(ctx);                      /* server waits for the room */
+  }
+
+  return got;
+}
@@ -0,0 +1,181 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YSHM_H
+
+#define _YSHM_H
+
+#include <ycommon.h>
+#include <ynet.h>
+
+/**
+ * @file yshm.h - Shared Memory Ring Transport
+ *
+ * For clients on the same host. A client connects to the server's shm
+ * Unix socket (YNET_SHM_PATH by default). The server creates a memfd
+ * with a request and a response ring and passes it back with
+ * SCM_RIGHTS. The socket then only tracks the client's lifetime and
+ * carries doorbells. Requests and responses are the native protocols,
+ * streamed through the rings as they would be through a socket, so
+ * every libyari call works unchanged over them (YNET_CLASS_SHM).
+ *
+ * Each ring is single producer, single consumer, with free running
+ * positions. Its data is mapped twice back to back, so any span of
+ * upto the ring size is contiguous and requests execute in place.
+ *
+ * A side only signals the other when that side is idle, announced by a
+ * sleep word:
+ *   - server idle on its requests : client writes a byte to the socket,
+ *     which wakes the server through epoll next to its other sockets
+ *   - client idle on its responses, or waiting for request ring space :
+ *     server does a futex wake on the word the client waits on
+ * A client spins YSHM_SPIN rounds before it sleeps, if it has more than
+ * one cpu. A server thread that busy polls (ynet_busy_spin) keeps
+ * polling the rings of its reactor connections and stays awake to the
+ * clients while doing so.
+ *
+ * Memory layout : header page, request data, response data.
+ */
+
+#define YSHM_MAGIC        (0x5953484d)                          /**< 'YSHM' */
+#define YSHM_RING_SIZE    (1024 * 1024)  /**< data bytes per ring, pages */
+#define YSHM_SPIN         (4096)    /**< client polls before it sleeps */
+#define YSHM_OWN_MAX      (1024)   /**< rings polled per server thread */
+
+/**
+ * @struct yshm_ring_t
+ *
+ * @brief  Ring control, positions and sleep words on own cache lines.
+ */
+struct yshm_ring_t
+{
+  uint32_t  head __attribute__((aligned(64)));    /**< consumed, consumer */
+  uint32_t  tail __attribute__((aligned(64)));    /**< produced, producer */
+  uint32_t  cons_sleep __attribute__((aligned(64)));  /**< consumer idle */
+  uint32_t  prod_sleep;            /**< producer waits for space, futex */
+};
+typedef struct yshm_ring_t yshm_ring_t;
+
+/**
+ * @struct yshm_hdr_t
+ *
+ * @brief  Header page, shared.
+ */
+struct yshm_hdr_t
+{
+  uint32_t    magic;
+  uint32_t    size;                                  /**< bytes per ring */
+  yshm_ring_t req;                                /**< client to server */
+  yshm_ring_t res;                                /**< server to client */
+};
+typedef struct yshm_hdr_t yshm_hdr_t;
+
+/**
+ * @struct yshm_t
+ *
+ * @brief  Mapping of a channel in this process.
+ */
+struct yshm_t
+{
+  yshm_hdr_t *hdr;
+  char       *req;                          /**< request data, mirrored */
+  char       *res;                         /**< response data, mirrored */
+  size_t      len;                               /**< length of mapping */
+  int         own;       /**< polled by the server thread owning it */
+  int         pend;           /**< responses wait for response ring room */
+};
+typedef struct yshm_t yshm_t;
+
+/**
+ * @brief Set up the rings of a connection accepted on the shm listener
+ *        and hand them to the client. The context becomes a
+ *        YNET_CLASS_SHM one, its socket is left for doorbells.
+ *
+ * @param ctx - network context of the accepted connection
+ * @param own - polled by the calling thread while it busy polls (reactor)
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yshm_server_attach(ynet_ctx_t *ctx, int own);
+
+/**
+ * @brief Release the rings of a connection, on close.
+ *
+ * @param ctx - network context
+ *
+ * @return None.
+ */
+void yshm_detach(ynet_ctx_t *ctx);
+
+/**
+ * @brief Execute requests queued in the request ring and move responses
+ *        to the response ring, till neither makes progress. Called on a
+ *        doorbell.
+ *
+ * @param ctx - network context
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yshm_server_process(ynet_ctx_t *ctx);
+
+/**
+ * @brief Poll the rings owned by the calling thread, from its wait loop.
+ *
+ * @param awake - TRUE while the thread spins, clients then don't ring
+ *                the doorbell; FALSE before it blocks
+ *
+ * @return Number of rings with progress.
+ */
+int yshm_poll(int awake);
+
+/**
+ * @brief Connect to the shm listener of a server on the same host and
+ *        map the rings it hands over.
+ *
+ * @param ctx  - network context, becomes a YNET_CLASS_SHM one
+ * @param path - socket path, YNET_SHM_PATH if NULL
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yshm_connect(ynet_ctx_t *ctx, char *path);
+
+/**
+ * @brief Queue data in the request ring, waiting for room as needed,
+ *        ynet_sendv counterpart for YNET_CLASS_SHM.
+ *
+ * @param ctx - network context
+ * @param iov - data to send
+ * @param cnt - number of entries in iov
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yshm_sendv(ynet_ctx_t *ctx, struct iovec *iov, int cnt);
+
+/**
+ * @brief Take data from the response ring, ynet_recv counterpart for
+ *        YNET_CLASS_SHM.
+ *
+ * @param ctx  - network context
+ * @param ptr  - buffer to fill
+ * @param len  - size of buffer
+ * @param full - TRUE to wait till len bytes are received
+ *
+ * @return Number of bytes received, -1 on failure with errno set.
+ */
+int yshm_recv(ynet_ctx_t *ctx, char *ptr, int len, int full);
+
+#endif /* yshm.h */
@@ -17,6 +17,7 @@
  */
 #include <ythread.h>
 #include <ytrace.h>
+#include <ynuma.h>
 
 /**
  * Globals .
@@ -26,6 +27,8 @@ __thread ythread_ctx_t *ythread_myctx;           /**< current thread context */
 /**
  * @brief Thread main driver. 
  *        Process net events as long as possible. If none, enter wait. 
+ *        A thread owning a reactor, or an io_uring, waits on and 
+ *        processes only that. 
  *
  * @param arg - Thread argument, thread context for current thread
  * @return None 
@@ -38,8 +41,33 @@ static void * ythread_driver(void *arg)
   ythread_myctx = tctx;
   ythread_myind = tctx->ind;
 
+  /* home queue was allocated by main, move it next to its consumer */
+  if ((tctx->cpu = ynuma_thread_place(tctx->slot)) >= 0)
+    ynuma_local(tctx->queue.cells, 
+                (tctx->queue.mask + 1) * sizeof(yqueue_cell_t));
+
   ytrace_msg(YTRACE_DEFAULT, "ythread_driver : %p : started \n", tctx);
 
+  while (tctx->uring)
+  {
+    if ((ret = yuring_process(tctx)) < 0)
+    {
+      ytrace_msg(YTRACE_DEFAULT, "ythread_driver : uring : exiting %d\n",
+                 ret);
+      return NULL;
+    }
+  }
+
+  while (ynet_waiter_is_reactor(tctx->wctx))
+  {
+    if ((ret = ynet_reactor_process(tctx)) < 0)
+    {
+      ytrace_msg(YTRACE_DEFAULT, "ythread_driver : reactor : exiting %d\n",
+                 ret);
+      return NULL;
+    }
+  }
+
   while (TRUE)
   {
     if ((ret = ynet_thread_process(tctx)) < 0)
@@ -66,11 +94,15 @@ static void * ythread_driver(void *arg)
 int ythread_create(ythread_ctx_t *tctx, int ind, ynet_waiter_ctx_t *wctx)
 {
   tctx->ind  = ind + 10001;
+  tctx->slot = ind;
   tctx->wctx = wctx;
 
   ylink_init(&tctx->wlink);
 
-  tctx->pctx = ynet_post_create();
+  tctx->park = YLOCK_PARK_RUN;
+
+  if (ynet_thread_attach(tctx) != 0)
+    return -1;
 
   return pthread_create(&tctx->hdl, NULL, ythread_driver, (void *)tctx);
 }
@@ -24,6 +24,7 @@
 #include <ycommon.h>
 #include <ynet.h>
 #include <ynets.h>
+#include <yuring.h>
 
 /**
  * @brief Thread context. 
@@ -33,9 +34,14 @@ struct ythread_ctx_t
 {
   pthread_t          hdl;                                 /**< thread handle */
   int                ind;                                  /**< thread index */
-  ynet_ctx_t        *pctx;                              /**< network context */
+  int                slot;        /**< 0 based index, of scheduler counters */
+  int                park;                     /**< park word, YLOCK_PARK_* */
+  int                overload;  /**< queue backlog, stealing allowed, sticky */
+  int                cpu;               /**< cpu pinned to, -1 if not pinned */
+  yqueue_t           queue;  /**< connections homed here, shared waiter */
   ylink_t            wlink;                    /**< wait context - wait link */
   ynet_waiter_ctx_t *wctx;                              /**< waiting context */
+  yuring_ctx_t      *uring;                 /**< io_uring owned, epoll if NULL */
 };
 
 /**
@@ -58,7 +64,8 @@ extern __thread int ythread_myind;
  *
  * @param tctx - Thread context for new thread
  * @param ind  - Thread index for new thread
- * @param wctx - Wait context in which the thread need to reap the requests. 
+ * @param wctx - Wait context in which the thread need to reap the requests,
+ *               a reactor is owned by the thread. 
  *
  * @return 0 on success, -1 on failure with errno set. 
  */
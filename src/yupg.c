@@ -0,0 +1,760 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE                                /* accept4, SO_PEERCRED */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/memfd.h>
+#include <pthread.h>
+
+#include <ycommon.h>
+#include <ytrace.h>
+#include <ynet.h>
+#include <ynets.h>
+#include <yhash.h>
+#include <yns.h>
+#include <ycommand.h>
+#include <yupg.h>
+
+#define YUPG_BUF_SIZE    (1024 * 1024)       /* image write buffer bytes */
+#define YUPG_ACK_TIMEOUT (10)    /* secs the new process has to answer */
+
+#define yupg_align(len)  (((len) + 7) & ~7)   /* records start 8 aligned */
+
+/**
+ * @struct yupg_msg_t
+ *
+ * @brief  Message on the handoff socket, descriptors attached. The new
+ *         process sends one to ask and one to acknowledge, with none.
+ */
+struct yupg_msg_t
+{
+  uint32_t     magic;
+  uint32_t     version;
+  int          nfd;                                /* descriptors attached */
+  int          last;                          /* no more messages follow */
+  uint64_t     size;                     /* image bytes, with the memfd */
+  yupg_lsnr_t  lsnr[YUPG_FD_CHUNK];        /* of the descriptors, in order */
+};
+typedef struct yupg_msg_t yupg_msg_t;
+
+/**
+ * Image : a header, then every namespace followed by its records, each
+ * record followed by its key and value.
+ */
+struct yupg_hdr_t
+{
+  uint32_t  magic;
+  uint32_t  version;
+  uint32_t  nns;                                          /* namespaces */
+  uint32_t  pad;
+};
+typedef struct yupg_hdr_t yupg_hdr_t;
+
+struct yupg_ns_t
+{
+  int       id;
+  int       ncnt;
+  int       evict;
+  int       pad;
+  uint64_t  mem_max;
+  uint64_t  nrec;                                   /* records following */
+  char      name[YNS_NAME_MAX];
+};
+typedef struct yupg_ns_t yupg_ns_t;
+
+struct yupg_rec_t
+{
+  uint32_t  klen;
+  uint32_t  vlen;
+  uint32_t  flags;
+  uint32_t  exptime;
+};
+typedef struct yupg_rec_t yupg_rec_t;
+
+/**
+ * Image being written, buffered.
+ */
+struct yupg_out_t
+{
+  int     fd;
+  size_t  off;                                   /* bytes written to fd */
+  int     len;                                  /* bytes in buf, after off */
+  char    buf[YUPG_BUF_SIZE];
+};
+typedef struct yupg_out_t yupg_out_t;
+
+/**
+ * Write all of a buffer.
+ */
+static int yupg_write(int fd, char *ptr, size_t len)
+{
+  ssize_t ret;
+
+  while (len)
+  {
+    if ((ret = write(fd, ptr, len)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+
+    ptr += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+/**
+ * Write out the buffered part of the image.
+ */
+static int yupg_flush(yupg_out_t *out)
+{
+  if (yupg_write(out->fd, out->buf, out->len) != 0)
+    return -1;
+
+  out->off += out->len;
+  out->len  = 0;
+
+  return 0;
+}
+
+/**
+ * Append to the image.
+ */
+static int yupg_put(yupg_out_t *out, void *ptr, size_t len)
+{
+  if ((out->len + len > YUPG_BUF_SIZE) && (yupg_flush(out) != 0))
+    return -1;
+
+  if (len > YUPG_BUF_SIZE)                      /* larger ones go straight */
+  {
+    if (yupg_write(out->fd, ptr, len) != 0)
+      return -1;
+
+    out->off += len;
+
+    return 0;
+  }
+
+  memcpy(out->buf + out->len, ptr, len);
+  out->len += len;
+
+  return 0;
+}
+
+/**
+ * Append an object, yhtab_walk callback.
+ */
+static int yupg_put_obj(void *arg, yhobj_t *obj)
+{
+  uint64_t    pad = 0;
+  yhdata_t   *key = yhobj_key(obj);
+  yhdata_t   *val = yhobj_val(obj);
+  yupg_out_t *out = (yupg_out_t *)arg;
+  yupg_rec_t  rec;
+
+  rec.klen    = key->len;
+  rec.vlen    = val->len;
+  rec.flags   = obj->flags;
+  rec.exptime = obj->exptime;
+
+  if ((yupg_put(out, &rec, sizeof(rec)) != 0) ||
+      (yupg_put(out, key->data, key->len) != 0) ||
+      (yupg_put(out, val->data, val->len) != 0) ||
+      (yupg_put(out, &pad, yupg_align(key->len + val->len) -
+                           (key->len + val->len)) != 0))
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Write the image of every namespace, frozen, into a new memfd.
+ */
+static int yupg_image(uint64_t *size, ssize_t *nkey)
+{
+  int          id;
+  int          fd;
+  ssize_t      cnt;
+  size_t       off;
+  yns_t       *ns;
+  yupg_out_t  *out;
+  yupg_hdr_t   hdr;
+  yupg_ns_t    rns;
+
+  if ((out = (yupg_out_t *)malloc(sizeof(yupg_out_t))) == NULL)
+    return y_error(ENOMEM);
+
+  if ((fd = syscall(SYS_memfd_create, "yari-upg", MFD_CLOEXEC)) < 0)
+  {
+    free(out);
+    return -1;
+  }
+
+  out->fd  = fd;
+  out->off = 0;
+  out->len = 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  hdr.magic   = YUPG_MAGIC;
+  hdr.version = YUPG_VERSION;
+
+  for (id = 0; id < YNS_MAX; id++)
+    hdr.nns += (yns_get(id) != NULL);
+
+  if (yupg_put(out, &hdr, sizeof(hdr)) != 0)
+    goto fail;
+
+  *nkey = 0;
+
+  for (id = 0; id < YNS_MAX; id++)
+  {
+    if ((ns = yns_get(id)) == NULL)
+      continue;
+
+    memset(&rns, 0, sizeof(rns));
+
+    rns.id      = id;
+    rns.ncnt    = ns->ncnt;
+    rns.evict   = ns->evict;
+    rns.mem_max = ns->mem_max;
+
+    memcpy(rns.name, ns->name, sizeof(rns.name));
+
+    off = out->off + out->len;
+
+    if ((yupg_put(out, &rns, sizeof(rns)) != 0) ||
+        ((cnt = yhtab_walk(ns->ht, yupg_put_obj, out)) < 0) ||
+        (yupg_flush(out) != 0))
+      goto fail;
+
+    /* count known once walked, patched in */
+    rns.nrec = cnt;
+
+    if (pwrite(fd, &rns, sizeof(rns), off) != sizeof(rns))
+      goto fail;
+
+    *nkey += cnt;
+  }
+
+  *size = out->off;
+
+  free(out);
+
+  return fd;
+
+fail:
+  ytrace_msg(YTRACE_ERROR, "yupg : image failed : %d\n", errno);
+  close(fd);
+  free(out);
+
+  return -1;
+}
+
+/**
+ * Load an image into the namespaces, creating the missing ones.
+ */
+static ssize_t yupg_load(char *img, size_t size)
+{
+  int          ind;
+  int          cnt;
+  uint64_t     rind;
+  ssize_t      nkey = 0;
+  char         name[YNS_NAME_MAX];
+  char        *ptr  = img + sizeof(yupg_hdr_t);
+  char        *end  = img + size;
+  yhtab_t     *ht;
+  yhmeta_t     meta;
+  yhload_t    *recs;
+  yupg_hdr_t  *hdr  = (yupg_hdr_t *)img;
+  yupg_ns_t   *rns;
+  yupg_rec_t  *rec;
+
+  if ((size < sizeof(*hdr)) || (hdr->magic != YUPG_MAGIC) ||
+      (hdr->version != YUPG_VERSION))
+    return y_error(EPROTO);
+
+  if ((recs = (yhload_t *)malloc(YUPG_LOAD_BATCH * sizeof(yhload_t))) == NULL)
+    return y_error(ENOMEM);
+
+  for (ind = 0; ind < hdr->nns; ind++)
+  {
+    if (ptr + sizeof(*rns) > end)
+      goto bad;
+
+    rns = (yupg_ns_t *)ptr;
+    ptr += sizeof(*rns);
+
+    snprintf(name, sizeof(name), "%.*s", YNS_NAME_MAX - 1, rns->name);
+
+    /* ones configured here keep their parameters */
+    if ((yns_create(rns->id, name, rns->ncnt, rns->mem_max,
+                    rns->evict) != 0) && (errno != EEXIST))
+      goto fail;
+
+    ht  = yns_acq(rns->id);
+    cnt = 0;
+
+    for (rind = 0; rind <= rns->nrec; rind++)
+    {
+      /* batch full or all in, load it */
+      if ((cnt == YUPG_LOAD_BATCH) || ((rind == rns->nrec) && cnt))
+      {
+        if (yhtab_load(ht, recs, cnt, ycmd_bulk_workers) < 0)
+        {
+          yns_rel(rns->id);
+          goto fail;
+        }
+
+        nkey += cnt;
+        cnt   = 0;
+      }
+
+      if (rind == rns->nrec)
+        break;
+
+      rec = (yupg_rec_t *)ptr;
+
+      if ((ptr + sizeof(*rec) > end) ||
+          (ptr + sizeof(*rec) +
+           yupg_align((size_t)rec->klen + rec->vlen) > end))
+      {
+        yns_rel(rns->id);
+        goto bad;
+      }
+
+      ptr += sizeof(*rec);
+
+      if (rec->flags || rec->exptime)             /* bulk load has neither */
+      {
+        meta.flags   = rec->flags;
+        meta.exptime = rec->exptime;
+        meta.cas     = 0;
+
+        if (yhtab_store(NULL, ht, ptr, rec->klen, ptr + rec->klen,
+                        rec->vlen, &meta, YHTAB_STORE_SET) != 0)
+        {
+          yns_rel(rns->id);
+          goto fail;
+        }
+
+        nkey++;
+      }
+      else
+      {
+        recs[cnt].key  = ptr;
+        recs[cnt].klen = rec->klen;
+        recs[cnt].val  = ptr + rec->klen;
+        recs[cnt].vlen = rec->vlen;
+        cnt++;
+      }
+
+      ptr += yupg_align(rec->klen + rec->vlen);
+    }
+
+    yns_rel(rns->id);
+  }
+
+  free(recs);
+
+  return nkey;
+
+bad:
+  errno = EPROTO;
+fail:
+  ytrace_msg(YTRACE_ERROR, "yupg : load failed : %d\n", errno);
+  free(recs);
+
+  return -1;
+}
+
+/**
+ * Send a message, with descriptors.
+ */
+static int yupg_send(int sfd, yupg_msg_t *msg, int *fds)
+{
+  char            cbuf[CMSG_SPACE(YUPG_FD_CHUNK * sizeof(int))];
+  struct iovec    iov;
+  struct msghdr   hdr;
+  struct cmsghdr *cmsg;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memset(cbuf, 0, sizeof(cbuf));
+
+  msg->magic   = YUPG_MAGIC;
+  msg->version = YUPG_VERSION;
+
+  iov.iov_base = msg;
+  iov.iov_len  = sizeof(*msg);
+
+  hdr.msg_iov    = &iov;
+  hdr.msg_iovlen = 1;
+
+  if (msg->nfd)
+  {
+    hdr.msg_control    = cbuf;
+    hdr.msg_controllen = CMSG_SPACE(msg->nfd * sizeof(int));
+
+    cmsg = CMSG_FIRSTHDR(&hdr);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(msg->nfd * sizeof(int));
+
+    memcpy(CMSG_DATA(cmsg), fds, msg->nfd * sizeof(int));
+  }
+
+  return (sendmsg(sfd, &hdr, MSG_NOSIGNAL) == sizeof(*msg)) ? 0 : -1;
+}
+
+/**
+ * Receive a message, with the descriptors it says it has.
+ */
+static int yupg_recv(int sfd, yupg_msg_t *msg, int *fds)
+{
+  int             nfd = 0;
+  int             ind;
+  char            cbuf[CMSG_SPACE(YUPG_FD_CHUNK * sizeof(int))];
+  ssize_t         ret;
+  struct iovec    iov;
+  struct msghdr   hdr;
+  struct cmsghdr *cmsg;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  iov.iov_base = msg;
+  iov.iov_len  = sizeof(*msg);
+
+  hdr.msg_iov        = &iov;
+  hdr.msg_iovlen     = 1;
+  hdr.msg_control    = cbuf;
+  hdr.msg_controllen = sizeof(cbuf);
+
+  while (((ret = recvmsg(sfd, &hdr, MSG_CMSG_CLOEXEC)) < 0) &&
+         (errno == EINTR));
+
+  if (ret < 0)
+    return -1;
+
+  for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+  {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+    {
+      nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), nfd * sizeof(int));
+    }
+  }
+
+  if ((ret != sizeof(*msg)) || (msg->magic != YUPG_MAGIC) ||
+      (msg->version != YUPG_VERSION) || (msg->nfd != nfd) ||
+      (hdr.msg_flags & MSG_CTRUNC))
+  {
+    for (ind = 0; ind < nfd; ind++)
+      close(fds[ind]);
+
+    return y_error((ret == 0) ? ECONNRESET : EPROTO);
+  }
+
+  return 0;
+}
+
+/**
+ * Hand everything over to the process on the socket. Returns only if it
+ * fails, the server goes on then.
+ */
+static int yupg_handoff(int sfd)
+{
+  int           ind;
+  int           ifd;
+  int           cnt;
+  int           nlsnr;
+  int           fds[YUPG_LSNR_MAX];
+  int           protos[YUPG_LSNR_MAX];
+  size_t        beg = ytime_get();
+  ssize_t       nkey;
+  uint64_t      size;
+  yupg_msg_t    msg;
+  struct timeval tmo = { YUPG_ACK_TIMEOUT, 0 };
+  struct sockaddr_storage addr;
+  socklen_t     alen;
+
+  /* the rest queue on the listeners, for the new one to accept */
+  ynet_lsnr_pause(TRUE);
+
+  yns_freeze();
+
+  if ((ifd = yupg_image(&size, &nkey)) < 0)
+    goto fail;
+
+  memset(&msg, 0, sizeof(msg));
+
+  msg.nfd  = 1;
+  msg.size = size;
+
+  if (yupg_send(sfd, &msg, &ifd) != 0)
+    goto fail;
+
+  nlsnr = ynet_lsnr_list(fds, protos, YUPG_LSNR_MAX);
+
+  for (ind = 0; ind == 0 || ind < nlsnr; ind += cnt)
+  {
+    cnt = min(nlsnr - ind, YUPG_FD_CHUNK);
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.nfd  = cnt;
+    msg.last = (ind + cnt == nlsnr);
+
+    for (ifd = 0; ifd < cnt; ifd++)
+    {
+      alen = sizeof(addr);
+      msg.lsnr[ifd].proto = protos[ind + ifd];
+
+      if ((getsockname(fds[ind + ifd], (struct sockaddr *)&addr, &alen) == 0)
+          && (addr.ss_family == AF_INET))
+        msg.lsnr[ifd].port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+    }
+
+    if (yupg_send(sfd, &msg, fds + ind) != 0)
+      goto fail;
+
+    if (cnt == 0)
+      break;
+  }
+
+  setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+  if (yupg_recv(sfd, &msg, fds) != 0)
+    goto fail;
+
+  ytrace_msg(YTRACE_DEFAULT,
+            "yupg : handed off : keys = %zd, image = %lu bytes, "
+            "listeners = %d, %zu us frozen\n",
+             nkey, (unsigned long)size, nlsnr, ytime_get() - beg);
+
+  return 0;
+
+fail:
+  ytrace_msg(YTRACE_ERROR, "yupg : handoff failed, serving on : %d\n",
+             errno);
+
+  yns_thaw();
+  ynet_lsnr_pause(FALSE);
+
+  return -1;
+}
+
+/**
+ * Handoff server, waits for the next process.
+ */
+static void * yupg_serve_run(void *arg)
+{
+  int           lfd = (int)(long)arg;
+  int           sfd;
+  int           fds[YUPG_FD_CHUNK];
+  yupg_msg_t    msg;
+  struct ucred  cred;
+  socklen_t     clen;
+
+  while (TRUE)
+  {
+    if ((sfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+    {
+      if (errno != EINTR)
+        ytrace_msg(YTRACE_ERROR, "yupg : accept failed : %d\n", errno);
+
+      continue;
+    }
+
+    clen = sizeof(cred);
+
+    /* the image is every key, only for processes of the same user */
+    if ((getsockopt(sfd, SOL_SOCKET, SO_PEERCRED, &cred, &clen) == 0) &&
+        (cred.uid == geteuid()) && (yupg_recv(sfd, &msg, fds) == 0) &&
+        (yupg_handoff(sfd) == 0))
+      exit(0);
+
+    close(sfd);
+  }
+
+  return NULL;
+}
+
+/**
+ * Serve handoffs. Refer yupg.h for details.
+ */
+int yupg_serve(char *path)
+{
+  int                sfd;
+  pthread_t          hdl;
+  struct sockaddr_un addr;
+
+  if (path == NULL)
+    path = YUPG_PATH;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return y_error(ENAMETOOLONG);
+
+  if ((sfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  unlink(path);                /* left behind, or by the one taken over */
+
+  if ((fchmod(sfd, S_IRUSR | S_IWUSR) != 0) ||
+      (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (listen(sfd, 1) != 0) ||
+      (pthread_create(&hdl, NULL, yupg_serve_run, (void *)(long)sfd) != 0))
+  {
+    ytrace_msg(YTRACE_ERROR, "yupg : serve failed : %s : %d\n", path, errno);
+    close(sfd);
+    return -1;
+  }
+
+  ytrace_msg(YTRACE_DEFAULT, "yupg : handoffs on %s\n", path);
+
+  return 0;
+}
+
+/**
+ * Take over. Refer yupg.h for details.
+ */
+int yupg_takeover(char *path, yupg_lsnr_t *lsnrs, int max)
+{
+  int                sfd;
+  int                ind;
+  int                ifd   = -1;
+  int                nlsnr = 0;
+  int                fds[YUPG_FD_CHUNK];
+  char              *img;
+  uint64_t           size;
+  size_t             beg   = ytime_get();
+  ssize_t            nkey;
+  yupg_msg_t         msg;
+  struct sockaddr_un addr;
+
+  if (path == NULL)
+    path = YUPG_PATH;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return y_error(ENAMETOOLONG);
+
+  if ((sfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  memset(&msg, 0, sizeof(msg));
+
+  if ((connect(sfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (yupg_send(sfd, &msg, NULL) != 0) ||
+      (yupg_recv(sfd, &msg, fds) != 0))
+    goto fail;
+
+  if (msg.nfd != 1)                               /* the image comes first */
+  {
+    for (ind = 0; ind < msg.nfd; ind++)
+      close(fds[ind]);
+
+    errno = EPROTO;
+    goto fail;
+  }
+
+  ifd  = fds[0];
+  size = msg.size;
+
+  msg.last = FALSE;
+
+  while (!msg.last)
+  {
+    if (yupg_recv(sfd, &msg, fds) != 0)
+      goto fail;
+
+    for (ind = 0; ind < msg.nfd; ind++)
+    {
+      if (nlsnr == max)                                /* no room, drop it */
+      {
+        close(fds[ind]);
+        continue;
+      }
+
+      lsnrs[nlsnr]       = msg.lsnr[ind];
+      lsnrs[nlsnr++].sfd = fds[ind];
+    }
+  }
+
+  /* descriptors are ours, the old process may go */
+  memset(&msg, 0, sizeof(msg));
+
+  if (yupg_send(sfd, &msg, NULL) != 0)
+    goto fail;
+
+  close(sfd);
+  sfd = -1;
+
+  img = mmap(NULL, size, PROT_READ, MAP_PRIVATE, ifd, 0);
+
+  if (img == MAP_FAILED)
+    goto fail;
+
+  nkey = yupg_load(img, size);
+
+  munmap(img, size);
+  close(ifd);
+
+  if (nkey < 0)
+    goto fail_lsnrs;
+
+  ytrace_msg(YTRACE_DEFAULT,
+            "yupg : taken over : keys = %zd, listeners = %d, %zu us\n",
+             nkey, nlsnr, ytime_get() - beg);
+
+  return nlsnr;
+
+fail:
+  ytrace_msg(YTRACE_ERROR, "yupg : takeover failed : %s : %d\n", path,
+             errno);
+
+  if (sfd >= 0)
+    close(sfd);
+
+  if (ifd >= 0)
+    close(ifd);
+
+fail_lsnrs:
+  for (ind = 0; ind < nlsnr; ind++)
+    close(lsnrs[ind].sfd);
+
+  return -1;
+}
@@ -0,0 +1,97 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YUPG_H
+
+#define _YUPG_H
+
+#include <ycommon.h>
+#include <ynet.h>
+#include <yns.h>
+
+/**
+ * @file yupg.h - Graceful Upgrade
+ *
+ * A new server process takes over from a running one without a port
+ * going dark. The running one serves handoffs on a Unix socket
+ * (YUPG_PATH by default, owner only). The new one connects to it early
+ * in startup (yupg_takeover), and the running one then:
+ *   - stops accepting (ynet_lsnr_pause), connections coming in stay
+ *     queued on the listeners
+ *   - freezes every namespace (yns_freeze), commands running finish and
+ *     the others wait
+ *   - writes an image of every namespace into a memfd : its parameters,
+ *     then its live keys with their values, flags and expiry
+ *   - passes the memfd, and then its listening sockets in messages of
+ *     upto YUPG_FD_CHUNK, with SCM_RIGHTS
+ *   - exits once the new one has them all, connections open on it are
+ *     reset and their clients reconnect to the new one
+ * The new one loads the image into its own namespaces and attaches the
+ * listeners it got in place of creating its own. Connections queued on
+ * them meanwhile are accepted by it, none is refused. It goes on to
+ * serve handoffs on the same path, for the next upgrade.
+ *
+ * Versions (cas) are not kept, keys get new ones as they are loaded.
+ * Should the new one go away before it has everything, the running one
+ * thaws and goes on serving. A running one over io_uring doesn't serve
+ * handoffs, its listeners belong to the rings (yuring.h).
+ */
+
+#define YUPG_PATH       "/tmp/yari.handoff"  /**< handoff socket default */
+#define YUPG_MAGIC      (0x59555047)                          /**< 'YUPG' */
+#define YUPG_VERSION    (1)                       /**< image and messages */
+#define YUPG_FD_CHUNK   (64)         /**< descriptors per message at most */
+#define YUPG_LSNR_MAX   (1024)       /**< listeners handed over at most */
+#define YUPG_LOAD_BATCH (65536)        /**< records per yhtab_load call */
+
+/**
+ * @struct yupg_lsnr_t
+ *
+ * @brief  Listener handed over.
+ */
+struct yupg_lsnr_t
+{
+  int  sfd;                            /**< socket, in the receiving process */
+  int  proto;                      /**< protocol of its connections, YPROTO_* */
+  int  port;                                /**< TCP port, 0 for Unix socket */
+};
+typedef struct yupg_lsnr_t yupg_lsnr_t;
+
+/**
+ * @brief Serve handoffs on a Unix socket, replacing whatever is at the
+ *        path, from a thread of its own.
+ *
+ * @param path - socket path, YUPG_PATH if NULL
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yupg_serve(char *path);
+
+/**
+ * @brief Take over from the server serving handoffs on a path : load its
+ *        namespaces and get its listeners. Called before the listeners
+ *        of this process are created.
+ *
+ * @param path  - socket path, YUPG_PATH if NULL
+ * @param lsnrs - filled with the listeners handed over
+ * @param max   - room in lsnrs
+ *
+ * @return Number of listeners on success, -1 on failure with errno set.
+ */
+int yupg_takeover(char *path, yupg_lsnr_t *lsnrs, int max);
+
+#endif /* yupg.h */
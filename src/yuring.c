@@ -0,0 +1,639 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <ycommon.h>
+#include <ytrace.h>
+#include <ynets.h>
+#include <ythread.h>
+#include <ycommand.h>
+#include <yuring.h>
+
+/**
+ * Completion tags, operation in the upper half of user_data and the
+ * descriptor in the lower.
+ */
+#define YURING_OP_ACCEPT  (1)
+#define YURING_OP_RECV    (2)
+#define YURING_OP_SEND    (3)
+
+#define yuring_tag(op, fd)  (((uint64_t)(op) << 32) | (uint32_t)(fd))
+#define yuring_tag_op(t)    ((int)((t) >> 32))
+#define yuring_tag_fd(t)    ((int)(uint32_t)(t))
+
+#define YURING_BGID       (0)               /**< provided buffer group id */
+
+/**
+ * @struct yuring_ctx_t
+ *
+ * @brief  Ring of a thread, with the kernel shared queues mapped.
+ */
+struct yuring_ctx_t
+{
+  int                    fd;
+
+  unsigned              *sq_head;
+  unsigned              *sq_tail;
+  unsigned               sq_mask;
+  unsigned               sq_cnt;
+  struct io_uring_sqe   *sqes;
+  unsigned               tail;                 /* local submission tail */
+  unsigned               pend;                    /* entries to submit */
+  int                    disabled;        /* till owner thread enables it */
+
+  unsigned              *cq_head;
+  unsigned              *cq_tail;
+  unsigned               cq_mask;
+  struct io_uring_cqe   *cqes;
+
+  struct io_uring_buf_ring *br;                     /* provided buffers */
+  char                  *bufs;
+  unsigned short         br_tail;
+
+  void                  *sq_ring;
+  void                  *cq_ring;
+  size_t                 sq_len;
+  size_t                 cq_len;
+};
+
+/**
+ * @struct yuring_send_t
+ *
+ * @brief  Message of a sendmsg in flight, made on the first send of a
+ *         connection so that idle ones stay small.
+ */
+struct yuring_send_t
+{
+  struct msghdr          msg;
+  struct iovec           iov[YNET_OUT_IOV];
+};
+typedef struct yuring_send_t yuring_send_t;
+
+/**
+ * @struct yuring_conn_t
+ *
+ * @brief  Connection, or listener, served by a ring.
+ */
+struct yuring_conn_t
+{
+  ynet_ctx_t             nctx;
+  int                    state;                          /* YSTATE_* */
+  int                    recv;                  /* multishot recv armed */
+  int                    send;                      /* sendmsg in flight */
+  int                    closing;               /* peer gone or failure */
+  yuring_send_t         *out;
+};
+typedef struct yuring_conn_t yuring_conn_t;
+
+static yfd_tab_t yuring_conn_tab = { sizeof(yuring_conn_t) };
+
+#define yuring_conn_get(fd, create) \
+          ((yuring_conn_t *)yfd_get(&yuring_conn_tab, (fd), (create)))
+
+static inline int yuring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int yuring_enter(int fd, unsigned submit, unsigned wait,
+                               unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static inline int yuring_register(int fd, unsigned op, void *arg,
+                                  unsigned cnt)
+{
+  return syscall(__NR_io_uring_register, fd, op, arg, cnt);
+}
+
+/**
+ * Publish queued submissions and hand them to the kernel, optionally
+ * waiting for a completion.
+ */
+static int yuring_submit(yuring_ctx_t *ctx, unsigned wait)
+{
+  int ret;
+
+  __atomic_store_n(ctx->sq_tail, ctx->tail, __ATOMIC_RELEASE);
+
+  /* completions are posted on entering with GETEVENTS, even without wait */
+  ret = yuring_enter(ctx->fd, ctx->pend, wait, IORING_ENTER_GETEVENTS);
+
+  if (ret < 0)
+    return y_error(errno);
+
+  ctx->pend -= min((unsigned)ret, ctx->pend);
+
+  return 0;
+}
+
+/**
+ * Get a submission entry, submitting queued ones if the queue is full.
+ */
+static struct io_uring_sqe * yuring_sqe(yuring_ctx_t *ctx)
+{
+  struct io_uring_sqe *sqe;
+
+  while (ctx->tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE) >=
+         ctx->sq_cnt)
+  {
+    if ((yuring_submit(ctx, 0) != 0) && (errno != EINTR) &&
+        (errno != EAGAIN) && (errno != EBUSY))
+      return NULL;
+  }
+
+  sqe = &ctx->sqes[ctx->tail & ctx->sq_mask];
+
+  memset(sqe, 0, sizeof(*sqe));
+
+  ctx->tail++;
+  ctx->pend++;
+
+  return sqe;
+}
+
+/**
+ * Return a provided buffer to the kernel, published on next loop.
+ */
+static inline void yuring_buf_put(yuring_ctx_t *ctx, int bid)
+{
+  struct io_uring_buf *buf;
+
+  buf = &ctx->br->bufs[ctx->br_tail & (YURING_BUF_CNT - 1)];
+
+  buf->addr = (uint64_t)(size_t)(ctx->bufs + (size_t)bid * YURING_BUF_LEN);
+  buf->len  = YURING_BUF_LEN;
+  buf->bid  = bid;
+
+  ctx->br_tail++;
+}
+
+static int yuring_arm_accept(yuring_ctx_t *ctx, yuring_conn_t *conn)
+{
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = yuring_sqe(ctx)) == NULL)
+    return -1;
+
+  sqe->opcode       = IORING_OP_ACCEPT;
+  sqe->fd           = conn->nctx.sfd;
+  sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;  /* other options from the listener */
+  sqe->user_data    = yuring_tag(YURING_OP_ACCEPT, conn->nctx.sfd);
+
+  return 0;
+}
+
+static int yuring_arm_recv(yuring_ctx_t *ctx, yuring_conn_t *conn)
+{
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = yuring_sqe(ctx)) == NULL)
+    return -1;
+
+  sqe->opcode    = IORING_OP_RECV;
+  sqe->fd        = conn->nctx.sfd;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = YURING_BGID;
+  sqe->user_data = yuring_tag(YURING_OP_RECV, conn->nctx.sfd);
+
+  conn->recv = TRUE;
+
+  return 0;
+}
+
+/**
+ * Send queued output of a connection, if any and none is in flight. An
+ * emptied queue gives its buffer back to the pool.
+ */
+static int yuring_send(yuring_ctx_t *ctx, yuring_conn_t *conn)
+{
+  int                  cnt;
+  yuring_send_t       *out;
+  struct io_uring_sqe *sqe;
+
+  if (conn->send || conn->closing)
+    return 0;
+
+  if (!conn->out && conn->nctx.out && conn->nctx.out->buf &&
+      (conn->out = (yuring_send_t *)malloc(sizeof(yuring_send_t))) == NULL)
+    return y_error(ENOMEM);
+
+  if ((out = conn->out) == NULL ||
+      (cnt = ynet_out_iov(&conn->nctx, out->iov)) == 0)
+  {
+    ynet_out_put(&conn->nctx, FALSE);
+    return 0;
+  }
+
+  if ((sqe = yuring_sqe(ctx)) == NULL)
+    return -1;
+
+  memset(&out->msg, 0, sizeof(out->msg));
+
+  out->msg.msg_iov    = out->iov;
+  out->msg.msg_iovlen = cnt;
+
+  sqe->opcode    = IORING_OP_SENDMSG;
+  sqe->fd        = conn->nctx.sfd;
+  sqe->addr      = (uint64_t)(size_t)&out->msg;
+  sqe->len       = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = yuring_tag(YURING_OP_SEND, conn->nctx.sfd);
+
+  conn->send = TRUE;
+
+  return 0;
+}
+
+/**
+ * Close a failed connection once nothing is in flight for it. A multishot
+ * recv still armed is ended by shutting the socket down.
+ */
+static void yuring_close(yuring_conn_t *conn)
+{
+  if (conn->recv && !conn->closing)
+    shutdown(conn->nctx.sfd, SHUT_RDWR);
+
+  conn->closing = TRUE;
+
+  if (conn->recv || conn->send || conn->state == YSTATE_FREE)
+    return;
+
+  ytrace_msg(YTRACE_LEVEL1, "yuring_close : fd = %d\n", conn->nctx.sfd);
+
+  close(conn->nctx.sfd);
+
+  ybuf_put(conn->nctx.ibuf);
+  conn->nctx.ibuf = NULL;
+
+  ynet_out_put(&conn->nctx, TRUE);
+
+  free(conn->out);
+  conn->out = NULL;
+
+  conn->state = YSTATE_FREE;
+}
+
+static void yuring_accept_done(yuring_ctx_t *ctx, yuring_conn_t *lsnr,
+                               struct io_uring_cqe *cqe)
+{
+  int            sfd = cqe->res;
+  yuring_conn_t *conn;
+
+  if (sfd < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "yuring : accept failed : %d\n", -sfd);
+  }
+  else if ((conn = yuring_conn_get(sfd, TRUE)) == NULL)
+  {
+    ytrace_msg(YTRACE_ERROR, "yuring : no context for fd %d : %d\n",
+               sfd, errno);
+    close(sfd);
+  }
+  else
+  {
+    ynet_ctx_init(&conn->nctx, YNET_CLASS_MSG, sfd);
+
+    conn->nctx.proto = lsnr->nctx.proto;
+    conn->nctx.async = TRUE;
+    conn->state      = YSTATE_WAITING;
+    conn->send       = FALSE;
+    conn->closing    = FALSE;
+
+    if (yuring_arm_recv(ctx, conn) != 0)
+      yuring_close(conn);
+  }
+
+  /* listener entry may be shared by rings, the completion tells whether
+   * this ring's accept is still armed */
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    yuring_arm_accept(ctx, lsnr);
+}
+
+static void yuring_recv_done(yuring_ctx_t *ctx, yuring_conn_t *conn,
+                             struct io_uring_cqe *cqe)
+{
+  int bid;
+
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    conn->recv = FALSE;
+
+  if (cqe->res > 0)
+  {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    /* framing lost, its error answer goes out before the close */
+    if (!conn->closing &&
+        (ycmd_server_input(&conn->nctx, ctx->bufs +
+                           (size_t)bid * YURING_BUF_LEN, cqe->res,
+                           !conn->send) != 0) && !conn->nctx.lost)
+      conn->closing = TRUE;
+
+    yuring_buf_put(ctx, bid);
+
+    if (yuring_send(ctx, conn) != 0)
+      conn->closing = TRUE;
+  }
+  else if (cqe->res != -ENOBUFS)          /* buffers run out, just re-arm */
+  {
+    conn->closing = TRUE;                   /* peer closed, or failure */
+  }
+
+  if (conn->closing || (conn->nctx.lost && !conn->send))
+    yuring_close(conn);
+  else if (!conn->recv && (yuring_arm_recv(ctx, conn) != 0))
+    yuring_close(conn);
+}
+
+static void yuring_send_done(yuring_ctx_t *ctx, yuring_conn_t *conn,
+                             struct io_uring_cqe *cqe)
+{
+  conn->send = FALSE;
+
+  if (cqe->res < 0)
+  {
+    yuring_close(conn);
+    return;
+  }
+
+  if ((ynet_out_done(&conn->nctx, cqe->res) == 0) && conn->nctx.ibuf &&
+      (ycmd_server_input(&conn->nctx, NULL, 0, TRUE) != 0) &&
+      !conn->nctx.lost)
+    conn->closing = TRUE;                /* resume input queued meanwhile */
+
+  if (conn->closing || (yuring_send(ctx, conn) != 0) ||
+      (conn->nctx.lost && !conn->send))       /* lost, all answers out */
+    yuring_close(conn);
+}
+
+/**
+ * Create a ring. Refer yuring.h for details.
+ */
+yuring_ctx_t * yuring_create(void)
+{
+  int                     ind;
+  yuring_ctx_t           *ctx;
+  struct io_uring_params  p;
+  struct io_uring_buf_reg reg;
+
+  if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+    return NULL;
+
+  memset(&p, 0, sizeof(p));
+
+  /* completion work run only when the owner thread enters, enabled by
+   * that thread (older kernels take the plain ring) */
+  p.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                 IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+  p.cq_entries = YURING_CQ_DEPTH;
+
+  if ((ctx->fd = yuring_setup(YURING_SQ_DEPTH, &p)) < 0 && errno == EINVAL)
+  {
+    memset(&p, 0, sizeof(p));
+
+    p.flags      = IORING_SETUP_CQSIZE;
+    p.cq_entries = YURING_CQ_DEPTH;
+
+    ctx->fd = yuring_setup(YURING_SQ_DEPTH, &p);
+  }
+
+  if (ctx->fd < 0)
+  {
+    free(ctx);
+    return NULL;
+  }
+
+  ctx->disabled = (p.flags & IORING_SETUP_R_DISABLED) != 0;
+
+  ctx->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ctx->cq_len = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ctx->sq_len = ctx->cq_len = max(ctx->sq_len, ctx->cq_len);
+
+  ctx->sq_ring = mmap(NULL, ctx->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ctx->fd, IORING_OFF_SQ_RING);
+
+  if (ctx->sq_ring == MAP_FAILED)
+  {
+    ctx->sq_ring = NULL;
+    goto fail;
+  }
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ctx->cq_ring = ctx->sq_ring;
+  else
+    ctx->cq_ring = mmap(NULL, ctx->cq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ctx->fd,
+                        IORING_OFF_CQ_RING);
+
+  if (ctx->cq_ring == MAP_FAILED)
+  {
+    ctx->cq_ring = NULL;
+    goto fail;
+  }
+
+  ctx->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ctx->fd, IORING_OFF_SQES);
+
+  if (ctx->sqes == MAP_FAILED)
+  {
+    ctx->sqes = NULL;
+    goto fail;
+  }
+
+  ctx->sq_head = (unsigned *)((char *)ctx->sq_ring + p.sq_off.head);
+  ctx->sq_tail = (unsigned *)((char *)ctx->sq_ring + p.sq_off.tail);
+  ctx->sq_mask = *(unsigned *)((char *)ctx->sq_ring + p.sq_off.ring_mask);
+  ctx->sq_cnt  = p.sq_entries;
+  ctx->tail    = *ctx->sq_tail;
+
+  /* submission entries are used in ring order */
+  for (ind = 0; ind < p.sq_entries; ind++)
+    ((unsigned *)((char *)ctx->sq_ring + p.sq_off.array))[ind] = ind;
+
+  ctx->cq_head = (unsigned *)((char *)ctx->cq_ring + p.cq_off.head);
+  ctx->cq_tail = (unsigned *)((char *)ctx->cq_ring + p.cq_off.tail);
+  ctx->cq_mask = *(unsigned *)((char *)ctx->cq_ring + p.cq_off.ring_mask);
+  ctx->cqes    = (struct io_uring_cqe *)((char *)ctx->cq_ring +
+                                         p.cq_off.cqes);
+
+  /* provided buffers, ring of descriptors page aligned */
+  if ((posix_memalign((void **)&ctx->br, getpagesize(),
+                      YURING_BUF_CNT * sizeof(struct io_uring_buf)) != 0) ||
+      (posix_memalign((void **)&ctx->bufs, getpagesize(),
+                      (size_t)YURING_BUF_CNT * YURING_BUF_LEN) != 0))
+    goto fail;
+
+  memset(ctx->br, 0, YURING_BUF_CNT * sizeof(struct io_uring_buf));
+  memset(&reg, 0, sizeof(reg));
+
+  reg.ring_addr    = (uint64_t)(size_t)ctx->br;
+  reg.ring_entries = YURING_BUF_CNT;
+  reg.bgid         = YURING_BGID;
+
+  if (yuring_register(ctx->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    goto fail;
+
+  for (ind = 0; ind < YURING_BUF_CNT; ind++)
+    yuring_buf_put(ctx, ind);
+
+  __atomic_store_n(&ctx->br->tail, ctx->br_tail, __ATOMIC_RELEASE);
+
+  return ctx;
+
+fail:
+  ytrace_msg(YTRACE_ERROR, "yuring_create failed : %d\n", errno);
+
+  if (ctx->sqes)
+    munmap(ctx->sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+
+  if (ctx->cq_ring && ctx->cq_ring != ctx->sq_ring)
+    munmap(ctx->cq_ring, ctx->cq_len);
+
+  if (ctx->sq_ring)
+    munmap(ctx->sq_ring, ctx->sq_len);
+
+  close(ctx->fd);
+
+  free(ctx->bufs);
+  free(ctx->br);
+  free(ctx);
+
+  return NULL;
+}
+
+/**
+ * Add a listener. Refer yuring.h for details.
+ */
+int yuring_lsnr_add(yuring_ctx_t *ctx, int port, int proto)
+{
+  int sfd;
+
+  if ((sfd = ynet_lsnr_socket(port, TRUE)) < 0)
+    return -1;
+
+  ytrace_msg(YTRACE_DEFAULT, "yuring listener : port = %d, fd = %d, "
+             "proto = %d\n", port, sfd, proto);
+
+  if (yuring_lsnr_attach(ctx, sfd, proto) != 0)
+  {
+    close(sfd);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Accept on a listening socket. Refer yuring.h for details.
+ */
+int yuring_lsnr_attach(yuring_ctx_t *ctx, int sfd, int proto)
+{
+  yuring_conn_t *conn;
+
+  if ((conn = yuring_conn_get(sfd, TRUE)) == NULL)
+    return -1;
+
+  ynet_ctx_init(&conn->nctx, YNET_CLASS_LSNR, sfd);
+
+  conn->nctx.proto = proto;                  /* inherited by connections */
+  conn->state      = YSTATE_WAITING;
+
+  return yuring_arm_accept(ctx, conn);
+}
+
+/**
+ * Process completions of a ring. Refer yuring.h for details.
+ */
+int yuring_process(ythread_ctx_t *tctx)
+{
+  unsigned             head;
+  unsigned             tail;
+  size_t               beg = 0;
+  yuring_conn_t       *conn;
+  struct io_uring_cqe  cqe;
+  yuring_ctx_t        *ctx = tctx->uring;
+
+  if (ctx->disabled)             /* bind ring to its only submitter */
+  {
+    if (yuring_register(ctx->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "io_uring enable failed : %d\n", errno);
+      return -1;
+    }
+
+    ctx->disabled = FALSE;
+  }
+
+  head = *ctx->cq_head;
+
+  do                        /* without waiting while within busy budget */
+  {
+    ynet_tstats.polls++;
+
+    if ((yuring_submit(ctx, !ynet_busy_check(&beg)) != 0) && 
+        (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+    {
+      ytrace_msg(YTRACE_ERROR, "io_uring_enter failed : %d\n", errno);
+      return -1;
+    }
+
+    tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+  }
+  while (head == tail);
+
+  for (; head != tail; head++)
+  {
+    cqe = ctx->cqes[head & ctx->cq_mask];
+
+    if ((conn = yuring_conn_get(yuring_tag_fd(cqe.user_data), FALSE)) == NULL)
+      continue;
+
+    switch (yuring_tag_op(cqe.user_data))
+    {
+      case YURING_OP_ACCEPT:
+        yuring_accept_done(ctx, conn, &cqe);
+        break;
+
+      case YURING_OP_RECV:
+        yuring_recv_done(ctx, conn, &cqe);
+        break;
+
+      case YURING_OP_SEND:
+        yuring_send_done(ctx, conn, &cqe);
+        break;
+    }
+  }
+
+  __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+
+  /* buffers consumed in this pass go back in one go */
+  __atomic_store_n(&ctx->br->tail, ctx->br_tail, __ATOMIC_RELEASE);
+
+  ynet_stats_fold();
+
+  return 0;
+}
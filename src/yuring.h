@@ -0,0 +1,90 @@
+/*
+ *  Yari - In memory Key Value Store 
+ *  Copyright (C) 2017  Yari 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _YURING_H
+
+#define _YURING_H
+
+#include <ycommon.h>
+#include <ynet.h>
+
+/**
+ * @file yuring.h - io_uring Network Backend
+ *
+ * Alternative to the epoll reactors, one ring per thread. Listeners of a
+ * ring share their ports with the other rings (SO_REUSEPORT) and accept
+ * with multishot accept. Connections receive with multishot recv into a
+ * ring of provided buffers, requests are executed straight from those
+ * buffers. Responses are queued in the connection output queue as on the
+ * epoll path and sent with one sendmsg per connection in flight. Every
+ * loop submits all queued work and reaps completions in one
+ * io_uring_enter, counted as a poll.
+ *
+ * Needs Linux 6.0 or later (multishot recv, provided buffer rings).
+ */
+
+#define YURING_SQ_DEPTH   (1024)              /**< submission queue entries */
+#define YURING_CQ_DEPTH   (4096)              /**< completion queue entries */
+#define YURING_BUF_CNT    (256)       /**< provided buffers, power of 2 */
+#define YURING_BUF_LEN    (16 * 1024)           /**< provided buffer size */
+
+typedef struct yuring_ctx_t yuring_ctx_t;
+
+/**
+ * @brief Create a ring with its provided buffers.
+ *
+ * @return Ring on success, NULL on failure with errno set, ENOSYS or
+ *         EINVAL if the kernel doesn't support io_uring or the features
+ *         used.
+ */
+yuring_ctx_t * yuring_create(void);
+
+/**
+ * @brief Add a listener to a ring, sharing the port with the listeners of
+ *        other rings.
+ *
+ * @param ctx   - ring
+ * @param port  - TCP port to listen on
+ * @param proto - wire protocol of accepted connections, YPROTO_*
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yuring_lsnr_add(yuring_ctx_t *ctx, int port, int proto);
+
+/**
+ * @brief Accept connections on a listening socket, which may be shared 
+ *        with other rings (Unix domain listener).
+ *
+ * @param ctx   - ring
+ * @param sfd   - listening socket
+ * @param proto - wire protocol of accepted connections, YPROTO_*
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yuring_lsnr_attach(yuring_ctx_t *ctx, int sfd, int proto);
+
+/**
+ * @brief Submit queued work, wait for and process completions of the
+ *        ring owned by the thread.
+ *
+ * @param tctx - thread context, owning the ring
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int yuring_process(ythread_ctx_t *tctx);
+
+#endif /* yuring.h */